@@ -52,6 +52,7 @@
 #define Logger_Debug(format, ...)
 #define LOGW(format, ...)
 #define TIME_SHIFT 116444736000000000ULL
+#define DIR_RECORD_BUFFER_SIZE (64 * 1024)
 
 using namespace concurrency;
 using namespace Platform;
@@ -92,8 +93,15 @@ typedef struct FileClientTask_ {
 	FileRequestHandler handler;
 } FileClientTask;
 
+/**
+ * 文件服务客户端
+ * 服务端为每个连接只创建一个线程，响应都写入连接的输入流中，所以请求仍然是
+ * 逐个发送和处理的。
+ */
 typedef struct FileClientRec_ {
 	LCUI_BOOL active;
+	int priority;		/**< 发出的请求的优先级 */
+	size_t max_requests;	/**< 能同时等待响应的请求数量，目前仅做记录 */
 	LCUI_Cond cond;
 	LCUI_Mutex mutex;
 	LCUI_Thread thread;
@@ -101,6 +109,12 @@ typedef struct FileClientRec_ {
 	LinkedList tasks;
 } FileClientRec, *FileClient;
 
+typedef struct DirRecordWriterRec_ {
+	Connection conn;
+	size_t len;	/**< 缓冲区中已写入的字节数 */
+	char *buf;
+} DirRecordWriterRec, *DirRecordWriter;
+
 static struct FileService {
 	LCUI_BOOL active;
 	LCUI_Thread thread;
@@ -604,6 +618,100 @@ static void FileService_GetFiles(Connection conn,
 	}).wait();
 }
 
+static time_t DateTimeToUnixTime(DateTime t)
+{
+	return (time_t)((t.UniversalTime - TIME_SHIFT) / 10000000);
+}
+
+static LCUI_BOOL FileService_FilterEntry(int filter, const wchar_t *name,
+					 LCUI_BOOL is_dir)
+{
+	switch (filter) {
+	case FILE_FILTER_FILE:
+		return !is_dir && IsImageFile(name);
+	case FILE_FILTER_FOLDER:
+		return is_dir;
+	default:
+		break;
+	}
+	return is_dir || IsImageFile(name);
+}
+
+static void DirRecordWriter_Flush(DirRecordWriter writer)
+{
+	if (writer->len > 0) {
+		Connection_Write(writer->conn, writer->buf, sizeof(char),
+				 writer->len);
+		writer->len = 0;
+	}
+}
+
+static void DirRecordWriter_Write(DirRecordWriter writer,
+				  FileDirRecord *record, const wchar_t *name)
+{
+	size_t size;
+	char buf[PATH_LEN];
+
+	record->name_len = (unsigned int)LCUI_EncodeUTF8String(buf, name,
+							       PATH_LEN - 1);
+	buf[record->name_len] = 0;
+	size = sizeof(FileDirRecord) + record->name_len + 1;
+	if (writer->len + size > DIR_RECORD_BUFFER_SIZE) {
+		DirRecordWriter_Flush(writer);
+	}
+	memcpy(writer->buf + writer->len, record, sizeof(FileDirRecord));
+	writer->len += sizeof(FileDirRecord);
+	memcpy(writer->buf + writer->len, buf, record->name_len + 1);
+	writer->len += record->name_len + 1;
+}
+
+/** 以二进制记录列出目录，各项的状态取自 GetBasicPropertiesAsync() */
+static void FileService_GetDirEntries(Connection conn,
+				      StorageFolder ^folder,
+				      FileRequest *request)
+{
+	LCUI_BOOL is_dir;
+	const wchar_t *name;
+	IStorageItem ^item;
+	IVectorView<IStorageItem^> ^items;
+	FileProperties::BasicProperties ^props;
+	FileDirRecord record = { 0 };
+	DirRecordWriterRec writer;
+
+	try {
+		items = create_task(folder->GetItemsAsync()).get();
+	} catch (Exception ^ex) {
+		return;
+	}
+	writer.conn = conn;
+	writer.len = 0;
+	writer.buf = (char*)malloc(DIR_RECORD_BUFFER_SIZE);
+	if (!writer.buf) {
+		return;
+	}
+	for (unsigned i = 0; i < items->Size && !conn->closed; ++i) {
+		item = items->GetAt(i);
+		name = item->Name->Data();
+		is_dir = item->IsOfType(StorageItemTypes::Folder);
+		if (!FileService_FilterEntry(request->params.filter, name,
+					     is_dir)) {
+			continue;
+		}
+		try {
+			props = create_task(item->GetBasicPropertiesAsync()).get();
+		} catch (Exception ^ex) {
+			continue;
+		}
+		record.type = is_dir ? FILE_TYPE_DIRECTORY : FILE_TYPE_ARCHIVE;
+		record.size = (size_t)props->Size;
+		record.ctime = DateTimeToUnixTime(item->DateCreated);
+		record.mtime = DateTimeToUnixTime(props->DateModified);
+		DirRecordWriter_Write(&writer, &record, name);
+	}
+	DirRecordWriter_Flush(&writer);
+	free(writer.buf);
+}
+
 typedef struct ImageFileStreamPackRec_ {
 	IRandomAccessStream ^stream;
 } ImageFileStreamPackRec, *ImageFileStreamPack;
@@ -779,7 +887,11 @@ static int FileService_GetFile(Connection conn,
 		}
 		GetFolderStatus(folder, &response->file).wait();
 		Connection_WriteChunk(conn, chunk);
-		FileService_GetFiles(conn, folder, request, chunk);
+		if (params->with_file_status) {
+			FileService_GetDirEntries(conn, folder, request);
+		} else {
+			FileService_GetFiles(conn, folder, request, chunk);
+		}
 		return 0;
 	}
 	if (response->status != RESPONSE_STATUS_OK) {
@@ -1016,6 +1128,8 @@ FileClient FileClient_Create(void)
 	client = NEW(FileClientRec, 1);
 	client->thread = 0;
 	client->active = FALSE;
+	client->priority = FILE_PRIORITY_BACKGROUND;
+	client->max_requests = 1;
 	client->connection = NULL;
 	LCUICond_Init(&client->cond);
 	LCUIMutex_Init(&client->mutex);
@@ -1099,8 +1213,10 @@ void FileClient_Run(FileClient client)
 			continue;
 		}
 		LinkedList_Unlink(&client->tasks, node);
-		LCUIMutex_Unlock(&client->mutex);
 		task = (FileClientTask*)node->data;
+		task->request.params.priority = client->priority;
+		task->request.stream = conn->input;
+		LCUIMutex_Unlock(&client->mutex);
 		LOGW(L"[file client][connection %d] send request, "
 		     L"method: %d, path: %s\n",
 		     conn->id, task->request.method, task->request.path);
@@ -1144,6 +1260,22 @@ void FileClient_RunAsync(FileClient client)
 	LCUIThread_Create(&client->thread, FileClient_Thread, client);
 }
 
+void FileClient_SetPriority(FileClient client, int priority)
+{
+	LCUIMutex_Lock(&client->mutex);
+	client->priority = priority;
+	LCUIMutex_Unlock(&client->mutex);
+}
+
+void FileClient_SetMaxRequests(FileClient client, size_t n)
+{
+	LCUIMutex_Lock(&client->mutex);
+	if (n > client->max_requests) {
+		client->max_requests = n;
+	}
+	LCUIMutex_Unlock(&client->mutex);
+}
+
 void FileClient_SendRequest(FileClient client,
 			    const FileRequest *request,
 			    const FileRequestHandler *handler)
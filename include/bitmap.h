@@ -0,0 +1,91 @@
+﻿/* ***************************************************************************
+ * bitmap.h -- compressed bitmap
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * bitmap.h -- 压缩位图
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#ifndef LCFINDER_BITMAP_H
+#define LCFINDER_BITMAP_H
+
+#include <stdint.h>
+
+#ifdef LCFINDER_BITMAP_C
+typedef struct BitmapRec_ *Bitmap;
+#else
+typedef void *Bitmap;
+#endif
+
+Bitmap Bitmap_Create(void);
+
+void Bitmap_Destroy(Bitmap bitmap);
+
+/** 复制位图 */
+Bitmap Bitmap_Copy(Bitmap bitmap);
+
+/** 清空位图 */
+void Bitmap_Clear(Bitmap bitmap);
+
+/**
+ * 添加一个值
+ * @returns 值原本不存在时返回 1，否则返回 0
+ */
+int Bitmap_Add(Bitmap bitmap, uint32_t value);
+
+/**
+ * 移除一个值
+ * @returns 值原本存在时返回 1，否则返回 0
+ */
+int Bitmap_Remove(Bitmap bitmap, uint32_t value);
+
+/** 判断位图中是否有该值 */
+int Bitmap_Contains(Bitmap bitmap, uint32_t value);
+
+/** 获取位图中值的数量 */
+size_t Bitmap_GetCardinality(Bitmap bitmap);
+
+/**
+ * 查找大于等于 value 的最小值
+ * @returns 找到时返回 1，否则返回 0
+ */
+int Bitmap_Next(Bitmap bitmap, uint32_t value, uint32_t *next);
+
+/** 求交集，结果保存在 dst 中 */
+void Bitmap_And(Bitmap dst, Bitmap src);
+
+/** 求并集，结果保存在 dst 中 */
+void Bitmap_Or(Bitmap dst, Bitmap src);
+
+/** 求差集，从 dst 中移除 src 中的值 */
+void Bitmap_AndNot(Bitmap dst, Bitmap src);
+
+#endif
@@ -80,6 +80,26 @@ LCUI_Widget FileBrowser_AppendPicture( FileBrowser browser, const DB_File file )
 LCUI_Widget FileBrowser_AppendFolder( FileBrowser browser, const char *path,
 				      LCUI_BOOL show_path );
 
+/** 在 before 前面插入部件，before 为 NULL 时追加到末尾 */
+void FileBrowser_Insert( FileBrowser browser, LCUI_Widget widget,
+			 LCUI_Widget before );
+
+/** 在 before 前面插入图片，before 为 NULL 时追加到末尾 */
+LCUI_Widget FileBrowser_InsertPicture( FileBrowser browser, const DB_File file,
+				       LCUI_Widget before );
+
+/** 移除文件对应的图片，返回是否有图片被移除 */
+LCUI_BOOL FileBrowser_RemovePicture( FileBrowser browser, const char *path );
+
+/**
+ * 按顺序查找文件应插入的位置
+ * @param compare 比较两个文件的先后顺序，a 应排在 b 前面时返回负数
+ * @returns 第一个应排在 file 后面的图片，没有时返回 NULL
+ */
+LCUI_Widget FileBrowser_FindPosition( FileBrowser browser, const DB_File file,
+				      int( *compare )(const DB_File,
+						      const DB_File) );
+
 void FileBrowser_Init( FileBrowser browser );
 
 #endif
@@ -68,6 +68,10 @@
 #	endif
 #else
 #	define PLATFORM_LINUX
+// 如果需要用 fanotify 监视整个文件系统的话，需要 CAP_SYS_ADMIN 权限
+//#define LCFINDER_USE_FANOTIFY
+// 如果需要用 io_uring 批量获取文件状态和读取文件头部的话，需要 Linux 5.6 以上的内核
+//#define LCFINDER_USE_IO_URING
 #endif
 
 enum VersionType {
@@ -0,0 +1,76 @@
+﻿/* ***************************************************************************
+ * dir_walker.h -- parallel directory walker
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * dir_walker.h -- 并行目录遍历器
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#ifndef LCFINDER_DIR_WALKER_H
+#define LCFINDER_DIR_WALKER_H
+
+#include "file_service.h"
+
+typedef struct DirWalkerRec_ *DirWalker;
+
+/** 一个目录的列表，格式与 FileStorage_GetDirEntries() 的结果相同 */
+typedef struct DirWalkerListRec_ {
+	LCUI_BOOL ok;		/**< 是否成功列出目录 */
+	FileStatus status;	/**< 目录自身的状态 */
+	FileDirEntry *entries;	/**< 目录中的图片文件和子目录 */
+	size_t n_entries;
+	char *names;		/**< 存放所有文件名的缓冲区 */
+} DirWalkerListRec, *DirWalkerList;
+
+/**
+ * 创建目录遍历器并开始遍历
+ * 多个工作线程各自维护一个目录队列，空闲的线程从其它线程的队列中窃取目录，
+ * 列出的目录暂存在遍历器中，直到被 DirWalker_GetList() 取走。
+ * @param[in] root 根目录路径，UTF-8 编码，末尾不带路径分隔符
+ * @param[in] n_threads 工作线程数量，为 0 时与处理器核心数相同
+ * @returns 当前平台不支持时返回 NULL
+ */
+DirWalker DirWalker_Create(const char *root, unsigned int n_threads);
+
+/**
+ * 取走目录的列表
+ * 目录还没被列出时，由调用者所在的线程立即列出，正被工作线程列出时则等待
+ * 其完成，因此调用者可以按任意顺序获取目录。
+ * @returns 目录不在遍历范围内时返回 NULL
+ */
+DirWalkerList DirWalker_GetList(DirWalker walker, const char *path);
+
+void DirWalkerList_Destroy(DirWalkerList list);
+
+/** 停止遍历并释放所有未取走的列表 */
+void DirWalker_Destroy(DirWalker walker);
+
+#endif
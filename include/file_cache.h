@@ -58,10 +58,26 @@ typedef struct FileCacheTimeRec_ {
 	unsigned int mtime;	/**< 修改时间 */
 } FileCacheTimeRec, *FileCacheTime;
 
+/** 目录状态信息 */
+typedef struct FileCacheDirRec_ {
+	unsigned int mtime;	/**< 修改时间 */
+	unsigned int count;	/**< 目录内的文件和子目录数量 */
+	unsigned int scan_time;	/**< 最近一次列出目录内容的时间 */
+} FileCacheDirRec, *FileCacheDir;
+
+/** 单个文件记录的更新结果 */
+typedef enum {
+	FILE_CACHE_UNCHANGED,
+	FILE_CACHE_ADDED,
+	FILE_CACHE_CHANGED,
+	FILE_CACHE_DELETED
+} FileCacheUpdateResult;
+
 /** 文件列表同步任务 */
 typedef struct SyncTaskRec_ {
 	wchar_t *file;		/**< 数据文件 */
-	wchar_t *tmpfile;	/**< 临时数据文件 */
+	wchar_t *tmpfile;	/**< 旧版本使用的临时数据文件，只用于清理 */
+	wchar_t *logfile;	/**< 变更记录文件 */
 	wchar_t *scan_dir;	/**< 需扫描的目录 */
 	wchar_t *data_dir;	/**< 数据存放目录 */
 	SyncTaskState state;	/**< 任务状态 */
@@ -73,21 +89,63 @@ typedef struct SyncTaskRec_ {
 
 typedef void(*FileInfoHanlder)(void*, const FileCacheInfo);
 
+/** 缓存中的目录内容的处理函数，参数依次为：名称、是否为目录、文件时间 */
+typedef void(*FileCacheEntryHandler)(void*, const wchar_t*, int,
+				     const FileCacheTime);
+
+/**
+ * 按缓存中键的顺序比较两个路径
+ * 扫描器按该顺序深度优先遍历时，目录名应以路径分隔符结尾，这样文件列表
+ * 可以直接与缓存逐条比对，不必将整个缓存载入内存。
+ */
+int SyncTask_ComparePath(const wchar_t *path1, const wchar_t *path2);
+
 SyncTask SyncTask_New(const char *data_dir, const char *scan_dir);
 
 /** 新建同步任务 */
 SyncTask SyncTask_NewW(const wchar_t *data_dir, const wchar_t *scan_dir);
 
-/** 添加文件至缓存 */
+/**
+ * 添加文件至缓存
+ * 按 SyncTask_ComparePath() 的顺序添加时，变更状态由逐条比对得出，否则
+ * 会逐个查询缓存。
+ */
 int SyncTask_AddFileW(SyncTask t, const wchar_t *path,
 		      unsigned int ctime, unsigned int mtime);
 
+/**
+ * 添加目录状态至缓存
+ * 目录的记录应在其内容之前添加，即与 SyncTask_AddFileW() 的顺序相同
+ */
+int SyncTask_AddDirW(SyncTask t, const wchar_t *path, const FileCacheDir dir);
+
+/** 获取缓存中的目录状态，只有在同步任务开始后且有序比对时可用 */
+int SyncTask_GetDirW(SyncTask t, const wchar_t *path, FileCacheDir dir);
+
+/**
+ * 读取缓存中的目录内容
+ * 只包括该目录内的文件和子目录，按 SyncTask_ComparePath() 的顺序读取，
+ * 用于在目录未变更时代替列出目录内容。
+ * @returns 读取到的文件和子目录数量
+ */
+size_t SyncTask_ReadDirW(SyncTask t, const wchar_t *path,
+			 FileCacheEntryHandler handler, void *data);
+
 /** 打开缓存 */
 int SyncTask_OpenCacheW(SyncTask t, const wchar_t *path);
 
 /** 从缓存中删除一个文件记录 */
 int SyncTask_DeleteFileW(SyncTask t, const wchar_t *filepath);
 
+/**
+ * 更新缓存中的一个文件记录
+ * 用于处理零散的文件变更，需先用 SyncTask_OpenCacheW() 打开缓存。
+ * @param[in] time 文件时间，为 NULL 时表示文件已不存在
+ * @returns 成功时返回 FileCacheUpdateResult 中的值，失败时返回负数
+ */
+int SyncTask_UpdateFileW(SyncTask t, const wchar_t *filepath,
+			 const FileCacheTime time);
+
 /** 清除缓存 */
 void SyncTask_ClearCache(SyncTask t);
 
@@ -112,7 +170,7 @@ int SyncTask_Start(SyncTask t);
 /** 结束同步文件列表 */
 void SyncTask_Finish(SyncTask t);
 
-/** 提交变更后文件列表至缓存数据库中 */
+/** 将变更的文件记录写入缓存数据库，未变更的记录不会被改写 */
 int SyncTask_Commit(SyncTask t);
 
 #endif
@@ -0,0 +1,121 @@
+﻿/* ***************************************************************************
+ * file_columns.h -- columnar mirror of the file table
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * file_columns.h -- 文件表的列式镜像
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#ifndef LCFINDER_FILE_COLUMNS_H
+#define LCFINDER_FILE_COLUMNS_H
+
+#include <stdint.h>
+#include "bitmap.h"
+#include "file_search.h"
+
+#ifdef LCFINDER_FILE_COLUMNS_C
+typedef struct FileColumnsRec_ *FileColumns;
+typedef struct FileColumnsSortRec_ *FileColumnsSort;
+#else
+typedef void *FileColumns;
+typedef void *FileColumnsSort;
+#endif
+
+/** 过滤条件 */
+typedef struct FileColumnsFilterRec_ {
+	/** 查询条件，只使用其中的源文件夹列表和数值范围 */
+	DB_QueryTerms terms;
+	Bitmap folders;  /**< 文件所在文件夹的集合，为 NULL 时不限制 */
+	Bitmap files;    /**< 文件需要在该集合中，为 NULL 时不限制 */
+	Bitmap excluded; /**< 文件不能在该集合中，为 NULL 时不限制 */
+} FileColumnsFilterRec, *FileColumnsFilter;
+
+FileColumns FileColumns_Create(void);
+
+void FileColumns_Destroy(FileColumns columns);
+
+/** 清空全部文件记录 */
+void FileColumns_Clear(FileColumns columns);
+
+/** 获取文件记录的数量 */
+size_t FileColumns_GetLength(FileColumns columns);
+
+/**
+ * 添加或更新文件记录
+ * @returns 成功时返回 0，否则返回 -1
+ */
+int FileColumns_Set(FileColumns columns, const DB_FileRec *file,
+		    int folder_id);
+
+/** 移除文件记录 */
+void FileColumns_Remove(FileColumns columns, int id);
+
+/**
+ * 选出符合条件的文件记录
+ * @param[out] rows 记录所在的行号列表，用完后需要用 free() 释放
+ * @returns 记录的数量
+ */
+size_t FileColumns_Select(FileColumns columns, const FileColumnsFilter filter,
+			  uint32_t **rows);
+
+/**
+ * 按查询条件中的排序规则复制出行号列表中各行的排序键
+ * 排序只用到复制出来的键，所以在排序期间不需要锁定镜像。
+ * @returns 排序数据，需要用 FileColumns_SortRows() 排序并释放
+ */
+FileColumnsSort FileColumns_PrepareSort(FileColumns columns,
+					const uint32_t *rows, size_t n,
+					const DB_QueryTerms terms);
+
+/**
+ * 对行号列表进行排序，然后释放排序数据
+ * 排序结果与 SQL 查询的排序结果一致，排序规则相同的记录按标识号排序。
+ * @param[in] rows 与 FileColumns_PrepareSort() 传入的是同一个行号列表
+ * @param[in] cancelled 取消标志，每轮排序前检查一次，可以为 NULL
+ * @returns 成功时返回 0，内存不足或者被取消时返回 -1
+ */
+int FileColumns_SortRows(FileColumnsSort sort, uint32_t *rows, size_t n,
+			 const volatile int *cancelled);
+
+/**
+ * 在已排序的行号列表中查找查询游标之后的第一行
+ * @returns 该行在列表中的位置，没有设置游标时返回 0
+ */
+size_t FileColumns_Seek(FileColumns columns, const uint32_t *rows, size_t n,
+			const DB_QueryTerms terms);
+
+/**
+ * 读取一行中的文件信息
+ * 文件路径指向镜像内部的内存，在镜像被修改前有效。
+ */
+void FileColumns_GetFile(FileColumns columns, uint32_t row, DB_File file);
+
+#endif
@@ -63,20 +63,79 @@ typedef struct DB_FileRec_ {
 	unsigned int modify_time; /**< 修改时间 */
 } DB_FileRec, *DB_File;
 
+/**
+ * 文件记录页
+ * 页中的文件记录保存在同一个数组中，路径字符串由页的内存池统一分配，释放页时
+ * 一次性释放全部记录，不能对页中的记录调用 DBFile_Release()。页在首次使用前
+ * 需要清零。
+ */
+typedef struct DB_FilePageRec_ {
+	DB_FileRec *files; /**< 文件记录数组 */
+	size_t length;     /**< 文件记录数量 */
+	void *arena;       /**< 存放路径字符串的内存池 */
+} DB_FilePageRec, *DB_FilePage;
+
+/**
+ * 查询游标
+ * 记录上一页最后一条记录的排序键，下一次查询将从该记录之后开始取数据记录，
+ * 这样无论翻到第几页，查询的开销都是一样的。
+ */
+typedef struct DB_QueryCursorRec_ {
+	int id;                   /**< 文件标识号，值为 0 时表示从头开始 */
+	int score;                /**< 文件评分 */
+	unsigned int create_time; /**< 创建时间 */
+	unsigned int modify_time; /**< 修改时间 */
+	int relevance;            /**< 与关键词的相关度 */
+} DB_QueryCursorRec, *DB_QueryCursor;
+
+/** 数值范围，范围包含最小值和最大值 */
+typedef struct DB_QueryRangeRec_ {
+	int has_min;  /**< 是否限制最小值 */
+	int has_max;  /**< 是否限制最大值 */
+	long long min; /**< 最小值 */
+	long long max; /**< 最大值 */
+} DB_QueryRangeRec, *DB_QueryRange;
+
+/** 时间线中的月份 */
+typedef struct DB_TimelineEntryRec_ {
+	int year;      /**< 年份 */
+	int month;     /**< 月份，从 1 开始 */
+	size_t count;  /**< 该月份的文件数量 */
+	size_t offset; /**< 排在该月份前面的文件数量 */
+	/**
+	 * 指向该月份之前的位置的游标，将它设置到查询条件中即可从该月份的第一个
+	 * 文件开始查询，只适用于仅按修改时间排序的查询
+	 */
+	DB_QueryCursorRec cursor;
+} DB_TimelineEntryRec, *DB_TimelineEntry;
+
 /*< 搜索规则定义 */
 typedef struct DB_QueryTermsRec_ {
 	DB_Dir *dirs;  /**< 源文件夹列表 */
-	DB_Tag *tags;  /**< 标签列表 */
+	DB_Tag *tags;  /**< 标签列表，文件需要拥有其中所有标签 */
 	size_t n_dirs; /**< 文件夹数量 */
 	size_t n_tags; /**< 标签数量 */
-	size_t offset; /**< 从何处开始取数据记录 */
+	DB_Tag *any_tags;       /**< 文件至少需要拥有其中一个标签 */
+	DB_Tag *excluded_tags;  /**< 文件不能拥有其中任何一个标签 */
+	size_t n_any_tags;      /**< 可选标签的数量 */
+	size_t n_excluded_tags; /**< 排除的标签的数量 */
+	size_t offset; /**< 从何处开始取数据记录，在设置游标后会被忽略 */
 	size_t limit;  /**< 数据记录的最大数量 */
 	int for_tree; /**< 是否搜索子级目录树，值为 0 时只搜索当前目录下的文件
 		       */
 	char *dirpath;          /**< 文件所在的目录路径 */
+	char *keywords; /**< 关键词，用于匹配文件名和文件夹名中的词 */
 	enum order score;       /**< 按评分排序时使用的排序规则 */
 	enum order create_time; /**< 按创建时间排序时使用的排序规则 */
 	enum order modify_time; /**< 按修改时间排序时使用的排序规则 */
+	struct {
+		DB_QueryRangeRec score;       /**< 评分范围 */
+		DB_QueryRangeRec create_time; /**< 创建时间范围 */
+		DB_QueryRangeRec modify_time; /**< 修改时间范围 */
+		DB_QueryRangeRec width;       /**< 宽度范围 */
+		DB_QueryRangeRec height;      /**< 高度范围 */
+	} range; /**< 数值过滤条件，未限制的范围不参与过滤 */
+	DB_QueryCursorRec cursor; /**< 查询游标 */
 } DB_QueryTermsRec, *DB_QueryTerms;
 
 #ifdef LCFINDER_FILE_SEARCH_C
@@ -108,15 +167,48 @@ DB_Tag DB_AddTag(const char *tagname);
 /** 添加一个文件记录 */
 void DB_AddFile(DB_Dir dir, const char *filepath, int ctime, int mtime);
 
+/**
+ * 批量添加文件记录
+ * 使用多行插入语句，每条语句可添加多个文件记录，适用于同步大量文件的场景。
+ * 文件信息中的 id 和 did 字段会被忽略，已存在的文件记录会被跳过。
+ * @returns 成功添加的记录数量，出错时返回 -1
+ */
+int DB_AddFiles(DB_Dir dir, const DB_FileRec *files, size_t n);
+
 /** 修改文件的时间信息 */
 void DB_UpdateFileTime(DB_Dir dir, const char *filepath, int ctime, int mtime);
 
 /** 删除一个文件记录 */
 void DB_DeleteFile(const char *filepath);
 
+/**
+ * 批量删除文件记录
+ * @returns 成功删除的记录数量，出错时返回 -1
+ */
+int DB_DeleteFiles(char *const *paths, size_t n);
+
+/** 获取源文件夹中的文件记录数量，dir 为 NULL 时获取全部文件记录数量 */
+int DB_CountFiles(DB_Dir dir);
+
+/**
+ * 获取按修改时间划分的时间线
+ * 只使用查询条件中的源文件夹列表和修改时间的排序规则，月份的顺序与按修改时间
+ * 排序的文件顺序一致。
+ * @param[out] entries 月份列表，用完后需要用 free() 释放
+ * @returns 月份的数量
+ */
+size_t DB_GetTimeline(const DB_QueryTerms terms, DB_TimelineEntry *entries);
+
 /** 获取一个文件记录 */
 DB_File DB_GetFile(const char *filepath);
 
+/**
+ * 设置是否启用文件表的内存镜像
+ * 启用后，没有关键词的查询会在内存中的列式镜像上完成过滤和排序，切换排序方式
+ * 时不必再访问数据库。镜像在首次查询时加载，占用的内存与文件数量成正比。
+ */
+void DB_SetFileColumnsEnabled(int enabled);
+
 /** 获取全部标签记录 */
 size_t DB_GetTags(DB_Tag **outlist);
 
@@ -158,9 +250,43 @@ int DBQuery_GetTotalFiles(DB_Query query);
 /** 从查询结果中获取下个文件 */
 DB_File DBQuery_FetchFile(DB_Query query);
 
+/**
+ * 从查询结果中批量获取文件
+ * 页中原有的记录会先被释放，取出的记录在页被释放前一直有效。
+ * @param[out] page 用于保存文件记录的页
+ * @param[in] max_files 最多获取的文件数量
+ * @returns 获取到的文件数量
+ */
+size_t DBQuery_FetchFiles(DB_Query query, DB_FilePage page, size_t max_files);
+
+/** 释放文件记录页中的记录 */
+void DBFilePage_Destroy(DB_FilePage page);
+
+/**
+ * 获取查询游标
+ * 游标指向最后一次取出的文件，将它设置到查询条件中即可继续查询下一页
+ */
+void DBQuery_GetCursor(DB_Query query, DB_QueryCursor cursor);
+
+/**
+ * 中断查询
+ * 可以在其它线程中调用，正在执行的语句会尽快结束，已取出的结果不受影响。调用
+ * 时需要保证查询还未被删除。
+ */
+void DBQuery_Interrupt(DB_Query query);
+
 /** 新建一个查询实例 */
 DB_Query DB_NewQuery(const DB_QueryTerms terms);
 
+/**
+ * 新建一个可取消的查询实例
+ * 加载镜像、计算标签集合、排序等准备工作都会检查取消标志，标志被其它线程设置
+ * 为非零值后尽快结束并返回 NULL。查询实例被删除前，标志需要一直有效，执行中的
+ * 语句也会因它而中断。
+ */
+DB_Query DB_NewCancellableQuery(const DB_QueryTerms terms,
+				const volatile int *cancelled);
+
 /** 删除一个查询实例 */
 void DB_DeleteQuery(DB_Query query);
 
@@ -170,4 +296,14 @@ int DB_Begin(void);
 /** 提交事务 */
 int DB_Commit(void);
 
+/**
+ * 开始首次导入
+ * 与 DB_Begin() 一样会开启事务，但还会暂时删除文件表的非唯一索引并关闭同步
+ * 写入，等到 DB_EndImport() 时再重建索引。适用于向空文件夹中导入大量文件。
+ */
+int DB_BeginImport(void);
+
+/** 结束首次导入，重建索引并提交事务 */
+int DB_EndImport(void);
+
 #endif
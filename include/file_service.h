@@ -87,6 +87,35 @@ typedef struct FileStatus_ {
 	FileImageStatus *image;
 } FileStatus;
 
+/**
+ * 目录列表中一项的二进制记录
+ * 记录之后紧跟 name_len 字节的 UTF-8 文件名及其结束符，记录不会跨越数据块
+ */
+typedef struct FileDirRecord_ {
+	int type;		/**< 文件类型 */
+	unsigned int name_len;	/**< 文件名的字节数，不含结束符 */
+	size_t size;		/**< 文件大小 */
+	time_t ctime;		/**< 创建时间 */
+	time_t mtime;		/**< 修改时间 */
+	uint64_t inode;		/**< 索引节点号，不支持的平台上为 0 */
+} FileDirRecord;
+
+/** 目录中的一项 */
+typedef struct FileDirEntry_ {
+	FileDirRecord status;	/**< 文件状态 */
+	const char *name;	/**< UTF-8 编码的文件名 */
+} FileDirEntry;
+
+/** 请求的优先级，文件服务总是先处理优先级高的请求 */
+enum FileRequestPriority {
+	FILE_PRIORITY_IMAGE,		/**< 查看器中正在打开的图片 */
+	FILE_PRIORITY_THUMB,		/**< 可见区域中的缩略图 */
+	FILE_PRIORITY_PREFETCH,		/**< 预先加载的内容 */
+	FILE_PRIORITY_SCAN,		/**< 扫描文件列表 */
+	FILE_PRIORITY_BACKGROUND,	/**< 后台任务 */
+	FILE_PRIORITY_TOTAL
+};
+
 enum FileFilter {
 	FILE_FILTER_NONE,	/**< 不过滤 */
 	FILE_FILTER_FILE,	/**< 仅保留文件 */
@@ -98,10 +127,12 @@ typedef struct FileRequestParams_ {
 	int filter;				/**< 过滤条件 */
 	LCUI_BOOL get_thumbnail;		/**< 是否仅获取缩略图 */
 	LCUI_BOOL with_image_status;		/**< 是否附带获取图片文件状态信息 */
+	LCUI_BOOL with_file_status;		/**< 列出目录时是否以二进制记录附带各项的文件状态 */
 	void( *progress )(void*, float);	/**< 回调函数，用于接收文件读取进度 */
 	void *progress_arg;			/**< 接收文件读取进度时的附加参数 */
 	unsigned int width;			/**< 缩略图的宽度 */
 	unsigned int height;			/**< 缩略图的高度 */
+	int priority;				/**< 优先级，由发出请求的客户端设置 */
 } FileRequestParams;
 
 /** 文件请求 */
@@ -110,7 +141,7 @@ typedef struct FileRequest_ {
 	wchar_t path[256];		/**< 资源路径 */
 	FileStatus file;		/**< 文件状态参数 */
 	FileRequestParams params;	/**< 请求参数 */
-	FileStream stream;		/**< 文件流 */
+	FileStream stream;		/**< 响应流，服务端将响应写入其中 */
 } FileRequest;
 
 /** 文件响应 */
@@ -219,6 +250,15 @@ void FileClient_Close( FileClient client );
 
 void FileClient_RunAsync( FileClient client );
 
+/** 设置客户端发出的请求的优先级，默认为 FILE_PRIORITY_BACKGROUND */
+void FileClient_SetPriority( FileClient client, int priority );
+
+/**
+ * 设置客户端能同时等待响应的请求数量，默认为 1，即按顺序逐个处理请求
+ * 数量大于 1 时，请求的回调函数会在不同的线程中同时被调用
+ */
+void FileClient_SetMaxRequests( FileClient client, size_t n );
+
 void FileClient_SendRequest( FileClient client,
 			     const FileRequest *request,
 			     const FileRequestHandler *handler );
@@ -45,6 +45,7 @@ typedef void( *HandlerOnGetImage )(LCUI_Graph*, void*);
 typedef void( *HandlerOnGetStatus )(FileStatus*, void*);
 typedef void( *HandlerOnGetFile )(FileStatus*, FileStream, void*);
 typedef void( *HandlerOnGetThumbnail )(FileStatus*, LCUI_Graph*, void*);
+typedef void( *HandlerOnGetDirEntries )(FileStatus*, FileDirEntry*, size_t, void*);
 
 void FileStorage_Init( void );
 
@@ -54,6 +55,12 @@ void FileStorage_Close( int id );
 
 void FileStorage_Free( void );
 
+/** 设置连接上的请求的优先级，取值见 enum FileRequestPriority */
+void FileStorage_SetPriority( int conn_id, int priority );
+
+/** 设置连接上能同时处理的请求数量，大于 1 时回调函数可能在多个线程中被调用 */
+void FileStorage_SetMaxRequests( int conn_id, size_t n );
+
 int FileStorage_GetFile( int conn_id, const wchar_t *filename,
 			 HandlerOnGetFile callback, void *data );
 
@@ -63,6 +70,13 @@ int FileStorage_GetFiles( int conn_id, const wchar_t *filename,
 int FileStorage_GetFolders( int conn_id, const wchar_t *filename,
 			    HandlerOnGetFile callback, void *data );
 
+/**
+ * 获取目录中的文件和文件夹，以及它们的文件状态
+ * 整个目录只需一次请求，回调函数收到的列表在回调返回后失效
+ */
+int FileStorage_GetDirEntries( int conn_id, const wchar_t *dirname,
+			       HandlerOnGetDirEntries callback, void *data );
+
 int FileStorage_GetImage( int conn_id, const wchar_t *filename,
 			  HandlerOnGetImage callback,
 			  HandlerOnGetProgress progress,
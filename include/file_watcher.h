@@ -0,0 +1,93 @@
+﻿/* ***************************************************************************
+ * file_watcher.h -- file system change watcher
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * file_watcher.h -- 文件系统变更监视器
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#ifndef LCFINDER_FILE_WATCHER_H
+#define LCFINDER_FILE_WATCHER_H
+
+#include <stddef.h>
+
+/** 文件变更类型 */
+typedef enum FileWatcherEventType_ {
+	FILE_WATCHER_CHANGED,		/**< 文件被新建、修改或移入 */
+	FILE_WATCHER_DELETED,		/**< 文件被删除或移出 */
+	FILE_WATCHER_DIR_DELETED,	/**< 目录被删除或移出，其中的文件都已不存在 */
+	FILE_WATCHER_OVERFLOW		/**< 事件队列已溢出，该根目录需要重新扫描 */
+} FileWatcherEventType;
+
+/** 文件变更事件 */
+typedef struct FileWatcherEventRec_ {
+	FileWatcherEventType type;
+	char *path;		/**< 文件路径，UTF-8 编码 */
+	unsigned int ctime;	/**< 创建时间，只在 FILE_WATCHER_CHANGED 时有效 */
+	unsigned int mtime;	/**< 修改时间，只在 FILE_WATCHER_CHANGED 时有效 */
+} FileWatcherEventRec, *FileWatcherEvent;
+
+/**
+ * 变更事件的处理函数
+ * 短时间内的事件会合并成一批，同一路径只保留最后一次变更。处理函数在监视器
+ * 线程中调用，事件列表在处理函数返回后释放。
+ */
+typedef void(*FileWatcherHandler)(FileWatcherEvent events, size_t n_events,
+				  void *data);
+
+/**
+ * 启动文件监视器
+ * 目前只支持 Linux，启用 LCFINDER_USE_FANOTIFY 时会优先使用 fanotify，权限
+ * 不足时改用 inotify。
+ * @returns 成功时返回 0，当前平台不支持时返回 -ENOSYS
+ */
+int FileWatcher_Init(FileWatcherHandler handler, void *data);
+
+/** 停止文件监视器，未处理的变更会被丢弃 */
+void FileWatcher_Exit(void);
+
+/** 监视目录及其所有子目录中的图片文件 */
+int FileWatcher_AddDir(const char *dirpath);
+
+/** 停止监视目录 */
+int FileWatcher_RemoveDir(const char *dirpath);
+
+/**
+ * 暂停处理变更
+ * 暂停期间的变更会继续积累和合并，恢复后再交给处理函数。如果处理函数正在
+ * 执行，会等到它返回。可嵌套调用，需与 FileWatcher_Resume() 成对使用。
+ */
+void FileWatcher_Pause(void);
+
+/** 恢复处理变更 */
+void FileWatcher_Resume(void);
+
+#endif
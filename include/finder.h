@@ -64,7 +64,8 @@ enum LCFinderEventType {
 	EVENT_THUMBDB_DEL_DONE,
 	EVENT_LANG_CHG,
 	EVENT_PRIVATE_SPACE_CHG,
-	EVENT_LICENSE_CHG
+	EVENT_LICENSE_CHG,
+	EVENT_FILES_CHG
 };
 
 /** 配置数据结构 */
@@ -117,13 +118,32 @@ typedef struct Finder_ {
 	int storage_for_image;		/**< 文件服务连接标识符，主要用于读取图片内容 */
 	int storage_for_thumb;		/**< 文件服务连接标识符，主要用于获取图片缩略图 */
 	int storage_for_scan;		/**< 文件服务连接标识符，主要用于扫描文件列表 */
+	int storage_for_prefetch;	/**< 文件服务连接标识符，用于预先加载不可见的缩略图 */
 } Finder;
 
 typedef void(*LCFinder_EventHandler)(void*, void*);
 
-/** 文件同步状态记录 */
+/** 单个源文件夹的同步状态 */
+typedef struct FileSyncRootStatusRec_ {
+	int state;		/**< 当前状态 */
+	DB_Dir dir;		/**< 源文件夹 */
+	SyncTask task;		/**< 文件列表同步任务，源文件夹不可用时为 NULL */
+	size_t files;		/**< 文件总数 */
+	size_t dirs;		/**< 目录总数 */
+	size_t added_files;	/**< 增加的文件数量，扫描结束后有效 */
+	size_t changed_files;	/**< 改变的文件数量，扫描结束后有效 */
+	size_t deleted_files;	/**< 删除的文件数量，扫描结束后有效 */
+	size_t scaned_files;	/**< 已扫描的文件数量 */
+	size_t synced_files;	/**< 已同步的文件数量 */
+	size_t scaned_dirs;	/**< 已扫描的目录数量 */
+	size_t cached_dirs;	/**< 未变更而沿用缓存内容的目录数量 */
+} FileSyncRootStatusRec, *FileSyncRootStatus;
+
+/**
+ * 文件同步状态记录
+ * 各个源文件夹并发扫描，总计数由 LCFinder_UpdateSyncStatus() 汇总
+ */
 typedef struct FileSyncStatusRec_ {
-	size_t task_i;
 	int state;		/**< 当前状态 */
 	size_t files;		/**< 文件总数 */
 	size_t dirs;		/**< 目录总数 */
@@ -132,13 +152,28 @@ typedef struct FileSyncStatusRec_ {
 	size_t deleted_files;	/**< 删除的文件数量 */
 	size_t scaned_files;	/**< 已扫描的文件数量 */
 	size_t synced_files;	/**< 已同步的文件数量 */
+	size_t synced_speed;	/**< 同步速度，即每秒同步的文件数量 */
 	size_t scaned_dirs;	/**< 已扫描的目录数量 */
-	SyncTask task;		/**< 当前正执行的任务 */
-	SyncTask *tasks;	/**< 所有任务 */
+	size_t cached_dirs;	/**< 未变更而沿用缓存内容的目录数量 */
+	LCUI_BOOL full_scan;	/**< 是否忽略目录的修改时间，完整扫描所有目录 */
+	size_t max_tasks;	/**< 同时扫描的源文件夹数量上限，为 0 时使用默认值 */
+	size_t running_tasks;	/**< 正在扫描的源文件夹数量 */
+	size_t n_roots;		/**< 源文件夹数量 */
+	FileSyncRootStatus roots;	/**< 各个源文件夹的同步状态 */
 	void *data;
 	void(*callback)(void*);
 } FileSyncStatusRec, *FileSyncStatus;
 
+/** 文件监视器应用的一批文件变更，作为 EVENT_FILES_CHG 事件的参数 */
+typedef struct FileChangesRec_ {
+	size_t added_files;	/**< 增加的文件数量 */
+	size_t changed_files;	/**< 改变的文件数量 */
+	size_t deleted_files;	/**< 删除的文件数量 */
+	char **deleted_paths;	/**< 删除的文件路径列表 */
+	size_t n_files;		/**< 文件记录的数量 */
+	DB_File *files;		/**< 增加和改变的文件在写入后的记录 */
+} FileChangesRec, *FileChanges;
+
 extern Finder finder;
 
 /** 绑定事件 */
@@ -160,6 +195,9 @@ void LCFinder_ClearThumbDB(void);
 
 void LCFinder_SyncFilesAsync(FileSyncStatus s);
 
+/** 将各个源文件夹的扫描进度汇总到同步状态记录中 */
+void LCFinder_UpdateSyncStatus(FileSyncStatus s);
+
 DB_Dir LCFinder_GetDir(const char *dirpath);
 
 DB_Dir LCFinder_AddDir(const char *dirpath, const char *token, int visible);
@@ -0,0 +1,91 @@
+﻿/* ***************************************************************************
+ * image_header.h -- image file header parser
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * image_header.h -- 图片文件头解析
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#ifndef LCFINDER_IMAGE_HEADER_H
+#define LCFINDER_IMAGE_HEADER_H
+
+#include <time.h>
+
+/** 读取文件头时一次读取的字节数 */
+#define IMAGE_HEADER_READ_SIZE (16 * 1024)
+
+enum ImageHeaderType {
+	IMAGE_HEADER_UNKNOWN,
+	IMAGE_HEADER_JPEG,
+	IMAGE_HEADER_PNG,
+	IMAGE_HEADER_BMP
+};
+
+/** 从文件头中解析出的图片信息 */
+typedef struct ImageHeaderRec_ {
+	int type;
+	unsigned int width;
+	unsigned int height;
+	int orientation;	/**< EXIF 中的方向，1 ~ 8，没有时为 0 */
+	time_t capture_time;	/**< EXIF 中的拍摄时间，没有时为 0 */
+	size_t offset;		/**< 还需继续解析时，下一次读取的位置 */
+} ImageHeaderRec, *ImageHeader;
+
+/**
+ * 解析文件中从 offset 开始的一段数据
+ * 首次解析时 header 需要清零，并且 offset 为 0。
+ * @returns 解析出尺寸时返回 0，需要从 header->offset 处继续读取时返回 1，
+ *  不是支持的图片格式或数据有误时返回 -1
+ */
+int ImageHeader_Parse(ImageHeader header, const void *data, size_t len,
+		      size_t offset);
+
+/** 读取并解析文件头，path 为 UTF-8 编码的路径 */
+int ImageHeader_ReadFile(ImageHeader header, const char *path);
+
+/** 批量读取文件头的读取器，它持有的线程和 I/O 引擎可在多批文件之间复用 */
+typedef struct ImageHeaderReaderRec_ *ImageHeaderReader;
+
+ImageHeaderReader ImageHeaderReader_Create(void);
+
+void ImageHeaderReader_Destroy(ImageHeaderReader reader);
+
+/**
+ * 用读取器的线程读取并解析一批文件的文件头
+ * 在 Linux 上会通过 I/O 引擎批量读取每个文件开头的数据，只有尺寸信息不在这段
+ * 数据中的 JPEG 文件才会再单独读取。多个线程同时调用时会依次处理。
+ * @param[out] headers 与 paths 一一对应的解析结果，未能解析的尺寸为 0
+ */
+void ImageHeaderReader_ReadFiles(ImageHeaderReader reader,
+				 ImageHeader headers, const char **paths,
+				 size_t n);
+
+#endif
@@ -0,0 +1,84 @@
+﻿/* ***************************************************************************
+ * io_engine.h -- batched file I/O engine
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * io_engine.h -- 批量文件 I/O 引擎
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#ifndef LCFINDER_IO_ENGINE_H
+#define LCFINDER_IO_ENGINE_H
+
+#include <time.h>
+#include <stdint.h>
+
+typedef struct IOEngineRec_ *IOEngine;
+
+/** 文件状态 */
+typedef struct IOFileStatRec_ {
+	int error;		/**< 成功时为 0，失败时为负的错误码 */
+	unsigned int mode;	/**< 文件类型和权限，与 struct stat 的 st_mode 相同 */
+	uint64_t size;
+	uint64_t inode;
+	time_t ctime;
+	time_t mtime;
+} IOFileStatRec, *IOFileStat;
+
+/**
+ * 创建 I/O 引擎
+ * 启用 LCFINDER_USE_IO_URING 且内核支持时，每批操作通过 io_uring 一次提交，
+ * 否则在调用者的线程中逐个执行。引擎只能在一个线程中使用。
+ * @returns 当前平台不支持时返回 NULL
+ */
+IOEngine IOEngine_Create(void);
+
+void IOEngine_Destroy(IOEngine engine);
+
+/** 判断引擎是否在使用 io_uring */
+int IOEngine_IsAsync(IOEngine engine);
+
+/**
+ * 批量获取文件状态，符号链接会被跟随
+ * @param[in] dirfd 文件名所相对的目录，可以是 AT_FDCWD
+ * @param[out] results 与 names 一一对应的文件状态
+ */
+void IOEngine_StatAt(IOEngine engine, int dirfd, const char **names,
+		     size_t n, IOFileStat results);
+
+/**
+ * 批量读取文件开头的数据，用于解析文件头
+ * @param[out] bufs 与 names 一一对应的缓冲区，每个缓冲区的大小为 size
+ * @param[out] results 读取的字节数，失败时为负的错误码
+ */
+void IOEngine_ReadHeadersAt(IOEngine engine, int dirfd, const char **names,
+			    size_t n, char **bufs, size_t size, long *results);
+
+#endif
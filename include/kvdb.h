@@ -25,6 +25,10 @@
 
 typedef struct kvdb_t kvdb_t;
 
+typedef struct kvdb_iterator_t kvdb_iterator_t;
+
+typedef struct kvdb_batch_t kvdb_batch_t;
+
 typedef void(*kvdb_each_callback_t)(
 	const char*, size_t, const void*, size_t, void*
 );
@@ -46,4 +50,40 @@ int kvdb_delete(kvdb_t *db, const char *key, size_t keylen);
 
 size_t kvdb_each(kvdb_t *db, kvdb_each_callback_t callback, void *privdata);
 
+kvdb_batch_t *kvdb_batch_create(void);
+
+void kvdb_batch_destroy(kvdb_batch_t *batch);
+
+void kvdb_batch_put(kvdb_batch_t *batch, const char *key, size_t keylen,
+		    const void *val, size_t vallen);
+
+void kvdb_batch_delete(kvdb_batch_t *batch, const char *key, size_t keylen);
+
+/** 获取批量写入中的操作数量 */
+size_t kvdb_batch_count(kvdb_batch_t *batch);
+
+/**
+ * 将批量写入中的操作一次性写入数据库，并清空这些操作
+ * @param[in] durable 是否等待数据落盘，批量写入多次时只需最后一次落盘
+ */
+int kvdb_write(kvdb_t *db, kvdb_batch_t *batch, int durable);
+
+/** 迭代器是否按键的字节序遍历 */
+int kvdb_is_ordered(void);
+
+kvdb_iterator_t *kvdb_iter_create(kvdb_t *db);
+
+void kvdb_iter_destroy(kvdb_iterator_t *iter);
+
+/** 定位到第一个不小于 key 的记录，key 为 NULL 时定位到第一条记录 */
+void kvdb_iter_seek(kvdb_iterator_t *iter, const char *key, size_t keylen);
+
+int kvdb_iter_valid(kvdb_iterator_t *iter);
+
+void kvdb_iter_next(kvdb_iterator_t *iter);
+
+const char *kvdb_iter_key(kvdb_iterator_t *iter, size_t *keylen);
+
+const void *kvdb_iter_value(kvdb_iterator_t *iter, size_t *vallen);
+
 #endif
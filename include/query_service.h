@@ -0,0 +1,83 @@
+﻿/* ***************************************************************************
+ * query_service.h -- asynchronous file query service
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * query_service.h -- 异步文件查询服务
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#ifndef LCFINDER_QUERY_SERVICE_H
+#define LCFINDER_QUERY_SERVICE_H
+
+#include "file_search.h"
+
+#ifdef LCFINDER_QUERY_SERVICE_C
+typedef struct QueryChannelRec_ *QueryChannel;
+#else
+typedef void *QueryChannel;
+#endif
+
+/**
+ * 收到一页查询结果时的回调函数
+ * 页的所有权转交给回调函数，用完后需要调用 DBFilePage_Destroy() 和 free() 释放
+ */
+typedef void (*QueryPageHandler)(DB_FilePage page, void *data);
+
+/** 查询完成时的回调函数，count 为查询到的文件数量 */
+typedef void (*QueryDoneHandler)(size_t count, void *data);
+
+/** 启动查询服务 */
+int QueryService_Init(void);
+
+/** 停止查询服务，未完成的查询都会被取消 */
+void QueryService_Exit(void);
+
+/**
+ * 创建查询通道
+ * 每个视图使用一个通道，回调函数都在 UI 线程中调用。
+ */
+QueryChannel QueryChannel_Create(QueryPageHandler on_page,
+				 QueryDoneHandler on_done, void *data);
+
+/** 销毁查询通道，通道中未完成的查询会被取消 */
+void QueryChannel_Destroy(QueryChannel channel);
+
+/**
+ * 提交查询
+ * 通道中未完成的查询会被取消，之后只会收到新查询的结果。查询条件会被复制，
+ * 查询结果按 terms->limit 分页，从 terms->cursor 之后开始。
+ */
+int QueryChannel_Submit(QueryChannel channel, const DB_QueryTerms terms);
+
+/** 取消通道中的查询，取消后不会再收到该查询的结果 */
+void QueryChannel_Cancel(QueryChannel channel);
+
+#endif
@@ -53,6 +53,13 @@ LCUI_Widget ThumbView_AppendFolder(LCUI_Widget w, const char *filepath,
 /** 追加图片 */
 LCUI_Widget ThumbView_AppendPicture(LCUI_Widget w, const DB_File file);
 
+/** 在 before 前面插入子部件，before 为 NULL 时追加到末尾 */
+void ThumbView_Insert(LCUI_Widget w, LCUI_Widget child, LCUI_Widget before);
+
+/** 在 before 前面插入图片，before 为 NULL 时追加到末尾 */
+LCUI_Widget ThumbView_InsertPicture(LCUI_Widget w, const DB_File file,
+				    LCUI_Widget before);
+
 void ThumbViewItem_AppendToCover(LCUI_Widget item, LCUI_Widget child);
 
 void ThumbView_StartUpdateLayout(LCUI_Widget w);
@@ -69,6 +76,9 @@ void ThumbView_SetCache(LCUI_Widget w, ThumbCache cache);
 /** 设置文件存储服务的连接标识符 */
 void ThumbView_SetStorage(LCUI_Widget w, int storage);
 
+/** 设置用于预加载缩略图的文件存储服务的连接标识符，未设置时不预加载 */
+void ThumbView_SetPrefetchStorage(LCUI_Widget w, int storage);
+
 /** 启用缩略图滚动加载功能 */
 void ThumbView_EnableAutoLoader(LCUI_Widget w);
 
@@ -40,12 +40,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
+#include <time.h>
 #include <locale.h>
 #include "finder.h"
 #include "i18n.h"
 #include "ui.h"
 #include "detector.h"
 #include "file_storage.h"
+#include "file_watcher.h"
+#include "dir_walker.h"
+#include "image_header.h"
+#include "query_service.h"
+#include <LCUI/timer.h>
 #include <LCUI/util/charset.h>
 
 // clang-format off
@@ -57,6 +63,27 @@
 
 #define THUMB_CACHE_SIZE (64 * 1024 * 1024)
 
+/** 同步文件记录时，每批提交至数据库的文件数量 */
+#define SYNC_BATCH_SIZE 512
+
+/**
+ * 目录的修改时间未变时，扫描器直接沿用缓存中的目录内容，但目录的修改时间
+ * 不会因其中的文件被修改而改变，所以超过这个时间（秒）的目录仍需完整扫描
+ */
+#define SCAN_VERIFY_INTERVAL (7 * 24 * 3600)
+
+/** 首次导入的文件数量需要达到该值才会启用首次导入模式 */
+#define FIRST_IMPORT_MIN_FILES 10000
+
+/** 同时扫描的源文件夹数量上限的默认值 */
+#define SYNC_DEFAULT_TASKS 2
+
+/** 扫描连接的数量，同时扫描的源文件夹数量不会超过该值 */
+#define SYNC_MAX_TASKS 4
+
+/** 同一设备上同时扫描的源文件夹数量 */
+#define SYNC_MAX_TASKS_PER_DEVICE 1
+
 #ifdef ASSERT
 #undef ASSERT
 #endif
@@ -71,7 +98,14 @@ Finder finder;
 
 typedef struct DirStatusDataPackRec_ {
 	FileSyncStatus status;
+	FileSyncRootStatus root;
 	DB_Dir dir;
+	int64_t start_time;			/**< 开始同步的时间 */
+	size_t n_files;				/**< 待提交的文件数量 */
+	DB_FileRec files[SYNC_BATCH_SIZE];	/**< 待添加的文件 */
+	char *paths[SYNC_BATCH_SIZE];		/**< 待删除的文件路径 */
+	struct ScanTaskRec_ *task;		/**< 当前源文件夹的扫描任务 */
+	size_t n_added;				/**< 已取用的新增文件的尺寸数量 */
 } DirStatusDataPackRec, *DirStatusDataPack;
 
 typedef struct EventPackRec_ {
@@ -79,11 +113,85 @@ typedef struct EventPackRec_ {
 	void *data;
 } EventPackRec, *EventPack;
 
-typedef struct FileSyncDataPackRec_ {
+/** 新增文件的图片尺寸 */
+typedef struct ImageSizeRec_ {
+	unsigned int width;
+	unsigned int height;
+} ImageSizeRec, *ImageSize;
+
+/** 源文件夹的扫描任务 */
+typedef struct ScanTaskRec_ {
 	FileSyncStatus status;
+	FileSyncRootStatus root;
+	int slot;		/**< 占用的扫描连接序号 */
+	int storage;		/**< 扫描连接 */
+	dev_t device;		/**< 源文件夹所在的设备 */
+	DirWalker walker;	/**< 需要列出所有目录时使用的并行遍历器 */
+	size_t n_sizes;		/**< 已读取尺寸的新增文件数量 */
+	ImageSize sizes;	/**< 新增文件的尺寸，顺序与 SyncTask_InAddedFiles() 一致 */
+} ScanTaskRec, *ScanTask;
+
+/** 扫描完一个源文件夹后，分批读取新增文件的文件头 */
+typedef struct HeaderBatchRec_ {
+	ScanTask task;
+	size_t capacity;			/**< task->sizes 的容量 */
+	size_t n_files;
+	char *paths[SYNC_BATCH_SIZE];
+	ImageHeaderRec headers[SYNC_BATCH_SIZE];
+} HeaderBatchRec, *HeaderBatch;
+
+/** 同步调度器，同一时间只有一次同步 */
+static struct FinderSyncRec_ {
+	LCUI_Mutex mutex;		/**< 保护任务状态和计数的互斥锁 */
+	ScanTask tasks;			/**< 与 FileSyncStatus.roots 一一对应 */
+	size_t n_tasks;
+	size_t finished;		/**< 已结束扫描的任务数量 */
+	int storages[SYNC_MAX_TASKS];	/**< 扫描连接，第一个即 storage_for_scan */
+	LCUI_BOOL busy[SYNC_MAX_TASKS];
+	ImageHeaderReader reader;	/**< 整个同步过程共用的文件头读取器 */
+} finder_sync;
+
+/** 目录中的一项，目录名以路径分隔符结尾 */
+typedef struct ScanEntryRec_ {
+	wchar_t *name;
+	LCUI_BOOL is_dir;
+	LCUI_BOOL ready;	/**< 是否已取得文件状态 */
+	LCUI_BOOL exists;	/**< 是否成功取得文件状态 */
+	unsigned int ctime;
+	unsigned int mtime;
+} ScanEntryRec, *ScanEntry;
+
+/**
+ * 目录扫描帧
+ * 扫描器按缓存中键的顺序深度优先遍历目录，文件同步任务因此只需与之前的
+ * 缓存逐条比对。一个目录的子目录扫描完后才继续提交该目录后面的文件。
+ */
+typedef struct ScanFrameRec_ ScanFrameRec, *ScanFrame;
+struct ScanFrameRec_ {
+	ScanTask task;
+	ScanFrame parent;
+	ScanFrame child;	/**< 正在扫描的子目录 */
+	ScanEntry entries;	/**< 已排序的目录内容 */
+	size_t n_entries;
+	size_t max_entries;
+	size_t cursor;		/**< 下一个待提交的项 */
+	size_t path_len;	/**< 目录路径长度，包括末尾的分隔符 */
 	wchar_t path[PATH_LEN];
-	size_t path_len;
-} FileSyncDataPackRec, *FileSyncDataPack;
+	FileCacheDirRec cache;	/**< 缓存中的目录状态 */
+};
+
+/** 源文件夹路径前缀树的结点，每个结点对应路径中的一级目录名 */
+typedef struct DirTrieNodeRec_ {
+	DB_Dir dir;		/**< 以该结点结尾的源文件夹 */
+	Dict *children;		/**< 子结点，以目录名作为索引 */
+} DirTrieNodeRec, *DirTrieNode;
+
+/** 标签和源文件夹的内存索引，与 finder.tags 和 finder.dirs 保持同步 */
+static struct FinderIndexRec_ {
+	Dict *tag_names;	/**< 以标签名称作为索引的标签表 */
+	Dict *tag_ids;		/**< 以标签标识号作为索引的标签表 */
+	DirTrieNode dirs;	/**< 源文件夹路径前缀树 */
+} finder_index;
 
 // clang-format on
 
@@ -101,6 +209,177 @@ static LCUI_BOOL AvailableSourceDir(DB_Dir dir)
 	return TRUE;
 }
 
+static unsigned int TagIdDict_KeyHash(const void *key)
+{
+	return (unsigned int)*(const int *)key;
+}
+
+static int TagIdDict_KeyCompare(void *privdata, const void *key1,
+				const void *key2)
+{
+	return *(const int *)key1 == *(const int *)key2;
+}
+
+/** 标签标识号索引直接引用 DB_Tag 里的 id 字段，不复制键 */
+static DictType TagIdDict = {
+	TagIdDict_KeyHash, NULL, NULL, TagIdDict_KeyCompare, NULL, NULL
+};
+
+static void LCFinder_IndexTag(DB_Tag tag)
+{
+	Dict_Add(finder_index.tag_names, tag->name, tag);
+	Dict_Add(finder_index.tag_ids, &tag->id, tag);
+}
+
+static void LCFinder_RebuildTagIndex(void)
+{
+	size_t i;
+
+	if (finder_index.tag_names) {
+		StrDict_Release(finder_index.tag_names);
+	}
+	if (finder_index.tag_ids) {
+		Dict_Release(finder_index.tag_ids);
+	}
+	finder_index.tag_names = StrDict_Create(NULL, NULL);
+	finder_index.tag_ids = Dict_Create(&TagIdDict, NULL);
+	for (i = 0; i < finder.n_tags; ++i) {
+		LCFinder_IndexTag(finder.tags[i]);
+	}
+}
+
+static void DirTrieNode_Destroy(void *privdata, void *data)
+{
+	DirTrieNode node = data;
+
+	StrDict_Release(node->children);
+	free(node);
+}
+
+static DirTrieNode DirTrieNode_Create(void)
+{
+	DirTrieNode node = NEW(DirTrieNodeRec, 1);
+
+	node->dir = NULL;
+	node->children = StrDict_Create(NULL, DirTrieNode_Destroy);
+	return node;
+}
+
+/**
+ * 读取路径中的下一级目录名
+ * @param[in,out] path 路径读取位置，读取后指向目录名之后的字符
+ * @param[out] name 目录名的存放位置，长度至少为 PATH_LEN
+ * @returns 若已到达路径末尾则返回 FALSE
+ */
+static LCUI_BOOL DirTrie_NextName(const char **path, char *name)
+{
+	size_t len;
+	const char *p = *path;
+
+	while (*p == PATH_SEP) {
+		++p;
+	}
+	for (len = 0; p[len] && p[len] != PATH_SEP; ++len);
+	if (len < 1 || len >= PATH_LEN) {
+		return FALSE;
+	}
+	strncpy(name, p, len);
+	name[len] = 0;
+	*path = p + len;
+	return TRUE;
+}
+
+static void DirTrie_Add(DirTrieNode root, DB_Dir dir)
+{
+	char name[PATH_LEN];
+	const char *p = dir->path;
+	DirTrieNode child, node = root;
+
+	while (DirTrie_NextName(&p, name)) {
+		child = Dict_FetchValue(node->children, name);
+		if (!child) {
+			child = DirTrieNode_Create();
+			Dict_Add(node->children, name, child);
+		}
+		node = child;
+	}
+	node->dir = dir;
+}
+
+/** 移除源文件夹，并顺带删除不再通往任何源文件夹的结点 */
+static LCUI_BOOL DirTrie_Remove(DirTrieNode node, const char *path,
+				DB_Dir dir)
+{
+	DirTrieNode child;
+	char name[PATH_LEN];
+
+	if (!DirTrie_NextName(&path, name)) {
+		if (node->dir == dir) {
+			node->dir = NULL;
+		}
+	} else {
+		child = Dict_FetchValue(node->children, name);
+		if (child && DirTrie_Remove(child, path, dir)) {
+			Dict_Delete(node->children, name);
+		}
+	}
+	return !node->dir && Dict_Size(node->children) == 0;
+}
+
+/**
+ * 查找路径所处的源文件夹
+ * @param[in] exact 是否要求路径与源文件夹路径完全一致
+ */
+static DB_Dir DirTrie_Match(DirTrieNode root, const char *path,
+			    LCUI_BOOL exact)
+{
+	DB_Dir dir = NULL;
+	char name[PATH_LEN];
+	DirTrieNode node = root;
+
+	while (node && DirTrie_NextName(&path, name)) {
+		node = Dict_FetchValue(node->children, name);
+		if (node && node->dir && !exact) {
+			dir = node->dir;
+		}
+	}
+	if (exact) {
+		return node ? node->dir : NULL;
+	}
+	return dir;
+}
+
+static void LCFinder_RebuildDirIndex(void)
+{
+	size_t i;
+
+	if (finder_index.dirs) {
+		DirTrieNode_Destroy(NULL, finder_index.dirs);
+	}
+	finder_index.dirs = DirTrieNode_Create();
+	for (i = 0; i < finder.n_dirs; ++i) {
+		if (finder.dirs[i]) {
+			DirTrie_Add(finder_index.dirs, finder.dirs[i]);
+		}
+	}
+}
+
+static void LCFinder_FreeIndex(void)
+{
+	if (finder_index.tag_names) {
+		StrDict_Release(finder_index.tag_names);
+	}
+	if (finder_index.tag_ids) {
+		Dict_Release(finder_index.tag_ids);
+	}
+	if (finder_index.dirs) {
+		DirTrieNode_Destroy(NULL, finder_index.dirs);
+	}
+	finder_index.tag_names = NULL;
+	finder_index.tag_ids = NULL;
+	finder_index.dirs = NULL;
+}
+
 int LCFinder_BindEvent(int event_id, LCFinder_EventHandler handler, void *data)
 {
 	EventPack pack = NEW(EventPackRec, 1);
@@ -116,13 +395,10 @@ int LCFinder_TriggerEvent(int event_id, void *data)
 
 DB_Dir LCFinder_GetDir(const char *dirpath)
 {
-	size_t i;
-	DB_Dir dir;
-	for (i = 0; i < finder.n_dirs; ++i) {
-		dir = finder.dirs[i];
-		if (dir && strcmp(dir->path, dirpath) == 0) {
-			return dir;
-		}
+	DB_Dir dir = DirTrie_Match(finder_index.dirs, dirpath, TRUE);
+
+	if (dir && strcmp(dir->path, dirpath) == 0) {
+		return dir;
 	}
 	return NULL;
 }
@@ -174,22 +450,29 @@ DB_Dir LCFinder_AddDir(const char *dirpath, const char *token, int visible)
 		free(path);
 		return NULL;
 	}
+	/* 等待文件监视器处理完当前的变更，再修改源文件夹列表 */
+	FileWatcher_Pause();
 	i = finder.n_dirs;
 	finder.n_dirs += 1;
 	dirs = realloc(finder.dirs, sizeof(DB_Dir) * finder.n_dirs);
 	if (!dirs) {
 		finder.n_dirs -= 1;
+		FileWatcher_Resume();
 		return NULL;
 	}
 	paths = realloc(finder.thumb_paths, sizeof(wchar_t *) * finder.n_dirs);
 	if (!path) {
 		finder.n_dirs -= 1;
+		FileWatcher_Resume();
 		return NULL;
 	}
 	dirs[i] = dir;
 	paths[i] = LCFinder_CreateThumbDB(dir->path);
 	finder.dirs = dirs;
 	finder.thumb_paths = paths;
+	DirTrie_Add(finder_index.dirs, dir);
+	FileWatcher_AddDir(dir->path);
+	FileWatcher_Resume();
 	return dir;
 }
 
@@ -207,7 +490,10 @@ void LCFinder_DeleteDir(DB_Dir dir)
 	if (i >= finder.n_dirs) {
 		return;
 	}
+	FileWatcher_Pause();
+	FileWatcher_RemoveDir(dir->path);
 	finder.dirs[i] = NULL;
+	DirTrie_Remove(finder_index.dirs, dir->path, dir);
 	wpath = DecodeUTF8(dir->path);
 	/* 准备清除文件列表缓存 */
 	t = SyncTask_NewW(finder.fileset_dir, wpath);
@@ -229,6 +515,7 @@ void LCFinder_DeleteDir(DB_Dir dir)
 	/* 删除数据库中的源文件夹记录 */
 	DB_DeleteDir(dir);
 	free(dir);
+	FileWatcher_Resume();
 }
 
 static void OnCloseFileCache(void *privdata, void *data)
@@ -245,6 +532,9 @@ size_t LCFinder_DeleteFiles(char *const *files, size_t nfiles,
 	wchar_t *path;
 	SyncTask task;
 	Dict *tasks = StrDict_Create(NULL, OnCloseFileCache);
+
+	/* 文件监视器也会改写文件列表缓存，删除期间先暂停 */
+	FileWatcher_Pause();
 	for (i = 0; i < nfiles; ++i) {
 		DB_Dir dir = LCFinder_GetSourceDir(files[i]);
 		if (!dir) {
@@ -275,19 +565,393 @@ size_t LCFinder_DeleteFiles(char *const *files, size_t nfiles,
 		}
 	}
 	StrDict_Release(tasks);
+	FileWatcher_Resume();
 	return i;
 }
 
+static void FileChanges_Destroy(FileChanges changes)
+{
+	size_t i;
+
+	for (i = 0; i < changes->deleted_files; ++i) {
+		free(changes->deleted_paths[i]);
+	}
+	free(changes->deleted_paths);
+	for (i = 0; i < changes->n_files; ++i) {
+		DBFile_Release(changes->files[i]);
+	}
+	free(changes->files);
+	free(changes);
+}
+
+/** 记录一个已删除的文件路径，路径的内存由 changes 接管 */
+static void FileChanges_AddDeletedPath(FileChanges changes, char *path)
+{
+	char **paths;
+	size_t n = changes->deleted_files;
+
+	/* 列表容量从 8 开始，每次填满后翻倍 */
+	if (n == 0 || (n >= 8 && (n & (n - 1)) == 0)) {
+		paths = realloc(changes->deleted_paths,
+				sizeof(char *) * (n > 0 ? n * 2 : 8));
+		if (!paths) {
+			free(path);
+			return;
+		}
+		changes->deleted_paths = paths;
+	}
+	changes->deleted_paths[changes->deleted_files++] = path;
+}
+
+static void LCFinder_OnFilesChanged(void *arg1, void *arg2)
+{
+	size_t i;
+	FileChanges changes = arg1;
+
+	for (i = 0; i < changes->deleted_files; ++i) {
+		LCFinder_TriggerEvent(EVENT_FILE_DEL,
+				      changes->deleted_paths[i]);
+	}
+	LCFinder_TriggerEvent(EVENT_FILES_CHG, changes);
+	FileChanges_Destroy(changes);
+}
+
+static void LCFinder_OnWatcherOverflow(void *arg1, void *arg2)
+{
+	LCFinder_TriggerEvent(EVENT_SYNC, NULL);
+}
+
+static SyncTask LCFinder_GetWatchTask(Dict *tasks, DB_Dir dir)
+{
+	wchar_t *path;
+	SyncTask task = Dict_FetchValue(tasks, dir->path);
+
+	if (task) {
+		return task;
+	}
+	path = DecodeUTF8(dir->path);
+	task = SyncTask_NewW(finder.fileset_dir, path);
+	free(path);
+	if (SyncTask_OpenCacheW(task, NULL) != 0) {
+		SyncTask_Delete(task);
+		return NULL;
+	}
+	Dict_Add(tasks, dir->path, task);
+	return task;
+}
+
+/** 文件监视器事件对应的一条数据库变更 */
+typedef struct FileChangeRec_ {
+	FileCacheUpdateResult result;	/**< 文件列表缓存的更新结果 */
+	DB_Dir dir;
+	DB_FileRec file;		/**< 文件信息，其中的路径由变更记录持有 */
+} FileChangeRec, *FileChange;
+
+typedef struct FileChangeListRec_ {
+	size_t length;
+	size_t capacity;
+	FileChangeRec *items;
+} FileChangeListRec, *FileChangeList;
+
+static FileChange FileChangeList_Add(FileChangeList list,
+				     FileCacheUpdateResult result, DB_Dir dir,
+				     char *path)
+{
+	size_t capacity;
+	FileChange change;
+
+	if (list->length >= list->capacity) {
+		capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+		change = realloc(list->items, sizeof(FileChangeRec) * capacity);
+		if (!change) {
+			free(path);
+			return NULL;
+		}
+		list->items = change;
+		list->capacity = capacity;
+	}
+	change = &list->items[list->length++];
+	memset(change, 0, sizeof(FileChangeRec));
+	change->result = result;
+	change->dir = dir;
+	change->file.path = path;
+	return change;
+}
+
+static void FileChangeList_Destroy(FileChangeList list)
+{
+	size_t i;
+
+	for (i = 0; i < list->length; ++i) {
+		free(list->items[i].file.path);
+	}
+	free(list->items);
+}
+
+/** 更新文件列表缓存，并在事务之外读取新增文件的文件头 */
+static void LCFinder_PrepareFileChange(FileChangeList list, DB_Dir dir,
+				       SyncTask task, FileWatcherEvent e)
+{
+	int ret;
+	wchar_t *wpath;
+	FileChange change;
+	ImageHeaderRec header;
+	FileCacheTimeRec time;
+
+	wpath = DecodeUTF8(e->path);
+	if (!wpath) {
+		return;
+	}
+	time.ctime = e->ctime;
+	time.mtime = e->mtime;
+	ret = SyncTask_UpdateFileW(
+	    task, wpath, e->type == FILE_WATCHER_CHANGED ? &time : NULL);
+	free(wpath);
+	if (ret == FILE_CACHE_UNCHANGED) {
+		return;
+	}
+	change = FileChangeList_Add(list, ret, dir, strdup2(e->path));
+	if (!change) {
+		return;
+	}
+	change->file.create_time = (unsigned int)e->ctime;
+	change->file.modify_time = (unsigned int)e->mtime;
+	if (ret == FILE_CACHE_ADDED) {
+		ImageHeader_ReadFile(&header, e->path);
+		change->file.width = header.width;
+		change->file.height = header.height;
+	}
+}
+
+/** 目录被删除后，从缓存中移除其中所有文件的记录，并记下要删除的路径 */
+static void LCFinder_PrepareDirDeletion(FileChangeList list, SyncTask task,
+					const char *dirpath)
+{
+	size_t n;
+	DB_File file;
+	DB_Query query;
+	wchar_t *wpath;
+	DB_QueryTermsRec terms;
+
+	memset(&terms, 0, sizeof(terms));
+	terms.dirpath = (char *)dirpath;
+	terms.for_tree = TRUE;
+	terms.limit = SYNC_BATCH_SIZE;
+	do {
+		query = DB_NewQuery(&terms);
+		if (!query) {
+			break;
+		}
+		for (n = 0; n < SYNC_BATCH_SIZE; ++n) {
+			file = DBQuery_FetchFile(query);
+			if (!file) {
+				break;
+			}
+			wpath = DecodeUTF8(file->path);
+			SyncTask_UpdateFileW(task, wpath, NULL);
+			free(wpath);
+			FileChangeList_Add(list, FILE_CACHE_DELETED, NULL,
+					   strdup2(file->path));
+			DBFile_Release(file);
+		}
+		DBQuery_GetCursor(query, &terms.cursor);
+		DB_DeleteQuery(query);
+	} while (n == SYNC_BATCH_SIZE);
+}
+
+/**
+ * 在一个事务中按顺序写入变更
+ * 连续的删除操作合并成一次批量删除，删除的路径随后交给 changes。
+ */
+static void LCFinder_CommitFileChanges(FileChanges changes,
+				       FileChangeList list)
+{
+	size_t i, j, n;
+	FileChange change;
+	char *paths[SYNC_BATCH_SIZE];
+
+	DB_Begin();
+	for (i = 0; i < list->length; i += n) {
+		change = &list->items[i];
+		n = 1;
+		switch (change->result) {
+		case FILE_CACHE_ADDED:
+			DB_AddFiles(change->dir, &change->file, 1);
+			changes->added_files += 1;
+			break;
+		case FILE_CACHE_CHANGED:
+			DB_UpdateFileTime(change->dir, change->file.path,
+					  (int)change->file.create_time,
+					  (int)change->file.modify_time);
+			changes->changed_files += 1;
+			break;
+		case FILE_CACHE_DELETED:
+			for (n = 0; n < SYNC_BATCH_SIZE && i + n < list->length;
+			     ++n) {
+				change = &list->items[i + n];
+				if (change->result != FILE_CACHE_DELETED) {
+					break;
+				}
+				paths[n] = change->file.path;
+			}
+			DB_DeleteFiles(paths, n);
+			for (j = 0; j < n; ++j) {
+				FileChanges_AddDeletedPath(changes, paths[j]);
+				list->items[i + j].file.path = NULL;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	DB_Commit();
+}
+
+/** 读取增加和改变的文件在数据库中的记录，供视图就地更新 */
+static void LCFinder_LoadChangedFiles(FileChanges changes,
+				      FileChangeList list)
+{
+	size_t i;
+	DB_File file;
+
+	changes->files = malloc(sizeof(DB_File) * list->length);
+	if (!changes->files) {
+		return;
+	}
+	for (i = 0; i < list->length; ++i) {
+		if (list->items[i].result != FILE_CACHE_ADDED &&
+		    list->items[i].result != FILE_CACHE_CHANGED) {
+			continue;
+		}
+		file = DB_GetFile(list->items[i].file.path);
+		if (file) {
+			changes->files[changes->n_files++] = file;
+		}
+	}
+}
+
+/**
+ * 应用文件监视器报告的一批变更
+ * 在监视器线程中调用。完整同步期间监视器处于暂停状态，所以不会与同步任务
+ * 同时改写文件列表缓存。读取文件头和更新缓存文件都在事务之外完成，事务中
+ * 只执行 SQL，避免在磁盘 I/O 期间阻塞其它写入。
+ */
+static void LCFinder_OnWatcherEvents(FileWatcherEvent events, size_t n_events,
+				     void *data)
+{
+	size_t i;
+	DB_Dir dir;
+	SyncTask task;
+	FileChanges changes;
+	FileChangeListRec list = { 0 };
+	LCUI_BOOL rescan = FALSE;
+	Dict *tasks = StrDict_Create(NULL, OnCloseFileCache);
+
+	for (i = 0; i < n_events; ++i) {
+		if (events[i].type == FILE_WATCHER_OVERFLOW) {
+			rescan = TRUE;
+			continue;
+		}
+		dir = LCFinder_GetSourceDir(events[i].path);
+		if (!dir) {
+			continue;
+		}
+		task = LCFinder_GetWatchTask(tasks, dir);
+		if (!task) {
+			continue;
+		}
+		if (events[i].type == FILE_WATCHER_DIR_DELETED) {
+			LCFinder_PrepareDirDeletion(&list, task,
+						    events[i].path);
+		} else {
+			LCFinder_PrepareFileChange(&list, dir, task,
+						   &events[i]);
+		}
+	}
+	changes = NEW(FileChangesRec, 1);
+	if (list.length > 0) {
+		LCFinder_CommitFileChanges(changes, &list);
+		LCFinder_LoadChangedFiles(changes, &list);
+	}
+	FileChangeList_Destroy(&list);
+	StrDict_Release(tasks);
+	Logger_Debug("[watcher] %lu added, %lu changed, %lu deleted\n",
+		     changes->added_files, changes->changed_files,
+		     changes->deleted_files);
+	if (changes->added_files + changes->changed_files +
+	    changes->deleted_files > 0) {
+		LCUI_PostSimpleTask(LCFinder_OnFilesChanged, changes, NULL);
+	} else {
+		FileChanges_Destroy(changes);
+	}
+	/* 有事件丢失时交给常规的同步流程，未变更的目录会沿用缓存 */
+	if (rescan) {
+		LCUI_PostSimpleTask(LCFinder_OnWatcherOverflow, NULL, NULL);
+	}
+}
+
+static void UpdateSyncSpeed(DirStatusDataPack pack)
+{
+	int64_t delta = LCUI_GetTimeDelta(pack->start_time);
+
+	if (delta > 0) {
+		pack->status->synced_speed =
+		    (size_t)(pack->status->synced_files * 1000 / delta);
+	}
+}
+
+static void FlushAddedFiles(DirStatusDataPack pack)
+{
+	size_t i;
+
+	DB_AddFiles(pack->dir, pack->files, pack->n_files);
+	pack->status->synced_files += pack->n_files;
+	pack->root->synced_files += pack->n_files;
+	for (i = 0; i < pack->n_files; ++i) {
+		free(pack->files[i].path);
+		pack->files[i].path = NULL;
+	}
+	pack->n_files = 0;
+	UpdateSyncSpeed(pack);
+}
+
+static void FlushDeletedFiles(DirStatusDataPack pack)
+{
+	size_t i;
+
+	DB_DeleteFiles(pack->paths, pack->n_files);
+	pack->status->synced_files += pack->n_files;
+	pack->root->synced_files += pack->n_files;
+	for (i = 0; i < pack->n_files; ++i) {
+		free(pack->paths[i]);
+		pack->paths[i] = NULL;
+	}
+	pack->n_files = 0;
+	UpdateSyncSpeed(pack);
+}
+
 static void SyncAddedFile(void *data, const FileCacheInfo info)
 {
 	char path[PATH_LEN];
+	DB_File file;
 	DirStatusDataPack pack = data;
-	int ctime = (int)info->ctime;
-	int mtime = (int)info->mtime;
-	pack->status->synced_files += 1;
+
 	LCUI_EncodeString(path, info->path, PATH_LEN, ENCODING_UTF8);
-	DB_AddFile(pack->dir, path, ctime, mtime);
-	// wprintf(L"sync: add file: %s, ctime: %d\n", wpath, ctime);
+	file = &pack->files[pack->n_files++];
+	file->path = strdup2(path);
+	file->width = 0;
+	file->height = 0;
+	/* 尺寸已在扫描阶段按同样的顺序读取好了 */
+	if (pack->task && pack->n_added < pack->task->n_sizes) {
+		file->width = pack->task->sizes[pack->n_added].width;
+		file->height = pack->task->sizes[pack->n_added].height;
+	}
+	pack->n_added += 1;
+	file->create_time = info->ctime;
+	file->modify_time = info->mtime;
+	if (pack->n_files >= SYNC_BATCH_SIZE) {
+		FlushAddedFiles(pack);
+	}
 }
 
 static void SyncChangedFile(void *data, const FileCacheInfo info)
@@ -297,6 +961,7 @@ static void SyncChangedFile(void *data, const FileCacheInfo info)
 	int mtime = (int)info->mtime;
 	DirStatusDataPack pack = data;
 	pack->status->synced_files += 1;
+	pack->root->synced_files += 1;
 	LCUI_EncodeString(path, info->path, PATH_LEN, ENCODING_UTF8);
 	DB_UpdateFileTime(pack->dir, path, ctime, mtime);
 }
@@ -305,23 +970,17 @@ static void SyncDeletedFile(void *data, const FileCacheInfo info)
 {
 	char path[PATH_LEN];
 	DirStatusDataPack pack = data;
-	pack->status->synced_files += 1;
+
 	LCUI_EncodeString(path, info->path, PATH_LEN, ENCODING_UTF8);
-	DB_DeleteFile(path);
-	// wprintf(L"sync: delete file: %s\n", wpath);
+	pack->paths[pack->n_files++] = strdup2(path);
+	if (pack->n_files >= SYNC_BATCH_SIZE) {
+		FlushDeletedFiles(pack);
+	}
 }
 
 DB_Dir LCFinder_GetSourceDir(const char *filepath)
 {
-	size_t i;
-	DB_Dir dir;
-	for (i = 0; i < finder.n_dirs; ++i) {
-		dir = finder.dirs[i];
-		if (dir && strstr(filepath, dir->path) == filepath) {
-			return dir;
-		}
-	}
-	return NULL;
+	return DirTrie_Match(finder_index.dirs, filepath, FALSE);
 }
 
 size_t LCFinder_GetSourceDirList(DB_Dir **outdirs)
@@ -366,216 +1025,688 @@ int64_t LCFinder_GetThumbDBTotalSize(void)
 	return sum_size;
 }
 
-static void LCFinder_SwitchTask(FileSyncStatus s);
-static void LCFinder_ScanDir(FileSyncStatus s, const wchar_t *path);
+static ScanFrame LCFinder_ScanDir(ScanTask t, ScanFrame parent,
+				  const wchar_t *path);
 
-static void LCFinder_OnScanFinished(FileSyncStatus s)
+void LCFinder_UpdateSyncStatus(FileSyncStatus s)
 {
 	size_t i;
-	wchar_t *dirpath;
-	DirStatusDataPackRec pack;
-
-	Logger_Debug("[scanner] task %lu finished\n", s->task_i);
-	if (finder.n_dirs > 0) {
-		s->task_i += 1;
-		if (s->task) {
-			s->added_files += s->task->added_files;
-			s->deleted_files += s->task->deleted_files;
-			s->changed_files += s->task->changed_files;
-			SyncTask_Finish(s->task);
+	FileSyncRootStatus root;
+
+	LCUIMutex_Lock(&finder_sync.mutex);
+	s->files = 0;
+	s->dirs = 0;
+	s->scaned_files = 0;
+	s->scaned_dirs = 0;
+	s->cached_dirs = 0;
+	s->added_files = 0;
+	s->changed_files = 0;
+	s->deleted_files = 0;
+	for (i = 0; i < s->n_roots; ++i) {
+		root = &s->roots[i];
+		s->files += root->files;
+		s->dirs += root->dirs;
+		s->scaned_files += root->scaned_files;
+		s->scaned_dirs += root->scaned_dirs;
+		s->cached_dirs += root->cached_dirs;
+		/* 扫描中的任务的计数仍在变化，需从任务中读取 */
+		if (root->state == STATE_STARTED && root->task) {
+			s->added_files += root->task->added_files;
+			s->changed_files += root->task->changed_files;
+			s->deleted_files += root->task->deleted_files;
+		} else {
+			s->added_files += root->added_files;
+			s->changed_files += root->changed_files;
+			s->deleted_files += root->deleted_files;
 		}
-		if (s->task_i < finder.n_dirs) {
-			LCFinder_SwitchTask(s);
-			return;
+	}
+	LCUIMutex_Unlock(&finder_sync.mutex);
+}
+
+/** 获取同步开始后仍然存在的源文件夹，源文件夹已被移除或不可用时返回 NULL */
+static DB_Dir LCFinder_GetSyncRootDir(FileSyncStatus s, size_t i)
+{
+	if (!s->roots[i].task || i >= finder.n_dirs ||
+	    finder.dirs[i] != s->roots[i].dir ||
+	    !AvailableSourceDir(finder.dirs[i])) {
+		return NULL;
+	}
+	return finder.dirs[i];
+}
+
+/**
+ * 判断本次同步是否为首次导入
+ * 只有新增到空文件夹中的文件数量足够多，且比已有文件还多时，推迟建立索引才
+ * 比逐条更新索引更快。
+ */
+static LCUI_BOOL LCFinder_IsFirstImport(FileSyncStatus s)
+{
+	size_t i, count = 0;
+	DB_Dir dir;
+
+	for (i = 0; i < s->n_roots; ++i) {
+		dir = LCFinder_GetSyncRootDir(s, i);
+		if (dir && DB_CountFiles(dir) == 0) {
+			count += s->roots[i].added_files;
 		}
 	}
-	DB_Begin();
+	return count >= FIRST_IMPORT_MIN_FILES &&
+	       count > (size_t)DB_CountFiles(NULL);
+}
+
+/**
+ * 所有源文件夹扫描完后，按源文件夹的顺序将变更写入数据库
+ * 数据库只有一个写连接，所以写入阶段不并发
+ */
+static void LCFinder_OnScanFinished(FileSyncStatus s)
+{
+	size_t i;
+	wchar_t *dirpath;
+	LCUI_BOOL first_import;
+	DirStatusDataPack pack;
+	FileSyncRootStatus root;
+
+	LCFinder_UpdateSyncStatus(s);
+	first_import = LCFinder_IsFirstImport(s);
+	if (first_import) {
+		DB_BeginImport();
+	} else {
+		DB_Begin();
+	}
 	s->state = STATE_SAVING;
-	Logger_Debug("[scanner] start sync, folders count: %lu\n", finder.n_dirs);
-	for (i = 0; i < finder.n_dirs; ++i) {
-		pack.dir = finder.dirs[i];
-		if (!AvailableSourceDir(pack.dir)) {
+	Logger_Debug("[scanner] start sync, folders count: %lu, "
+		     "%lu of %lu dirs unchanged\n", s->n_roots,
+		     s->cached_dirs, s->scaned_dirs);
+	pack = NEW(DirStatusDataPackRec, 1);
+	pack->status = s;
+	pack->start_time = LCUI_GetTime();
+	for (i = 0; i < s->n_roots; ++i) {
+		root = &s->roots[i];
+		pack->root = root;
+		pack->task = finder_sync.tasks ? &finder_sync.tasks[i] : NULL;
+		pack->n_added = 0;
+		pack->dir = LCFinder_GetSyncRootDir(s, i);
+		if (!pack->dir) {
+			if (root->task) {
+				SyncTask_Delete(root->task);
+				root->task = NULL;
+			}
+			root->state = STATE_FINISHED;
 			continue;
 		}
-		pack.status = s;
-		s->task = s->tasks[i];
-		dirpath = DecodeUTF8(pack.dir->path);
+		dirpath = DecodeUTF8(pack->dir->path);
 		Logger_Debug("[scanner] sync files from folder: %ls\n", dirpath);
-		SyncTask_InAddedFiles(s->task, SyncAddedFile, &pack);
-		SyncTask_InDeletedFiles(s->task, SyncDeletedFile, &pack);
-		SyncTask_InChangedFiles(s->task, SyncChangedFile, &pack);
-		SyncTask_Commit(s->task);
-		SyncTask_Delete(s->task);
-		s->task = NULL;
+		SyncTask_InAddedFiles(root->task, SyncAddedFile, pack);
+		FlushAddedFiles(pack);
+		SyncTask_InDeletedFiles(root->task, SyncDeletedFile, pack);
+		FlushDeletedFiles(pack);
+		SyncTask_InChangedFiles(root->task, SyncChangedFile, pack);
+		SyncTask_Commit(root->task);
+		SyncTask_Delete(root->task);
+		root->task = NULL;
+		root->state = STATE_FINISHED;
 		free(dirpath);
 	}
-	DB_Commit();
-	Logger_Debug("[scanner] end sync\n");
+	if (first_import) {
+		DB_EndImport();
+	} else {
+		DB_Commit();
+	}
+	UpdateSyncSpeed(pack);
+	Logger_Debug("[scanner] end sync, %lu files synced in %ldms, "
+		     "%lu files/s\n", s->synced_files,
+		     (long)LCUI_GetTimeDelta(pack->start_time), s->synced_speed);
+	free(pack);
+	for (i = 0; finder_sync.tasks && i < finder_sync.n_tasks; ++i) {
+		free(finder_sync.tasks[i].sizes);
+	}
+	free(finder_sync.tasks);
+	finder_sync.tasks = NULL;
+	if (finder_sync.reader) {
+		ImageHeaderReader_Destroy(finder_sync.reader);
+		finder_sync.reader = NULL;
+	}
+	finder_sync.n_tasks = 0;
 	s->state = STATE_FINISHED;
-	s->task = NULL;
-	s->task_i = 0;
-	free(s->tasks);
-	s->tasks = NULL;
+	FileWatcher_Resume();
 	if (s->callback) {
 		s->callback(s->data);
 	}
 }
 
-static void LCFinder_OnScanFile(FileStatus *status, void *data)
+static void LCFinder_ScanNext(ScanFrame frame);
+
+static void LCFinder_StartScanTask(ScanTask t)
 {
-	unsigned int ctime, mtime;
-	FileSyncDataPack pack = data;
+	wchar_t *path;
+	ScanFrame frame;
 
-	if (!status) {
-		goto finish;
+	SyncTask_Start(t->root->task);
+	path = DecodeUTF8(t->root->dir->path);
+	Logger_Debug("[scanner] task %d started, path: %ls\n", t->slot, path);
+	frame = LCFinder_ScanDir(t, NULL, path);
+	free(path);
+	if (frame) {
+		LCFinder_ScanNext(frame);
 	}
-	ctime = (unsigned int)status->ctime;
-	mtime = (unsigned int)status->mtime;
-	SyncTask_AddFileW(pack->status->task, pack->path, ctime, mtime);
-finish:
-	pack->status->scaned_files += 1;
-	if (pack->status->scaned_dirs == pack->status->dirs &&
-	    pack->status->scaned_files == pack->status->files) {
-		LCFinder_OnScanFinished(pack->status);
+}
+
+/**
+ * 在并发数量的限制内开始等待中的扫描任务
+ * 同一设备上的源文件夹依次扫描，以免机械硬盘在多个目录树之间来回寻道，
+ * 不同设备上的源文件夹则可以同时扫描。
+ */
+static void LCFinder_ScheduleScanTasks(FileSyncStatus s)
+{
+	int slot;
+	size_t i, j, n, count, max_tasks;
+	ScanTask t, tasks[SYNC_MAX_TASKS];
+
+	max_tasks = s->max_tasks > 0 ? s->max_tasks : SYNC_DEFAULT_TASKS;
+	if (max_tasks > SYNC_MAX_TASKS) {
+		max_tasks = SYNC_MAX_TASKS;
 	}
-	free(pack);
+	LCUIMutex_Lock(&finder_sync.mutex);
+	for (n = 0, i = 0; i < finder_sync.n_tasks; ++i) {
+		if (s->running_tasks >= max_tasks) {
+			break;
+		}
+		t = &finder_sync.tasks[i];
+		if (t->root->state != STATE_NONE) {
+			continue;
+		}
+		for (count = 0, j = 0; j < finder_sync.n_tasks; ++j) {
+			if (finder_sync.tasks[j].root->state == STATE_STARTED &&
+			    finder_sync.tasks[j].device == t->device) {
+				count += 1;
+			}
+		}
+		if (count >= SYNC_MAX_TASKS_PER_DEVICE) {
+			continue;
+		}
+		for (slot = 0; slot < SYNC_MAX_TASKS; ++slot) {
+			if (!finder_sync.busy[slot] &&
+			    finder_sync.storages[slot] > 0) {
+				break;
+			}
+		}
+		if (slot >= SYNC_MAX_TASKS) {
+			break;
+		}
+		finder_sync.busy[slot] = TRUE;
+		t->slot = slot;
+		t->storage = finder_sync.storages[slot];
+		t->root->state = STATE_STARTED;
+		s->running_tasks += 1;
+		tasks[n++] = t;
+	}
+	LCUIMutex_Unlock(&finder_sync.mutex);
+	for (i = 0; i < n; ++i) {
+		LCFinder_StartScanTask(tasks[i]);
+	}
+}
+
+static void HeaderBatch_Flush(HeaderBatch batch)
+{
+	size_t i;
+	ScanTask t = batch->task;
+
+	if (finder_sync.reader) {
+		ImageHeaderReader_ReadFiles(finder_sync.reader, batch->headers,
+					    (const char **)batch->paths,
+					    batch->n_files);
+	} else {
+		for (i = 0; i < batch->n_files; ++i) {
+			ImageHeader_ReadFile(&batch->headers[i],
+					     batch->paths[i]);
+		}
+	}
+	for (i = 0; i < batch->n_files; ++i) {
+		if (t->n_sizes < batch->capacity) {
+			t->sizes[t->n_sizes].width = batch->headers[i].width;
+			t->sizes[t->n_sizes].height = batch->headers[i].height;
+			t->n_sizes += 1;
+		}
+		free(batch->paths[i]);
+		batch->paths[i] = NULL;
+	}
+	batch->n_files = 0;
 }
 
-static void LCFinder_ScanFile(FileSyncStatus s, const wchar_t *path)
+static void HeaderBatch_AddFile(void *data, const FileCacheInfo info)
+{
+	char path[PATH_LEN];
+	HeaderBatch batch = data;
+
+	LCUI_EncodeString(path, info->path, PATH_LEN, ENCODING_UTF8);
+	batch->paths[batch->n_files++] = strdup2(path);
+	if (batch->n_files >= SYNC_BATCH_SIZE) {
+		HeaderBatch_Flush(batch);
+	}
+}
+
+/**
+ * 读取源文件夹中新增文件的尺寸
+ * 缩略图列表按图片的宽高比排版，入库时就带上尺寸，首次显示的排版就是准确
+ * 的，不必等到缩略图加载完后再逐个修正。文件头在扫描阶段读取，写入数据库
+ * 时的事务中就只剩下 SQL 语句。
+ */
+static void LCFinder_ReadAddedFileSizes(ScanTask t)
+{
+	HeaderBatch batch;
+	size_t n = t->root->task->added_files;
+
+	if (n < 1) {
+		return;
+	}
+	t->sizes = NEW(ImageSizeRec, n);
+	batch = NEW(HeaderBatchRec, 1);
+	if (!t->sizes || !batch) {
+		free(batch);
+		return;
+	}
+	batch->task = t;
+	batch->capacity = n;
+	SyncTask_InAddedFiles(t->root->task, HeaderBatch_AddFile, batch);
+	HeaderBatch_Flush(batch);
+	free(batch);
+}
+
+/** 一个源文件夹扫描完后让出扫描连接，全部扫描完后开始写入数据库 */
+static void LCFinder_OnScanTaskFinished(ScanTask t)
+{
+	LCUI_BOOL done;
+	FileSyncStatus s = t->status;
+	FileSyncRootStatus root = t->root;
+
+	if (t->walker) {
+		DirWalker_Destroy(t->walker);
+		t->walker = NULL;
+	}
+	SyncTask_Finish(root->task);
+	LCFinder_ReadAddedFileSizes(t);
+	LCUIMutex_Lock(&finder_sync.mutex);
+	root->added_files = root->task->added_files;
+	root->changed_files = root->task->changed_files;
+	root->deleted_files = root->task->deleted_files;
+	root->state = STATE_SAVING;
+	finder_sync.busy[t->slot] = FALSE;
+	finder_sync.finished += 1;
+	s->running_tasks -= 1;
+	done = finder_sync.finished >= finder_sync.n_tasks;
+	LCUIMutex_Unlock(&finder_sync.mutex);
+	Logger_Debug("[scanner] task %d finished, %lu files, %lu dirs\n",
+		     t->slot, root->files, root->dirs);
+	if (done) {
+		LCFinder_OnScanFinished(s);
+	} else {
+		LCFinder_ScheduleScanTasks(s);
+	}
+}
+
+static void ScanFrame_Destroy(ScanFrame frame)
+{
+	size_t i;
+
+	for (i = 0; i < frame->n_entries; ++i) {
+		free(frame->entries[i].name);
+	}
+	free(frame->entries);
+	free(frame);
+}
+
+/** 按目录中的文件顺序提交文件，遇到子目录时先扫描子目录 */
+static void LCFinder_ScanNext(ScanFrame frame)
+{
+	ScanEntry e;
+	ScanFrame parent, child;
+	ScanTask t = frame->task;
+
+	while (frame) {
+		for (child = NULL; frame->cursor < frame->n_entries;
+		     ++frame->cursor) {
+			e = &frame->entries[frame->cursor];
+			wcsncpy(frame->path + frame->path_len, e->name,
+				PATH_LEN - frame->path_len - 1);
+			if (e->is_dir) {
+				frame->cursor += 1;
+				/* 子目录的内容未就绪时，由请求的回调继续扫描 */
+				child = LCFinder_ScanDir(t, frame, frame->path);
+				if (!child) {
+					return;
+				}
+				break;
+			}
+			if (!e->ready) {
+				return;
+			}
+			if (e->exists) {
+				SyncTask_AddFileW(t->root->task, frame->path,
+						  e->ctime, e->mtime);
+			}
+		}
+		if (child) {
+			frame = child;
+			continue;
+		}
+		parent = frame->parent;
+		ScanFrame_Destroy(frame);
+		frame = parent;
+		if (frame) {
+			frame->child = NULL;
+		}
+	}
+	LCFinder_OnScanTaskFinished(t);
+}
+
+static int ScanEntry_Compare(const void *a, const void *b)
+{
+	const ScanEntryRec *e1 = a, *e2 = b;
+	return SyncTask_ComparePath(e1->name, e2->name);
+}
+
+static void ScanFrame_AddEntry(ScanFrame frame, const wchar_t *name,
+			       LCUI_BOOL is_dir)
 {
 	size_t len;
-	FileSyncDataPack pack;
+	ScanEntry e, entries;
 
-	pack = NEW(FileSyncDataPackRec, 1);
-	wcscpy(pack->path, path);
-	len = wcslen(pack->path);
-	if (path[len - 1] == PATH_SEP) {
-		pack->path[len - 1] = 0;
+	if (frame->n_entries >= frame->max_entries) {
+		frame->max_entries = frame->max_entries * 2 + 16;
+		entries = realloc(frame->entries,
+				  sizeof(ScanEntryRec) * frame->max_entries);
+		if (!entries) {
+			return;
+		}
+		frame->entries = entries;
 	}
-	pack->status = s;
-	pack->path_len = len;
-	pack->status->files += 1;
-	FileStorage_GetStatus(finder.storage, pack->path, FALSE,
-			      LCFinder_OnScanFile, pack);
+	len = wcslen(name);
+	e = &frame->entries[frame->n_entries++];
+	e->name = NEW(wchar_t, len + 2);
+	wcsncpy(e->name, name, len + 1);
+	/* 目录名以分隔符结尾，以保证深度优先的遍历顺序与缓存的顺序一致 */
+	if (is_dir) {
+		e->name[len] = PATH_SEP;
+		e->name[len + 1] = 0;
+	}
+	e->is_dir = is_dir;
+	e->ready = is_dir;
+	e->exists = FALSE;
+	e->ctime = 0;
+	e->mtime = 0;
 }
 
-static void LCFinder_OnScanDir(FileStatus *status, FileStream stream,
-			       void *data)
+/** 载入目录列表，列表中已附带文件状态，载入的同时即完成了对其中文件的扫描 */
+static void ScanFrame_Load(ScanFrame frame, FileStatus *status,
+			   FileDirEntry *entries, size_t n_entries)
 {
-	char *p;
-	char buf[PATH_LEN];
-	size_t max_len;
-	wchar_t *name;
-	wchar_t path[PATH_LEN];
-	FileSyncDataPack pack = data;
+	size_t i, n;
+	ScanEntry e;
+	FileSyncRootStatus root = frame->task->root;
+	wchar_t name[PATH_LEN];
 
-	if (!status || !stream) {
+	frame->path[frame->path_len - 1] = PATH_SEP;
+	frame->path[frame->path_len] = 0;
+	if (!status) {
 		goto finish;
 	}
-	path[PATH_LEN - 1] = 0;
-	name = path + pack->path_len;
-	max_len = PATH_LEN - pack->path_len - 1;
-	wcsncpy(path, pack->path, PATH_LEN - 1);
-	if (path[pack->path_len - 1] != PATH_SEP) {
-		path[pack->path_len] = PATH_SEP;
-		path[pack->path_len + 1] = 0;
-		name += 1;
-	}
-	while (1) {
-		p = FileStream_ReadLine(stream, buf, PATH_LEN - 1);
-		if (!p) {
-			break;
+	for (i = 0; i < n_entries; ++i) {
+		LCUI_DecodeString(name, entries[i].name, PATH_LEN - 1,
+				  ENCODING_UTF8);
+		name[PATH_LEN - 1] = 0;
+		if (entries[i].status.type == FILE_TYPE_DIRECTORY) {
+			ScanFrame_AddEntry(frame, name, TRUE);
+			continue;
 		}
-		buf[PATH_LEN - 1] = 0;
-		buf[strlen(buf) - 1] = 0;
-		LCUI_DecodeString(name, buf + 1, max_len, ENCODING_UTF8);
-		if (buf[0] == 'd') {
-			LCFinder_ScanDir(pack->status, path);
+		n = frame->n_entries;
+		ScanFrame_AddEntry(frame, name, FALSE);
+		if (frame->n_entries == n) {
 			continue;
 		}
-		LCFinder_ScanFile(pack->status, path);
+		e = &frame->entries[n];
+		e->ready = TRUE;
+		e->exists = TRUE;
+		e->ctime = (unsigned int)entries[i].status.ctime;
+		e->mtime = (unsigned int)entries[i].status.mtime;
+		root->files += 1;
+		root->scaned_files += 1;
 	}
+	qsort(frame->entries, frame->n_entries, sizeof(ScanEntryRec),
+	      ScanEntry_Compare);
+	frame->cache.mtime = (unsigned int)status->mtime;
+	frame->cache.count = (unsigned int)frame->n_entries;
+	frame->cache.scan_time = (unsigned int)time(NULL);
+	frame->path[frame->path_len - 1] = 0;
+	SyncTask_AddDirW(root->task, frame->path, &frame->cache);
+	frame->path[frame->path_len - 1] = PATH_SEP;
 
 finish:
-	pack->status->scaned_dirs += 1;
-	if (pack->status->scaned_dirs == pack->status->dirs &&
-	    pack->status->scaned_files == pack->status->files) {
-		LCFinder_OnScanFinished(pack->status);
+	root->scaned_dirs += 1;
+}
+
+static void LCFinder_OnScanDir(FileStatus *status, FileDirEntry *entries,
+			       size_t n_entries, void *data)
+{
+	ScanFrame_Load(data, status, entries, n_entries);
+	LCFinder_ScanNext(data);
+}
+
+static void LCFinder_ListDir(ScanFrame frame)
+{
+	if (FileStorage_GetDirEntries(frame->task->storage, frame->path,
+				      LCFinder_OnScanDir, frame) != 0) {
+		LCFinder_OnScanDir(NULL, NULL, 0, frame);
 	}
-	free(pack);
 }
 
-static void LCFinder_ScanDir(FileSyncStatus s, const wchar_t *path)
+static void LCFinder_OnLoadCachedEntry(void *data, const wchar_t *name,
+				       int is_dir, const FileCacheTime time)
 {
-	size_t len;
-	FileSyncDataPack pack;
+	ScanEntry e;
+	ScanFrame frame = data;
+	size_t n = frame->n_entries;
 
-	len = wcslen(path);
-	pack = NEW(FileSyncDataPackRec, 1);
-	wcsncpy(pack->path, path, len);
-	if (path[len - 1] == PATH_SEP) {
-		len -= 1;
+	ScanFrame_AddEntry(frame, name, is_dir);
+	if (is_dir || frame->n_entries == n) {
+		return;
 	}
-	pack->status = s;
-	pack->path[len] = 0;
-	pack->path_len = len;
-	pack->status->dirs += 1;
-	FileStorage_GetFile(finder.storage_for_scan, path, LCFinder_OnScanDir,
-			    pack);
+	e = &frame->entries[n];
+	e->ready = TRUE;
+	e->exists = TRUE;
+	e->ctime = time->ctime;
+	e->mtime = time->mtime;
 }
 
-static void LCFinder_SwitchTask(FileSyncStatus s)
+/** 目录的修改时间未变时，沿用缓存中的目录内容 */
+static void LCFinder_OnStatDir(FileStatus *status, void *data)
 {
-	DB_Dir dir;
-	wchar_t *path;
-	s->task = s->tasks[s->task_i];
-	if (s->task) {
-		SyncTask_Start(s->task);
-		dir = finder.dirs[s->task_i];
-		path = DecodeUTF8(dir->path);
-		Logger_Debug("[scanner] task %lu started, path: %ls\n", s->task_i, path);
-		LCFinder_ScanDir(s, path);
-		free(path);
+	size_t i, count;
+	ScanFrame frame = data;
+	FileSyncRootStatus root = frame->task->root;
+
+	if (!status || (unsigned int)status->mtime != frame->cache.mtime) {
+		LCFinder_ListDir(frame);
+		return;
+	}
+	count = SyncTask_ReadDirW(root->task, frame->path,
+				  LCFinder_OnLoadCachedEntry, frame);
+	if (count != frame->cache.count) {
+		for (i = 0; i < frame->n_entries; ++i) {
+			free(frame->entries[i].name);
+		}
+		frame->n_entries = 0;
+		LCFinder_ListDir(frame);
+		return;
+	}
+	SyncTask_AddDirW(root->task, frame->path, &frame->cache);
+	for (i = 0; i < frame->n_entries; ++i) {
+		if (!frame->entries[i].is_dir) {
+			root->files += 1;
+			root->scaned_files += 1;
+		}
+	}
+	root->cached_dirs += 1;
+	root->scaned_dirs += 1;
+	frame->path[frame->path_len - 1] = PATH_SEP;
+	frame->path[frame->path_len] = 0;
+	LCFinder_ScanNext(frame);
+}
+
+/**
+ * 从并行遍历器中取出目录列表
+ * @returns 成功时返回已载入列表的扫描帧，失败时改为请求文件服务并返回 NULL
+ */
+static ScanFrame LCFinder_WalkDir(ScanFrame frame)
+{
+	char *path;
+	DirWalkerList list;
+
+	path = EncodeUTF8(frame->path);
+	list = DirWalker_GetList(frame->task->walker, path);
+	free(path);
+	if (!list) {
+		LCFinder_ListDir(frame);
+		return NULL;
+	}
+	if (list->ok) {
+		ScanFrame_Load(frame, &list->status, list->entries,
+			       list->n_entries);
 	} else {
-		LCFinder_OnScanFinished(s);
+		ScanFrame_Load(frame, NULL, NULL, 0);
+	}
+	DirWalkerList_Destroy(list);
+	return frame;
+}
+
+/**
+ * 开始扫描目录
+ * @returns 目录内容已就绪时返回扫描帧，否则返回 NULL，由请求的回调继续扫描
+ */
+static ScanFrame LCFinder_ScanDir(ScanTask t, ScanFrame parent,
+				  const wchar_t *path)
+{
+	size_t len;
+	char *root_path;
+	ScanFrame frame;
+	unsigned int now = (unsigned int)time(NULL);
+
+	frame = NEW(ScanFrameRec, 1);
+	wcsncpy(frame->path, path, PATH_LEN - 2);
+	frame->path[PATH_LEN - 2] = 0;
+	len = wcslen(frame->path);
+	if (frame->path[len - 1] == PATH_SEP) {
+		len -= 1;
+	}
+	frame->path[len] = 0;
+	frame->task = t;
+	frame->parent = parent;
+	frame->path_len = len + 1;
+	if (parent) {
+		parent->child = frame;
+	}
+	t->root->dirs += 1;
+	if (t->walker) {
+		return LCFinder_WalkDir(frame);
+	}
+	if (t->status->full_scan ||
+	    SyncTask_GetDirW(t->root->task, frame->path, &frame->cache) != 0) {
+		/*
+		 * 完整扫描或首次扫描该源文件夹时，所有目录都需要列出，
+		 * 改由并行遍历器直接读取文件系统，不支持的平台上仍使用文件服务
+		 */
+		if (!parent) {
+			root_path = EncodeUTF8(frame->path);
+			t->walker = DirWalker_Create(root_path, 0);
+			free(root_path);
+		}
+		if (t->walker) {
+			return LCFinder_WalkDir(frame);
+		}
+		LCFinder_ListDir(frame);
+		return NULL;
 	}
+	if (now - frame->cache.scan_time >= SCAN_VERIFY_INTERVAL) {
+		LCFinder_ListDir(frame);
+		return NULL;
+	}
+	/* 先确认目录的修改时间，未变更时可省去列出目录和获取文件状态 */
+	if (FileStorage_GetStatus(t->storage, frame->path, FALSE,
+				  LCFinder_OnStatDir, frame) != 0) {
+		LCFinder_ListDir(frame);
+	}
+	return NULL;
 }
 
 void LCFinder_SyncFilesAsync(FileSyncStatus s)
 {
 	DB_Dir dir;
+	ScanTask t;
 	size_t i, count;
+	struct stat buf;
 	wchar_t path[PATH_LEN];
 
 	path[PATH_LEN - 1] = 0;
-	s->task_i = 0;
-	s->task = NULL;
-	s->tasks = NULL;
+	LCUIMutex_Lock(&finder_sync.mutex);
+	free(s->roots);
+	s->roots = NULL;
+	s->n_roots = 0;
+	LCUIMutex_Unlock(&finder_sync.mutex);
+	s->running_tasks = 0;
 	s->files = 0;
 	s->dirs = 0;
 	s->added_files = 0;
+	s->changed_files = 0;
 	s->synced_files = 0;
+	s->synced_speed = 0;
 	s->scaned_files = 0;
 	s->scaned_dirs = 0;
+	s->cached_dirs = 0;
 	s->deleted_files = 0;
 	s->state = STATE_STARTED;
+	/* 同步结束前，文件监视器报告的变更都先积累起来 */
+	FileWatcher_Pause();
+	finder_sync.finished = 0;
+	finder_sync.n_tasks = finder.n_dirs;
 	if (finder.n_dirs < 1) {
-		s->tasks = NULL;
 		LCFinder_OnScanFinished(s);
 		return;
 	}
-	s->tasks = NEW(SyncTask, finder.n_dirs);
+	LCUIMutex_Lock(&finder_sync.mutex);
+	s->roots = NEW(FileSyncRootStatusRec, finder.n_dirs);
+	s->n_roots = finder.n_dirs;
+	LCUIMutex_Unlock(&finder_sync.mutex);
+	finder_sync.tasks = NEW(ScanTaskRec, finder.n_dirs);
 	for (count = 0, i = 0; i < finder.n_dirs; ++i) {
 		dir = finder.dirs[i];
+		t = &finder_sync.tasks[i];
+		t->status = s;
+		t->root = &s->roots[i];
+		t->root->dir = dir;
+		t->root->state = STATE_NONE;
 		if (!AvailableSourceDir(dir)) {
+			t->root->state = STATE_FINISHED;
+			finder_sync.finished += 1;
 			continue;
 		}
 		LCUI_DecodeUTF8String(path, dir->path, PATH_LEN - 1);
-		s->tasks[i] = SyncTask_NewW(finder.fileset_dir, path);
+		t->root->task = SyncTask_NewW(finder.fileset_dir, path);
+		if (!t->root->task) {
+			t->root->state = STATE_FINISHED;
+			finder_sync.finished += 1;
+			continue;
+		}
+		if (wgetfilestat(path, &buf) == 0) {
+			t->device = buf.st_dev;
+		}
 		count += 1;
 	}
 	Logger_Debug("[scanner] created %lu tasks\n", count);
-	LCFinder_SwitchTask(s);
+	if (count < 1) {
+		LCFinder_OnScanFinished(s);
+		return;
+	}
+	finder_sync.reader = ImageHeaderReader_Create();
+	LCFinder_ScheduleScanTasks(s);
 }
 
 /** 初始化工作目录 */
@@ -614,24 +1745,12 @@ static int LCFinder_InitWorkDir(void)
 
 DB_Tag LCFinder_GetTagById(int id)
 {
-	size_t i;
-	for (i = 0; i < finder.n_tags; ++i) {
-		if (finder.tags[i]->id == id) {
-			return finder.tags[i];
-		}
-	}
-	return NULL;
+	return Dict_FetchValue(finder_index.tag_ids, &id);
 }
 
 DB_Tag LCFinder_GetTag(const char *tagname)
 {
-	size_t i;
-	for (i = 0; i < finder.n_tags; ++i) {
-		if (strcmp(finder.tags[i]->name, tagname) == 0) {
-			return finder.tags[i];
-		}
-	}
-	return NULL;
+	return Dict_FetchValue(finder_index.tag_names, tagname);
 }
 
 DB_Tag LCFinder_AddTag(const char *tagname)
@@ -650,6 +1769,7 @@ DB_Tag LCFinder_AddTag(const char *tagname)
 	tags[finder.n_tags - 1] = tag;
 	tags[finder.n_tags] = NULL;
 	finder.tags = tags;
+	LCFinder_IndexTag(tag);
 	LCFinder_TriggerEvent(EVENT_TAG_ADD, tag);
 	return tag;
 }
@@ -670,17 +1790,14 @@ DB_Tag LCFinder_AddTagForFile(DB_File file, const char *tagname)
 
 size_t LCFinder_GetFileTags(DB_File file, DB_Tag **outtags)
 {
-	size_t i, j, count, n;
-	DB_Tag *tags, *newtags;
+	size_t i, count, n;
+	DB_Tag tag, *tags, *newtags;
 	n = DBFile_GetTags(file, &tags);
 	newtags = malloc(sizeof(DB_Tag) * (n + 1));
 	for (count = 0, i = 0; i < n; ++i) {
-		for (j = 0; j < finder.n_tags; ++j) {
-			if (tags[i]->id == finder.tags[j]->id) {
-				newtags[count] = finder.tags[j];
-				++count;
-				break;
-			}
+		tag = LCFinder_GetTagById(tags[i]->id);
+		if (tag) {
+			newtags[count++] = tag;
 		}
 		free(tags[i]);
 	}
@@ -697,6 +1814,7 @@ void LCFinder_ReloadTags(void)
 	}
 	free(finder.tags);
 	finder.n_tags = DB_GetTags(&finder.tags);
+	LCFinder_RebuildTagIndex();
 }
 
 /** 初始化文件数据库 */
@@ -708,8 +1826,13 @@ static int LCFinder_InitFileDB(void)
 	Logger_Debug("[filedb] path: %ls\n", wpath);
 	path = EncodeUTF8(wpath);
 	ASSERT(DB_Init(path) == 0);
+	/* 切换排序方式和筛选条件时不必再访问数据库 */
+	DB_SetFileColumnsEnabled(TRUE);
+	QueryService_Init();
 	finder.n_dirs = DB_GetDirs(&finder.dirs);
 	finder.n_tags = DB_GetTags(&finder.tags);
+	LCFinder_RebuildDirIndex();
+	LCFinder_RebuildTagIndex();
 	free(path);
 	return 0;
 
@@ -721,6 +1844,7 @@ error:
 static void LCFinder_FreeFileDB(void)
 {
 	size_t i;
+	LCFinder_FreeIndex();
 	for (i = 0; i < finder.n_dirs; ++i) {
 		if (finder.dirs[i]) {
 			DBDir_Release(finder.dirs[i]);
@@ -731,6 +1855,7 @@ static void LCFinder_FreeFileDB(void)
 		DBTag_Release(finder.tags[i]);
 		finder.tags[i] = NULL;
 	}
+	QueryService_Exit();
 	DB_Exit();
 }
 
@@ -885,6 +2010,8 @@ void LCFinder_ClearThumbDB(void)
 
 static int LCFinder_InitFileStorage(void)
 {
+	int i;
+
 	FileStorage_Init();
 	finder.storage = FileStorage_Connect();
 	finder.storage_for_image = FileStorage_Connect();
@@ -894,18 +2021,61 @@ static int LCFinder_InitFileStorage(void)
 	ASSERT(finder.storage_for_image > 0);
 	ASSERT(finder.storage_for_thumb > 0);
 	ASSERT(finder.storage_for_scan > 0);
+	/* 查看器中的图片最先处理，其次是界面上可见的缩略图和文件信息 */
+	FileStorage_SetPriority(finder.storage, FILE_PRIORITY_THUMB);
+	FileStorage_SetPriority(finder.storage_for_image, FILE_PRIORITY_IMAGE);
+	FileStorage_SetPriority(finder.storage_for_thumb, FILE_PRIORITY_THUMB);
+	FileStorage_SetPriority(finder.storage_for_scan, FILE_PRIORITY_SCAN);
+	/* 预加载只是锦上添花，连接失败时不预加载缩略图 */
+	finder.storage_for_prefetch = FileStorage_Connect();
+	FileStorage_SetPriority(finder.storage_for_prefetch,
+				FILE_PRIORITY_PREFETCH);
+	LCUIMutex_Init(&finder_sync.mutex);
+	/* 其余的扫描连接供并发扫描的源文件夹使用，连接失败时只是减少并发数 */
+	finder_sync.storages[0] = finder.storage_for_scan;
+	for (i = 1; i < SYNC_MAX_TASKS; ++i) {
+		finder_sync.storages[i] = FileStorage_Connect();
+		FileStorage_SetPriority(finder_sync.storages[i],
+					FILE_PRIORITY_SCAN);
+	}
 	return 0;
 
 error:
 	return -1;
 }
 
+/** 启动文件监视器，当前平台不支持时只能通过手动同步更新文件列表 */
+static void LCFinder_InitFileWatcher(void)
+{
+	size_t i;
+
+	if (FileWatcher_Init(LCFinder_OnWatcherEvents, NULL) != 0) {
+		Logger_Debug("[watcher] file watcher is unavailable\n");
+		return;
+	}
+	for (i = 0; i < finder.n_dirs; ++i) {
+		if (finder.dirs[i]) {
+			FileWatcher_AddDir(finder.dirs[i]->path);
+		}
+	}
+}
+
 static void LCFinder_FreeFileStorage(void)
 {
+	int i;
+
 	FileStorage_Close(finder.storage);
 	FileStorage_Close(finder.storage_for_image);
 	FileStorage_Close(finder.storage_for_thumb);
 	FileStorage_Close(finder.storage_for_scan);
+	if (finder.storage_for_prefetch > 0) {
+		FileStorage_Close(finder.storage_for_prefetch);
+	}
+	for (i = 1; i < SYNC_MAX_TASKS; ++i) {
+		if (finder_sync.storages[i] > 0) {
+			FileStorage_Close(finder_sync.storages[i]);
+		}
+	}
 	FileStorage_Free();
 }
 
@@ -1051,6 +2221,7 @@ int LCFinder_Init(int argc, char **argv)
 	ASSERT(LCFinder_InitThumbCache() == 0);
 	ASSERT(LCFinder_InitFileStorage() == 0);
 	ASSERT(UI_Init(argc, argv) == 0);
+	LCFinder_InitFileWatcher();
 	finder.state = FINDER_STATE_ACTIVATED;
 	return 0;
 
@@ -1061,6 +2232,7 @@ error:
 
 void LCFinder_Exit(void)
 {
+	FileWatcher_Exit();
 	UI_Free();
 	LCFinder_FreeThumbDB();
 	LCFinder_FreeFileStorage();
@@ -0,0 +1,771 @@
+﻿/* ***************************************************************************
+ * bitmap.c -- compressed bitmap
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * bitmap.c -- 压缩位图
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/**
+ * 压缩位图
+ * 参考 Roaring Bitmap 的结构，将 32 位的值按高 16 位分组存放到容器中，每个容器
+ * 根据值的数量选择使用有序数组或者位图存放低 16 位。集合运算按容器进行，位图
+ * 容器之间的运算只是逐个字的位运算，编译器能够将这些循环向量化。
+ */
+
+#define LCFINDER_BITMAP_C
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap.h"
+
+/** 数组容器的最大长度，超过后转换为位图容器 */
+#define ARRAY_MAX_SIZE 4096
+
+/** 位图容器中的字的数量 */
+#define BITSET_WORDS 1024
+
+/** 两个数组的长度相差超过这个倍数时，求交集改用二分查找 */
+#define GALLOP_RATIO 32
+
+enum BitmapOperation { OP_AND, OP_OR, OP_ANDNOT };
+
+typedef struct ContainerRec_ {
+	uint16_t key;         /**< 值的高 16 位 */
+	uint32_t cardinality; /**< 值的数量 */
+	uint16_t *array;      /**< 有序数组，为 NULL 时使用位图 */
+	uint32_t capacity;    /**< 数组的容量 */
+	uint64_t *words;      /**< 位图 */
+} ContainerRec, *Container;
+
+typedef struct BitmapRec_ {
+	Container containers; /**< 容器列表，按 key 升序排列 */
+	size_t length;
+	size_t capacity;
+} BitmapRec;
+
+static unsigned PopCount(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned)__builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (unsigned)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static unsigned CountTrailingZeros(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned)__builtin_ctzll(x);
+#else
+	return PopCount((x & (~x + 1)) - 1);
+#endif
+}
+
+/**
+ * 在有序数组中查找值
+ * @returns 找到时返回值的下标，否则返回 -(插入位置 + 1)
+ */
+static long Array_Search(const uint16_t *array, uint32_t n, uint16_t value)
+{
+	long low = 0, high = (long)n - 1, mid;
+
+	while (low <= high) {
+		mid = (low + high) >> 1;
+		if (array[mid] < value) {
+			low = mid + 1;
+		} else if (array[mid] > value) {
+			high = mid - 1;
+		} else {
+			return mid;
+		}
+	}
+	return -(low + 1);
+}
+
+static int Words_Contains(const uint64_t *words, uint16_t value)
+{
+	return (words[value >> 6] >> (value & 63)) & 1;
+}
+
+static uint32_t Words_GetCardinality(const uint64_t *words)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < BITSET_WORDS; ++i) {
+		n += PopCount(words[i]);
+	}
+	return n;
+}
+
+static void Container_Destroy(Container c)
+{
+	free(c->array);
+	free(c->words);
+	c->array = NULL;
+	c->words = NULL;
+	c->capacity = 0;
+	c->cardinality = 0;
+}
+
+static int Container_Copy(Container dst, const ContainerRec *src)
+{
+	*dst = *src;
+	if (src->words) {
+		dst->words = malloc(sizeof(uint64_t) * BITSET_WORDS);
+		if (!dst->words) {
+			return -1;
+		}
+		memcpy(dst->words, src->words, sizeof(uint64_t) * BITSET_WORDS);
+		return 0;
+	}
+	dst->capacity = src->cardinality;
+	dst->array = malloc(sizeof(uint16_t) * (src->cardinality + 1));
+	if (!dst->array) {
+		return -1;
+	}
+	memcpy(dst->array, src->array, sizeof(uint16_t) * src->cardinality);
+	return 0;
+}
+
+static int Container_ToBitset(Container c)
+{
+	uint32_t i;
+	uint64_t *words;
+
+	words = calloc(BITSET_WORDS, sizeof(uint64_t));
+	if (!words) {
+		return -1;
+	}
+	for (i = 0; i < c->cardinality; ++i) {
+		words[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63);
+	}
+	free(c->array);
+	c->array = NULL;
+	c->capacity = 0;
+	c->words = words;
+	return 0;
+}
+
+static int Container_ToArray(Container c)
+{
+	uint16_t *array;
+	uint32_t i, n = 0;
+	uint64_t word;
+
+	array = malloc(sizeof(uint16_t) * (c->cardinality + 1));
+	if (!array) {
+		return -1;
+	}
+	for (i = 0; i < BITSET_WORDS; ++i) {
+		for (word = c->words[i]; word; word &= word - 1) {
+			array[n++] = (uint16_t)(i * 64 + CountTrailingZeros(word));
+		}
+	}
+	free(c->words);
+	c->words = NULL;
+	c->array = array;
+	c->capacity = c->cardinality;
+	return 0;
+}
+
+/** 根据值的数量选择合适的容器类型 */
+static void Container_Optimize(Container c)
+{
+	if (c->words && c->cardinality <= ARRAY_MAX_SIZE) {
+		Container_ToArray(c);
+	} else if (c->array && c->cardinality > ARRAY_MAX_SIZE) {
+		Container_ToBitset(c);
+	}
+}
+
+static int Container_Contains(const ContainerRec *c, uint16_t value)
+{
+	if (c->words) {
+		return Words_Contains(c->words, value);
+	}
+	return Array_Search(c->array, c->cardinality, value) >= 0;
+}
+
+static int Container_Add(Container c, uint16_t value)
+{
+	long i;
+	uint16_t *array;
+
+	if (c->words) {
+		if (Words_Contains(c->words, value)) {
+			return 0;
+		}
+		c->words[value >> 6] |= 1ULL << (value & 63);
+		c->cardinality += 1;
+		return 1;
+	}
+	i = Array_Search(c->array, c->cardinality, value);
+	if (i >= 0) {
+		return 0;
+	}
+	if (c->cardinality >= ARRAY_MAX_SIZE) {
+		if (Container_ToBitset(c) != 0) {
+			return 0;
+		}
+		return Container_Add(c, value);
+	}
+	if (c->cardinality >= c->capacity) {
+		c->capacity = c->capacity < 4 ? 4 : c->capacity * 2;
+		array = realloc(c->array, sizeof(uint16_t) * c->capacity);
+		if (!array) {
+			return 0;
+		}
+		c->array = array;
+	}
+	i = -i - 1;
+	memmove(c->array + i + 1, c->array + i,
+		sizeof(uint16_t) * (c->cardinality - i));
+	c->array[i] = value;
+	c->cardinality += 1;
+	return 1;
+}
+
+static int Container_Remove(Container c, uint16_t value)
+{
+	long i;
+
+	if (c->words) {
+		if (!Words_Contains(c->words, value)) {
+			return 0;
+		}
+		c->words[value >> 6] &= ~(1ULL << (value & 63));
+		c->cardinality -= 1;
+		Container_Optimize(c);
+		return 1;
+	}
+	i = Array_Search(c->array, c->cardinality, value);
+	if (i < 0) {
+		return 0;
+	}
+	memmove(c->array + i, c->array + i + 1,
+		sizeof(uint16_t) * (c->cardinality - i - 1));
+	c->cardinality -= 1;
+	return 1;
+}
+
+/** 查找容器中大于等于 value 的最小值 */
+static int Container_Next(const ContainerRec *c, uint32_t value,
+			  uint16_t *next)
+{
+	long i;
+	uint32_t w;
+	uint64_t word;
+
+	if (c->array) {
+		i = Array_Search(c->array, c->cardinality, (uint16_t)value);
+		if (i < 0) {
+			i = -i - 1;
+		}
+		if ((uint32_t)i >= c->cardinality) {
+			return 0;
+		}
+		*next = c->array[i];
+		return 1;
+	}
+	w = value >> 6;
+	word = c->words[w] & (~0ULL << (value & 63));
+	while (!word) {
+		if (++w >= BITSET_WORDS) {
+			return 0;
+		}
+		word = c->words[w];
+	}
+	*next = (uint16_t)(w * 64 + CountTrailingZeros(word));
+	return 1;
+}
+
+/** 两个有序数组求交集，结果写入 out，out 可以是 a */
+static uint32_t Array_And(const uint16_t *a, uint32_t na, const uint16_t *b,
+			  uint32_t nb, uint16_t *out)
+{
+	long k;
+	uint32_t i = 0, j = 0, n = 0;
+
+	/* 长度相差较大时，在长数组中二分查找短数组的值会更快 */
+	if (na * GALLOP_RATIO < nb) {
+		for (i = 0; i < na; ++i) {
+			k = Array_Search(b + j, nb - j, a[i]);
+			if (k >= 0) {
+				out[n++] = a[i];
+				j += (uint32_t)k + 1;
+			} else {
+				j += (uint32_t)(-k - 1);
+			}
+			if (j >= nb) {
+				break;
+			}
+		}
+		return n;
+	}
+	while (i < na && j < nb) {
+		if (a[i] < b[j]) {
+			++i;
+		} else if (a[i] > b[j]) {
+			++j;
+		} else {
+			out[n++] = a[i];
+			++i;
+			++j;
+		}
+	}
+	return n;
+}
+
+/** 两个有序数组求差集，结果写入 out，out 可以是 a */
+static uint32_t Array_AndNot(const uint16_t *a, uint32_t na, const uint16_t *b,
+			     uint32_t nb, uint16_t *out)
+{
+	uint32_t i = 0, j = 0, n = 0;
+
+	while (i < na) {
+		if (j >= nb || a[i] < b[j]) {
+			out[n++] = a[i++];
+		} else if (a[i] > b[j]) {
+			++j;
+		} else {
+			++i;
+			++j;
+		}
+	}
+	return n;
+}
+
+/** 两个有序数组求并集 */
+static uint32_t Array_Or(const uint16_t *a, uint32_t na, const uint16_t *b,
+			 uint32_t nb, uint16_t *out)
+{
+	uint32_t i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j]) {
+			out[n++] = a[i++];
+		} else if (a[i] > b[j]) {
+			out[n++] = b[j++];
+		} else {
+			out[n++] = a[i];
+			++i;
+			++j;
+		}
+	}
+	while (i < na) {
+		out[n++] = a[i++];
+	}
+	while (j < nb) {
+		out[n++] = b[j++];
+	}
+	return n;
+}
+
+static void Container_OpArrays(Container a, const ContainerRec *b, int op)
+{
+	uint16_t *array;
+
+	switch (op) {
+	case OP_AND:
+		a->cardinality = Array_And(a->array, a->cardinality, b->array,
+					   b->cardinality, a->array);
+		break;
+	case OP_ANDNOT:
+		a->cardinality = Array_AndNot(a->array, a->cardinality,
+					      b->array, b->cardinality,
+					      a->array);
+		break;
+	default:
+		array = malloc(sizeof(uint16_t) *
+			       (a->cardinality + b->cardinality + 1));
+		if (!array) {
+			return;
+		}
+		a->cardinality = Array_Or(a->array, a->cardinality, b->array,
+					  b->cardinality, array);
+		free(a->array);
+		a->array = array;
+		a->capacity = a->cardinality;
+		Container_Optimize(a);
+		break;
+	}
+}
+
+static void Container_OpWords(Container a, const uint64_t *words, int op)
+{
+	uint32_t i;
+	uint64_t *w = a->words;
+
+	switch (op) {
+	case OP_AND:
+		for (i = 0; i < BITSET_WORDS; ++i) {
+			w[i] &= words[i];
+		}
+		break;
+	case OP_ANDNOT:
+		for (i = 0; i < BITSET_WORDS; ++i) {
+			w[i] &= ~words[i];
+		}
+		break;
+	default:
+		for (i = 0; i < BITSET_WORDS; ++i) {
+			w[i] |= words[i];
+		}
+		break;
+	}
+	a->cardinality = Words_GetCardinality(w);
+	Container_Optimize(a);
+}
+
+/** 对两个容器进行集合运算，结果保存在 a 中 */
+static void Container_Op(Container a, const ContainerRec *b, int op)
+{
+	uint32_t i, n = 0;
+
+	if (a->array && b->array) {
+		Container_OpArrays(a, b, op);
+		return;
+	}
+	if (a->words && b->words) {
+		Container_OpWords(a, b->words, op);
+		return;
+	}
+	if (a->array) {
+		if (op == OP_OR) {
+			if (Container_ToBitset(a) == 0) {
+				Container_OpWords(a, b->words, op);
+			}
+			return;
+		}
+		/* 数组与位图求交集或差集时，只需逐个检查数组中的值 */
+		for (i = 0; i < a->cardinality; ++i) {
+			if (Words_Contains(b->words, a->array[i]) ==
+			    (op == OP_AND)) {
+				a->array[n++] = a->array[i];
+			}
+		}
+		a->cardinality = n;
+		return;
+	}
+	if (op == OP_AND) {
+		uint16_t *array;
+
+		array = malloc(sizeof(uint16_t) * (b->cardinality + 1));
+		if (!array) {
+			return;
+		}
+		for (i = 0; i < b->cardinality; ++i) {
+			if (Words_Contains(a->words, b->array[i])) {
+				array[n++] = b->array[i];
+			}
+		}
+		free(a->words);
+		a->words = NULL;
+		a->array = array;
+		a->capacity = b->cardinality;
+		a->cardinality = n;
+		return;
+	}
+	for (i = 0; i < b->cardinality; ++i) {
+		if (op == OP_OR) {
+			a->words[b->array[i] >> 6] |= 1ULL << (b->array[i] & 63);
+		} else {
+			a->words[b->array[i] >> 6] &=
+			    ~(1ULL << (b->array[i] & 63));
+		}
+	}
+	a->cardinality = Words_GetCardinality(a->words);
+	Container_Optimize(a);
+}
+
+/**
+ * 查找容器
+ * @returns 找到时返回容器的下标，否则返回 -(插入位置 + 1)
+ */
+static long Bitmap_FindContainer(Bitmap bitmap, uint16_t key)
+{
+	long low = 0, high = (long)bitmap->length - 1, mid;
+
+	while (low <= high) {
+		mid = (low + high) >> 1;
+		if (bitmap->containers[mid].key < key) {
+			low = mid + 1;
+		} else if (bitmap->containers[mid].key > key) {
+			high = mid - 1;
+		} else {
+			return mid;
+		}
+	}
+	return -(low + 1);
+}
+
+static int Bitmap_Reserve(Bitmap bitmap, size_t capacity)
+{
+	Container containers;
+
+	if (capacity <= bitmap->capacity) {
+		return 0;
+	}
+	if (capacity < bitmap->capacity * 2) {
+		capacity = bitmap->capacity * 2;
+	}
+	containers =
+	    realloc(bitmap->containers, sizeof(ContainerRec) * capacity);
+	if (!containers) {
+		return -1;
+	}
+	bitmap->containers = containers;
+	bitmap->capacity = capacity;
+	return 0;
+}
+
+Bitmap Bitmap_Create(void)
+{
+	Bitmap bitmap;
+
+	bitmap = malloc(sizeof(BitmapRec));
+	if (!bitmap) {
+		return NULL;
+	}
+	bitmap->containers = NULL;
+	bitmap->length = 0;
+	bitmap->capacity = 0;
+	return bitmap;
+}
+
+void Bitmap_Clear(Bitmap bitmap)
+{
+	size_t i;
+
+	for (i = 0; i < bitmap->length; ++i) {
+		Container_Destroy(&bitmap->containers[i]);
+	}
+	bitmap->length = 0;
+}
+
+void Bitmap_Destroy(Bitmap bitmap)
+{
+	Bitmap_Clear(bitmap);
+	free(bitmap->containers);
+	free(bitmap);
+}
+
+Bitmap Bitmap_Copy(Bitmap bitmap)
+{
+	size_t i;
+	Bitmap copy = Bitmap_Create();
+
+	if (!copy || Bitmap_Reserve(copy, bitmap->length) != 0) {
+		return copy;
+	}
+	for (i = 0; i < bitmap->length; ++i) {
+		if (Container_Copy(&copy->containers[copy->length],
+				   &bitmap->containers[i]) == 0) {
+			copy->length += 1;
+		}
+	}
+	return copy;
+}
+
+int Bitmap_Add(Bitmap bitmap, uint32_t value)
+{
+	long i;
+	Container c;
+	uint16_t key = (uint16_t)(value >> 16);
+
+	i = Bitmap_FindContainer(bitmap, key);
+	if (i < 0) {
+		if (Bitmap_Reserve(bitmap, bitmap->length + 1) != 0) {
+			return 0;
+		}
+		i = -i - 1;
+		memmove(bitmap->containers + i + 1, bitmap->containers + i,
+			sizeof(ContainerRec) * (bitmap->length - i));
+		bitmap->length += 1;
+		c = &bitmap->containers[i];
+		memset(c, 0, sizeof(ContainerRec));
+		c->key = key;
+	}
+	return Container_Add(&bitmap->containers[i], (uint16_t)value);
+}
+
+int Bitmap_Remove(Bitmap bitmap, uint32_t value)
+{
+	long i;
+	Container c;
+
+	i = Bitmap_FindContainer(bitmap, (uint16_t)(value >> 16));
+	if (i < 0) {
+		return 0;
+	}
+	c = &bitmap->containers[i];
+	if (!Container_Remove(c, (uint16_t)value)) {
+		return 0;
+	}
+	if (c->cardinality == 0) {
+		Container_Destroy(c);
+		bitmap->length -= 1;
+		memmove(bitmap->containers + i, bitmap->containers + i + 1,
+			sizeof(ContainerRec) * (bitmap->length - i));
+	}
+	return 1;
+}
+
+int Bitmap_Contains(Bitmap bitmap, uint32_t value)
+{
+	long i;
+
+	i = Bitmap_FindContainer(bitmap, (uint16_t)(value >> 16));
+	if (i < 0) {
+		return 0;
+	}
+	return Container_Contains(&bitmap->containers[i], (uint16_t)value);
+}
+
+size_t Bitmap_GetCardinality(Bitmap bitmap)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < bitmap->length; ++i) {
+		n += bitmap->containers[i].cardinality;
+	}
+	return n;
+}
+
+int Bitmap_Next(Bitmap bitmap, uint32_t value, uint32_t *next)
+{
+	long i;
+	uint16_t low;
+	uint32_t start = value & 0xffff;
+
+	i = Bitmap_FindContainer(bitmap, (uint16_t)(value >> 16));
+	if (i < 0) {
+		i = -i - 1;
+		start = 0;
+	}
+	for (; (size_t)i < bitmap->length; ++i, start = 0) {
+		if (Container_Next(&bitmap->containers[i], start, &low)) {
+			*next = ((uint32_t)bitmap->containers[i].key << 16) | low;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** 移除空的容器 */
+static void Bitmap_Compact(Bitmap bitmap)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < bitmap->length; ++i) {
+		if (bitmap->containers[i].cardinality > 0) {
+			bitmap->containers[n++] = bitmap->containers[i];
+		} else {
+			Container_Destroy(&bitmap->containers[i]);
+		}
+	}
+	bitmap->length = n;
+}
+
+void Bitmap_And(Bitmap dst, Bitmap src)
+{
+	size_t i, j = 0;
+	Container a, b;
+
+	for (i = 0; i < dst->length; ++i) {
+		a = &dst->containers[i];
+		while (j < src->length && src->containers[j].key < a->key) {
+			++j;
+		}
+		b = j < src->length ? &src->containers[j] : NULL;
+		if (b && b->key == a->key) {
+			Container_Op(a, b, OP_AND);
+		} else {
+			Container_Destroy(a);
+		}
+	}
+	Bitmap_Compact(dst);
+}
+
+void Bitmap_AndNot(Bitmap dst, Bitmap src)
+{
+	size_t i, j = 0;
+	Container a;
+
+	for (i = 0; i < dst->length; ++i) {
+		a = &dst->containers[i];
+		while (j < src->length && src->containers[j].key < a->key) {
+			++j;
+		}
+		if (j < src->length && src->containers[j].key == a->key) {
+			Container_Op(a, &src->containers[j], OP_ANDNOT);
+		}
+	}
+	Bitmap_Compact(dst);
+}
+
+void Bitmap_Or(Bitmap dst, Bitmap src)
+{
+	size_t i = 0, j = 0, n = 0;
+	size_t capacity = dst->length + src->length + 1;
+	Container containers;
+
+	containers = malloc(sizeof(ContainerRec) * capacity);
+	if (!containers) {
+		return;
+	}
+	while (i < dst->length || j < src->length) {
+		if (j >= src->length ||
+		    (i < dst->length &&
+		     dst->containers[i].key < src->containers[j].key)) {
+			containers[n++] = dst->containers[i++];
+		} else if (i >= dst->length ||
+			   dst->containers[i].key > src->containers[j].key) {
+			if (Container_Copy(&containers[n],
+					   &src->containers[j]) == 0) {
+				++n;
+			}
+			++j;
+		} else {
+			Container_Op(&dst->containers[i], &src->containers[j],
+				     OP_OR);
+			containers[n++] = dst->containers[i++];
+			++j;
+		}
+	}
+	free(dst->containers);
+	dst->containers = containers;
+	dst->length = n;
+	dst->capacity = capacity;
+}
@@ -661,7 +661,7 @@ int Detector_RunTask(DetectorTask task)
 			}
 			LinkedList_Append(&files, file);
 		}
-		terms.offset += terms.limit;
+		DBQuery_GetCursor(query, &terms.cursor);
 		DB_DeleteQuery(query);
 		if (i < terms.limit) {
 			break;
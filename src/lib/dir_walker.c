@@ -0,0 +1,663 @@
+﻿/* ***************************************************************************
+ * dir_walker.c -- parallel directory walker
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * dir_walker.c -- 并行目录遍历器
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+
+/**
+ * 并行目录遍历器
+ * 每个工作线程从自己队列的尾部取出目录，列出后把子目录放回队列尾部，因此大致
+ * 按深度优先的顺序遍历；队列空了就从其它线程队列的头部窃取，头部的目录层级较
+ * 浅，一次窃取通常能分到较大的一棵子树。子目录优先通过 openat() 相对于父目录
+ * 打开，为此父目录的文件描述符会保留到所有子目录都打开之后，保留数量有上限。
+ * 每读取一批目录项，就把需要获取状态的文件交给 I/O 引擎一次性处理。
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <LCUI_Build.h>
+#include <LCUI/LCUI.h>
+#include <LCUI/thread.h>
+#include <LCUI/util/charset.h>
+#include "build.h"
+#include "common.h"
+#include "dir_walker.h"
+#include "io_engine.h"
+
+#ifdef PLATFORM_LINUX
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/** 工作线程数量上限 */
+#define DIR_WALKER_MAX_THREADS 16
+
+/** 为打开子目录而保留的父目录文件描述符数量上限 */
+#define DIR_WALKER_MAX_FDS 64
+
+/** 已列出但未被取走的目录数量上限，超过时工作线程暂停，以限制内存占用 */
+#define DIR_WALKER_MAX_PENDING 4096
+
+/** 读取目录项的缓冲区大小 */
+#define DIR_WALKER_BUFFER_SIZE (32 * 1024)
+
+/** 一批目录项的最大数量 */
+#define DIR_WALKER_BATCH_SIZE \
+	(DIR_WALKER_BUFFER_SIZE / sizeof(struct linux_dirent64))
+
+enum DirWalkerJobState {
+	JOB_QUEUED,	/**< 在队列中等待 */
+	JOB_LISTING,	/**< 正在列出 */
+	JOB_DONE	/**< 已列出，等待取走 */
+};
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/** 保留的目录文件描述符，引用计数为尚未打开的子目录数量 */
+typedef struct DirWalkerFdRec_ {
+	int fd;
+	size_t refs;
+} DirWalkerFdRec, *DirWalkerFd;
+
+/** 待列出的目录，由目录表和所在的队列共同引用 */
+typedef struct DirWalkerJobRec_ {
+	int state;
+	int refs;
+	char *path;
+	size_t name_offset;	/**< 目录名在路径中的位置 */
+	DirWalkerFd parent;	/**< 父目录的文件描述符，没有保留时为 NULL */
+	DirWalkerList list;
+} DirWalkerJobRec, *DirWalkerJob;
+
+/** 双端队列，所属线程操作尾部，其它线程从头部窃取 */
+typedef struct DirWalkerDequeRec_ {
+	LCUI_Mutex mutex;
+	DirWalkerJob *jobs;
+	size_t head;
+	size_t length;
+	size_t capacity;
+} DirWalkerDequeRec, *DirWalkerDeque;
+
+typedef struct DirWalkerThreadRec_ {
+	size_t index;
+	LCUI_Thread tid;
+	IOEngine io;
+	DirWalker walker;
+	DirWalkerDequeRec deque;
+} DirWalkerThreadRec, *DirWalkerThread;
+
+typedef struct DirWalkerRec_ {
+	LCUI_BOOL quit;
+	LCUI_Mutex mutex;	/**< 保护目录表、任务状态和以下计数 */
+	LCUI_Cond cond;
+	Dict *jobs;		/**< 以路径为索引的目录表 */
+	size_t queued;		/**< 各个队列中的任务总数 */
+	size_t busy;		/**< 正在列出目录的线程数量 */
+	size_t pending;		/**< 已列出但未取走的目录数量 */
+	size_t open_fds;	/**< 保留的文件描述符数量 */
+	size_t n_threads;
+	DirWalkerThreadRec *threads;
+	IOEngine io;		/**< 供调用者自行列出目录时使用 */
+} DirWalkerRec;
+
+static void DirWalkerDeque_Init(DirWalkerDeque deque)
+{
+	deque->head = 0;
+	deque->length = 0;
+	deque->capacity = 0;
+	deque->jobs = NULL;
+	LCUIMutex_Init(&deque->mutex);
+}
+
+static void DirWalkerDeque_Push(DirWalkerDeque deque, DirWalkerJob job)
+{
+	size_t i, capacity;
+	DirWalkerJob *jobs;
+
+	LCUIMutex_Lock(&deque->mutex);
+	if (deque->length >= deque->capacity) {
+		capacity = deque->capacity * 2 + 64;
+		jobs = malloc(sizeof(DirWalkerJob) * capacity);
+		for (i = 0; i < deque->length; ++i) {
+			jobs[i] = deque->jobs[(deque->head + i) %
+					      deque->capacity];
+		}
+		free(deque->jobs);
+		deque->jobs = jobs;
+		deque->head = 0;
+		deque->capacity = capacity;
+	}
+	i = (deque->head + deque->length) % deque->capacity;
+	deque->jobs[i] = job;
+	deque->length += 1;
+	LCUIMutex_Unlock(&deque->mutex);
+}
+
+static DirWalkerJob DirWalkerDeque_PopBack(DirWalkerDeque deque)
+{
+	DirWalkerJob job = NULL;
+
+	LCUIMutex_Lock(&deque->mutex);
+	if (deque->length > 0) {
+		deque->length -= 1;
+		job = deque->jobs[(deque->head + deque->length) %
+				  deque->capacity];
+	}
+	LCUIMutex_Unlock(&deque->mutex);
+	return job;
+}
+
+static DirWalkerJob DirWalkerDeque_PopFront(DirWalkerDeque deque)
+{
+	DirWalkerJob job = NULL;
+
+	LCUIMutex_Lock(&deque->mutex);
+	if (deque->length > 0) {
+		job = deque->jobs[deque->head];
+		deque->head = (deque->head + 1) % deque->capacity;
+		deque->length -= 1;
+	}
+	LCUIMutex_Unlock(&deque->mutex);
+	return job;
+}
+
+static void DirWalkerDeque_Destroy(DirWalkerDeque deque)
+{
+	free(deque->jobs);
+	deque->jobs = NULL;
+	deque->length = 0;
+	LCUIMutex_Destroy(&deque->mutex);
+}
+
+void DirWalkerList_Destroy(DirWalkerList list)
+{
+	free(list->entries);
+	free(list->names);
+	free(list);
+}
+
+/** 释放文件描述符的一个引用，需在持有遍历器的锁时调用 */
+static void DirWalker_ReleaseFd(DirWalker walker, DirWalkerFd dirfd)
+{
+	dirfd->refs -= 1;
+	if (dirfd->refs < 1) {
+		close(dirfd->fd);
+		free(dirfd);
+		walker->open_fds -= 1;
+	}
+}
+
+/** 释放任务的一个引用，需在持有遍历器的锁时调用 */
+static void DirWalker_ReleaseJob(DirWalker walker, DirWalkerJob job)
+{
+	job->refs -= 1;
+	if (job->refs > 0) {
+		return;
+	}
+	if (job->parent) {
+		DirWalker_ReleaseFd(walker, job->parent);
+	}
+	if (job->list) {
+		DirWalkerList_Destroy(job->list);
+	}
+	free(job->path);
+	free(job);
+}
+
+/** 添加待列出的目录，需在持有遍历器的锁时调用 */
+static void DirWalker_AddJob(DirWalker walker, DirWalkerDeque deque,
+			     const char *path, size_t name_offset,
+			     DirWalkerFd parent)
+{
+	DirWalkerJob job;
+
+	job = NEW(DirWalkerJobRec, 1);
+	job->refs = 2;
+	job->state = JOB_QUEUED;
+	job->path = strdup2(path);
+	job->name_offset = name_offset;
+	job->parent = parent;
+	job->list = NULL;
+	if (Dict_Add(walker->jobs, job->path, job) != 0) {
+		free(job->path);
+		free(job);
+		if (parent) {
+			DirWalker_ReleaseFd(walker, parent);
+		}
+		return;
+	}
+	walker->queued += 1;
+	DirWalkerDeque_Push(deque, job);
+	LCUICond_Signal(&walker->cond);
+}
+
+static int DirWalker_OpenDir(DirWalker walker, DirWalkerJob job)
+{
+	int fd = -1;
+	int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+	if (job->parent) {
+		fd = openat(job->parent->fd, job->path + job->name_offset,
+			    flags);
+		LCUIMutex_Lock(&walker->mutex);
+		DirWalker_ReleaseFd(walker, job->parent);
+		job->parent = NULL;
+		LCUIMutex_Unlock(&walker->mutex);
+	}
+	if (fd < 0) {
+		fd = open(job->path, flags);
+	}
+	return fd;
+}
+
+static void DirWalkerList_Add(DirWalkerList list, size_t *max_entries,
+			      size_t *names_len, size_t *max_names_len,
+			      const char *name, IOFileStat buf)
+{
+	char *names;
+	FileDirEntry *entries;
+	FileDirRecord *record;
+	size_t len = strlen(name);
+
+	if (list->n_entries >= *max_entries) {
+		*max_entries = *max_entries * 2 + 64;
+		entries = realloc(list->entries,
+				  sizeof(FileDirEntry) * *max_entries);
+		if (!entries) {
+			return;
+		}
+		list->entries = entries;
+	}
+	if (*names_len + len + 1 > *max_names_len) {
+		*max_names_len = (*max_names_len + len + 1) * 2;
+		names = realloc(list->names, *max_names_len);
+		if (!names) {
+			return;
+		}
+		list->names = names;
+	}
+	record = &list->entries[list->n_entries].status;
+	record->name_len = (unsigned int)len;
+	record->size = (size_t)buf->size;
+	record->ctime = buf->ctime;
+	record->mtime = buf->mtime;
+	record->inode = buf->inode;
+	if (S_ISDIR(buf->mode)) {
+		record->type = FILE_TYPE_DIRECTORY;
+	} else {
+		record->type = FILE_TYPE_ARCHIVE;
+	}
+	memcpy(list->names + *names_len, name, len + 1);
+	*names_len += len + 1;
+	list->n_entries += 1;
+}
+
+/** 列出目录中的图片文件和子目录，并将子目录加入队列 */
+static void DirWalker_ListDir(DirWalker walker, IOEngine io,
+			      DirWalkerDeque deque, DirWalkerJob job)
+{
+	int fd;
+	long n, pos;
+	size_t i, len, n_dirs = 0, n_names;
+	size_t max_entries = 0, names_len = 0, max_names_len = 0;
+	char *buf, *name, path[PATH_LEN];
+	const char **names;
+	unsigned char *types, *images;
+	wchar_t wname[PATH_LEN];
+	struct stat st;
+	struct linux_dirent64 *d;
+	IOFileStat stats;
+	DirWalkerFd dirfd = NULL;
+	DirWalkerList list;
+
+	list = NEW(DirWalkerListRec, 1);
+	job->list = list;
+	fd = DirWalker_OpenDir(walker, job);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return;
+	}
+	list->ok = TRUE;
+	list->status.type = FILE_TYPE_DIRECTORY;
+	list->status.ctime = st.st_ctime;
+	list->status.mtime = st.st_mtime;
+	buf = malloc(DIR_WALKER_BUFFER_SIZE);
+	names = malloc(sizeof(char *) * DIR_WALKER_BATCH_SIZE);
+	types = malloc(sizeof(unsigned char) * DIR_WALKER_BATCH_SIZE);
+	images = malloc(sizeof(unsigned char) * DIR_WALKER_BATCH_SIZE);
+	stats = malloc(sizeof(IOFileStatRec) * DIR_WALKER_BATCH_SIZE);
+	while (!walker->quit) {
+		n = syscall(SYS_getdents64, fd, buf, DIR_WALKER_BUFFER_SIZE);
+		if (n <= 0) {
+			break;
+		}
+		n_names = 0;
+		for (pos = 0; pos < n; pos += d->d_reclen) {
+			d = (struct linux_dirent64 *)(buf + pos);
+			if (d->d_name[0] == '.' &&
+			    (d->d_name[1] == 0 ||
+			     (d->d_name[1] == '.' && d->d_name[2] == 0))) {
+				continue;
+			}
+			/* 类型未知或是符号链接的文件，要等获取状态后才能确
+			 * 定是否需要，这里先记下它是否有图片文件的扩展名 */
+			images[n_names] = FALSE;
+			if (d->d_type != DT_DIR) {
+				LCUI_DecodeUTF8String(wname, d->d_name,
+						      PATH_LEN - 1);
+				wname[PATH_LEN - 1] = 0;
+				images[n_names] = IsImageFile(wname);
+				if (d->d_type == DT_REG && !images[n_names]) {
+					continue;
+				}
+			}
+			types[n_names] = d->d_type;
+			names[n_names++] = d->d_name;
+		}
+		IOEngine_StatAt(io, fd, names, n_names, stats);
+		for (i = 0; i < n_names; ++i) {
+			if (stats[i].error != 0) {
+				continue;
+			}
+			if (S_ISDIR(stats[i].mode)) {
+				/* 不进入指向目录的符号链接，以免循环遍历，文件服务
+				 * 列出目录时也是这样。有的文件系统不提供 d_type，
+				 * 所以类型不是 DT_DIR 时再确认一下是否为符号链接 */
+				if (types[i] != DT_DIR &&
+				    (fstatat(fd, names[i], &st,
+					     AT_SYMLINK_NOFOLLOW) != 0 ||
+				     S_ISLNK(st.st_mode))) {
+					continue;
+				}
+				n_dirs += 1;
+			} else if (types[i] == DT_DIR ||
+				   !S_ISREG(stats[i].mode) ||
+				   !images[i]) {
+				continue;
+			}
+			DirWalkerList_Add(list, &max_entries, &names_len,
+					  &max_names_len, names[i], &stats[i]);
+		}
+	}
+	free(buf);
+	free(names);
+	free(types);
+	free(images);
+	free(stats);
+	/* 文件名缓冲区在列出过程中可能被移动，所以最后才设置文件名指针 */
+	for (i = 0, name = list->names; i < list->n_entries; ++i) {
+		list->entries[i].name = name;
+		name += list->entries[i].status.name_len + 1;
+	}
+	LCUIMutex_Lock(&walker->mutex);
+	if (n_dirs > 0 && walker->open_fds < DIR_WALKER_MAX_FDS) {
+		dirfd = NEW(DirWalkerFdRec, 1);
+		dirfd->fd = fd;
+		dirfd->refs = 1;
+		walker->open_fds += 1;
+	} else {
+		close(fd);
+	}
+	len = strlen(job->path);
+	for (i = 0; i < list->n_entries; ++i) {
+		if (list->entries[i].status.type != FILE_TYPE_DIRECTORY ||
+		    len + list->entries[i].status.name_len + 2 > PATH_LEN) {
+			continue;
+		}
+		snprintf(path, PATH_LEN, "%s/%s", job->path,
+			 list->entries[i].name);
+		if (dirfd) {
+			dirfd->refs += 1;
+		}
+		DirWalker_AddJob(walker, deque, path, len + 1, dirfd);
+	}
+	if (dirfd) {
+		DirWalker_ReleaseFd(walker, dirfd);
+	}
+	LCUIMutex_Unlock(&walker->mutex);
+}
+
+/** 从自己的队列尾部取出任务，没有时从其它线程的队列头部窃取 */
+static DirWalkerJob DirWalker_TakeJob(DirWalker walker, DirWalkerThread self)
+{
+	size_t i;
+	DirWalkerJob job;
+
+	job = DirWalkerDeque_PopBack(&self->deque);
+	for (i = 1; !job && i < walker->n_threads; ++i) {
+		job = DirWalkerDeque_PopFront(
+		    &walker->threads[(self->index + i) % walker->n_threads]
+			 .deque);
+	}
+	return job;
+}
+
+static void DirWalker_Thread(void *arg)
+{
+	DirWalkerJob job;
+	DirWalkerThread self = arg;
+	DirWalker walker = self->walker;
+
+	self->io = IOEngine_Create();
+	while (1) {
+		job = DirWalker_TakeJob(walker, self);
+		LCUIMutex_Lock(&walker->mutex);
+		if (!job) {
+			if (walker->quit ||
+			    (walker->queued < 1 && walker->busy < 1)) {
+				LCUIMutex_Unlock(&walker->mutex);
+				break;
+			}
+			LCUICond_Wait(&walker->cond, &walker->mutex);
+			LCUIMutex_Unlock(&walker->mutex);
+			continue;
+		}
+		walker->queued -= 1;
+		walker->busy += 1;
+		while (job->state == JOB_QUEUED && !walker->quit &&
+		       walker->pending >= DIR_WALKER_MAX_PENDING) {
+			LCUICond_Wait(&walker->cond, &walker->mutex);
+		}
+		/* 目录可能已被调用者取走并自行列出 */
+		if (job->state != JOB_QUEUED || walker->quit) {
+			walker->busy -= 1;
+			DirWalker_ReleaseJob(walker, job);
+			LCUICond_Broadcast(&walker->cond);
+			LCUIMutex_Unlock(&walker->mutex);
+			continue;
+		}
+		job->state = JOB_LISTING;
+		LCUIMutex_Unlock(&walker->mutex);
+		DirWalker_ListDir(walker, self->io, &self->deque, job);
+		LCUIMutex_Lock(&walker->mutex);
+		job->state = JOB_DONE;
+		walker->busy -= 1;
+		walker->pending += 1;
+		DirWalker_ReleaseJob(walker, job);
+		LCUICond_Broadcast(&walker->cond);
+		LCUIMutex_Unlock(&walker->mutex);
+	}
+	IOEngine_Destroy(self->io);
+	self->io = NULL;
+	LCUIThread_Exit(NULL);
+}
+
+DirWalker DirWalker_Create(const char *root, unsigned int n_threads)
+{
+	size_t i;
+	long n_cpus;
+	DirWalker walker;
+
+	if (n_threads < 1) {
+		n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = n_cpus > 0 ? (unsigned int)n_cpus : 1;
+	}
+	if (n_threads > DIR_WALKER_MAX_THREADS) {
+		n_threads = DIR_WALKER_MAX_THREADS;
+	}
+	walker = NEW(DirWalkerRec, 1);
+	walker->quit = FALSE;
+	walker->jobs = StrDict_Create(NULL, NULL);
+	walker->n_threads = n_threads;
+	walker->threads = NEW(DirWalkerThreadRec, n_threads);
+	walker->io = IOEngine_Create();
+	LCUIMutex_Init(&walker->mutex);
+	LCUICond_Init(&walker->cond);
+	for (i = 0; i < walker->n_threads; ++i) {
+		walker->threads[i].index = i;
+		walker->threads[i].walker = walker;
+		DirWalkerDeque_Init(&walker->threads[i].deque);
+	}
+	LCUIMutex_Lock(&walker->mutex);
+	DirWalker_AddJob(walker, &walker->threads[0].deque, root, 0, NULL);
+	LCUIMutex_Unlock(&walker->mutex);
+	for (i = 0; i < walker->n_threads; ++i) {
+		LCUIThread_Create(&walker->threads[i].tid, DirWalker_Thread,
+				  &walker->threads[i]);
+	}
+	Logger_Debug("[walker] started with %lu threads: %s\n",
+		     walker->n_threads, root);
+	return walker;
+}
+
+DirWalkerList DirWalker_GetList(DirWalker walker, const char *path)
+{
+	DirWalkerJob job;
+	DirWalkerList list;
+
+	LCUIMutex_Lock(&walker->mutex);
+	job = Dict_FetchValue(walker->jobs, path);
+	if (!job) {
+		LCUIMutex_Unlock(&walker->mutex);
+		return NULL;
+	}
+	while (job->state == JOB_LISTING) {
+		LCUICond_Wait(&walker->cond, &walker->mutex);
+	}
+	if (job->state == JOB_QUEUED) {
+		job->state = JOB_LISTING;
+		walker->busy += 1;
+		LCUIMutex_Unlock(&walker->mutex);
+		DirWalker_ListDir(walker, walker->io,
+				  &walker->threads[0].deque, job);
+		LCUIMutex_Lock(&walker->mutex);
+		walker->busy -= 1;
+	} else {
+		walker->pending -= 1;
+	}
+	list = job->list;
+	job->list = NULL;
+	job->state = JOB_DONE;
+	Dict_Delete(walker->jobs, path);
+	DirWalker_ReleaseJob(walker, job);
+	LCUICond_Broadcast(&walker->cond);
+	LCUIMutex_Unlock(&walker->mutex);
+	return list;
+}
+
+void DirWalker_Destroy(DirWalker walker)
+{
+	size_t i;
+	DirWalkerJob job;
+	DictEntry *entry;
+	DictIterator *iter;
+
+	LCUIMutex_Lock(&walker->mutex);
+	walker->quit = TRUE;
+	LCUICond_Broadcast(&walker->cond);
+	LCUIMutex_Unlock(&walker->mutex);
+	for (i = 0; i < walker->n_threads; ++i) {
+		LCUIThread_Join(walker->threads[i].tid, NULL);
+	}
+	for (i = 0; i < walker->n_threads; ++i) {
+		while ((job = DirWalkerDeque_PopBack(
+			    &walker->threads[i].deque))) {
+			DirWalker_ReleaseJob(walker, job);
+		}
+		DirWalkerDeque_Destroy(&walker->threads[i].deque);
+	}
+	iter = Dict_GetIterator(walker->jobs);
+	while ((entry = Dict_Next(iter))) {
+		DirWalker_ReleaseJob(walker, DictEntry_GetVal(entry));
+	}
+	Dict_ReleaseIterator(iter);
+	Dict_Release(walker->jobs);
+	IOEngine_Destroy(walker->io);
+	LCUIMutex_Destroy(&walker->mutex);
+	LCUICond_Destroy(&walker->cond);
+	free(walker->threads);
+	free(walker);
+}
+
+#else
+
+DirWalker DirWalker_Create(const char *root, unsigned int n_threads)
+{
+	return NULL;
+}
+
+DirWalkerList DirWalker_GetList(DirWalker walker, const char *path)
+{
+	return NULL;
+}
+
+void DirWalkerList_Destroy(DirWalkerList list)
+{
+	free(list->entries);
+	free(list->names);
+	free(list);
+}
+
+void DirWalker_Destroy(DirWalker walker)
+{
+}
+
+#endif
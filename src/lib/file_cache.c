@@ -47,6 +47,9 @@
 #include "file_cache.h"
 
 #define MAX_PATH_LEN	2048
+
+/** 每批写入缓存的记录数量，只有最后一批需要等待落盘 */
+#define CACHE_BATCH_SIZE 1024
 #define WCSLEN(STR)	(sizeof( STR ) / sizeof( wchar_t ))
 #define GetDirStats(T)	(DirStats)(((char*)(T)) + sizeof(SyncTaskRec))
 
@@ -57,6 +60,22 @@ typedef struct FileInfoHanlderPackRec_ {
 	FileInfoHanlder handler;
 } FileInfoHanlderPackRec, *FileInfoHanlderPack;
 
+/** 变更记录的类型，作为变更记录中键的第一个字符 */
+enum FileChangeType {
+	FILE_ADDED = L'A',
+	FILE_CHANGED = L'C',
+	FILE_DELETED = L'D',
+	DIR_UPDATED = L'U',
+	DIR_DELETED = L'R'
+};
+
+/** 一条记录与之前的缓存的比对结果 */
+enum FileMergeResult {
+	MERGE_ADDED,
+	MERGE_CHANGED,
+	MERGE_UNCHANGED
+};
+
 /** 文件夹内的文件变更状态统计 */
 typedef struct DirStatsRec_ {
 	FileCache db;
@@ -64,6 +83,19 @@ typedef struct DirStatsRec_ {
 	Dict *added_files;	/**< 新增的文件 */
 	Dict *changed_files;	/**< 已改变的文件 */
 	Dict *deleted_files;	/**< 删除的文件 */
+
+	/**
+	 * 有序比对模式
+	 * 缓存按键的字节序存储，扫描器按相同顺序添加文件时，只需用迭代器
+	 * 与之前的缓存逐条比对，比对结果写入变更记录，不在内存中保留。
+	 */
+	LCUI_BOOL ordered;
+	FileCache cache;		/**< 之前的缓存 */
+	FileCache journal;		/**< 变更记录，有变更时才创建 */
+	kvdb_batch_t *batch;		/**< 待写入变更记录的操作 */
+	kvdb_iterator_t *iter;		/**< 之前的缓存的读取位置 */
+	size_t last_len;		/**< 上一个添加的文件路径的长度 */
+	wchar_t last_path[MAX_PATH_LEN];	/**< 上一个添加的文件路径 */
 } DirStatsRec, *DirStats;
 
 static unsigned int Dict_KeyHash(const void *key)
@@ -164,6 +196,304 @@ int FileCache_Delete(FileCache cache, const wchar_t *path)
 			   wcslen(path) * sizeof(wchar_t));
 }
 
+/** 与 LevelDB 默认的比较器一致，按字节序比较 */
+static int FileCache_CompareKey(const char *key1, size_t len1,
+				const char *key2, size_t len2)
+{
+	int ret = memcmp(key1, key2, len1 < len2 ? len1 : len2);
+
+	if (ret != 0) {
+		return ret;
+	}
+	if (len1 == len2) {
+		return 0;
+	}
+	return len1 < len2 ? -1 : 1;
+}
+
+int SyncTask_ComparePath(const wchar_t *path1, const wchar_t *path2)
+{
+	return FileCache_CompareKey((const char*)path1,
+				    wcslen(path1) * sizeof(wchar_t),
+				    (const char*)path2,
+				    wcslen(path2) * sizeof(wchar_t));
+}
+
+static int SyncTask_OpenJournal(SyncTask t)
+{
+	char *file;
+	DirStats ds = GetDirStats(t);
+
+	if (ds->journal) {
+		return 0;
+	}
+	file = EncodeANSI(t->logfile);
+	ds->journal = kvdb_open(file);
+	free(file);
+	if (!ds->journal) {
+		return -1;
+	}
+	ds->batch = kvdb_batch_create();
+	return 0;
+}
+
+/** 写入待写入的变更记录，变更记录只在本次同步中使用，不必等待落盘 */
+static void SyncTask_FlushJournal(SyncTask t)
+{
+	DirStats ds = GetDirStats(t);
+
+	if (ds->journal && kvdb_batch_count(ds->batch) > 0) {
+		kvdb_write(ds->journal, ds->batch, 0);
+	}
+}
+
+static void SyncTask_AddChange(SyncTask t, int type, const char *key,
+			       size_t keylen, const void *val, size_t vallen)
+{
+	char buf[(MAX_PATH_LEN + 1) * sizeof(wchar_t)];
+	DirStats ds = GetDirStats(t);
+
+	if (keylen > MAX_PATH_LEN * sizeof(wchar_t)) {
+		return;
+	}
+	if (SyncTask_OpenJournal(t) != 0) {
+		return;
+	}
+	*(wchar_t*)buf = (wchar_t)type;
+	memcpy(buf + sizeof(wchar_t), key, keylen);
+	kvdb_batch_put(ds->batch, buf, keylen + sizeof(wchar_t), val, vallen);
+	if (kvdb_batch_count(ds->batch) >= CACHE_BATCH_SIZE) {
+		SyncTask_FlushJournal(t);
+	}
+}
+
+/** 移除一条变更记录，返回值表示该记录是否存在 */
+static LCUI_BOOL SyncTask_RemoveChange(SyncTask t, int type, const char *key,
+				       size_t keylen)
+{
+	void *val;
+	size_t vallen;
+	char buf[(MAX_PATH_LEN + 1) * sizeof(wchar_t)];
+	DirStats ds = GetDirStats(t);
+
+	if (!ds->journal || keylen > MAX_PATH_LEN * sizeof(wchar_t)) {
+		return FALSE;
+	}
+	SyncTask_FlushJournal(t);
+	*(wchar_t*)buf = (wchar_t)type;
+	memcpy(buf + sizeof(wchar_t), key, keylen);
+	keylen += sizeof(wchar_t);
+	val = kvdb_get(ds->journal, buf, keylen, &vallen);
+	if (!val) {
+		return FALSE;
+	}
+	free(val);
+	kvdb_delete(ds->journal, buf, keylen);
+	return TRUE;
+}
+
+/** 遍历某一类变更记录，回调函数收到的键不含类型前缀 */
+static int SyncTask_EachRawChange(SyncTask t, int type,
+				  kvdb_each_callback_t func, void *func_data)
+{
+	int count = 0;
+	size_t keylen, vallen;
+	const char *key;
+	const void *val;
+	const wchar_t prefix = (wchar_t)type;
+	kvdb_iterator_t *iter;
+	DirStats ds = GetDirStats(t);
+
+	if (!ds->journal) {
+		return 0;
+	}
+	SyncTask_FlushJournal(t);
+	iter = kvdb_iter_create(ds->journal);
+	kvdb_iter_seek(iter, (const char*)&prefix, sizeof(prefix));
+	for (; kvdb_iter_valid(iter); kvdb_iter_next(iter), ++count) {
+		key = kvdb_iter_key(iter, &keylen);
+		if (keylen < sizeof(wchar_t) ||
+		    memcmp(key, &prefix, sizeof(prefix)) != 0) {
+			break;
+		}
+		val = kvdb_iter_value(iter, &vallen);
+		func(key + sizeof(wchar_t), keylen - sizeof(wchar_t),
+		     val, vallen, func_data);
+	}
+	kvdb_iter_destroy(iter);
+	return count;
+}
+
+static void SyncTask_OnEachChange(const char *key, size_t keylen,
+				  const void *val, size_t vallen, void *data)
+{
+	wchar_t path[MAX_PATH_LEN + 1];
+	FileCacheInfoRec info;
+	FileCacheTime time = (FileCacheTime)val;
+	FileInfoHanlderPack pack = data;
+
+	keylen /= sizeof(wchar_t);
+	if (keylen > MAX_PATH_LEN || vallen < sizeof(FileCacheTimeRec)) {
+		return;
+	}
+	memcpy(path, key, keylen * sizeof(wchar_t));
+	path[keylen] = 0;
+	info.path = path;
+	info.ctime = time->ctime;
+	info.mtime = time->mtime;
+	pack->handler(pack->data, &info);
+}
+
+/** 遍历某一类文件变更记录 */
+static int SyncTask_EachChange(SyncTask t, int type, FileInfoHanlder func,
+			       void *func_data)
+{
+	FileInfoHanlderPackRec pack = { func_data, func };
+	return SyncTask_EachRawChange(t, type, SyncTask_OnEachChange, &pack);
+}
+
+/** 目录记录的键以路径分隔符结尾，排在该目录内所有文件的前面 */
+static LCUI_BOOL FileCache_IsDirKey(const char *key, size_t keylen)
+{
+	wchar_t ch;
+
+	if (keylen < sizeof(wchar_t)) {
+		return FALSE;
+	}
+	memcpy(&ch, key + keylen - sizeof(wchar_t), sizeof(wchar_t));
+	return ch == PATH_SEP;
+}
+
+/** 将之前的缓存中排在 key 前面的记录都视为已删除的记录 */
+static void SyncTask_SkipDeletedFiles(SyncTask t, const char *key,
+				      size_t keylen)
+{
+	size_t len, vallen;
+	const char *cache_key;
+	const void *val;
+	DirStats ds = GetDirStats(t);
+
+	while (kvdb_iter_valid(ds->iter)) {
+		cache_key = kvdb_iter_key(ds->iter, &len);
+		if (key && FileCache_CompareKey(cache_key, len,
+						key, keylen) >= 0) {
+			break;
+		}
+		val = kvdb_iter_value(ds->iter, &vallen);
+		if (FileCache_IsDirKey(cache_key, len)) {
+			SyncTask_AddChange(t, DIR_DELETED, cache_key, len,
+					   val, vallen);
+		} else {
+			SyncTask_AddChange(t, FILE_DELETED, cache_key, len,
+					   val, vallen);
+			DEBUG_MSG("deleted file: %.*ls\n",
+				  (int)(len / sizeof(wchar_t)),
+				  (wchar_t*)cache_key);
+			++t->deleted_files;
+		}
+		kvdb_iter_next(ds->iter);
+	}
+}
+
+static LCUI_BOOL FileCache_IsSameValue(const void *val1, size_t len1,
+				       const void *val2, size_t len2)
+{
+	return len1 == len2 && memcmp(val1, val2, len1) == 0;
+}
+
+/** 比对一条记录，返回值为比对结果 */
+static int SyncTask_MergeKey(SyncTask t, const char *key, size_t keylen,
+			     const void *val, size_t vallen)
+{
+	int cmp, type;
+	size_t len;
+	void *cached;
+	const void *cached_val;
+	DirStats ds = GetDirStats(t);
+
+	cmp = ds->last_len < 1 ? 1 :
+	      FileCache_CompareKey(key, keylen, (const char*)ds->last_path,
+				   ds->last_len * sizeof(wchar_t));
+	if (cmp == 0) {
+		return MERGE_UNCHANGED;
+	}
+	if (cmp < 0) {
+		/* 扫描顺序与缓存不一致时，该记录可能已被记为删除 */
+		cached = kvdb_get(ds->cache, key, keylen, &len);
+		if (!cached) {
+			return MERGE_ADDED;
+		}
+		type = FileCache_IsDirKey(key, keylen) ?
+			DIR_DELETED : FILE_DELETED;
+		if (!SyncTask_RemoveChange(t, type, key, keylen)) {
+			free(cached);
+			return MERGE_UNCHANGED;
+		}
+		if (type == FILE_DELETED) {
+			--t->deleted_files;
+		}
+		cmp = FileCache_IsSameValue(cached, len, val, vallen);
+		free(cached);
+		return cmp ? MERGE_UNCHANGED : MERGE_CHANGED;
+	}
+	if (keylen < MAX_PATH_LEN * sizeof(wchar_t)) {
+		memcpy(ds->last_path, key, keylen);
+		ds->last_len = keylen / sizeof(wchar_t);
+	}
+	SyncTask_SkipDeletedFiles(t, key, keylen);
+	if (!kvdb_iter_valid(ds->iter)) {
+		return MERGE_ADDED;
+	}
+	cached_val = kvdb_iter_key(ds->iter, &len);
+	if (FileCache_CompareKey(cached_val, len, key, keylen) != 0) {
+		return MERGE_ADDED;
+	}
+	cached_val = kvdb_iter_value(ds->iter, &len);
+	cmp = FileCache_IsSameValue(cached_val, len, val, vallen);
+	kvdb_iter_next(ds->iter);
+	return cmp ? MERGE_UNCHANGED : MERGE_CHANGED;
+}
+
+static void SyncTask_MergeFile(SyncTask t, const wchar_t *path, size_t len,
+			       FileCacheTime time)
+{
+	const char *key = (const char*)path;
+	size_t keylen = len * sizeof(wchar_t);
+
+	switch (SyncTask_MergeKey(t, key, keylen, time, sizeof(*time))) {
+	case MERGE_ADDED:
+		SyncTask_AddChange(t, FILE_ADDED, key, keylen,
+				   time, sizeof(*time));
+		DEBUG_MSG("added file: %ls\n", path);
+		++t->added_files;
+		break;
+	case MERGE_CHANGED:
+		SyncTask_AddChange(t, FILE_CHANGED, key, keylen,
+				   time, sizeof(*time));
+		DEBUG_MSG("changed file: %ls\n", path);
+		++t->changed_files;
+		break;
+	default:
+		break;
+	}
+}
+
+/** 生成目录记录的键，即以路径分隔符结尾的目录路径 */
+static size_t FileCache_GetDirKey(wchar_t *key, const wchar_t *path)
+{
+	size_t len = wcslen(path);
+
+	if (len >= MAX_PATH_LEN - 1) {
+		return 0;
+	}
+	wcsncpy(key, path, len + 1);
+	if (len > 0 && key[len - 1] != PATH_SEP) {
+		key[len++] = PATH_SEP;
+		key[len] = 0;
+	}
+	return len;
+}
+
 SyncTask SyncTask_New(const char *data_dir, const char *scan_dir)
 {
 	SyncTask t;
@@ -184,6 +514,7 @@ SyncTask SyncTask_NewW(const wchar_t *data_dir, const wchar_t *scan_dir)
 	wchar_t name[44];
 	size_t max_len, len1, len2;
 	const wchar_t suffix[] = L".tmp";
+	const wchar_t log_suffix[] = L".log";
 
 	t = malloc(sizeof(SyncTaskRec) + sizeof(DirStatsRec));
 	ds = GetDirStats(t);
@@ -193,6 +524,13 @@ SyncTask SyncTask_NewW(const wchar_t *data_dir, const wchar_t *scan_dir)
 	ds->added_files = Dict_Create(&FilesDict, NULL);
 	ds->changed_files = Dict_Create(&FilePathsDict, NULL);
 	ds->deleted_files = Dict_Create(&FilePathsDict, NULL);
+	ds->db = NULL;
+	ds->ordered = FALSE;
+	ds->cache = NULL;
+	ds->journal = NULL;
+	ds->batch = NULL;
+	ds->iter = NULL;
+	ds->last_len = 0;
 	t->data_dir = malloc(sizeof(wchar_t) * len1);
 	t->scan_dir = malloc(sizeof(wchar_t) * len2);
 	wcsncpy(t->data_dir, data_dir, len1);
@@ -201,9 +539,11 @@ SyncTask SyncTask_NewW(const wchar_t *data_dir, const wchar_t *scan_dir)
 	max_len = len1 + WCSLEN(name) + WCSLEN(suffix) + 1;
 	t->tmpfile = malloc(max_len * sizeof(wchar_t));
 	t->file = malloc(max_len * sizeof(wchar_t));
+	t->logfile = malloc(max_len * sizeof(wchar_t));
 	wcsncpy(t->tmpfile, t->data_dir, len1);
 	wpathjoin(t->file, data_dir, name);
 	swprintf(t->tmpfile, max_len, L"%ls%ls", t->file, suffix);
+	swprintf(t->logfile, max_len, L"%ls%ls", t->file, log_suffix);
 	t->state = STATE_NONE;
 	t->changed_files = 0;
 	t->deleted_files = 0;
@@ -212,25 +552,53 @@ SyncTask SyncTask_NewW(const wchar_t *data_dir, const wchar_t *scan_dir)
 	return t;
 }
 
-void SyncTask_ClearCache(SyncTask t)
+static void SyncTask_DestroyDB(const wchar_t *path)
 {
-	char *file = EncodeANSI(t->file);
-	char *tmpfile = EncodeANSI(t->tmpfile);
+	char *file = EncodeANSI(path);
 	kvdb_destroy_db(file);
-	kvdb_destroy_db(tmpfile);
 	free(file);
-	free(tmpfile);
+}
+
+void SyncTask_ClearCache(SyncTask t)
+{
+	SyncTask_DestroyDB(t->file);
+	SyncTask_DestroyDB(t->tmpfile);
+	SyncTask_DestroyDB(t->logfile);
+}
+
+/** 关闭有序比对所用的缓存和变更记录 */
+static void SyncTask_CloseMerge(SyncTask t)
+{
+	DirStats ds = GetDirStats(t);
+
+	if (ds->iter) {
+		kvdb_iter_destroy(ds->iter);
+		ds->iter = NULL;
+	}
+	if (ds->cache) {
+		kvdb_close(ds->cache);
+		ds->cache = NULL;
+	}
+	if (ds->journal) {
+		kvdb_close(ds->journal);
+		kvdb_batch_destroy(ds->batch);
+		ds->journal = NULL;
+		ds->batch = NULL;
+	}
 }
 
 void SyncTask_Delete(SyncTask t)
 {
 	DirStats ds = GetDirStats(t);
+	SyncTask_CloseMerge(t);
 	free(t->scan_dir);
 	free(t->data_dir);
 	free(t->file);
 	free(t->tmpfile);
+	free(t->logfile);
 	t->file = NULL;
 	t->tmpfile = NULL;
+	t->logfile = NULL;
 	t->scan_dir = NULL;
 	t->data_dir = NULL;
 	Dict_Release(ds->files);
@@ -256,18 +624,27 @@ static int FileDict_ForEach(Dict *d, FileInfoHanlder func, void *data)
 int SyncTask_InAddedFiles(SyncTask t, FileInfoHanlder func, void *func_data)
 {
 	DirStats ds = GetDirStats(t);
+	if (ds->ordered) {
+		return SyncTask_EachChange(t, FILE_ADDED, func, func_data);
+	}
 	return FileDict_ForEach(ds->added_files, func, func_data);
 }
 
 int SyncTask_InChangedFiles(SyncTask t, FileInfoHanlder func, void *func_data)
 {
 	DirStats ds = GetDirStats(t);
+	if (ds->ordered) {
+		return SyncTask_EachChange(t, FILE_CHANGED, func, func_data);
+	}
 	return FileDict_ForEach(ds->changed_files, func, func_data);
 }
 
 int SyncTask_InDeletedFiles(SyncTask t, FileInfoHanlder func, void *func_data)
 {
 	DirStats ds = GetDirStats(t);
+	if (ds->ordered) {
+		return SyncTask_EachChange(t, FILE_DELETED, func, func_data);
+	}
 	return FileDict_ForEach(ds->deleted_files, func, func_data);
 }
 
@@ -290,7 +667,10 @@ int SyncTask_OpenCacheW(SyncTask t, const wchar_t *path)
 void SyncTask_CloseCache(SyncTask t)
 {
 	DirStats ds = GetDirStats(t);
-	kvdb_close(ds->db);
+	if (ds->db) {
+		kvdb_close(ds->db);
+		ds->db = NULL;
+	}
 }
 
 static void SyncTask_OnLoadFile(void *data, const FileCacheInfo info)
@@ -314,6 +694,24 @@ static size_t SyncTask_LoadCache(SyncTask t)
 	return count;
 }
 
+/** 准备有序比对，之前的缓存只在比对时按顺序读取 */
+static int SyncTask_OpenMerge(SyncTask t)
+{
+	char *file;
+	DirStats ds = GetDirStats(t);
+
+	file = EncodeANSI(t->file);
+	ds->cache = kvdb_open(file);
+	free(file);
+	if (!ds->cache) {
+		return -1;
+	}
+	ds->iter = kvdb_iter_create(ds->cache);
+	ds->last_len = 0;
+	t->deleted_files = 0;
+	return 0;
+}
+
 int SyncTask_AddFileW(SyncTask t, const wchar_t *path,
 		      unsigned int ctime, unsigned int mtime)
 {
@@ -326,6 +724,13 @@ int SyncTask_AddFileW(SyncTask t, const wchar_t *path,
 		return -1;
 	}
 	len = wcslen(path);
+	if (ds->ordered) {
+		time.ctime = ctime;
+		time.mtime = mtime;
+		SyncTask_MergeFile(t, path, len, &time);
+		++t->total_files;
+		return 0;
+	}
 	/* 若该文件路径存在于之前的缓存中，说明未被删除，否则将之
 	 * 视为新增的文件。
 	 */
@@ -352,9 +757,6 @@ int SyncTask_AddFileW(SyncTask t, const wchar_t *path,
 		DEBUG_MSG("added file: %ls\n", path);
 		++t->added_files;
 	}
-	time.ctime = info->ctime;
-	time.mtime = info->mtime;
-	FileCache_Put(ds->db, path, &time);
 	++t->total_files;
 	return 0;
 }
@@ -365,34 +767,297 @@ int SyncTask_DeleteFileW(SyncTask t, const wchar_t *filepath)
 	return FileCache_Delete(ds->db, filepath);
 }
 
-int SyncTask_Start(SyncTask t)
+int SyncTask_UpdateFileW(SyncTask t, const wchar_t *filepath,
+			 const FileCacheTime time)
 {
-	SyncTask_LoadCache(t);
-	if (0 != SyncTask_OpenCacheW(t, t->tmpfile)) {
+	void *val;
+	size_t vallen;
+	int ret = FILE_CACHE_UNCHANGED;
+	DirStats ds = GetDirStats(t);
+	const char *key = (const char*)filepath;
+	size_t keylen = wcslen(filepath) * sizeof(wchar_t);
+
+	if (!ds->db) {
 		return -1;
 	}
+	val = kvdb_get(ds->db, key, keylen, &vallen);
+	if (!time) {
+		if (!val) {
+			return FILE_CACHE_UNCHANGED;
+		}
+		free(val);
+		if (kvdb_delete(ds->db, key, keylen) != 0) {
+			return -1;
+		}
+		return FILE_CACHE_DELETED;
+	}
+	if (!val) {
+		ret = FILE_CACHE_ADDED;
+	} else if (!FileCache_IsSameValue(val, vallen, time, sizeof(*time))) {
+		ret = FILE_CACHE_CHANGED;
+	}
+	free(val);
+	if (ret != FILE_CACHE_UNCHANGED &&
+	    kvdb_put(ds->db, key, keylen, (const char*)time,
+		     sizeof(*time)) != 0) {
+		return -1;
+	}
+	return ret;
+}
+
+int SyncTask_Start(SyncTask t)
+{
+	DirStats ds = GetDirStats(t);
+
+	/* 上次未完成的同步所遗留的数据已没有用处 */
+	SyncTask_DestroyDB(t->tmpfile);
+	SyncTask_DestroyDB(t->logfile);
+	ds->ordered = kvdb_is_ordered() && SyncTask_OpenMerge(t) == 0;
+	if (!ds->ordered) {
+		SyncTask_LoadCache(t);
+	}
 	t->state = STATE_STARTED;
 	return 0;
 }
 
 void SyncTask_Finish(SyncTask t)
 {
+	DirStats ds = GetDirStats(t);
+
+	if (ds->ordered && t->state == STATE_STARTED) {
+		SyncTask_SkipDeletedFiles(t, NULL, 0);
+		SyncTask_FlushJournal(t);
+		kvdb_iter_destroy(ds->iter);
+		kvdb_close(ds->cache);
+		ds->iter = NULL;
+		ds->cache = NULL;
+	}
 	t->state = STATE_FINISHED;
-	SyncTask_CloseCache(t);
+}
+
+int SyncTask_GetDirW(SyncTask t, const wchar_t *path, FileCacheDir dir)
+{
+	size_t len, vallen;
+	void *val;
+	wchar_t key[MAX_PATH_LEN];
+	DirStats ds = GetDirStats(t);
+
+	if (!ds->ordered || t->state != STATE_STARTED) {
+		return -1;
+	}
+	len = FileCache_GetDirKey(key, path);
+	if (len < 1) {
+		return -1;
+	}
+	val = kvdb_get(ds->cache, (const char*)key, len * sizeof(wchar_t),
+		       &vallen);
+	if (!val) {
+		return -1;
+	}
+	if (vallen != sizeof(FileCacheDirRec)) {
+		free(val);
+		return -1;
+	}
+	memcpy(dir, val, sizeof(FileCacheDirRec));
+	free(val);
+	return 0;
+}
+
+int SyncTask_AddDirW(SyncTask t, const wchar_t *path, const FileCacheDir dir)
+{
+	size_t len;
+	wchar_t key[MAX_PATH_LEN];
+	DirStats ds = GetDirStats(t);
+
+	if (t->state != STATE_STARTED) {
+		return -1;
+	}
+	/* 无序比对时没有办法跳过目录，也就不必记录目录状态 */
+	if (!ds->ordered) {
+		return 0;
+	}
+	len = FileCache_GetDirKey(key, path);
+	if (len < 1) {
+		return -1;
+	}
+	len *= sizeof(wchar_t);
+	if (SyncTask_MergeKey(t, (const char*)key, len, dir,
+			      sizeof(FileCacheDirRec)) != MERGE_UNCHANGED) {
+		SyncTask_AddChange(t, DIR_UPDATED, (const char*)key, len, dir,
+				   sizeof(FileCacheDirRec));
+	}
+	return 0;
+}
+
+/** 将迭代器定位到所有以 prefix 开头的键的后面 */
+static void FileCache_SeekPast(kvdb_iterator_t *iter, const char *prefix,
+			       size_t len)
+{
+	unsigned char key[MAX_PATH_LEN * sizeof(wchar_t)];
+
+	if (len > sizeof(key)) {
+		return;
+	}
+	memcpy(key, prefix, len);
+	while (len > 0 && key[len - 1] == 0xff) {
+		--len;
+	}
+	if (len < 1) {
+		while (kvdb_iter_valid(iter)) {
+			kvdb_iter_next(iter);
+		}
+		return;
+	}
+	key[len - 1] += 1;
+	kvdb_iter_seek(iter, (const char*)key, len);
+}
+
+size_t SyncTask_ReadDirW(SyncTask t, const wchar_t *path,
+			 FileCacheEntryHandler handler, void *data)
+{
+	size_t count = 0;
+	size_t prefix_len, keylen, vallen, len;
+	const char *key;
+	const void *val;
+	wchar_t *sep;
+	wchar_t prefix[MAX_PATH_LEN];
+	wchar_t name[MAX_PATH_LEN];
+	kvdb_iterator_t *iter;
+	DirStats ds = GetDirStats(t);
+
+	if (!ds->ordered || t->state != STATE_STARTED) {
+		return 0;
+	}
+	prefix_len = FileCache_GetDirKey(prefix, path) * sizeof(wchar_t);
+	if (prefix_len < 1) {
+		return 0;
+	}
+	iter = kvdb_iter_create(ds->cache);
+	kvdb_iter_seek(iter, (const char*)prefix, prefix_len);
+	while (kvdb_iter_valid(iter)) {
+		key = kvdb_iter_key(iter, &keylen);
+		if (keylen < prefix_len ||
+		    memcmp(key, prefix, prefix_len) != 0) {
+			break;
+		}
+		len = (keylen - prefix_len) / sizeof(wchar_t);
+		if (len < 1 || len >= MAX_PATH_LEN) {
+			kvdb_iter_next(iter);
+			continue;
+		}
+		memcpy(name, key + prefix_len, len * sizeof(wchar_t));
+		name[len] = 0;
+		sep = wcschr(name, PATH_SEP);
+		if (!sep) {
+			val = kvdb_iter_value(iter, &vallen);
+			if (vallen == sizeof(FileCacheTimeRec)) {
+				handler(data, name, FALSE, (FileCacheTime)val);
+				++count;
+			}
+			kvdb_iter_next(iter);
+			continue;
+		}
+		/* 子目录的记录排在其内容的前面，报告子目录后跳过其内容 */
+		*sep = 0;
+		handler(data, name, TRUE, NULL);
+		++count;
+		len = prefix_len + (sep - name + 1) * sizeof(wchar_t);
+		memcpy(prefix + prefix_len / sizeof(wchar_t), key + prefix_len,
+		       len - prefix_len);
+		FileCache_SeekPast(iter, (const char*)prefix, len);
+	}
+	kvdb_iter_destroy(iter);
+	return count;
+}
+
+/** 缓存的写入器，用于将变更逐批写入缓存 */
+typedef struct FileCacheWriterRec_ {
+	FileCache db;
+	kvdb_batch_t *batch;
+} FileCacheWriterRec, *FileCacheWriter;
+
+static void FileCacheWriter_Put(void *data, const FileCacheInfo info)
+{
+	FileCacheTimeRec time;
+	FileCacheWriter writer = data;
+	const char *key = (const char*)info->path;
+	size_t keylen = wcslen(info->path) * sizeof(wchar_t);
+
+	time.ctime = info->ctime;
+	time.mtime = info->mtime;
+	kvdb_batch_put(writer->batch, key, keylen, &time, sizeof(time));
+	if (kvdb_batch_count(writer->batch) >= CACHE_BATCH_SIZE) {
+		kvdb_write(writer->db, writer->batch, 0);
+	}
+}
+
+static void FileCacheWriter_PutRaw(const char *key, size_t keylen,
+				   const void *val, size_t vallen, void *data)
+{
+	FileCacheWriter writer = data;
+
+	kvdb_batch_put(writer->batch, key, keylen, val, vallen);
+	if (kvdb_batch_count(writer->batch) >= CACHE_BATCH_SIZE) {
+		kvdb_write(writer->db, writer->batch, 0);
+	}
+}
+
+static void FileCacheWriter_DeleteRaw(const char *key, size_t keylen,
+				      const void *val, size_t vallen,
+				      void *data)
+{
+	FileCacheWriter writer = data;
+
+	kvdb_batch_delete(writer->batch, key, keylen);
+	if (kvdb_batch_count(writer->batch) >= CACHE_BATCH_SIZE) {
+		kvdb_write(writer->db, writer->batch, 0);
+	}
+}
+
+static void FileCacheWriter_Delete(void *data, const FileCacheInfo info)
+{
+	FileCacheWriter writer = data;
+	const char *key = (const char*)info->path;
+	size_t keylen = wcslen(info->path) * sizeof(wchar_t);
+
+	kvdb_batch_delete(writer->batch, key, keylen);
+	if (kvdb_batch_count(writer->batch) >= CACHE_BATCH_SIZE) {
+		kvdb_write(writer->db, writer->batch, 0);
+	}
 }
 
 int SyncTask_Commit(SyncTask t)
 {
-	int ret;
-	char *file = EncodeANSI(t->file);
-	char *tmpfile = EncodeANSI(t->tmpfile);
+	int ret = 0;
+	LCUI_BOOL changed;
+	FileCacheWriterRec writer;
+	DirStats ds = GetDirStats(t);
 
-	kvdb_destroy_db(file);
-	ret = rename(tmpfile, file);
-	if (ret != 0) {
-		_DEBUG_MSG("%s\n", strerror(errno));
+	if (ds->ordered) {
+		changed = ds->journal != NULL;
+	} else {
+		changed = t->added_files + t->changed_files +
+			  t->deleted_files > 0;
 	}
-	free(file);
-	free(tmpfile);
+	/* 只改写有变更的记录，最后一批写入落盘后整个提交才算完成 */
+	if (changed) {
+		if (SyncTask_OpenCacheW(t, t->file) != 0) {
+			return -1;
+		}
+		writer.db = ds->db;
+		writer.batch = kvdb_batch_create();
+		SyncTask_InAddedFiles(t, FileCacheWriter_Put, &writer);
+		SyncTask_InChangedFiles(t, FileCacheWriter_Put, &writer);
+		SyncTask_InDeletedFiles(t, FileCacheWriter_Delete, &writer);
+		SyncTask_EachRawChange(t, DIR_UPDATED, FileCacheWriter_PutRaw,
+				       &writer);
+		SyncTask_EachRawChange(t, DIR_DELETED,
+				       FileCacheWriter_DeleteRaw, &writer);
+		ret = kvdb_write(writer.db, writer.batch, 1);
+		kvdb_batch_destroy(writer.batch);
+		SyncTask_CloseCache(t);
+	}
+	SyncTask_CloseMerge(t);
+	SyncTask_DestroyDB(t->logfile);
 	return ret;
 }
@@ -0,0 +1,666 @@
+﻿/* ***************************************************************************
+ * file_columns.c -- columnar mirror of the file table
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * file_columns.c -- 文件表的列式镜像
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/**
+ * 文件表的列式镜像
+ * 每个字段存放在各自的数组中，过滤时只需顺序扫描用到的字段，编译器能够将这些
+ * 循环向量化；排序使用基数排序，不需要调用比较函数。文件路径统一存放在字符串
+ * 池中，行中只记录它在池中的偏移量。
+ */
+
+#define LCFINDER_FILE_COLUMNS_C
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "file_columns.h"
+
+/** 字符串池中的无用数据超过池的一半时整理字符串池 */
+#define PATHS_GARBAGE_RATIO 2
+
+/** 排序键的最大数量 */
+#define SORT_KEYS_MAX 4
+
+enum ColumnType { COLUMN_INT, COLUMN_UINT };
+
+typedef struct FileColumnsRec_ {
+	size_t length;
+	size_t capacity;
+	int *id;
+	int *did;
+	int *folder_id;
+	int *score;
+	int *width;
+	int *height;
+	unsigned int *create_time;
+	unsigned int *modify_time;
+	size_t *path; /**< 路径在字符串池中的偏移量 */
+
+	/** 以文件标识号为下标的行号列表，值为行号加 1，为 0 时表示没有该文件 */
+	uint32_t *rows;
+	size_t n_rows;
+
+	/** 字符串池 */
+	struct {
+		char *data;
+		size_t length;
+		size_t size;
+		size_t garbage; /**< 已被移除的路径占用的空间 */
+	} paths;
+} FileColumnsRec;
+
+/** 排序键，字段中的值都按 32 位整数读取 */
+typedef struct SortKeyRec_ {
+	const uint32_t *column;
+	enum ColumnType type;
+	enum order order;
+	uint32_t value; /**< 游标所在记录的字段值 */
+} SortKeyRec, *SortKey;
+
+typedef struct SortItemRec_ {
+	uint32_t key;
+	uint32_t index; /**< 在行号列表中的位置 */
+} SortItemRec, *SortItem;
+
+/** 排序数据，按排序键依次存放编码后的键，每个排序键有 n 个 */
+typedef struct FileColumnsSortRec_ {
+	size_t n_keys;
+	uint32_t *keys;
+} FileColumnsSortRec;
+
+static int Column_Realloc(void **column, size_t size, size_t capacity)
+{
+	void *data;
+
+	data = realloc(*column, size * capacity);
+	if (!data) {
+		return -1;
+	}
+	*column = data;
+	return 0;
+}
+
+static int FileColumns_Reserve(FileColumns columns, size_t capacity)
+{
+	if (capacity <= columns->capacity) {
+		return 0;
+	}
+	if (capacity < columns->capacity * 2) {
+		capacity = columns->capacity * 2;
+	}
+	if (Column_Realloc((void **)&columns->id, sizeof(int), capacity) != 0 ||
+	    Column_Realloc((void **)&columns->did, sizeof(int), capacity) != 0 ||
+	    Column_Realloc((void **)&columns->folder_id, sizeof(int),
+			   capacity) != 0 ||
+	    Column_Realloc((void **)&columns->score, sizeof(int), capacity) != 0 ||
+	    Column_Realloc((void **)&columns->width, sizeof(int), capacity) != 0 ||
+	    Column_Realloc((void **)&columns->height, sizeof(int), capacity) !=
+		0 ||
+	    Column_Realloc((void **)&columns->create_time, sizeof(unsigned int),
+			   capacity) != 0 ||
+	    Column_Realloc((void **)&columns->modify_time, sizeof(unsigned int),
+			   capacity) != 0 ||
+	    Column_Realloc((void **)&columns->path, sizeof(size_t), capacity) !=
+		0) {
+		return -1;
+	}
+	columns->capacity = capacity;
+	return 0;
+}
+
+/**
+ * 将路径添加到字符串池中
+ * @returns 路径在字符串池中的偏移量，失败时返回 (size_t)-1
+ */
+static size_t FileColumns_AddPath(FileColumns columns, const char *path)
+{
+	char *data;
+	size_t offset, size, len = strlen(path) + 1;
+
+	if (columns->paths.length + len > columns->paths.size) {
+		size = (columns->paths.length + len) * 2;
+		data = realloc(columns->paths.data, size);
+		if (!data) {
+			return (size_t)-1;
+		}
+		columns->paths.data = data;
+		columns->paths.size = size;
+	}
+	offset = columns->paths.length;
+	memcpy(columns->paths.data + offset, path, len);
+	columns->paths.length += len;
+	return offset;
+}
+
+/** 整理字符串池，去掉已被移除的路径 */
+static void FileColumns_CompactPaths(FileColumns columns)
+{
+	char *data;
+	size_t i, len, length = 0;
+	size_t size = columns->paths.length - columns->paths.garbage;
+
+	data = malloc(size > 0 ? size : 1);
+	if (!data) {
+		return;
+	}
+	for (i = 0; i < columns->length; ++i) {
+		len = strlen(columns->paths.data + columns->path[i]) + 1;
+		memcpy(data + length, columns->paths.data + columns->path[i],
+		       len);
+		columns->path[i] = length;
+		length += len;
+	}
+	free(columns->paths.data);
+	columns->paths.data = data;
+	columns->paths.length = length;
+	columns->paths.size = size > 0 ? size : 1;
+	columns->paths.garbage = 0;
+}
+
+/** 移除字符串池中的路径，被移除的路径只有在整理字符串池时才会释放 */
+static void FileColumns_RemovePath(FileColumns columns, size_t offset)
+{
+	columns->paths.garbage += strlen(columns->paths.data + offset) + 1;
+	if (columns->paths.garbage * PATHS_GARBAGE_RATIO >
+	    columns->paths.length) {
+		FileColumns_CompactPaths(columns);
+	}
+}
+
+FileColumns FileColumns_Create(void)
+{
+	return calloc(1, sizeof(FileColumnsRec));
+}
+
+void FileColumns_Clear(FileColumns columns)
+{
+	if (columns->rows) {
+		memset(columns->rows, 0, sizeof(uint32_t) * columns->n_rows);
+	}
+	columns->length = 0;
+	columns->paths.length = 0;
+	columns->paths.garbage = 0;
+}
+
+void FileColumns_Destroy(FileColumns columns)
+{
+	free(columns->id);
+	free(columns->did);
+	free(columns->folder_id);
+	free(columns->score);
+	free(columns->width);
+	free(columns->height);
+	free(columns->create_time);
+	free(columns->modify_time);
+	free(columns->path);
+	free(columns->rows);
+	free(columns->paths.data);
+	free(columns);
+}
+
+size_t FileColumns_GetLength(FileColumns columns)
+{
+	return columns->length;
+}
+
+int FileColumns_Set(FileColumns columns, const DB_FileRec *file,
+		    int folder_id)
+{
+	size_t row, n, offset, old_offset;
+	uint32_t *rows;
+	const char *path = file->path ? file->path : "";
+
+	if (file->id < 1) {
+		return -1;
+	}
+	if ((size_t)file->id >= columns->n_rows) {
+		n = (size_t)file->id + (size_t)file->id / 2 + 1024;
+		rows = realloc(columns->rows, sizeof(uint32_t) * n);
+		if (!rows) {
+			return -1;
+		}
+		memset(rows + columns->n_rows, 0,
+		       sizeof(uint32_t) * (n - columns->n_rows));
+		columns->rows = rows;
+		columns->n_rows = n;
+	}
+	row = columns->rows[file->id];
+	if (row > 0) {
+		row -= 1;
+		if (strcmp(columns->paths.data + columns->path[row], path) !=
+		    0) {
+			offset = FileColumns_AddPath(columns, path);
+			if (offset == (size_t)-1) {
+				return -1;
+			}
+			old_offset = columns->path[row];
+			columns->path[row] = offset;
+			FileColumns_RemovePath(columns, old_offset);
+		}
+	} else {
+		if (columns->length >= UINT32_MAX ||
+		    FileColumns_Reserve(columns, columns->length + 1) != 0) {
+			return -1;
+		}
+		offset = FileColumns_AddPath(columns, path);
+		if (offset == (size_t)-1) {
+			return -1;
+		}
+		row = columns->length++;
+		columns->rows[file->id] = (uint32_t)row + 1;
+		columns->path[row] = offset;
+	}
+	columns->id[row] = file->id;
+	columns->did[row] = file->did;
+	columns->folder_id[row] = folder_id;
+	columns->score[row] = file->score;
+	columns->width[row] = file->width;
+	columns->height[row] = file->height;
+	columns->create_time[row] = file->create_time;
+	columns->modify_time[row] = file->modify_time;
+	return 0;
+}
+
+void FileColumns_Remove(FileColumns columns, int id)
+{
+	size_t row, last, offset;
+
+	if (id < 1 || (size_t)id >= columns->n_rows || !columns->rows[id]) {
+		return;
+	}
+	row = columns->rows[id] - 1;
+	last = columns->length - 1;
+	offset = columns->path[row];
+	columns->rows[id] = 0;
+	/* 用最后一行填补被移除的行 */
+	if (row != last) {
+		columns->id[row] = columns->id[last];
+		columns->did[row] = columns->did[last];
+		columns->folder_id[row] = columns->folder_id[last];
+		columns->score[row] = columns->score[last];
+		columns->width[row] = columns->width[last];
+		columns->height[row] = columns->height[last];
+		columns->create_time[row] = columns->create_time[last];
+		columns->modify_time[row] = columns->modify_time[last];
+		columns->path[row] = columns->path[last];
+		columns->rows[columns->id[row]] = (uint32_t)row + 1;
+	}
+	columns->length -= 1;
+	FileColumns_RemovePath(columns, offset);
+}
+
+/**
+ * 将数值范围限制在字段类型的取值范围内
+ * @returns 范围内有值时返回 1，否则返回 0
+ */
+static int Range_Clamp(const DB_QueryRangeRec *range, long long lower,
+		       long long upper, long long *min, long long *max)
+{
+	*min = range->has_min && range->min > lower ? range->min : lower;
+	*max = range->has_max && range->max < upper ? range->max : upper;
+	return *min <= *max;
+}
+
+static void Column_FilterInt(uint8_t *mask, const int *column, size_t n,
+			     const DB_QueryRangeRec *range)
+{
+	size_t i;
+	int min, max;
+	long long lmin, lmax;
+
+	if (!range->has_min && !range->has_max) {
+		return;
+	}
+	if (!Range_Clamp(range, INT_MIN, INT_MAX, &lmin, &lmax)) {
+		memset(mask, 0, n);
+		return;
+	}
+	min = (int)lmin;
+	max = (int)lmax;
+	for (i = 0; i < n; ++i) {
+		mask[i] &= (column[i] >= min) & (column[i] <= max);
+	}
+}
+
+static void Column_FilterUInt(uint8_t *mask, const unsigned int *column,
+			      size_t n, const DB_QueryRangeRec *range)
+{
+	size_t i;
+	unsigned int min, max;
+	long long lmin, lmax;
+
+	if (!range->has_min && !range->has_max) {
+		return;
+	}
+	if (!Range_Clamp(range, 0, UINT_MAX, &lmin, &lmax)) {
+		memset(mask, 0, n);
+		return;
+	}
+	min = (unsigned int)lmin;
+	max = (unsigned int)lmax;
+	for (i = 0; i < n; ++i) {
+		mask[i] &= (column[i] >= min) & (column[i] <= max);
+	}
+}
+
+/** 只保留在源文件夹列表中的文件 */
+static void FileColumns_FilterDirs(FileColumns columns, uint8_t *mask,
+				   const DB_QueryTerms terms)
+{
+	size_t i, j;
+	uint8_t *in_dirs;
+
+	if (terms->n_dirs < 1 || !terms->dirs) {
+		return;
+	}
+	in_dirs = calloc(columns->length > 0 ? columns->length : 1, 1);
+	if (!in_dirs) {
+		return;
+	}
+	for (j = 0; j < terms->n_dirs; ++j) {
+		for (i = 0; i < columns->length; ++i) {
+			in_dirs[i] |= columns->did[i] == terms->dirs[j]->id;
+		}
+	}
+	for (i = 0; i < columns->length; ++i) {
+		mask[i] &= in_dirs[i];
+	}
+	free(in_dirs);
+}
+
+size_t FileColumns_Select(FileColumns columns, const FileColumnsFilter filter,
+			  uint32_t **rows)
+{
+	size_t i, n = 0;
+	uint8_t *mask;
+	uint32_t *list, value = 0;
+	DB_QueryTerms terms = filter->terms;
+
+	*rows = NULL;
+	mask = malloc(columns->length > 0 ? columns->length : 1);
+	list = malloc(sizeof(uint32_t) *
+		      (columns->length > 0 ? columns->length : 1));
+	if (!mask || !list) {
+		free(mask);
+		free(list);
+		return 0;
+	}
+	if (filter->files) {
+		memset(mask, 0, columns->length);
+		while (Bitmap_Next(filter->files, value, &value)) {
+			if (value < columns->n_rows && columns->rows[value]) {
+				mask[columns->rows[value] - 1] = 1;
+			}
+			if (value == UINT32_MAX) {
+				break;
+			}
+			++value;
+		}
+	} else {
+		memset(mask, 1, columns->length);
+	}
+	FileColumns_FilterDirs(columns, mask, terms);
+	Column_FilterInt(mask, columns->score, columns->length,
+			 &terms->range.score);
+	Column_FilterUInt(mask, columns->create_time, columns->length,
+			  &terms->range.create_time);
+	Column_FilterUInt(mask, columns->modify_time, columns->length,
+			  &terms->range.modify_time);
+	Column_FilterInt(mask, columns->width, columns->length,
+			 &terms->range.width);
+	Column_FilterInt(mask, columns->height, columns->length,
+			 &terms->range.height);
+	/* 集合条件需要逐个查找，放到最后检查剩下的记录 */
+	for (i = 0; i < columns->length; ++i) {
+		if (!mask[i]) {
+			continue;
+		}
+		if (filter->folders &&
+		    !Bitmap_Contains(filter->folders,
+				     (uint32_t)columns->folder_id[i])) {
+			continue;
+		}
+		if (filter->excluded &&
+		    Bitmap_Contains(filter->excluded,
+				    (uint32_t)columns->id[i])) {
+			continue;
+		}
+		list[n++] = (uint32_t)i;
+	}
+	free(mask);
+	*rows = list;
+	return n;
+}
+
+/** 获取排序键列表，顺序与 file_search.c 中的 DB_GetSortKeys() 一致 */
+static size_t FileColumns_GetSortKeys(FileColumns columns,
+				      const DB_QueryTerms terms, SortKey keys)
+{
+	size_t n = 0;
+
+	if (terms->create_time != NONE) {
+		keys[n].column = (const uint32_t *)columns->create_time;
+		keys[n].type = COLUMN_UINT;
+		keys[n].order = terms->create_time;
+		keys[n].value = terms->cursor.create_time;
+		++n;
+	}
+	if (terms->modify_time != NONE) {
+		keys[n].column = (const uint32_t *)columns->modify_time;
+		keys[n].type = COLUMN_UINT;
+		keys[n].order = terms->modify_time;
+		keys[n].value = terms->cursor.modify_time;
+		++n;
+	}
+	if (terms->score != NONE) {
+		keys[n].column = (const uint32_t *)columns->score;
+		keys[n].type = COLUMN_INT;
+		keys[n].order = terms->score;
+		keys[n].value = (uint32_t)terms->cursor.score;
+		++n;
+	}
+	keys[n].column = (const uint32_t *)columns->id;
+	keys[n].type = COLUMN_INT;
+	keys[n].order = n > 0 ? keys[0].order : ASC;
+	keys[n].value = (uint32_t)terms->cursor.id;
+	return n + 1;
+}
+
+/**
+ * 将字段值转换为排序用的键
+ * 有符号整数需要翻转符号位，降序排列时再按位取反，这样键的大小顺序就是排序
+ * 后的顺序。
+ */
+static uint32_t SortKey_Encode(const SortKeyRec *key, uint32_t value)
+{
+	if (key->type == COLUMN_INT) {
+		value ^= 0x80000000u;
+	}
+	return key->order == DESC ? ~value : value;
+}
+
+/**
+ * 按键对列表进行稳定的基数排序
+ * 每轮处理键中的 8 位，所有键的这 8 位都相同时跳过这一轮。
+ */
+static void SortItems(SortItem items, SortItem buffer, size_t n)
+{
+	size_t i, pass, sum, tmp;
+	size_t counts[4][256] = { { 0 } };
+	SortItem src = items, dst = buffer, swap;
+
+	for (i = 0; i < n; ++i) {
+		counts[0][items[i].key & 0xff] += 1;
+		counts[1][(items[i].key >> 8) & 0xff] += 1;
+		counts[2][(items[i].key >> 16) & 0xff] += 1;
+		counts[3][items[i].key >> 24] += 1;
+	}
+	for (pass = 0; pass < 4; ++pass) {
+		if (counts[pass][(items[0].key >> (pass * 8)) & 0xff] == n) {
+			continue;
+		}
+		for (sum = 0, i = 0; i < 256; ++i) {
+			tmp = counts[pass][i];
+			counts[pass][i] = sum;
+			sum += tmp;
+		}
+		for (i = 0; i < n; ++i) {
+			dst[counts[pass][(src[i].key >> (pass * 8)) & 0xff]++] =
+			    src[i];
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != items) {
+		memcpy(items, src, sizeof(SortItemRec) * n);
+	}
+}
+
+FileColumnsSort FileColumns_PrepareSort(FileColumns columns,
+					const uint32_t *rows, size_t n,
+					const DB_QueryTerms terms)
+{
+	size_t i, k;
+	uint32_t *values;
+	FileColumnsSort sort;
+	SortKeyRec keys[SORT_KEYS_MAX];
+
+	sort = malloc(sizeof(FileColumnsSortRec));
+	if (!sort) {
+		return NULL;
+	}
+	sort->n_keys = FileColumns_GetSortKeys(columns, terms, keys);
+	sort->keys = malloc(sizeof(uint32_t) * sort->n_keys * (n > 0 ? n : 1));
+	if (!sort->keys) {
+		free(sort);
+		return NULL;
+	}
+	for (k = 0; k < sort->n_keys; ++k) {
+		values = sort->keys + k * n;
+		for (i = 0; i < n; ++i) {
+			values[i] =
+			    SortKey_Encode(&keys[k], keys[k].column[rows[i]]);
+		}
+	}
+	return sort;
+}
+
+int FileColumns_SortRows(FileColumnsSort sort, uint32_t *rows, size_t n,
+			 const volatile int *cancelled)
+{
+	int ret = 0;
+	size_t i, k;
+	uint32_t *values;
+	SortItem items = NULL;
+
+	if (!sort) {
+		return -1;
+	}
+	if (n > 1) {
+		items = malloc(sizeof(SortItemRec) * n * 2);
+		ret = items ? 0 : -1;
+	}
+	if (items) {
+		for (i = 0; i < n; ++i) {
+			items[i].index = (uint32_t)i;
+		}
+		/* 从最次要的排序键开始排，每一轮都是稳定的，最后得到按全部键排序
+		 * 的结果 */
+		for (k = sort->n_keys; k-- > 0;) {
+			if (cancelled && *cancelled) {
+				ret = -1;
+				break;
+			}
+			values = sort->keys + k * n;
+			for (i = 0; i < n; ++i) {
+				items[i].key = values[items[i].index];
+			}
+			SortItems(items, items + n, n);
+		}
+		/* 借用键的空间暂存行号 */
+		values = sort->keys;
+		memcpy(values, rows, sizeof(uint32_t) * n);
+		for (i = 0; ret == 0 && i < n; ++i) {
+			rows[i] = values[items[i].index];
+		}
+		free(items);
+	}
+	free(sort->keys);
+	free(sort);
+	return ret;
+}
+
+size_t FileColumns_Seek(FileColumns columns, const uint32_t *rows, size_t n,
+			const DB_QueryTerms terms)
+{
+	size_t low = 0, high = n, mid, i, n_keys;
+	uint32_t a, b;
+	SortKeyRec keys[SORT_KEYS_MAX];
+
+	if (terms->cursor.id < 1) {
+		return 0;
+	}
+	n_keys = FileColumns_GetSortKeys(columns, terms, keys);
+	/* 查找第一个排在游标之后的行 */
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		for (i = 0; i < n_keys; ++i) {
+			a = SortKey_Encode(&keys[i], keys[i].column[rows[mid]]);
+			b = SortKey_Encode(&keys[i], keys[i].value);
+			if (a != b) {
+				break;
+			}
+		}
+		if (i < n_keys && a > b) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return low;
+}
+
+void FileColumns_GetFile(FileColumns columns, uint32_t row, DB_File file)
+{
+	file->id = columns->id[row];
+	file->did = columns->did[row];
+	file->score = columns->score[row];
+	file->width = columns->width[row];
+	file->height = columns->height[row];
+	file->create_time = columns->create_time[row];
+	file->modify_time = columns->modify_time[row];
+	file->path = columns->paths.data + columns->path[row];
+}
@@ -35,22 +35,75 @@
  * ****************************************************************************/
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <LCUI_Build.h>
+#include <LCUI/types.h>
+#include <LCUI/thread.h>
+#include <LCUI/util/time.h>
 #include "sqlite3.h"
+#include "bitmap.h"
 #define LCFINDER_FILE_SEARCH_C
 #include "file_search.h"
+#include "file_columns.h"
 
-#define SQL_BUF_SIZE 2048
+/** 批量添加和删除文件记录时，每条语句处理的记录数量 */
+#define FILE_BATCH_SIZE 64
+
+/** 只读连接的最大数量，每个线程同一时间最多占用一个只读连接 */
+#define DB_MAX_READERS 8
+
+/** 等待数据库锁的超时时间，单位为毫秒 */
+#define DB_BUSY_TIMEOUT 5000
+
+/** 每个连接缓存的动态查询语句的数量 */
+#define DB_STMT_CACHE_SIZE 16
+
+/** 文件路径中的词的最大长度，超出的部分会被截断 */
+#define DB_TERM_MAX 32
+
+/** 关键词中最多使用的词的数量 */
+#define DB_MAX_KEYWORDS 8
+
+/** 绑定到查询语句中的标签集合的指针类型 */
+#define DB_TAGSET_TYPE "DB_TagSet"
+
+/**
+ * 标签集合中的文件数量少于文件总数的几分之一时，直接按集合中的文件标识号查找
+ * 文件，否则遍历文件表并逐个检查文件是否在集合中
+ */
+#define DB_TAGSET_LOOKUP_RATIO 8
+
+/** 文件记录页的内存池中每个内存块的大小 */
+#define DB_ARENA_BLOCK_SIZE 16384
+
+/** 执行多少条虚拟机指令检查一次查询的取消标志 */
+#define DB_PROGRESS_STEPS 1000
+
+/** 缓存的镜像查询结果的数量，每个视图翻页时都能命中自己的结果 */
+#define DB_COLUMNS_CACHE_SIZE 4
 
 #ifdef _WIN32
 #define strdup _strdup
+#define PATH_SEP '\\'
+#else
+#define PATH_SEP '/'
 #endif
 
+/** 数据库结构迁移记录 */
+typedef struct DB_MigrationRec_ {
+	int version;     /**< 迁移后的版本号 */
+	const char *sql; /**< 需要执行的 SQL 语句 */
+} DB_MigrationRec;
+
 enum SQLCodeList {
 	SQL_ADD_FILE,
+	SQL_ADD_FILES,
 	SQL_DEL_FILE,
+	SQL_DEL_FILES,
 	SQL_GET_FILE,
 	SQL_GET_FILE_TAGS,
 	SQL_ADD_FILE_TAG,
@@ -60,6 +113,11 @@ enum SQLCodeList {
 	SQL_SET_FILE_TIME,
 	SQL_SET_FILE_TIME_BY_PATH,
 	SQL_GET_DIR_TOTAL,
+	SQL_GET_FOLDER,
+	SQL_ADD_FOLDER,
+	SQL_DEL_EMPTY_FOLDERS,
+	SQL_ADD_FILE_TERMS,
+	SQL_GET_MAX_FILE_ID,
 	SQL_GET_DIR_LIST,
 	SQL_ADD_TAG,
 	SQL_GET_TAG,
@@ -69,26 +127,171 @@ enum SQLCodeList {
 	SQL_TOTAL
 };
 
-typedef struct DB_QueryRec_ {
-	char sql_tables[128];
-	char sql_terms[1024];
-	char sql_orderby[128];
-	char sql_groupby[128];
-	char sql_having[128];
-	char sql_limit[128];
+/**
+ * 缓存的查询语句
+ * 查询语句的内容只取决于查询条件的结构，条件中的值都通过参数绑定，因此结构
+ * 相同的查询可以复用同一个预编译语句。
+ */
+typedef struct DB_CachedStmtRec_ {
+	char *sql;
 	sqlite3_stmt *stmt;
+	int in_use;               /**< 是否正被某个查询使用 */
+	unsigned long last_used;  /**< 最近一次使用的时间，用于淘汰缓存 */
+} DB_CachedStmtRec, *DB_CachedStmt;
+
+/**
+ * 数据库连接
+ * 每个连接有自己的预编译语句缓存，同一时间只能由一个线程使用。
+ */
+typedef struct DB_ConnectionRec_ {
+	sqlite3 *db;
+	LCUI_Thread owner;              /**< 正在使用该连接的线程 */
+	int refs;                       /**< 该线程对连接的引用次数 */
+	sqlite3_stmt *stmts[SQL_TOTAL]; /**< 预编译语句缓存 */
+	DB_CachedStmtRec cache[DB_STMT_CACHE_SIZE];
+	unsigned long cache_clock;
+} DB_ConnectionRec, *DB_Connection;
+
+/** 内存池中的内存块，块中的数据紧跟在块头之后 */
+typedef struct DB_ArenaBlockRec_ {
+	struct DB_ArenaBlockRec_ *next;
+	size_t size;
+	size_t used;
+} DB_ArenaBlockRec, *DB_ArenaBlock;
+
+/** 可增长的 SQL 语句缓冲区 */
+typedef struct DB_SQLBufferRec_ {
+	char *data;
+	size_t length;
+	size_t size;
+} DB_SQLBufferRec, *DB_SQLBuffer;
+
+/** 查询参数 */
+typedef struct DB_QueryParamRec_ {
+	long long value; /**< 整数值 */
+	char *text;      /**< 文本值，为 NULL 时使用整数值 */
+	Bitmap tagset;   /**< 标签集合，不为 NULL 时绑定为指针 */
+} DB_QueryParamRec, *DB_QueryParam;
+
+typedef struct DB_QueryRec_ {
+	char *sql;               /**< 查询文件的语句 */
+	char *sql_count;         /**< 统计文件总数的语句 */
+	size_t n_count_params;   /**< 统计语句用到的参数数量 */
+	size_t n_params;
+	DB_QueryParam params;
+	Bitmap tagset;           /**< 符合标签条件的文件集合 */
+	int by_relevance;        /**< 是否按关键词的相关度排序 */
+	int total;               /**< 已知的文件总数，值为 -1 时需要查询 */
+	DB_QueryCursorRec cursor;
+	DB_Connection conn;
+	sqlite3_stmt *stmt;      /**< 为 NULL 时从镜像的查询结果中取记录 */
+	DB_FilePageRec result;   /**< 在文件表的镜像中查询到的记录 */
+	size_t index;            /**< 下一个要取出的记录的位置 */
+	const volatile int *cancelled; /**< 取消标志，为 NULL 时不可取消 */
 } DB_QueryRec;
 
+/** 排序键 */
+typedef struct DB_SortKeyRec_ {
+	const char *column; /**< 字段名 */
+	enum order order;   /**< 排序规则 */
+	long long value;    /**< 游标所在记录的字段值 */
+} DB_SortKeyRec, *DB_SortKey;
+
 static struct DB_Module {
-	sqlite3 *db;
+	char *path;
 	const char *sqls[SQL_TOTAL];
-	sqlite3_stmt *stmts[SQL_TOTAL];
+
+	/**
+	 * 写连接
+	 * 所有写操作都通过它进行，需要写入的线程依次等待上一个线程用完它。
+	 * 同一线程可重复获取，以便在事务中嵌套调用其它写操作。
+	 */
+	DB_ConnectionRec writer;
+
+	/** 事务的嵌套层数 */
+	int transaction_depth;
+
+	/** 只读连接池，按需创建，在 WAL 模式下读取不会被写入阻塞 */
+	DB_Connection readers[DB_MAX_READERS];
+	size_t n_readers;
+
+	LCUI_Mutex mutex;
+	LCUI_Cond cond;
+
+	/** 最近一次用到的文件夹，同步时大部分文件都在同一文件夹内 */
+	struct {
+		int id;
+		char *path;
+	} folder;
+
+	/** 首次导入时被暂时删除的索引 */
+	struct {
+		char **indexes;
+		size_t n_indexes;
+		int synchronous;
+	} import;
+
+	/**
+	 * 标签索引
+	 * 以位图记录每个标签关联的文件，多标签查询的集合运算都在内存中完成。
+	 * 事务回滚后索引可能与数据库不一致，需要重新加载。
+	 */
+	struct {
+		Bitmap *tags; /**< 以标签标识号为下标的位图列表 */
+		size_t n_tags;
+		int dirty;
+		LCUI_Mutex mutex;
+	} tag_index;
+
+	/**
+	 * 文件表的镜像
+	 * 启用后在首次查询时加载，写连接修改过的文件记录会在连接被释放时同步到
+	 * 镜像中。事务回滚后镜像可能与数据库不一致，需要重新加载。
+	 * 加载和排序都在锁外进行，锁只保护对镜像的读取和替换。
+	 */
+	struct {
+		FileColumns data;
+		Bitmap changed; /**< 修改过的文件，启用镜像后一直记录 */
+		int enabled;
+		int dirty;
+		int loading; /**< 是否有线程正在加载镜像 */
+
+		/** 版本号，镜像或标签索引被修改后递增，用于判断缓存是否有效 */
+		unsigned long version;
+		unsigned long clock;
+
+		/**
+		 * 最近的查询结果
+		 * 翻页时只有游标在变化，直接在上次排好序的结果中定位即可。
+		 */
+		struct {
+			char *key;       /**< 由查询条件生成的缓存键 */
+			uint32_t *rows;  /**< 排好序的行号列表 */
+			size_t length;
+			unsigned long version;
+			unsigned long last_used;
+		} cache[DB_COLUMNS_CACHE_SIZE];
+		LCUI_Mutex mutex;
+	} columns;
 } self;
 
 #define STATIC_STR static const char *
 
 STATIC_STR sql_init = "\
 PRAGMA foreign_keys=ON;\
+CREATE TABLE IF NOT EXISTS schema_version (\
+	version INTEGER PRIMARY KEY,\
+	time INTEGER NOT NULL\
+);";
+
+STATIC_STR sql_get_schema_version = "\
+SELECT MAX(version) FROM schema_version;";
+
+STATIC_STR sql_set_schema_version = "\
+INSERT INTO schema_version(version, time) VALUES(?, strftime('%s', 'now'));";
+
+/** 版本 1：初始的表结构，兼容旧版本程序创建的数据库 */
+STATIC_STR sql_migration_v1 = "\
 CREATE TABLE IF NOT EXISTS dir (\
 	id INTEGER PRIMARY KEY AUTOINCREMENT,\
 	path TEXT NOT NULL, \
@@ -118,6 +321,178 @@ CREATE TABLE IF NOT EXISTS file_tag_relation (\
 	UNIQUE(fid, tid)\
 );";
 
+/**
+ * 版本 2：为常用的查询条件添加索引
+ * 旧版本的数据库中可能存在路径重复的文件记录，在创建唯一索引前需要将重复记录
+ * 的标签合并到最早的那条记录上，然后删除其余的重复记录。
+ */
+STATIC_STR sql_migration_v2 = "\
+INSERT OR IGNORE INTO file_tag_relation(fid, tid) \
+SELECT k.id, ftr.tid FROM file_tag_relation ftr, file f, \
+(SELECT MIN(id) AS id, path FROM file GROUP BY path HAVING COUNT(*) > 1) k \
+WHERE ftr.fid = f.id AND f.path = k.path AND f.id <> k.id;\
+DELETE FROM file WHERE id NOT IN (SELECT MIN(id) FROM file GROUP BY path);\
+CREATE UNIQUE INDEX IF NOT EXISTS file_path_index ON file(path);\
+CREATE INDEX IF NOT EXISTS file_did_modify_time_index \
+ON file(did, modify_time);\
+CREATE INDEX IF NOT EXISTS file_create_time_index ON file(create_time);\
+CREATE INDEX IF NOT EXISTS file_score_index ON file(score);\
+CREATE INDEX IF NOT EXISTS file_tag_relation_tid_index \
+ON file_tag_relation(tid, fid);\
+CREATE INDEX IF NOT EXISTS tag_name_index ON tag(name);";
+
+/** 版本 3：按修改时间分页查询全部文件时需要用到的索引 */
+STATIC_STR sql_migration_v3 = "\
+CREATE INDEX IF NOT EXISTS file_modify_time_index ON file(modify_time);";
+
+/**
+ * 版本 4：添加文件夹表，并为文件记录所在的文件夹
+ * 已有的文件记录需要补全文件夹记录，包括源文件夹与文件之间的各级文件夹。
+ */
+STATIC_STR sql_migration_v4 = "\
+CREATE TABLE IF NOT EXISTS folder (\
+	id INTEGER PRIMARY KEY AUTOINCREMENT,\
+	parent_id INTEGER DEFAULT NULL,\
+	path TEXT NOT NULL UNIQUE,\
+	FOREIGN KEY(parent_id) REFERENCES folder(id) ON DELETE SET NULL\
+);\
+ALTER TABLE file ADD COLUMN folder_id INTEGER DEFAULT NULL \
+REFERENCES folder(id) ON DELETE SET NULL;\
+WITH RECURSIVE p(did, path) AS (\
+	SELECT DISTINCT did, DIRNAME(path) FROM file \
+	UNION SELECT p.did, DIRNAME(p.path) FROM p, dir d \
+	WHERE d.id = p.did AND length(p.path) > length(d.path)\
+) INSERT OR IGNORE INTO folder(path) \
+SELECT path FROM p ORDER BY length(path);\
+UPDATE folder SET parent_id = (\
+	SELECT p.id FROM folder p WHERE p.path = DIRNAME(folder.path)\
+);\
+UPDATE file SET folder_id = (\
+	SELECT id FROM folder WHERE folder.path = DIRNAME(file.path)\
+);\
+CREATE INDEX IF NOT EXISTS file_folder_id_index ON file(folder_id);\
+CREATE INDEX IF NOT EXISTS folder_parent_id_index ON folder(parent_id);";
+
+/**
+ * 版本 5：为源文件夹、文件夹和标签添加文件数量字段
+ * 文件数量由触发器在增删文件和标签关系时维护，统计文件总数时直接读取该字段，
+ * 不用再扫描文件表。
+ */
+STATIC_STR sql_migration_v5 = "\
+ALTER TABLE dir ADD COLUMN file_count INTEGER NOT NULL DEFAULT 0;\
+ALTER TABLE folder ADD COLUMN file_count INTEGER NOT NULL DEFAULT 0;\
+ALTER TABLE tag ADD COLUMN file_count INTEGER NOT NULL DEFAULT 0;\
+UPDATE dir SET file_count = (SELECT COUNT(*) FROM file WHERE did = dir.id);\
+UPDATE folder SET file_count = (\
+	SELECT COUNT(*) FROM file WHERE folder_id = folder.id\
+);\
+UPDATE tag SET file_count = (\
+	SELECT COUNT(*) FROM file_tag_relation WHERE tid = tag.id\
+);\
+CREATE TRIGGER IF NOT EXISTS file_insert_trigger AFTER INSERT ON file \
+BEGIN \
+	UPDATE dir SET file_count = file_count + 1 WHERE id = NEW.did;\
+	UPDATE folder SET file_count = file_count + 1 \
+	WHERE id = NEW.folder_id;\
+END;\
+CREATE TRIGGER IF NOT EXISTS file_delete_trigger AFTER DELETE ON file \
+BEGIN \
+	UPDATE dir SET file_count = file_count - 1 WHERE id = OLD.did;\
+	UPDATE folder SET file_count = file_count - 1 \
+	WHERE id = OLD.folder_id;\
+END;\
+CREATE TRIGGER IF NOT EXISTS file_move_trigger \
+AFTER UPDATE OF did, folder_id ON file \
+WHEN OLD.did IS NOT NEW.did OR OLD.folder_id IS NOT NEW.folder_id \
+BEGIN \
+	UPDATE dir SET file_count = file_count - 1 WHERE id = OLD.did;\
+	UPDATE dir SET file_count = file_count + 1 WHERE id = NEW.did;\
+	UPDATE folder SET file_count = file_count - 1 \
+	WHERE id = OLD.folder_id;\
+	UPDATE folder SET file_count = file_count + 1 \
+	WHERE id = NEW.folder_id;\
+END;\
+CREATE TRIGGER IF NOT EXISTS file_tag_insert_trigger \
+AFTER INSERT ON file_tag_relation \
+BEGIN \
+	UPDATE tag SET file_count = file_count + 1 WHERE id = NEW.tid;\
+END;\
+CREATE TRIGGER IF NOT EXISTS file_tag_delete_trigger \
+AFTER DELETE ON file_tag_relation \
+BEGIN \
+	UPDATE tag SET file_count = file_count - 1 WHERE id = OLD.tid;\
+END;";
+
+/**
+ * 版本 6：添加文件路径的词索引，用于按文件名和文件夹名中的词搜索文件
+ * 只索引源文件夹之下的路径，文件名中的词的权重比文件夹名中的词高。
+ */
+STATIC_STR sql_migration_v6 = "\
+CREATE TABLE IF NOT EXISTS file_term (\
+	term TEXT NOT NULL,\
+	fid INTEGER NOT NULL,\
+	weight INTEGER NOT NULL DEFAULT 1,\
+	PRIMARY KEY(term, fid),\
+	FOREIGN KEY(fid) REFERENCES file(id) ON DELETE CASCADE\
+) WITHOUT ROWID;\
+INSERT OR IGNORE INTO file_term(term, fid, weight) \
+SELECT t.term, f.id, t.weight FROM dir d, file f, \
+path_terms(f.path, length(CAST(d.path AS BLOB))) t WHERE f.did = d.id;\
+CREATE INDEX IF NOT EXISTS file_term_fid_index ON file_term(fid);";
+
+/** 版本 7：按宽度和高度过滤文件时需要用到的索引 */
+STATIC_STR sql_migration_v7 = "\
+CREATE INDEX IF NOT EXISTS file_width_index ON file(width);\
+CREATE INDEX IF NOT EXISTS file_height_index ON file(height);";
+
+/**
+ * 版本 8：添加时间线表，记录每个源文件夹中每个月份的文件数量
+ * 月份按文件修改时间的本地时间计算，格式为 YYYYMM，由触发器在增删文件和修改
+ * 文件时间时维护。
+ */
+STATIC_STR sql_migration_v8 = "\
+CREATE TABLE IF NOT EXISTS timeline (\
+	did INTEGER NOT NULL,\
+	month INTEGER NOT NULL,\
+	file_count INTEGER NOT NULL DEFAULT 0,\
+	PRIMARY KEY(did, month),\
+	FOREIGN KEY(did) REFERENCES dir(id) ON DELETE CASCADE\
+) WITHOUT ROWID;\
+INSERT OR IGNORE INTO timeline(did, month, file_count) \
+SELECT did, CAST(strftime('%Y%m', modify_time, 'unixepoch', 'localtime') \
+AS INTEGER) AS m, COUNT(*) FROM file GROUP BY did, m;\
+CREATE TRIGGER IF NOT EXISTS file_timeline_insert_trigger \
+AFTER INSERT ON file \
+BEGIN \
+	INSERT OR IGNORE INTO timeline(did, month) VALUES(NEW.did, \
+	CAST(strftime('%Y%m', NEW.modify_time, 'unixepoch', 'localtime') \
+	AS INTEGER));\
+	UPDATE timeline SET file_count = file_count + 1 \
+	WHERE did = NEW.did AND month = CAST(strftime('%Y%m', \
+	NEW.modify_time, 'unixepoch', 'localtime') AS INTEGER);\
+END;\
+CREATE TRIGGER IF NOT EXISTS file_timeline_delete_trigger \
+AFTER DELETE ON file \
+BEGIN \
+	UPDATE timeline SET file_count = file_count - 1 \
+	WHERE did = OLD.did AND month = CAST(strftime('%Y%m', \
+	OLD.modify_time, 'unixepoch', 'localtime') AS INTEGER);\
+END;\
+CREATE TRIGGER IF NOT EXISTS file_timeline_update_trigger \
+AFTER UPDATE OF did, modify_time ON file \
+WHEN OLD.did IS NOT NEW.did OR OLD.modify_time IS NOT NEW.modify_time \
+BEGIN \
+	UPDATE timeline SET file_count = file_count - 1 \
+	WHERE did = OLD.did AND month = CAST(strftime('%Y%m', \
+	OLD.modify_time, 'unixepoch', 'localtime') AS INTEGER);\
+	INSERT OR IGNORE INTO timeline(did, month) VALUES(NEW.did, \
+	CAST(strftime('%Y%m', NEW.modify_time, 'unixepoch', 'localtime') \
+	AS INTEGER));\
+	UPDATE timeline SET file_count = file_count + 1 \
+	WHERE did = NEW.did AND month = CAST(strftime('%Y%m', \
+	NEW.modify_time, 'unixepoch', 'localtime') AS INTEGER);\
+END;";
+
 STATIC_STR sql_get_dir_total = "SELECT COUNT(*) FROM dir;";
 STATIC_STR sql_get_tag_total = "SELECT COUNT(*) FROM tag;";
 STATIC_STR sql_del_dir = "DELETE FROM dir WHERE id = ?;";
@@ -125,7 +500,7 @@ STATIC_STR sql_add_tag = "INSERT INTO tag(name) VALUES(?);";
 STATIC_STR sql_del_file = "DELETE FROM file WHERE path = ?;";
 STATIC_STR sql_get_tag = "SELECT id FROM tag WHERE name = ?;";
 STATIC_STR sql_file_set_score = "UPDATE file SET score = ? WHERE id = ?;";
-STATIC_STR sql_count_files = "SELECT COUNT(*) FROM ";
+STATIC_STR sql_count_files = "SELECT COUNT(*) FROM file f ";
 
 STATIC_STR sql_add_dir = "\
 INSERT INTO dir(path, token, visible) VALUES(?, ?, ?);";
@@ -137,12 +512,12 @@ STATIC_STR sql_get_dir_list = "\
 SELECT id, path, token, visible FROM dir ORDER BY PATH ASC;";
 
 STATIC_STR sql_get_tag_list = "\
-SELECT t.id, t.name, COUNT(ftr.tid) FROM tag t, file_tag_relation ftr \
-WHERE ftr.tid = t.id GROUP BY ftr.tid ORDER BY t.name ASC;";
+SELECT id, name, file_count FROM tag WHERE file_count > 0 \
+ORDER BY name ASC;";
 
 STATIC_STR sql_get_tag_list_order_by_id = "\
-SELECT t.id, t.name, COUNT(ftr.tid) FROM tag t, file_tag_relation ftr \
-WHERE ftr.tid = t.id GROUP BY ftr.tid ORDER BY t.id ASC;";
+SELECT id, name, file_count FROM tag WHERE file_count > 0 \
+ORDER BY id ASC;";
 
 STATIC_STR sql_file_set_size = "\
 UPDATE file SET width = ?, height = ? WHERE id = ?;";
@@ -154,14 +529,41 @@ STATIC_STR sql_file_set_time_by_path = "\
 UPDATE file SET create_time = ?, modify_time = ? \
 WHERE did = ? AND path = ?;";
 
+/** 不能用 REPLACE，它删除已有记录时不会触发删除触发器，会导致计数出错 */
 STATIC_STR sql_file_add_tag = "\
-REPLACE INTO file_tag_relation(fid, tid) VALUES(?, ?);";
+INSERT OR IGNORE INTO file_tag_relation(fid, tid) VALUES(?, ?);";
 
 STATIC_STR sql_file_del_tag = "\
 DELETE FROM file_tag_relation WHERE fid = ? AND tid = ?;";
 
-STATIC_STR sql_add_file = "\
-INSERT INTO file(did, path, create_time, modify_time) VALUES(?, ?, ?, ?);";
+STATIC_STR sql_add_file_head = "\
+INSERT OR IGNORE INTO file(did, folder_id, path, width, height, \
+create_time, modify_time) VALUES";
+
+STATIC_STR sql_add_file_values = "(?, ?, ?, ?, ?, ?, ?)";
+
+STATIC_STR sql_del_files_head = "DELETE FROM file WHERE path IN (";
+
+/** 首次导入前需要暂时删除的索引，唯一索引用于保证数据正确，需要保留 */
+STATIC_STR sql_get_file_indexes = "\
+SELECT name, sql FROM sqlite_master WHERE type = 'index' \
+AND tbl_name = 'file' AND sql IS NOT NULL \
+AND sql NOT LIKE 'CREATE UNIQUE%';";
+
+static char sql_add_file[160];
+static char sql_add_files[128 + FILE_BATCH_SIZE * 24];
+static char sql_del_files[64 + FILE_BATCH_SIZE * 3];
+
+STATIC_STR sql_get_folder = "SELECT id FROM folder WHERE path = ?;";
+
+STATIC_STR sql_add_folder = "\
+INSERT INTO folder(parent_id, path) VALUES(?, ?);";
+
+/** 删除源文件夹后，清理该文件夹下已经没有文件的文件夹记录 */
+STATIC_STR sql_del_empty_folders = "\
+DELETE FROM folder WHERE path >= ?1 AND path < ?1 || ?2 \
+AND (path = ?1 OR substr(path, length(?1) + 1, 1) = ?3) \
+AND NOT EXISTS (SELECT 1 FROM file f WHERE f.folder_id = folder.id);";
 
 STATIC_STR sql_get_file = "\
 SELECT f.id, f.did, f.score, f.path, f.width, f.height, f.create_time, \
@@ -172,682 +574,3113 @@ SELECT t.id, t.name, count(*) FROM tag t, file_tag_relation ftr \
 WHERE t.id = ftr.tid and ftr.fid = ? GROUP BY t.id ORDER BY count(*) ASC;";
 
 STATIC_STR sql_search_files = "SELECT f.id, f.did, f.score, f.path, \
-f.width, f.height, f.create_time, f.modify_time FROM file f ";
+f.width, f.height, f.create_time, f.modify_time";
+
+/** 加载文件表的镜像，字段顺序与 sql_search_files 一致 */
+STATIC_STR sql_get_file_columns = "SELECT id, did, score, path, width, \
+height, create_time, modify_time, folder_id FROM file;";
+
+STATIC_STR sql_get_changed_file_columns = "SELECT id, did, score, path, \
+width, height, create_time, modify_time, folder_id FROM file \
+WHERE id IN (SELECT value FROM tagset(?));";
+
+/** 为新添加的文件建立词索引，新文件的标识号都大于添加前的最大标识号 */
+STATIC_STR sql_add_file_terms = "\
+INSERT OR IGNORE INTO file_term(term, fid, weight) \
+SELECT t.term, f.id, t.weight FROM file f, path_terms(f.path, ?1) t \
+WHERE f.id > ?2;";
 
-/** 检测目录的下一级文件列表中是否有指定文件 */
-static int DirHasFile(const char *dirpath, const char *filepath)
+STATIC_STR sql_get_max_file_id = "SELECT IFNULL(MAX(id), 0) FROM file;";
+
+/** 获取路径中的目录部分的长度，不包括末尾的路径分隔符 */
+static size_t DirNameLength(const char *path, size_t len)
 {
-	const char *dp, *fp;
-	for (dp = dirpath, fp = filepath; *dp && *fp; ++dp, ++fp) {
-		if (*dp != *fp) {
-			break;
-		}
-	}
-	/* 目录路径必须比文件路径短 */
-	if (*dp || !*fp) {
-		return 0;
-	}
-	if (dp != dirpath) {
-		/* 如果目录路径最后一个字符不是路径分隔符 */
-		if (dp[-1] != '\\' && dp[-1] != '/') {
-			if (*fp != '\\' && *fp != '/') {
-				return 0;
-			}
-		}
-	}
-	/* 检测剩余这段文件路径是否包含路径分隔符 */
-	while (*fp++) {
-		if (*fp == '\\' || *fp == '/') {
-			return 0;
+	while (len > 0) {
+		--len;
+		if (path[len] == '\\' || path[len] == '/') {
+			return len;
 		}
 	}
-	return 1;
+	return 0;
 }
 
-static void sqlite3_hasfile(sqlite3_context *ctx, int argc,
+static void sqlite3_dirname(sqlite3_context *ctx, int argc,
 			    sqlite3_value **argv)
 {
-	const char *dirpath, *filepath;
-	if (argc != 2) {
+	const char *path;
+	if (argc != 1) {
 		return;
 	}
 	if (sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
 		return;
 	}
-	if (sqlite3_value_type(argv[1]) != SQLITE_TEXT) {
+	path = (const char *)sqlite3_value_text(argv[0]);
+	sqlite3_result_text(ctx, path, (int)DirNameLength(path, strlen(path)),
+			    SQLITE_TRANSIENT);
+}
+
+/** tagset_has(set, id)：判断文件是否在标签集合中 */
+static void sqlite3_tagset_has(sqlite3_context *ctx, int argc,
+			       sqlite3_value **argv)
+{
+	Bitmap set;
+
+	if (argc != 2) {
+		return;
+	}
+	set = sqlite3_value_pointer(argv[0], DB_TAGSET_TYPE);
+	if (!set) {
+		sqlite3_result_int(ctx, 0);
 		return;
 	}
-	dirpath = (const char *)sqlite3_value_text(argv[0]);
-	filepath = (const char *)sqlite3_value_text(argv[1]);
-	sqlite3_result_int(ctx, DirHasFile(dirpath, filepath));
+	sqlite3_result_int(
+	    ctx, Bitmap_Contains(set, (uint32_t)sqlite3_value_int64(argv[1])));
 }
 
-int DB_Init(const char *dbpath)
+/**
+ * tagset(set) 表值函数，列出标签集合中的文件标识号
+ * 用于 f.id IN (SELECT value FROM tagset(?)) 这样的条件，让 SQLite 直接按标识号
+ * 查找文件。
+ */
+typedef struct DB_TagSetCursorRec_ {
+	sqlite3_vtab_cursor base;
+	Bitmap set;
+	uint32_t value;
+	int eof;
+} DB_TagSetCursorRec, *DB_TagSetCursor;
+
+static int DB_TagSetConnect(sqlite3 *db, void *arg, int argc,
+			    const char *const *argv, sqlite3_vtab **vtab,
+			    char **errmsg)
 {
-	int i, ret;
-	char *errmsg;
-	printf("[database] init ...\n");
-	ret = sqlite3_open(dbpath, &self.db);
-	if (ret != SQLITE_OK) {
-		printf("[database] open failed\n");
-		return -1;
-	}
-	ret = sqlite3_exec(self.db, sql_init, NULL, NULL, &errmsg);
+	int ret;
+
+	ret = sqlite3_declare_vtab(db, "CREATE TABLE x(value, set_ptr HIDDEN)");
 	if (ret != SQLITE_OK) {
-		printf("[database] error: %s\n", errmsg);
-		return -2;
+		return ret;
 	}
-	sqlite3_create_function(self.db, "hasfile", 2, SQLITE_UTF8, NULL,
-				sqlite3_hasfile, NULL, NULL);
-	self.sqls[SQL_ADD_FILE] = sql_add_file;
-	self.sqls[SQL_DEL_FILE] = sql_del_file;
-	self.sqls[SQL_GET_FILE] = sql_get_file;
-	self.sqls[SQL_ADD_DIR] = sql_add_dir;
-	self.sqls[SQL_GET_DIR] = sql_get_dir;
-	self.sqls[SQL_DEL_DIR] = sql_del_dir;
-	self.sqls[SQL_ADD_TAG] = sql_add_tag;
-	self.sqls[SQL_GET_TAG] = sql_get_tag;
-	self.sqls[SQL_ADD_FILE_TAG] = sql_file_add_tag;
-	self.sqls[SQL_DEL_FILE_TAG] = sql_file_del_tag;
-	self.sqls[SQL_SET_FILE_SIZE] = sql_file_set_size;
-	self.sqls[SQL_SET_FILE_SCORE] = sql_file_set_score;
-	self.sqls[SQL_SET_FILE_TIME_BY_PATH] = sql_file_set_time_by_path;
-	self.sqls[SQL_SET_FILE_TIME] = sql_file_set_time;
-	self.sqls[SQL_GET_FILE_TAGS] = sql_get_file_tags;
-	self.sqls[SQL_GET_DIR_LIST] = sql_get_dir_list;
-	self.sqls[SQL_GET_DIR_TOTAL] = sql_get_dir_total;
-	for (i = 0; i < SQL_TOTAL; ++i) {
-		sqlite3_stmt *stmt;
-		const char *sql = self.sqls[i];
-		ret = sqlite3_prepare_v2(self.db, sql, -1, &stmt, NULL);
-		if (ret == SQLITE_OK) {
-			self.stmts[i] = stmt;
-		} else {
-			self.stmts[i] = NULL;
-		}
-		stmt = NULL;
+	*vtab = sqlite3_malloc(sizeof(sqlite3_vtab));
+	if (!*vtab) {
+		return SQLITE_NOMEM;
 	}
-	printf("[database] init done\n");
-	return 0;
+	memset(*vtab, 0, sizeof(sqlite3_vtab));
+	return SQLITE_OK;
 }
 
-void DB_Exit(void)
+static int DB_TagSetDisconnect(sqlite3_vtab *vtab)
 {
-	int i;
-	for (i = 0; i < SQL_TOTAL; ++i) {
-		sqlite3_finalize(self.stmts[i]);
-		self.stmts[i] = NULL;
+	sqlite3_free(vtab);
+	return SQLITE_OK;
+}
+
+static int DB_TagSetOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
+{
+	DB_TagSetCursor c = sqlite3_malloc(sizeof(DB_TagSetCursorRec));
+
+	if (!c) {
+		return SQLITE_NOMEM;
 	}
+	memset(c, 0, sizeof(DB_TagSetCursorRec));
+	c->eof = 1;
+	*cursor = &c->base;
+	return SQLITE_OK;
 }
 
-static DB_Dir DB_LoadDir(sqlite3_stmt *stmt)
+static int DB_TagSetClose(sqlite3_vtab_cursor *cursor)
 {
-	DB_Dir dir;
-	const unsigned char *text;
-	dir = malloc(sizeof(DB_DirRec));
-	dir->id = sqlite3_column_int(stmt, 0);
-	dir->path = strdup((const char *)sqlite3_column_text(stmt, 1));
-	dir->visible = sqlite3_column_int(stmt, 3);
-	text = sqlite3_column_text(stmt, 2);
-	if (text) {
-		dir->token = strdup((const char *)text);
-	} else {
-		dir->token = NULL;
+	sqlite3_free(cursor);
+	return SQLITE_OK;
+}
+
+static int DB_TagSetBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
+{
+	int i;
+
+	for (i = 0; i < info->nConstraint; ++i) {
+		if (info->aConstraint[i].iColumn == 1 &&
+		    info->aConstraint[i].op == SQLITE_INDEX_CONSTRAINT_EQ &&
+		    info->aConstraint[i].usable) {
+			info->aConstraintUsage[i].argvIndex = 1;
+			info->aConstraintUsage[i].omit = 1;
+			info->estimatedCost = 1000;
+			info->idxNum = 1;
+			/* 集合中的值是升序排列的 */
+			if (info->nOrderBy == 1 &&
+			    info->aOrderBy[0].iColumn == 0 &&
+			    !info->aOrderBy[0].desc) {
+				info->orderByConsumed = 1;
+			}
+			return SQLITE_OK;
+		}
 	}
-	return dir;
+	return SQLITE_CONSTRAINT;
 }
 
-DB_Dir DB_AddDir(const char *dirpath, const char *token, int visible)
+static int DB_TagSetFilter(sqlite3_vtab_cursor *cursor, int idx_num,
+			   const char *idx_str, int argc, sqlite3_value **argv)
 {
-	int ret;
-	DB_Dir dir;
-	sqlite3_stmt *stmt;
-	stmt = self.stmts[SQL_ADD_DIR];
-	sqlite3_reset(stmt);
-	sqlite3_bind_text(stmt, 1, dirpath, -1, NULL);
-	sqlite3_bind_int(stmt, 3, visible ? 1 : 0);
-	if (token) {
-		sqlite3_bind_text(stmt, 2, token, -1, NULL);
+	DB_TagSetCursor c = (DB_TagSetCursor)cursor;
+
+	c->eof = 1;
+	c->set = NULL;
+	if (argc == 1) {
+		c->set = sqlite3_value_pointer(argv[0], DB_TAGSET_TYPE);
 	}
-	ret = sqlite3_step(stmt);
-	if (ret != SQLITE_DONE) {
-		printf("[database] error: %s\n", dirpath);
-		return NULL;
+	if (c->set) {
+		c->eof = !Bitmap_Next(c->set, 0, &c->value);
 	}
-	stmt = self.stmts[SQL_GET_DIR];
-	sqlite3_reset(stmt);
-	sqlite3_bind_text(stmt, 1, dirpath, -1, NULL);
-	ret = sqlite3_step(stmt);
-	if (ret != SQLITE_ROW) {
-		return NULL;
+	return SQLITE_OK;
+}
+
+static int DB_TagSetNext(sqlite3_vtab_cursor *cursor)
+{
+	DB_TagSetCursor c = (DB_TagSetCursor)cursor;
+
+	if (c->value == UINT32_MAX) {
+		c->eof = 1;
+	} else {
+		c->eof = !Bitmap_Next(c->set, c->value + 1, &c->value);
 	}
-	dir = DB_LoadDir(stmt);
-	return dir;
+	return SQLITE_OK;
 }
 
-void DBDir_Release(DB_Dir dir)
+static int DB_TagSetEof(sqlite3_vtab_cursor *cursor)
 {
-	free(dir->path);
-	if (dir->token) {
-		free(dir->token);
+	return ((DB_TagSetCursor)cursor)->eof;
+}
+
+static int DB_TagSetColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx,
+			   int i)
+{
+	if (i == 0) {
+		sqlite3_result_int64(ctx, ((DB_TagSetCursor)cursor)->value);
 	}
-	dir->path = NULL;
-	dir->token = NULL;
-	free(dir);
+	return SQLITE_OK;
 }
 
-void DB_DeleteDir(DB_Dir dir)
+static int DB_TagSetRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid)
 {
-	sqlite3_stmt *stmt = self.stmts[SQL_DEL_DIR];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, dir->id);
-	sqlite3_step(stmt);
+	*rowid = ((DB_TagSetCursor)cursor)->value;
+	return SQLITE_OK;
 }
 
-int DB_GetDirs(DB_Dir **outlist)
+static sqlite3_module tagset_module = {
+	0,                   /* iVersion */
+	NULL,                /* xCreate，只能作为表值函数使用 */
+	DB_TagSetConnect,    /* xConnect */
+	DB_TagSetBestIndex,  /* xBestIndex */
+	DB_TagSetDisconnect, /* xDisconnect */
+	NULL,                /* xDestroy */
+	DB_TagSetOpen,       /* xOpen */
+	DB_TagSetClose,      /* xClose */
+	DB_TagSetFilter,     /* xFilter */
+	DB_TagSetNext,       /* xNext */
+	DB_TagSetEof,        /* xEof */
+	DB_TagSetColumn,     /* xColumn */
+	DB_TagSetRowid       /* xRowid */
+};
+
+static int IsTermChar(char ch)
 {
-	DB_Dir *list;
-	sqlite3_stmt *stmt;
-	int ret, i, total = 0;
-	stmt = self.stmts[SQL_GET_DIR_TOTAL];
-	sqlite3_reset(stmt);
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_ROW) {
-		total = sqlite3_column_int(stmt, 0);
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+	       (ch >= '0' && ch <= '9');
+}
+
+/**
+ * 从字符串中取出下一个词
+ * 连续的英文字母和数字组成一个词，并转换为小写，非 ASCII 字符各自作为一个词，
+ * 其余字符都视为分隔符。
+ * @param[out] term 词，长度不超过 DB_TERM_MAX - 1
+ * @returns 词之后的位置，没有词时返回 NULL
+ */
+static const char *DB_NextTerm(const char *str, const char *end, char *term)
+{
+	size_t n = 0;
+
+	while (str < end && !IsTermChar(*str) &&
+	       ((unsigned char)*str < 0xc0)) {
+		++str;
 	}
-	if (total == 0) {
-		*outlist = NULL;
-		return 0;
+	if (str >= end) {
+		return NULL;
 	}
-	list = malloc(sizeof(DB_Dir) * (total + 1));
-	if (!list) {
-		return -1;
+	if ((unsigned char)*str >= 0xc0) {
+		term[n++] = *str++;
+		while (str < end && ((unsigned char)*str & 0xc0) == 0x80 &&
+		       n < DB_TERM_MAX - 1) {
+			term[n++] = *str++;
+		}
+		term[n] = 0;
+		return str;
 	}
-	list[total] = NULL;
-	stmt = self.stmts[SQL_GET_DIR_LIST];
-	sqlite3_reset(stmt);
-	for (i = 0; i < total; ++i) {
-		ret = sqlite3_step(stmt);
-		if (ret != SQLITE_ROW) {
-			list[i] = NULL;
-			break;
+	for (; str < end && IsTermChar(*str); ++str) {
+		if (n < DB_TERM_MAX - 1) {
+			term[n++] = (*str >= 'A' && *str <= 'Z')
+					? *str - 'A' + 'a'
+					: *str;
 		}
-		list[i] = DB_LoadDir(stmt);
 	}
-	*outlist = list;
-	return i;
+	term[n] = 0;
+	return str;
 }
 
-DB_Tag DB_AddTag(const char *tagname)
+/**
+ * path_terms(path, start) 表值函数，列出文件路径中的词及其权重
+ * 先列出文件名中的词，再列出文件夹名中的词，start 是源文件夹路径的长度，源
+ * 文件夹路径中的词不会被列出。文件的扩展名也不会被列出。
+ */
+typedef struct DB_PathTermsCursorRec_ {
+	sqlite3_vtab_cursor base;
+	char *path;
+	const char *cur;
+	const char *end;
+	const char *folder;    /**< 文件夹部分的起始位置 */
+	const char *name;      /**< 文件名的起始位置 */
+	char term[DB_TERM_MAX];
+	int weight;
+	sqlite3_int64 rowid;
+} DB_PathTermsCursorRec, *DB_PathTermsCursor;
+
+static int DB_PathTermsConnect(sqlite3 *db, void *arg, int argc,
+			       const char *const *argv, sqlite3_vtab **vtab,
+			       char **errmsg)
 {
 	int ret;
-	DB_Tag tag;
-	sqlite3_stmt *stmt;
-	stmt = self.stmts[SQL_ADD_TAG];
-	sqlite3_reset(stmt);
-	sqlite3_bind_text(stmt, 1, tagname, -1, NULL);
-	ret = sqlite3_step(stmt);
-	if (ret != SQLITE_DONE) {
-		printf("[database] error: %s\n", sqlite3_errmsg(self.db));
-		return NULL;
+
+	ret = sqlite3_declare_vtab(
+	    db, "CREATE TABLE x(term, weight, path HIDDEN, start HIDDEN)");
+	if (ret != SQLITE_OK) {
+		return ret;
 	}
-	stmt = self.stmts[SQL_GET_TAG];
-	sqlite3_reset(stmt);
-	sqlite3_bind_text(stmt, 1, tagname, -1, NULL);
-	ret = sqlite3_step(stmt);
-	if (ret != SQLITE_ROW) {
-		return NULL;
+	*vtab = sqlite3_malloc(sizeof(sqlite3_vtab));
+	if (!*vtab) {
+		return SQLITE_NOMEM;
 	}
-	tag = malloc(sizeof(DB_TagRec));
-	tag->id = sqlite3_column_int(stmt, 0);
-	tag->name = strdup(tagname);
-	tag->count = 0;
-	return tag;
+	memset(*vtab, 0, sizeof(sqlite3_vtab));
+	return SQLITE_OK;
 }
 
-void DB_AddFile(DB_Dir dir, const char *filepath, int ctime, int mtime)
+static int DB_PathTermsOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor)
 {
-	sqlite3_stmt *stmt = self.stmts[SQL_ADD_FILE];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, dir->id);
-	sqlite3_bind_text(stmt, 2, filepath, -1, NULL);
-	sqlite3_bind_int(stmt, 3, ctime);
-	sqlite3_bind_int(stmt, 4, mtime);
-	sqlite3_step(stmt);
+	DB_PathTermsCursor c = sqlite3_malloc(sizeof(DB_PathTermsCursorRec));
+
+	if (!c) {
+		return SQLITE_NOMEM;
+	}
+	memset(c, 0, sizeof(DB_PathTermsCursorRec));
+	*cursor = &c->base;
+	return SQLITE_OK;
 }
 
-void DB_UpdateFileTime(DB_Dir dir, const char *filepath, int ctime, int mtime)
+static int DB_PathTermsClose(sqlite3_vtab_cursor *cursor)
 {
-	sqlite3_stmt *stmt = self.stmts[SQL_SET_FILE_TIME_BY_PATH];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, ctime);
-	sqlite3_bind_int(stmt, 2, mtime);
-	sqlite3_bind_int(stmt, 3, dir->id);
-	sqlite3_bind_text(stmt, 4, filepath, -1, NULL);
-	sqlite3_step(stmt);
+	free(((DB_PathTermsCursor)cursor)->path);
+	sqlite3_free(cursor);
+	return SQLITE_OK;
 }
 
-void DB_DeleteFile(const char *filepath)
+static int DB_PathTermsBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info)
 {
-	sqlite3_stmt *stmt = self.stmts[SQL_DEL_FILE];
-	sqlite3_reset(stmt);
-	sqlite3_bind_text(stmt, 1, filepath, -1, NULL);
-	sqlite3_step(stmt);
+	int i, path = -1, start = -1;
+
+	for (i = 0; i < info->nConstraint; ++i) {
+		if (info->aConstraint[i].iColumn < 2 ||
+		    info->aConstraint[i].op != SQLITE_INDEX_CONSTRAINT_EQ) {
+			continue;
+		}
+		/* 参数的值还不可用时，让 SQLite 换一种连接顺序 */
+		if (!info->aConstraint[i].usable) {
+			return SQLITE_CONSTRAINT;
+		}
+		if (info->aConstraint[i].iColumn == 2) {
+			path = i;
+		} else {
+			start = i;
+		}
+	}
+	if (path < 0) {
+		return SQLITE_CONSTRAINT;
+	}
+	info->aConstraintUsage[path].argvIndex = 1;
+	info->aConstraintUsage[path].omit = 1;
+	if (start >= 0) {
+		info->aConstraintUsage[start].argvIndex = 2;
+		info->aConstraintUsage[start].omit = 1;
+	}
+	info->estimatedCost = 10;
+	info->estimatedRows = 10;
+	return SQLITE_OK;
 }
 
-DB_File DBFile_Dup(DB_File file)
+static int DB_PathTermsNext(sqlite3_vtab_cursor *cursor)
 {
-	DB_File f = malloc(sizeof(DB_FileRec));
-	*f = *file;
-	f->path = strdup(file->path);
-	return f;
+	const char *next;
+	DB_PathTermsCursor c = (DB_PathTermsCursor)cursor;
+
+	while (c->cur) {
+		next = DB_NextTerm(c->cur, c->end, c->term);
+		if (next) {
+			c->cur = next;
+			c->rowid += 1;
+			return SQLITE_OK;
+		}
+		/* 文件名中的词取完后再取文件夹名中的词 */
+		if (c->weight == 2) {
+			c->cur = c->folder;
+			c->end = c->name;
+			c->weight = 1;
+		} else {
+			c->cur = NULL;
+		}
+	}
+	return SQLITE_OK;
 }
 
-void DBFile_Release(DB_File file)
+static int DB_PathTermsFilter(sqlite3_vtab_cursor *cursor, int idx_num,
+			      const char *idx_str, int argc,
+			      sqlite3_value **argv)
 {
-	free(file->path);
-	file->path = NULL;
-	free(file);
+	size_t len, start = 0;
+	const char *p, *ext = NULL;
+	DB_PathTermsCursor c = (DB_PathTermsCursor)cursor;
+
+	free(c->path);
+	c->path = NULL;
+	c->cur = NULL;
+	c->rowid = 0;
+	if (argc < 1 || sqlite3_value_type(argv[0]) != SQLITE_TEXT) {
+		return SQLITE_OK;
+	}
+	c->path = strdup((const char *)sqlite3_value_text(argv[0]));
+	if (!c->path) {
+		return SQLITE_NOMEM;
+	}
+	len = strlen(c->path);
+	if (argc > 1) {
+		start = (size_t)sqlite3_value_int64(argv[1]);
+	}
+	if (start > len) {
+		start = len;
+	}
+	c->folder = c->path + start;
+	c->name = c->path + start + DirNameLength(c->folder, len - start);
+	for (p = c->name; *p; ++p) {
+		if (*p == '.') {
+			ext = p;
+		}
+	}
+	c->cur = c->name;
+	c->end = ext && ext > c->name + 1 ? ext : c->path + len;
+	c->weight = 2;
+	return DB_PathTermsNext(cursor);
 }
 
-static DB_File DB_LoadFile(sqlite3_stmt *stmt)
+static int DB_PathTermsEof(sqlite3_vtab_cursor *cursor)
 {
-	size_t len;
-	DB_File file;
-	const char *path;
-	if (sqlite3_step(stmt) != SQLITE_ROW) {
+	return ((DB_PathTermsCursor)cursor)->cur == NULL;
+}
+
+static int DB_PathTermsColumn(sqlite3_vtab_cursor *cursor,
+			      sqlite3_context *ctx, int i)
+{
+	DB_PathTermsCursor c = (DB_PathTermsCursor)cursor;
+
+	if (i == 0) {
+		sqlite3_result_text(ctx, c->term, -1, SQLITE_TRANSIENT);
+	} else if (i == 1) {
+		sqlite3_result_int(ctx, c->weight);
+	}
+	return SQLITE_OK;
+}
+
+static int DB_PathTermsRowid(sqlite3_vtab_cursor *cursor,
+			     sqlite3_int64 *rowid)
+{
+	*rowid = ((DB_PathTermsCursor)cursor)->rowid;
+	return SQLITE_OK;
+}
+
+static sqlite3_module path_terms_module = {
+	0,                     /* iVersion */
+	NULL,                  /* xCreate，只能作为表值函数使用 */
+	DB_PathTermsConnect,   /* xConnect */
+	DB_PathTermsBestIndex, /* xBestIndex */
+	DB_TagSetDisconnect,   /* xDisconnect */
+	NULL,                  /* xDestroy */
+	DB_PathTermsOpen,      /* xOpen */
+	DB_PathTermsClose,     /* xClose */
+	DB_PathTermsFilter,    /* xFilter */
+	DB_PathTermsNext,      /* xNext */
+	DB_PathTermsEof,       /* xEof */
+	DB_PathTermsColumn,    /* xColumn */
+	DB_PathTermsRowid      /* xRowid */
+};
+
+static int DB_GetSchemaVersion(void)
+{
+	int version = 0;
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(self.writer.db, sql_get_schema_version, -1, &stmt,
+			       NULL) != SQLITE_OK) {
+		return -1;
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		version = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return version;
+}
+
+static int DB_SetSchemaVersion(int version)
+{
+	int ret;
+	sqlite3_stmt *stmt;
+
+	if (sqlite3_prepare_v2(self.writer.db, sql_set_schema_version, -1, &stmt,
+			       NULL) != SQLITE_OK) {
+		return -1;
+	}
+	sqlite3_bind_int(stmt, 1, version);
+	ret = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	return ret == SQLITE_DONE ? 0 : -1;
+}
+
+/** 将数据库结构迁移至最新版本，每个版本的迁移都在独立的事务中进行 */
+static int DB_Migrate(void)
+{
+	size_t i;
+	int version;
+	char *errmsg = NULL;
+	const DB_MigrationRec migrations[] = {
+		{ 1, sql_migration_v1 },
+		{ 2, sql_migration_v2 },
+		{ 3, sql_migration_v3 },
+		{ 4, sql_migration_v4 },
+		{ 5, sql_migration_v5 },
+		{ 6, sql_migration_v6 },
+		{ 7, sql_migration_v7 },
+		{ 8, sql_migration_v8 }
+	};
+
+	version = DB_GetSchemaVersion();
+	if (version < 0) {
+		printf("[database] error: %s\n", sqlite3_errmsg(self.writer.db));
+		return -1;
+	}
+	for (i = 0; i < sizeof(migrations) / sizeof(migrations[0]); ++i) {
+		if (migrations[i].version <= version) {
+			continue;
+		}
+		printf("[database] migrate schema from version %d to %d\n",
+		       version, migrations[i].version);
+		sqlite3_exec(self.writer.db, "begin;", NULL, NULL, NULL);
+		if (sqlite3_exec(self.writer.db, migrations[i].sql, NULL, NULL,
+				 &errmsg) != SQLITE_OK ||
+		    DB_SetSchemaVersion(migrations[i].version) != 0) {
+			printf("[database] migration failed: %s\n",
+			       errmsg ? errmsg : sqlite3_errmsg(self.writer.db));
+			sqlite3_free(errmsg);
+			sqlite3_exec(self.writer.db, "rollback;", NULL, NULL, NULL);
+			return -1;
+		}
+		sqlite3_exec(self.writer.db, "commit;", NULL, NULL, NULL);
+		version = migrations[i].version;
+	}
+	return 0;
+}
+
+/** 打开一个数据库连接 */
+static sqlite3 *DB_Open(const char *path, int flags)
+{
+	sqlite3 *db;
+
+	if (sqlite3_open_v2(path, &db, flags, NULL) != SQLITE_OK) {
+		printf("[database] open failed: %s\n", sqlite3_errmsg(db));
+		sqlite3_close(db);
 		return NULL;
 	}
-	file = malloc(sizeof(DB_FileRec));
+	sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT);
+	sqlite3_create_function(db, "dirname", 1,
+				SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+				sqlite3_dirname, NULL, NULL);
+	sqlite3_create_function(db, "tagset_has", 2, SQLITE_UTF8, NULL,
+				sqlite3_tagset_has, NULL, NULL);
+	sqlite3_create_module(db, "tagset", &tagset_module, NULL);
+	sqlite3_create_module(db, "path_terms", &path_terms_module, NULL);
+	return db;
+}
+
+static void DB_CloseConnection(DB_Connection conn)
+{
+	int i;
+
+	for (i = 0; i < SQL_TOTAL; ++i) {
+		sqlite3_finalize(conn->stmts[i]);
+		conn->stmts[i] = NULL;
+	}
+	for (i = 0; i < DB_STMT_CACHE_SIZE; ++i) {
+		sqlite3_finalize(conn->cache[i].stmt);
+		free(conn->cache[i].sql);
+		conn->cache[i].stmt = NULL;
+		conn->cache[i].sql = NULL;
+	}
+	sqlite3_close(conn->db);
+	conn->db = NULL;
+}
+
+/** 获取连接中的预编译语句，如果还未编译则先编译它 */
+static sqlite3_stmt *DB_GetStmt(DB_Connection conn, int code)
+{
+	sqlite3_stmt *stmt = conn->stmts[code];
+
+	if (stmt) {
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		return stmt;
+	}
+	if (sqlite3_prepare_v2(conn->db, self.sqls[code], -1, &stmt, NULL) !=
+	    SQLITE_OK) {
+		printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+		return NULL;
+	}
+	conn->stmts[code] = stmt;
+	return stmt;
+}
+
+/**
+ * 从缓存中获取预编译语句
+ * 如果缓存中没有该语句，则编译它并替换掉最久未使用的缓存；如果相同的语句正
+ * 在被使用，则另外编译一个不缓存的语句。
+ */
+static sqlite3_stmt *DB_PrepareCached(DB_Connection conn, const char *sql)
+{
+	size_t i;
+	sqlite3_stmt *stmt;
+	DB_CachedStmt entry = NULL, lru = NULL;
+
+	for (i = 0; i < DB_STMT_CACHE_SIZE; ++i) {
+		if (conn->cache[i].in_use) {
+			continue;
+		}
+		if (conn->cache[i].sql && strcmp(conn->cache[i].sql, sql) == 0) {
+			entry = &conn->cache[i];
+			break;
+		}
+		if (!lru || conn->cache[i].last_used < lru->last_used) {
+			lru = &conn->cache[i];
+		}
+	}
+	if (!entry) {
+		if (sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL) !=
+		    SQLITE_OK) {
+			printf("[database] error: %s\n",
+			       sqlite3_errmsg(conn->db));
+			return NULL;
+		}
+		if (!lru) {
+			return stmt;
+		}
+		entry = lru;
+		sqlite3_finalize(entry->stmt);
+		free(entry->sql);
+		entry->sql = strdup(sql);
+		entry->stmt = stmt;
+	}
+	entry->in_use = 1;
+	entry->last_used = ++conn->cache_clock;
+	return entry->stmt;
+}
+
+/** 归还预编译语句，如果它不在缓存中则销毁它 */
+static void DB_ReleaseCached(DB_Connection conn, sqlite3_stmt *stmt)
+{
+	size_t i;
+
+	for (i = 0; i < DB_STMT_CACHE_SIZE; ++i) {
+		if (conn->cache[i].stmt == stmt) {
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+			conn->cache[i].in_use = 0;
+			return;
+		}
+	}
+	sqlite3_finalize(stmt);
+}
+
+/** 获取写连接，如果它正被其它线程使用则等待 */
+static DB_Connection DB_LockWriter(void)
+{
+	LCUI_Thread tid = LCUIThread_SelfID();
+
+	LCUIMutex_Lock(&self.mutex);
+	if (self.writer.refs < 1 || self.writer.owner != tid) {
+		while (self.writer.refs > 0) {
+			LCUICond_Wait(&self.cond, &self.mutex);
+		}
+		self.writer.owner = tid;
+	}
+	self.writer.refs += 1;
+	LCUIMutex_Unlock(&self.mutex);
+	return &self.writer;
+}
+
+/**
+ * 获取只读连接
+ * 如果当前线程正持有写连接，则直接使用写连接，以便读取到事务中尚未提交的
+ * 修改；如果当前线程已经占用了一个只读连接，则继续使用该连接。
+ * @returns 打开连接失败或者等待空闲连接超时时返回 NULL
+ */
+static DB_Connection DB_AcquireReader(void)
+{
+	size_t i;
+	int64_t start = LCUI_GetTime();
+	DB_Connection conn = NULL;
+	LCUI_Thread tid = LCUIThread_SelfID();
+
+	LCUIMutex_Lock(&self.mutex);
+	if (self.writer.refs > 0 && self.writer.owner == tid) {
+		self.writer.refs += 1;
+		LCUIMutex_Unlock(&self.mutex);
+		return &self.writer;
+	}
+	for (i = 0; i < self.n_readers; ++i) {
+		if (self.readers[i]->refs > 0 && self.readers[i]->owner == tid) {
+			conn = self.readers[i];
+			break;
+		}
+	}
+	while (!conn) {
+		for (i = 0; i < self.n_readers; ++i) {
+			if (self.readers[i]->refs < 1) {
+				conn = self.readers[i];
+				break;
+			}
+		}
+		if (conn || self.n_readers >= DB_MAX_READERS) {
+			if (conn) {
+				continue;
+			}
+			if (LCUI_GetTimeDelta(start) >= DB_BUSY_TIMEOUT) {
+				LCUIMutex_Unlock(&self.mutex);
+				printf("[database] no reader available after "
+				       "%dms\n", DB_BUSY_TIMEOUT);
+				return NULL;
+			}
+			LCUICond_TimedWait(&self.cond, &self.mutex, 1000);
+			continue;
+		}
+		conn = calloc(1, sizeof(DB_ConnectionRec));
+		conn->db = DB_Open(self.path, SQLITE_OPEN_READONLY);
+		if (!conn->db) {
+			free(conn);
+			LCUIMutex_Unlock(&self.mutex);
+			return NULL;
+		}
+		self.readers[self.n_readers++] = conn;
+	}
+	conn->owner = tid;
+	conn->refs += 1;
+	LCUIMutex_Unlock(&self.mutex);
+	return conn;
+}
+
+/** 读取当前行中除路径以外的文件信息 */
+static void DB_ReadFile(sqlite3_stmt *stmt, DB_File file)
+{
 	file->id = sqlite3_column_int(stmt, 0);
 	file->did = sqlite3_column_int(stmt, 1);
 	file->score = sqlite3_column_int(stmt, 2);
-	path = (const char *)sqlite3_column_text(stmt, 3);
 	file->width = sqlite3_column_int(stmt, 4);
 	file->height = sqlite3_column_int(stmt, 5);
 	file->create_time = sqlite3_column_int(stmt, 6);
 	file->modify_time = sqlite3_column_int(stmt, 7);
-	if (path) {
-		len = strlen(path) + 1;
-		file->path = malloc(len * sizeof(char));
-		strncpy(file->path, path, len);
-	} else {
-		file->path = NULL;
-	}
-	return file;
 }
 
-DB_File DB_GetFile(const char *filepath)
+/**
+ * 从数据库中加载文件表的镜像
+ * 加载到新的镜像中，不需要锁定当前的镜像。
+ */
+static FileColumns DB_LoadFileColumns(DB_Connection conn)
 {
-	sqlite3_stmt *stmt = self.stmts[SQL_GET_FILE];
-	sqlite3_reset(stmt);
-	sqlite3_bind_text(stmt, 1, filepath, -1, NULL);
-	return DB_LoadFile(stmt);
+	int ret;
+	DB_FileRec file;
+	sqlite3_stmt *stmt;
+	FileColumns data;
+
+	data = FileColumns_Create();
+	if (!data) {
+		return NULL;
+	}
+	stmt = DB_PrepareCached(conn, sql_get_file_columns);
+	if (!stmt) {
+		FileColumns_Destroy(data);
+		return NULL;
+	}
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		DB_ReadFile(stmt, &file);
+		file.path = (char *)sqlite3_column_text(stmt, 3);
+		FileColumns_Set(data, &file, sqlite3_column_int(stmt, 8));
+	}
+	DB_ReleaseCached(conn, stmt);
+	if (ret != SQLITE_DONE) {
+		FileColumns_Destroy(data);
+		return NULL;
+	}
+	printf("[database] loaded %zu files into memory\n",
+	       FileColumns_GetLength(data));
+	return data;
 }
 
-static size_t DB_GetTagsBySQL(DB_Tag **outlist, const char *sql)
+/**
+ * 重新读取修改过的文件记录，调用前需要锁定镜像
+ * 先从镜像中移除这些文件，再读取仍然存在的文件并重新添加，这样被删除的文件
+ * 就不会再出现在镜像中。
+ */
+static int DB_ReloadChangedFiles(DB_Connection conn)
 {
-	DB_Tag *list, tag;
-	sqlite3_stmt *stmt;
-	size_t i, total = 0;
-	const char *name;
 	int ret;
+	uint32_t id = 0;
+	DB_FileRec file;
+	sqlite3_stmt *stmt;
 
-	sqlite3_prepare_v2(self.db, sql_get_tag_total, -1, &stmt, NULL);
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_ROW) {
-		total = sqlite3_column_int(stmt, 0);
+	while (Bitmap_Next(self.columns.changed, id, &id)) {
+		FileColumns_Remove(self.columns.data, (int)id);
+		if (id == UINT32_MAX) {
+			break;
+		}
+		++id;
 	}
-	sqlite3_finalize(stmt);
-	if (total == 0) {
-		*outlist = NULL;
+	stmt = DB_PrepareCached(conn, sql_get_changed_file_columns);
+	if (!stmt) {
+		return -1;
+	}
+	sqlite3_bind_pointer(stmt, 1, self.columns.changed, DB_TAGSET_TYPE,
+			     NULL);
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		DB_ReadFile(stmt, &file);
+		file.path = (char *)sqlite3_column_text(stmt, 3);
+		FileColumns_Set(self.columns.data, &file,
+				sqlite3_column_int(stmt, 8));
+	}
+	DB_ReleaseCached(conn, stmt);
+	self.columns.version += 1;
+	return ret == SQLITE_DONE ? 0 : -1;
+}
+
+/**
+ * 确保镜像可用，调用前需要锁定镜像，返回时仍然锁定
+ * 加载期间不持有锁，写连接可以继续记录修改过的文件。加载的结果是某一时刻
+ * 的快照，替换进来后再重新读取加载期间修改过的文件，但不清除这些记录，因为
+ * 其中可能有尚未提交的修改，它们会在写连接释放时再同步一次。
+ * @returns 镜像可用时返回 0，其它线程正在加载或者加载失败时返回 -1
+ */
+static int DB_PrepareFileColumns(DB_Connection conn)
+{
+	FileColumns data;
+
+	if (!self.columns.enabled || self.columns.loading) {
+		return -1;
+	}
+	if (self.columns.data && !self.columns.dirty) {
 		return 0;
 	}
-	list = malloc(sizeof(DB_Dir) * (total + 1));
-	if (!list) {
+	self.columns.loading = 1;
+	self.columns.dirty = 0;
+	LCUIMutex_Unlock(&self.columns.mutex);
+	data = DB_LoadFileColumns(conn);
+	LCUIMutex_Lock(&self.columns.mutex);
+	self.columns.loading = 0;
+	/* 加载期间有事务回滚，或者镜像被禁用了 */
+	if (!data || self.columns.dirty || !self.columns.enabled) {
+		self.columns.dirty = 1;
+		if (data) {
+			FileColumns_Destroy(data);
+		}
 		return -1;
 	}
-	list[total] = NULL;
-	sqlite3_prepare_v2(self.db, sql, -1, &stmt, NULL);
-	for (i = 0; i < total; ++i) {
-		ret = sqlite3_step(stmt);
-		if (ret != SQLITE_ROW) {
-			list[i] = NULL;
-			break;
+	if (self.columns.data) {
+		FileColumns_Destroy(self.columns.data);
+	}
+	self.columns.data = data;
+	self.columns.version += 1;
+	if (self.columns.changed &&
+	    Bitmap_GetCardinality(self.columns.changed) > 0 &&
+	    DB_ReloadChangedFiles(conn) != 0) {
+		self.columns.dirty = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/** 将写连接修改过的文件记录同步到镜像中，此时修改都已提交 */
+static void DB_SyncFileColumns(DB_Connection conn)
+{
+	size_t n;
+
+	LCUIMutex_Lock(&self.columns.mutex);
+	/* 正在加载时保留修改记录，等加载完后再处理 */
+	if (!self.columns.changed || self.columns.loading) {
+		LCUIMutex_Unlock(&self.columns.mutex);
+		return;
+	}
+	/* 下次加载时会读到这些修改 */
+	if (!self.columns.data || self.columns.dirty) {
+		Bitmap_Clear(self.columns.changed);
+		LCUIMutex_Unlock(&self.columns.mutex);
+		return;
+	}
+	n = Bitmap_GetCardinality(self.columns.changed);
+	if (n < 1) {
+		LCUIMutex_Unlock(&self.columns.mutex);
+		return;
+	}
+	/* 修改的文件太多时，不如在下次查询时重新加载 */
+	if (n * 4 > FileColumns_GetLength(self.columns.data) ||
+	    DB_ReloadChangedFiles(conn) != 0) {
+		self.columns.dirty = 1;
+	}
+	Bitmap_Clear(self.columns.changed);
+	LCUIMutex_Unlock(&self.columns.mutex);
+}
+
+/** 释放连接，引用次数为 0 时它可以被其它线程使用 */
+static void DB_ReleaseConnection(DB_Connection conn)
+{
+	/* 写操作都已结束，事务中的修改也已提交，可以同步镜像了 */
+	if (conn == &self.writer && conn->refs == 1 &&
+	    self.transaction_depth == 0) {
+		DB_SyncFileColumns(conn);
+	}
+	LCUIMutex_Lock(&self.mutex);
+	conn->refs -= 1;
+	if (conn->refs < 1) {
+		LCUICond_Broadcast(&self.cond);
+	}
+	LCUIMutex_Unlock(&self.mutex);
+}
+
+static void DB_ClearTagIndex(void)
+{
+	size_t i;
+
+	for (i = 0; i < self.tag_index.n_tags; ++i) {
+		if (self.tag_index.tags[i]) {
+			Bitmap_Destroy(self.tag_index.tags[i]);
 		}
-		tag = malloc(sizeof(DB_TagRec));
-		if (!tag) {
-			list[i] = NULL;
-			break;
+	}
+	free(self.tag_index.tags);
+	self.tag_index.tags = NULL;
+	self.tag_index.n_tags = 0;
+}
+
+/** 获取标签的位图，如果不存在则创建，调用前需要锁定标签索引 */
+static Bitmap DB_GetTagBitmap(int tid)
+{
+	size_t n;
+	Bitmap *tags;
+
+	if (tid < 0) {
+		return NULL;
+	}
+	if ((size_t)tid >= self.tag_index.n_tags) {
+		n = (size_t)tid + 16;
+		tags = realloc(self.tag_index.tags, sizeof(Bitmap) * n);
+		if (!tags) {
+			return NULL;
+		}
+		memset(tags + self.tag_index.n_tags, 0,
+		       sizeof(Bitmap) * (n - self.tag_index.n_tags));
+		self.tag_index.tags = tags;
+		self.tag_index.n_tags = n;
+	}
+	if (!self.tag_index.tags[tid]) {
+		self.tag_index.tags[tid] = Bitmap_Create();
+	}
+	return self.tag_index.tags[tid];
+}
+
+/** 从数据库中加载标签索引，调用前需要锁定标签索引 */
+static int DB_LoadTagIndex(DB_Connection conn)
+{
+	int ret;
+	Bitmap bitmap;
+	sqlite3_stmt *stmt;
+
+	DB_ClearTagIndex();
+	ret = sqlite3_prepare_v2(conn->db,
+				 "SELECT tid, fid FROM file_tag_relation "
+				 "ORDER BY tid, fid;",
+				 -1, &stmt, NULL);
+	if (ret != SQLITE_OK) {
+		printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+		return -1;
+	}
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		bitmap = DB_GetTagBitmap(sqlite3_column_int(stmt, 0));
+		if (bitmap) {
+			Bitmap_Add(bitmap, (uint32_t)sqlite3_column_int(stmt, 1));
 		}
-		name = (const char *)sqlite3_column_text(stmt, 1);
-		tag->id = sqlite3_column_int(stmt, 0);
-		tag->name = strdup(name);
-		tag->count = sqlite3_column_int(stmt, 2);
-		list[i] = tag;
 	}
 	sqlite3_finalize(stmt);
-	*outlist = list;
-	return i;
+	/* 被中断时只加载了一部分，下次再重新加载 */
+	if (ret != SQLITE_DONE) {
+		return -1;
+	}
+	self.tag_index.dirty = 0;
+	return 0;
+}
+
+static void DB_UpdateTagIndex(int tid, int fid, int add)
+{
+	Bitmap bitmap;
+
+	LCUIMutex_Lock(&self.columns.mutex);
+	self.columns.version += 1;
+	LCUIMutex_Unlock(&self.columns.mutex);
+	LCUIMutex_Lock(&self.tag_index.mutex);
+	bitmap = DB_GetTagBitmap(tid);
+	if (bitmap) {
+		if (add) {
+			Bitmap_Add(bitmap, (uint32_t)fid);
+		} else {
+			Bitmap_Remove(bitmap, (uint32_t)fid);
+		}
+	}
+	LCUIMutex_Unlock(&self.tag_index.mutex);
+}
+
+/**
+ * 监听写连接对数据行的修改
+ * 删除文件时会级联删除它的标签关系，但 SQLite 不会告诉我们删除了哪些关系，
+ * 所以在删除文件时将它从所有标签的位图中移除。
+ */
+static void DB_OnRowChanged(void *arg, int op, const char *dbname,
+			    const char *table, sqlite3_int64 rowid)
+{
+	size_t i;
+
+	if (strcmp(table, "file") != 0) {
+		return;
+	}
+	LCUIMutex_Lock(&self.columns.mutex);
+	if (self.columns.changed) {
+		Bitmap_Add(self.columns.changed, (uint32_t)rowid);
+	}
+	LCUIMutex_Unlock(&self.columns.mutex);
+	if (op != SQLITE_DELETE) {
+		return;
+	}
+	LCUIMutex_Lock(&self.tag_index.mutex);
+	for (i = 0; i < self.tag_index.n_tags; ++i) {
+		if (self.tag_index.tags[i]) {
+			Bitmap_Remove(self.tag_index.tags[i], (uint32_t)rowid);
+		}
+	}
+	LCUIMutex_Unlock(&self.tag_index.mutex);
+}
+
+static void DB_OnRollback(void *arg)
+{
+	/* 回滚后缓存的文件夹记录可能已经不存在了 */
+	free(self.folder.path);
+	self.folder.path = NULL;
+	self.folder.id = 0;
+	LCUIMutex_Lock(&self.tag_index.mutex);
+	self.tag_index.dirty = 1;
+	LCUIMutex_Unlock(&self.tag_index.mutex);
+	LCUIMutex_Lock(&self.columns.mutex);
+	self.columns.dirty = 1;
+	LCUIMutex_Unlock(&self.columns.mutex);
+}
+
+/**
+ * 根据查询条件中的标签计算文件集合
+ * @param[out] excluded 当没有必须拥有的标签时，用于保存需要排除的文件集合
+ * @returns 文件集合，没有标签条件时返回 NULL
+ */
+static Bitmap DB_GetTagSet(DB_Connection conn, const DB_QueryTerms terms,
+			   Bitmap *excluded)
+{
+	size_t i;
+	Bitmap set = NULL, any = NULL, bitmap;
+
+	*excluded = NULL;
+	LCUIMutex_Lock(&self.tag_index.mutex);
+	if (self.tag_index.dirty) {
+		DB_LoadTagIndex(conn);
+	}
+	if (terms->tags) {
+		for (i = 0; i < terms->n_tags; ++i) {
+			bitmap = DB_GetTagBitmap(terms->tags[i]->id);
+			if (!bitmap) {
+				continue;
+			}
+			if (set) {
+				Bitmap_And(set, bitmap);
+			} else {
+				set = Bitmap_Copy(bitmap);
+			}
+		}
+	}
+	if (terms->any_tags && terms->n_any_tags > 0) {
+		any = Bitmap_Create();
+		for (i = 0; i < terms->n_any_tags; ++i) {
+			bitmap = DB_GetTagBitmap(terms->any_tags[i]->id);
+			if (bitmap) {
+				Bitmap_Or(any, bitmap);
+			}
+		}
+		if (set) {
+			Bitmap_And(set, any);
+			Bitmap_Destroy(any);
+		} else {
+			set = any;
+		}
+	}
+	if (terms->excluded_tags && terms->n_excluded_tags > 0) {
+		bitmap = Bitmap_Create();
+		for (i = 0; i < terms->n_excluded_tags; ++i) {
+			any = DB_GetTagBitmap(terms->excluded_tags[i]->id);
+			if (any) {
+				Bitmap_Or(bitmap, any);
+			}
+		}
+		if (set) {
+			Bitmap_AndNot(set, bitmap);
+			Bitmap_Destroy(bitmap);
+		} else {
+			*excluded = bitmap;
+		}
+	}
+	LCUIMutex_Unlock(&self.tag_index.mutex);
+	return set;
+}
+
+int DB_Init(const char *dbpath)
+{
+	int i, ret;
+	char *errmsg;
+	printf("[database] init ...\n");
+	LCUIMutex_Init(&self.mutex);
+	LCUIMutex_Init(&self.tag_index.mutex);
+	LCUIMutex_Init(&self.columns.mutex);
+	LCUICond_Init(&self.cond);
+	self.path = strdup(dbpath);
+	self.writer.db =
+	    DB_Open(dbpath, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+	if (!self.writer.db) {
+		return -1;
+	}
+	/* 使用 WAL 模式，让只读连接在写入时也能读取数据 */
+	ret = sqlite3_exec(self.writer.db,
+			   "PRAGMA journal_mode=WAL;PRAGMA synchronous=NORMAL;",
+			   NULL, NULL, &errmsg);
+	if (ret != SQLITE_OK) {
+		printf("[database] error: %s\n", errmsg);
+		sqlite3_free(errmsg);
+	}
+	ret = sqlite3_exec(self.writer.db, sql_init, NULL, NULL, &errmsg);
+	if (ret != SQLITE_OK) {
+		printf("[database] error: %s\n", errmsg);
+		return -2;
+	}
+	if (DB_Migrate() != 0) {
+		return -3;
+	}
+	if (DB_LoadTagIndex(&self.writer) != 0) {
+		return -4;
+	}
+	sqlite3_update_hook(self.writer.db, DB_OnRowChanged, NULL);
+	sqlite3_rollback_hook(self.writer.db, DB_OnRollback, NULL);
+	strcpy(sql_add_file, sql_add_file_head);
+	strcat(sql_add_file, sql_add_file_values);
+	strcpy(sql_add_files, sql_add_file_head);
+	strcpy(sql_del_files, sql_del_files_head);
+	for (i = 0; i < FILE_BATCH_SIZE; ++i) {
+		if (i > 0) {
+			strcat(sql_add_files, ", ");
+			strcat(sql_del_files, ", ");
+		}
+		strcat(sql_add_files, sql_add_file_values);
+		strcat(sql_del_files, "?");
+	}
+	strcat(sql_del_files, ")");
+	self.sqls[SQL_ADD_FILE] = sql_add_file;
+	self.sqls[SQL_ADD_FILES] = sql_add_files;
+	self.sqls[SQL_DEL_FILE] = sql_del_file;
+	self.sqls[SQL_DEL_FILES] = sql_del_files;
+	self.sqls[SQL_GET_FILE] = sql_get_file;
+	self.sqls[SQL_ADD_DIR] = sql_add_dir;
+	self.sqls[SQL_GET_DIR] = sql_get_dir;
+	self.sqls[SQL_DEL_DIR] = sql_del_dir;
+	self.sqls[SQL_ADD_TAG] = sql_add_tag;
+	self.sqls[SQL_GET_TAG] = sql_get_tag;
+	self.sqls[SQL_ADD_FILE_TAG] = sql_file_add_tag;
+	self.sqls[SQL_DEL_FILE_TAG] = sql_file_del_tag;
+	self.sqls[SQL_SET_FILE_SIZE] = sql_file_set_size;
+	self.sqls[SQL_SET_FILE_SCORE] = sql_file_set_score;
+	self.sqls[SQL_SET_FILE_TIME_BY_PATH] = sql_file_set_time_by_path;
+	self.sqls[SQL_SET_FILE_TIME] = sql_file_set_time;
+	self.sqls[SQL_GET_FILE_TAGS] = sql_get_file_tags;
+	self.sqls[SQL_GET_DIR_LIST] = sql_get_dir_list;
+	self.sqls[SQL_GET_DIR_TOTAL] = sql_get_dir_total;
+	self.sqls[SQL_GET_FOLDER] = sql_get_folder;
+	self.sqls[SQL_ADD_FOLDER] = sql_add_folder;
+	self.sqls[SQL_DEL_EMPTY_FOLDERS] = sql_del_empty_folders;
+	self.sqls[SQL_ADD_FILE_TERMS] = sql_add_file_terms;
+	self.sqls[SQL_GET_MAX_FILE_ID] = sql_get_max_file_id;
+	printf("[database] init done\n");
+	return 0;
+}
+
+void DB_Exit(void)
+{
+	size_t i;
+
+	for (i = 0; i < self.n_readers; ++i) {
+		DB_CloseConnection(self.readers[i]);
+		free(self.readers[i]);
+		self.readers[i] = NULL;
+	}
+	self.n_readers = 0;
+	DB_CloseConnection(&self.writer);
+	free(self.folder.path);
+	free(self.path);
+	self.folder.path = NULL;
+	self.folder.id = 0;
+	self.path = NULL;
+	DB_ClearTagIndex();
+	DB_SetFileColumnsEnabled(0);
+	LCUICond_Destroy(&self.cond);
+	LCUIMutex_Destroy(&self.columns.mutex);
+	LCUIMutex_Destroy(&self.tag_index.mutex);
+	LCUIMutex_Destroy(&self.mutex);
+}
+
+static DB_Dir DB_LoadDir(sqlite3_stmt *stmt)
+{
+	DB_Dir dir;
+	const unsigned char *text;
+	dir = malloc(sizeof(DB_DirRec));
+	dir->id = sqlite3_column_int(stmt, 0);
+	dir->path = strdup((const char *)sqlite3_column_text(stmt, 1));
+	dir->visible = sqlite3_column_int(stmt, 3);
+	text = sqlite3_column_text(stmt, 2);
+	if (text) {
+		dir->token = strdup((const char *)text);
+	} else {
+		dir->token = NULL;
+	}
+	return dir;
+}
+
+DB_Dir DB_AddDir(const char *dirpath, const char *token, int visible)
+{
+	int ret;
+	DB_Dir dir = NULL;
+	sqlite3_stmt *stmt;
+	DB_Connection conn = DB_LockWriter();
+
+	stmt = DB_GetStmt(conn, SQL_ADD_DIR);
+	sqlite3_bind_text(stmt, 1, dirpath, -1, NULL);
+	sqlite3_bind_int(stmt, 3, visible ? 1 : 0);
+	if (token) {
+		sqlite3_bind_text(stmt, 2, token, -1, NULL);
+	}
+	ret = sqlite3_step(stmt);
+	if (ret != SQLITE_DONE) {
+		printf("[database] error: %s\n", dirpath);
+		DB_ReleaseConnection(conn);
+		return NULL;
+	}
+	stmt = DB_GetStmt(conn, SQL_GET_DIR);
+	sqlite3_bind_text(stmt, 1, dirpath, -1, NULL);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_ROW) {
+		dir = DB_LoadDir(stmt);
+	}
+	sqlite3_reset(stmt);
+	DB_ReleaseConnection(conn);
+	return dir;
+}
+
+void DBDir_Release(DB_Dir dir)
+{
+	free(dir->path);
+	if (dir->token) {
+		free(dir->token);
+	}
+	dir->path = NULL;
+	dir->token = NULL;
+	free(dir);
+}
+
+void DB_DeleteDir(DB_Dir dir)
+{
+	char sep[2] = { PATH_SEP, 0 };
+	char sep_next[2] = { PATH_SEP + 1, 0 };
+	sqlite3_stmt *stmt;
+	DB_Connection conn = DB_LockWriter();
+
+	stmt = DB_GetStmt(conn, SQL_DEL_DIR);
+	sqlite3_bind_int(stmt, 1, dir->id);
+	sqlite3_step(stmt);
+	stmt = DB_GetStmt(conn, SQL_DEL_EMPTY_FOLDERS);
+	sqlite3_bind_text(stmt, 1, dir->path, -1, NULL);
+	sqlite3_bind_text(stmt, 2, sep_next, -1, NULL);
+	sqlite3_bind_text(stmt, 3, sep, -1, NULL);
+	sqlite3_step(stmt);
+	free(self.folder.path);
+	self.folder.path = NULL;
+	self.folder.id = 0;
+	DB_ReleaseConnection(conn);
+}
+
+int DB_GetDirs(DB_Dir **outlist)
+{
+	DB_Dir *list;
+	sqlite3_stmt *stmt;
+	int ret, i, total = 0;
+	DB_Connection conn = DB_AcquireReader();
+
+	*outlist = NULL;
+	if (!conn) {
+		return -1;
+	}
+	stmt = DB_GetStmt(conn, SQL_GET_DIR_TOTAL);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_ROW) {
+		total = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_reset(stmt);
+	if (total == 0) {
+		DB_ReleaseConnection(conn);
+		*outlist = NULL;
+		return 0;
+	}
+	list = malloc(sizeof(DB_Dir) * (total + 1));
+	if (!list) {
+		DB_ReleaseConnection(conn);
+		return -1;
+	}
+	list[total] = NULL;
+	stmt = DB_GetStmt(conn, SQL_GET_DIR_LIST);
+	for (i = 0; i < total; ++i) {
+		ret = sqlite3_step(stmt);
+		if (ret != SQLITE_ROW) {
+			list[i] = NULL;
+			break;
+		}
+		list[i] = DB_LoadDir(stmt);
+	}
+	sqlite3_reset(stmt);
+	DB_ReleaseConnection(conn);
+	*outlist = list;
+	return i;
+}
+
+DB_Tag DB_AddTag(const char *tagname)
+{
+	int ret;
+	DB_Tag tag = NULL;
+	sqlite3_stmt *stmt;
+	DB_Connection conn = DB_LockWriter();
+
+	stmt = DB_GetStmt(conn, SQL_ADD_TAG);
+	sqlite3_bind_text(stmt, 1, tagname, -1, NULL);
+	ret = sqlite3_step(stmt);
+	if (ret != SQLITE_DONE) {
+		printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+		DB_ReleaseConnection(conn);
+		return NULL;
+	}
+	stmt = DB_GetStmt(conn, SQL_GET_TAG);
+	sqlite3_bind_text(stmt, 1, tagname, -1, NULL);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_ROW) {
+		tag = malloc(sizeof(DB_TagRec));
+		tag->id = sqlite3_column_int(stmt, 0);
+		tag->name = strdup(tagname);
+		tag->count = 0;
+	}
+	sqlite3_reset(stmt);
+	DB_ReleaseConnection(conn);
+	return tag;
+}
+
+/**
+ * 获取文件夹标识号
+ * 如果文件夹记录不存在则创建它，在源文件夹范围内的上级文件夹也会一并创建。
+ * @param[in] path 文件夹路径，只取前 len 个字符
+ */
+static int DB_GetFolderId(DB_Connection conn, DB_Dir dir, const char *path,
+			  size_t len)
+{
+	int id, parent_id = 0;
+	sqlite3_stmt *stmt;
+
+	if (self.folder.path && strncmp(self.folder.path, path, len) == 0 &&
+	    self.folder.path[len] == 0) {
+		return self.folder.id;
+	}
+	stmt = DB_GetStmt(conn, SQL_GET_FOLDER);
+	sqlite3_bind_text(stmt, 1, path, (int)len, NULL);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		id = sqlite3_column_int(stmt, 0);
+		sqlite3_reset(stmt);
+	} else {
+		if (len > strlen(dir->path)) {
+			parent_id = DB_GetFolderId(
+			    conn, dir, path, DirNameLength(path, len));
+		}
+		stmt = DB_GetStmt(conn, SQL_ADD_FOLDER);
+		if (parent_id > 0) {
+			sqlite3_bind_int(stmt, 1, parent_id);
+		} else {
+			sqlite3_bind_null(stmt, 1);
+		}
+		sqlite3_bind_text(stmt, 2, path, (int)len, NULL);
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			printf("[database] error: %s\n",
+			       sqlite3_errmsg(conn->db));
+			return 0;
+		}
+		id = (int)sqlite3_last_insert_rowid(conn->db);
+	}
+	free(self.folder.path);
+	self.folder.path = malloc((len + 1) * sizeof(char));
+	strncpy(self.folder.path, path, len);
+	self.folder.path[len] = 0;
+	self.folder.id = id;
+	return id;
+}
+
+/** 绑定文件记录的字段值，返回下一个参数的位置 */
+static int DB_BindFile(DB_Connection conn, sqlite3_stmt *stmt, int col,
+		       DB_Dir dir, const DB_FileRec *file)
+{
+	int folder_id;
+
+	folder_id =
+	    DB_GetFolderId(conn, dir, file->path,
+			   DirNameLength(file->path, strlen(file->path)));
+	sqlite3_bind_int(stmt, col++, dir->id);
+	if (folder_id > 0) {
+		sqlite3_bind_int(stmt, col++, folder_id);
+	} else {
+		sqlite3_bind_null(stmt, col++);
+	}
+	sqlite3_bind_text(stmt, col++, file->path, -1, NULL);
+	sqlite3_bind_int(stmt, col++, file->width);
+	sqlite3_bind_int(stmt, col++, file->height);
+	sqlite3_bind_int(stmt, col++, file->create_time);
+	sqlite3_bind_int(stmt, col++, file->modify_time);
+	return col;
+}
+
+static sqlite3_int64 DB_GetMaxFileId(DB_Connection conn)
+{
+	sqlite3_int64 id = 0;
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_GET_MAX_FILE_ID);
+
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		id = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_reset(stmt);
+	return id;
+}
+
+/** 为标识号大于 min_id 的文件建立词索引 */
+static int DB_AddFileTerms(DB_Connection conn, DB_Dir dir,
+			   sqlite3_int64 min_id)
+{
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_ADD_FILE_TERMS);
+
+	sqlite3_bind_int64(stmt, 1, (sqlite3_int64)strlen(dir->path));
+	sqlite3_bind_int64(stmt, 2, min_id);
+	if (sqlite3_step(stmt) != SQLITE_DONE) {
+		printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+		return -1;
+	}
+	return 0;
+}
+
+void DB_AddFile(DB_Dir dir, const char *filepath, int ctime, int mtime)
+{
+	DB_FileRec file = { 0 };
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_ADD_FILE);
+
+	file.path = (char *)filepath;
+	file.create_time = ctime;
+	file.modify_time = mtime;
+	DB_BindFile(conn, stmt, 1, dir, &file);
+	if (sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(conn->db) > 0) {
+		DB_AddFileTerms(conn, dir,
+				sqlite3_last_insert_rowid(conn->db) - 1);
+	}
+	DB_ReleaseConnection(conn);
+}
+
+int DB_AddFiles(DB_Dir dir, const DB_FileRec *files, size_t n)
+{
+	int col, count = 0;
+	size_t i, j;
+	sqlite3_stmt *stmt;
+	sqlite3_int64 max_id;
+	DB_Connection conn = DB_LockWriter();
+
+	max_id = DB_GetMaxFileId(conn);
+	for (i = 0; i + FILE_BATCH_SIZE <= n; i += FILE_BATCH_SIZE) {
+		stmt = DB_GetStmt(conn, SQL_ADD_FILES);
+		for (j = 0, col = 1; j < FILE_BATCH_SIZE; ++j) {
+			col = DB_BindFile(conn, stmt, col, dir, &files[i + j]);
+		}
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			printf("[database] error: %s\n",
+			       sqlite3_errmsg(conn->db));
+			count = -1;
+			break;
+		}
+		count += sqlite3_changes(conn->db);
+	}
+	/* 剩余不足一批的记录逐条添加 */
+	for (; count >= 0 && i < n; ++i) {
+		stmt = DB_GetStmt(conn, SQL_ADD_FILE);
+		DB_BindFile(conn, stmt, 1, dir, &files[i]);
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			printf("[database] error: %s\n",
+			       sqlite3_errmsg(conn->db));
+			count = -1;
+			break;
+		}
+		count += sqlite3_changes(conn->db);
+	}
+	if (count > 0 && DB_AddFileTerms(conn, dir, max_id) != 0) {
+		count = -1;
+	}
+	DB_ReleaseConnection(conn);
+	return count;
+}
+
+void DB_UpdateFileTime(DB_Dir dir, const char *filepath, int ctime, int mtime)
+{
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_SET_FILE_TIME_BY_PATH);
+
+	sqlite3_bind_int(stmt, 1, ctime);
+	sqlite3_bind_int(stmt, 2, mtime);
+	sqlite3_bind_int(stmt, 3, dir->id);
+	sqlite3_bind_text(stmt, 4, filepath, -1, NULL);
+	sqlite3_step(stmt);
+	DB_ReleaseConnection(conn);
+}
+
+void DB_DeleteFile(const char *filepath)
+{
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_DEL_FILE);
+
+	sqlite3_bind_text(stmt, 1, filepath, -1, NULL);
+	sqlite3_step(stmt);
+	DB_ReleaseConnection(conn);
+}
+
+int DB_DeleteFiles(char *const *paths, size_t n)
+{
+	int count = 0;
+	size_t i, j;
+	sqlite3_stmt *stmt;
+	DB_Connection conn = DB_LockWriter();
+
+	for (i = 0; i + FILE_BATCH_SIZE <= n; i += FILE_BATCH_SIZE) {
+		stmt = DB_GetStmt(conn, SQL_DEL_FILES);
+		for (j = 0; j < FILE_BATCH_SIZE; ++j) {
+			sqlite3_bind_text(stmt, (int)j + 1, paths[i + j], -1,
+					  NULL);
+		}
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			printf("[database] error: %s\n",
+			       sqlite3_errmsg(conn->db));
+			count = -1;
+			break;
+		}
+		count += sqlite3_changes(conn->db);
+	}
+	for (; count >= 0 && i < n; ++i) {
+		stmt = DB_GetStmt(conn, SQL_DEL_FILE);
+		sqlite3_bind_text(stmt, 1, paths[i], -1, NULL);
+		if (sqlite3_step(stmt) != SQLITE_DONE) {
+			printf("[database] error: %s\n",
+			       sqlite3_errmsg(conn->db));
+			count = -1;
+			break;
+		}
+		count += sqlite3_changes(conn->db);
+	}
+	DB_ReleaseConnection(conn);
+	return count;
+}
+
+int DB_CountFiles(DB_Dir dir)
+{
+	int total = 0;
+	sqlite3_stmt *stmt;
+	DB_Connection conn = DB_AcquireReader();
+
+	if (!conn) {
+		return 0;
+	}
+	if (dir) {
+		sqlite3_prepare_v2(conn->db,
+				   "SELECT file_count FROM dir WHERE id = ?;",
+				   -1, &stmt, NULL);
+		sqlite3_bind_int(stmt, 1, dir->id);
+	} else {
+		sqlite3_prepare_v2(conn->db,
+				   "SELECT IFNULL(SUM(file_count), 0) FROM dir;",
+				   -1, &stmt, NULL);
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		total = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	DB_ReleaseConnection(conn);
+	return total;
+}
+
+DB_File DBFile_Dup(DB_File file)
+{
+	DB_File f = malloc(sizeof(DB_FileRec));
+	*f = *file;
+	f->path = strdup(file->path);
+	return f;
+}
+
+void DBFile_Release(DB_File file)
+{
+	free(file->path);
+	file->path = NULL;
+	free(file);
+}
+
+static DB_File DB_LoadFile(sqlite3_stmt *stmt)
+{
+	size_t len;
+	DB_File file;
+	const char *path;
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
+		return NULL;
+	}
+	file = malloc(sizeof(DB_FileRec));
+	DB_ReadFile(stmt, file);
+	path = (const char *)sqlite3_column_text(stmt, 3);
+	if (path) {
+		len = strlen(path) + 1;
+		file->path = malloc(len * sizeof(char));
+		strncpy(file->path, path, len);
+	} else {
+		file->path = NULL;
+	}
+	return file;
+}
+
+DB_File DB_GetFile(const char *filepath)
+{
+	DB_File file;
+	sqlite3_stmt *stmt;
+	DB_Connection conn = DB_AcquireReader();
+
+	if (!conn) {
+		return NULL;
+	}
+	stmt = DB_GetStmt(conn, SQL_GET_FILE);
+	sqlite3_bind_text(stmt, 1, filepath, -1, NULL);
+	file = DB_LoadFile(stmt);
+	sqlite3_reset(stmt);
+	DB_ReleaseConnection(conn);
+	return file;
+}
+
+static size_t DB_GetTagsBySQL(DB_Tag **outlist, const char *sql)
+{
+	DB_Tag *list, tag;
+	sqlite3_stmt *stmt;
+	size_t i, total = 0;
+	const char *name;
+	int ret;
+	DB_Connection conn = DB_AcquireReader();
+
+	*outlist = NULL;
+	if (!conn) {
+		return 0;
+	}
+	sqlite3_prepare_v2(conn->db, sql_get_tag_total, -1, &stmt, NULL);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_ROW) {
+		total = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	if (total == 0) {
+		DB_ReleaseConnection(conn);
+		*outlist = NULL;
+		return 0;
+	}
+	list = malloc(sizeof(DB_Dir) * (total + 1));
+	if (!list) {
+		DB_ReleaseConnection(conn);
+		return -1;
+	}
+	list[total] = NULL;
+	sqlite3_prepare_v2(conn->db, sql, -1, &stmt, NULL);
+	for (i = 0; i < total; ++i) {
+		ret = sqlite3_step(stmt);
+		if (ret != SQLITE_ROW) {
+			list[i] = NULL;
+			break;
+		}
+		tag = malloc(sizeof(DB_TagRec));
+		if (!tag) {
+			list[i] = NULL;
+			break;
+		}
+		name = (const char *)sqlite3_column_text(stmt, 1);
+		tag->id = sqlite3_column_int(stmt, 0);
+		tag->name = strdup(name);
+		tag->count = sqlite3_column_int(stmt, 2);
+		list[i] = tag;
+	}
+	sqlite3_finalize(stmt);
+	DB_ReleaseConnection(conn);
+	*outlist = list;
+	return i;
+}
+
+size_t DB_GetTags(DB_Tag **outlist)
+{
+	return DB_GetTagsBySQL(outlist, sql_get_tag_list);
+}
+
+size_t DB_GetTagsOrderById(DB_Tag **outlist)
+{
+	return DB_GetTagsBySQL(outlist, sql_get_tag_list_order_by_id);
+}
+
+int DBFile_RemoveTag(DB_File file, DB_Tag tag)
+{
+	int ret;
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_DEL_FILE_TAG);
+
+	sqlite3_bind_int(stmt, 1, file->id);
+	sqlite3_bind_int(stmt, 2, tag->id);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_DONE) {
+		if (sqlite3_changes(conn->db) > 0) {
+			DB_UpdateTagIndex(tag->id, file->id, 0);
+		}
+		DB_ReleaseConnection(conn);
+		return 0;
+	}
+	printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+	DB_ReleaseConnection(conn);
+	return -1;
+}
+
+int DBFile_AddTag(DB_File file, DB_Tag tag)
+{
+	int ret;
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_ADD_FILE_TAG);
+
+	sqlite3_bind_int(stmt, 1, file->id);
+	sqlite3_bind_int(stmt, 2, tag->id);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_DONE) {
+		if (sqlite3_changes(conn->db) > 0) {
+			DB_UpdateTagIndex(tag->id, file->id, 1);
+		}
+		DB_ReleaseConnection(conn);
+		return 0;
+	}
+	printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+	DB_ReleaseConnection(conn);
+	return -1;
+}
+
+size_t DBFile_GetTags(DB_File file, DB_Tag **outtags)
+{
+	const char *name;
+	size_t len, total = 0;
+	sqlite3_stmt *stmt;
+	DB_Tag tag, *tags = NULL, *newtags;
+	DB_Connection conn = DB_AcquireReader();
+
+	*outtags = NULL;
+	if (!conn) {
+		return 0;
+	}
+	stmt = DB_GetStmt(conn, SQL_GET_FILE_TAGS);
+	sqlite3_bind_int(stmt, 1, file->id);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		++total;
+		newtags = realloc(tags, (total + 1) * sizeof(DB_Tag));
+		if (!newtags) {
+			sqlite3_reset(stmt);
+			DB_ReleaseConnection(conn);
+			free(tags);
+			return -ENOMEM;
+		}
+		tags = newtags;
+		tag = malloc(sizeof(DB_TagRec));
+		tag->id = sqlite3_column_int(stmt, 0);
+		name = (const char *)sqlite3_column_text(stmt, 1);
+		len = strlen(name) + 1;
+		tag->name = malloc(len * sizeof(char));
+		strncpy(tag->name, name, len);
+		tag->count = sqlite3_column_int(stmt, 2);
+		tags[total - 1] = tag;
+	}
+	sqlite3_reset(stmt);
+	DB_ReleaseConnection(conn);
+	if (total > 0) {
+		tags[total] = NULL;
+	}
+	*outtags = tags;
+	return total;
+}
+
+int DBFile_SetScore(DB_File file, int score)
+{
+	int ret;
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_SET_FILE_SCORE);
+
+	sqlite3_bind_int(stmt, 1, score);
+	sqlite3_bind_int(stmt, 2, file->id);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_DONE) {
+		DB_ReleaseConnection(conn);
+		return 0;
+	}
+	printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+	DB_ReleaseConnection(conn);
+	return -1;
+}
+
+int DBFile_SetTime(DB_File file, int ctime, int mtime)
+{
+	int ret;
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_SET_FILE_TIME);
+
+	sqlite3_bind_int(stmt, 1, ctime);
+	sqlite3_bind_int(stmt, 2, mtime);
+	sqlite3_bind_int(stmt, 3, file->id);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_DONE) {
+		DB_ReleaseConnection(conn);
+		file->create_time = ctime;
+		file->modify_time = mtime;
+		return 0;
+	}
+	printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+	DB_ReleaseConnection(conn);
+	return -1;
+}
+
+int DBFile_SetSize(DB_File file, int width, int height)
+{
+	int ret;
+	DB_Connection conn = DB_LockWriter();
+	sqlite3_stmt *stmt = DB_GetStmt(conn, SQL_SET_FILE_SIZE);
+
+	sqlite3_bind_int(stmt, 1, width);
+	sqlite3_bind_int(stmt, 2, height);
+	sqlite3_bind_int(stmt, 3, file->id);
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_DONE) {
+		DB_ReleaseConnection(conn);
+		file->width = width;
+		file->height = height;
+		return 0;
+	}
+	printf("[database] error: %s\n", sqlite3_errmsg(conn->db));
+	DB_ReleaseConnection(conn);
+	return -1;
+}
+
+DB_Tag DBTag_Dup(DB_Tag tag)
+{
+	size_t len;
+	DB_Tag newtag = malloc(sizeof(DB_TagRec));
+
+	newtag->id = tag->id;
+	len = strlen(tag->name);
+	newtag->name = strdup(tag->name);
+	newtag->count = 0;
+	return newtag;
+}
+
+void DBTag_Release(DB_Tag tag)
+{
+	free(tag->name);
+	tag->name = NULL;
+	free(tag);
+}
+
+static void DBQuery_BindParams(DB_Query query, sqlite3_stmt *stmt, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (query->params[i].tagset) {
+			sqlite3_bind_pointer(stmt, (int)i + 1,
+					     query->params[i].tagset,
+					     DB_TAGSET_TYPE, NULL);
+		} else if (query->params[i].text) {
+			sqlite3_bind_text(stmt, (int)i + 1,
+					  query->params[i].text, -1, NULL);
+		} else {
+			sqlite3_bind_int64(stmt, (int)i + 1,
+					   query->params[i].value);
+		}
+	}
+}
+
+int DBQuery_GetTotalFiles(DB_Query query)
+{
+	int total = 0;
+	sqlite3_stmt *stmt;
+
+	if (!query) {
+		return 0;
+	}
+	if (query->total >= 0) {
+		return query->total;
+	}
+	stmt = DB_PrepareCached(query->conn, query->sql_count);
+	if (!stmt) {
+		return 0;
+	}
+	DBQuery_BindParams(query, stmt, query->n_count_params);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		total = sqlite3_column_int(stmt, 0);
+	}
+	DB_ReleaseCached(query->conn, stmt);
+	return total;
+}
+
+/** 将游标移动到当前行的文件 */
+static void DBQuery_UpdateCursor(DB_Query query, DB_File file)
+{
+	if (query->by_relevance) {
+		query->cursor.relevance = sqlite3_column_int(query->stmt, 8);
+	}
+	query->cursor.id = file->id;
+	query->cursor.score = file->score;
+	query->cursor.create_time = file->create_time;
+	query->cursor.modify_time = file->modify_time;
+}
+
+DB_File DBQuery_FetchFile(DB_Query query)
+{
+	DB_File file;
+
+	if (!query) {
+		return NULL;
+	}
+	if (!query->stmt) {
+		if (query->index >= query->result.length) {
+			return NULL;
+		}
+		file = DBFile_Dup(&query->result.files[query->index++]);
+	} else {
+		file = DB_LoadFile(query->stmt);
+	}
+	if (file) {
+		DBQuery_UpdateCursor(query, file);
+	}
+	return file;
+}
+
+/**
+ * 从内存池中分配内存
+ * 当前内存块的剩余空间不足时从新的内存块中分配，已分配的内存不会被移动。
+ */
+static char *DBArena_Alloc(DB_ArenaBlock *arena, size_t size)
+{
+	char *data;
+	size_t block_size;
+	DB_ArenaBlock block = *arena;
+
+	if (!block || block->used + size > block->size) {
+		block_size = size > DB_ARENA_BLOCK_SIZE ? size
+							: DB_ARENA_BLOCK_SIZE;
+		block = malloc(sizeof(DB_ArenaBlockRec) + block_size);
+		if (!block) {
+			return NULL;
+		}
+		block->size = block_size;
+		block->used = 0;
+		block->next = *arena;
+		*arena = block;
+	}
+	data = (char *)(block + 1) + block->used;
+	block->used += size;
+	return data;
+}
+
+void DBFilePage_Destroy(DB_FilePage page)
+{
+	DB_ArenaBlock block, next;
+
+	for (block = page->arena; block; block = next) {
+		next = block->next;
+		free(block);
+	}
+	free(page->files);
+	page->files = NULL;
+	page->arena = NULL;
+	page->length = 0;
+}
+
+size_t DBQuery_FetchFiles(DB_Query query, DB_FilePage page, size_t max_files)
+{
+	size_t len;
+	DB_File file;
+	DB_ArenaBlock arena = NULL;
+	const char *path;
+
+	DBFilePage_Destroy(page);
+	if (!query || max_files < 1) {
+		return 0;
+	}
+	page->files = malloc(max_files * sizeof(DB_FileRec));
+	if (!page->files) {
+		return 0;
+	}
+	while (page->length < max_files) {
+		file = &page->files[page->length];
+		if (!query->stmt) {
+			if (query->index >= query->result.length) {
+				break;
+			}
+			*file = query->result.files[query->index++];
+			path = file->path;
+			len = path ? strlen(path) + 1 : 0;
+		} else {
+			if (sqlite3_step(query->stmt) != SQLITE_ROW) {
+				break;
+			}
+			DB_ReadFile(query->stmt, file);
+			path = (const char *)sqlite3_column_text(query->stmt, 3);
+			len = sqlite3_column_bytes(query->stmt, 3) + 1;
+		}
+		file->path = path ? DBArena_Alloc(&arena, len) : NULL;
+		if (file->path) {
+			memcpy(file->path, path, len);
+		}
+		DBQuery_UpdateCursor(query, file);
+		page->length += 1;
+	}
+	page->arena = arena;
+	return page->length;
+}
+
+void DBQuery_GetCursor(DB_Query query, DB_QueryCursor cursor)
+{
+	if (query) {
+		*cursor = query->cursor;
+	}
+}
+
+void DBQuery_Interrupt(DB_Query query)
+{
+	if (query) {
+		sqlite3_interrupt(query->conn->db);
+	}
+}
+
+/**
+ * 获取排序键列表，最后一个排序键是文件标识号，用于保证排序结果唯一
+ * 有关键词且没有指定排序方式时按相关度从高到低排序。
+ */
+static size_t DB_GetSortKeys(const DB_QueryTerms terms, int by_relevance,
+			     DB_SortKey keys)
+{
+	size_t n = 0;
+
+	if (by_relevance) {
+		keys[n].column = "relevance";
+		keys[n].order = DESC;
+		keys[n].value = terms->cursor.relevance;
+		++n;
+	}
+	if (terms->create_time != NONE) {
+		keys[n].column = "f.create_time";
+		keys[n].order = terms->create_time;
+		keys[n].value = terms->cursor.create_time;
+		++n;
+	}
+	if (terms->modify_time != NONE) {
+		keys[n].column = "f.modify_time";
+		keys[n].order = terms->modify_time;
+		keys[n].value = terms->cursor.modify_time;
+		++n;
+	}
+	if (terms->score != NONE) {
+		keys[n].column = "f.score";
+		keys[n].order = terms->score;
+		keys[n].value = terms->cursor.score;
+		++n;
+	}
+	keys[n].column = "f.id";
+	keys[n].order = n > 0 ? keys[0].order : ASC;
+	keys[n].value = terms->cursor.id;
+	return n + 1;
+}
+
+static void DBSQLBuffer_Append(DB_SQLBuffer buf, const char *str)
+{
+	char *data;
+	size_t len = strlen(str);
+
+	if (buf->length + len + 1 > buf->size) {
+		buf->size = (buf->length + len + 1) * 2;
+		if (buf->size < 256) {
+			buf->size = 256;
+		}
+		data = realloc(buf->data, buf->size * sizeof(char));
+		if (!data) {
+			return;
+		}
+		buf->data = data;
+	}
+	memcpy(buf->data + buf->length, str, len + 1);
+	buf->length += len;
+}
+
+/** 添加一个查询参数，并在语句中加入对它的引用 */
+static void DBQuery_AddParam(DB_Query query, DB_SQLBuffer buf,
+			     long long value, const char *text)
+{
+	char str[32];
+	DB_QueryParam params;
+
+	params = realloc(query->params,
+			 (query->n_params + 1) * sizeof(DB_QueryParamRec));
+	if (!params) {
+		return;
+	}
+	query->params = params;
+	params[query->n_params].value = value;
+	params[query->n_params].text = text ? strdup(text) : NULL;
+	params[query->n_params].tagset = NULL;
+	query->n_params += 1;
+	sprintf(str, "?%u", (unsigned)query->n_params);
+	DBSQLBuffer_Append(buf, str);
+}
+
+/** 在语句中加入对已有参数的引用 */
+static void DBQuery_RefParam(DB_SQLBuffer buf, size_t index)
+{
+	char str[32];
+
+	sprintf(str, "?%u", (unsigned)index);
+	DBSQLBuffer_Append(buf, str);
+}
+
+/**
+ * 生成游标定位条件，用于跳过游标及其之前的记录
+ * 当所有排序键的排序规则相同时使用行值比较，以便 SQLite 利用索引直接定位，
+ * 否则展开为 (a > ?) OR (a = ? AND b < ?) ... 的形式。
+ */
+static void DBQuery_BuildSeekTerms(DB_Query query, DB_SQLBuffer buf,
+				   const DB_SortKey keys, size_t n)
+{
+	size_t i, j, first;
+	int same_order = 1;
+
+	for (i = 1; i < n; ++i) {
+		if (keys[i].order != keys[0].order) {
+			same_order = 0;
+			break;
+		}
+	}
+	first = query->n_params + 1;
+	if (same_order) {
+		DBSQLBuffer_Append(buf, "(");
+		for (i = 0; i < n; ++i) {
+			if (i > 0) {
+				DBSQLBuffer_Append(buf, ", ");
+			}
+			DBSQLBuffer_Append(buf, keys[i].column);
+		}
+		DBSQLBuffer_Append(buf,
+				   keys[0].order == DESC ? ") < (" : ") > (");
+		for (i = 0; i < n; ++i) {
+			if (i > 0) {
+				DBSQLBuffer_Append(buf, ", ");
+			}
+			DBQuery_AddParam(query, buf, keys[i].value, NULL);
+		}
+		DBSQLBuffer_Append(buf, ") ");
+		return;
+	}
+	DBSQLBuffer_Append(buf, "(");
+	for (i = 0; i < n; ++i) {
+		DBSQLBuffer_Append(buf, i > 0 ? " OR (" : "(");
+		for (j = 0; j < i; ++j) {
+			DBSQLBuffer_Append(buf, keys[j].column);
+			DBSQLBuffer_Append(buf, " = ");
+			DBQuery_RefParam(buf, first + j);
+			DBSQLBuffer_Append(buf, " AND ");
+		}
+		DBSQLBuffer_Append(buf, keys[i].column);
+		DBSQLBuffer_Append(buf, keys[i].order == DESC ? " < " : " > ");
+		/* 每个排序键的值只需添加一次，之后的条件直接引用它 */
+		DBQuery_AddParam(query, buf, keys[i].value, NULL);
+		DBSQLBuffer_Append(buf, ")");
+	}
+	DBSQLBuffer_Append(buf, ") ");
+}
+
+/** 判断查询条件中是否有标签条件 */
+static int DBQuery_HasTagTerms(const DB_QueryTerms terms)
+{
+	return (terms->n_tags > 0 && terms->tags) ||
+	       (terms->n_any_tags > 0 && terms->any_tags) ||
+	       (terms->n_excluded_tags > 0 && terms->excluded_tags);
+}
+
+/** 判断查询条件中是否有数值范围条件 */
+static int DBQuery_HasRangeTerms(const DB_QueryTerms terms)
+{
+	size_t i;
+	const DB_QueryRangeRec *ranges[] = {
+		&terms->range.score, &terms->range.create_time,
+		&terms->range.modify_time, &terms->range.width,
+		&terms->range.height
+	};
+
+	for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i) {
+		if (ranges[i]->has_min || ranges[i]->has_max) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * 添加数值范围条件
+ * 同时限制最小值和最大值时使用 BETWEEN，以便 SQLite 用该列的索引扫描范围。
+ */
+static void DBQuery_AddRange(DB_Query query, DB_SQLBuffer buf,
+			     const char *column, const DB_QueryRange range,
+			     const char **and_str)
+{
+	if (!range->has_min && !range->has_max) {
+		return;
+	}
+	DBSQLBuffer_Append(buf, *and_str);
+	DBSQLBuffer_Append(buf, column);
+	if (range->has_min && range->has_max) {
+		DBSQLBuffer_Append(buf, " BETWEEN ");
+		DBQuery_AddParam(query, buf, range->min, NULL);
+		DBSQLBuffer_Append(buf, " AND ");
+		DBQuery_AddParam(query, buf, range->max, NULL);
+	} else if (range->has_min) {
+		DBSQLBuffer_Append(buf, " >= ");
+		DBQuery_AddParam(query, buf, range->min, NULL);
+	} else {
+		DBSQLBuffer_Append(buf, " <= ");
+		DBQuery_AddParam(query, buf, range->max, NULL);
+	}
+	DBSQLBuffer_Append(buf, " ");
+	*and_str = "AND ";
+}
+
+/**
+ * 生成直接读取文件数量字段的统计语句
+ * 只有按源文件夹或单个文件夹过滤的查询可以这样统计，其它查询仍需要扫描文件
+ * 表。
+ * @returns 能够生成时返回 0，否则返回 -1
+ */
+static int DBQuery_BuildCounterSQL(const DB_QueryTerms terms,
+				   DB_SQLBuffer buf)
+{
+	size_t i;
+	char str[256];
+	int has_dirs = terms->n_dirs > 0 && terms->dirs;
+	int has_tags = DBQuery_HasTagTerms(terms);
+
+	/* 参数的顺序与 DB_NewQuery() 中添加参数的顺序一致 */
+	if (terms->keywords || has_tags || DBQuery_HasRangeTerms(terms)) {
+		return -1;
+	}
+	if (!terms->dirpath) {
+		DBSQLBuffer_Append(buf, "SELECT IFNULL(SUM(file_count), 0) "
+				   "FROM dir");
+		if (has_dirs) {
+			DBSQLBuffer_Append(buf, " WHERE id IN (");
+			for (i = 1; i <= terms->n_dirs; ++i) {
+				sprintf(str, i > 1 ? ", ?%u" : "?%u",
+					(unsigned)i);
+				DBSQLBuffer_Append(buf, str);
+			}
+			DBSQLBuffer_Append(buf, ")");
+		}
+		DBSQLBuffer_Append(buf, ";");
+		return 0;
+	}
+	if (has_dirs) {
+		return -1;
+	}
+	if (!terms->for_tree) {
+		DBSQLBuffer_Append(buf, "SELECT IFNULL(SUM(file_count), 0) "
+				   "FROM folder WHERE path = ?1;");
+		return 0;
+	}
+	sprintf(str,
+		"SELECT IFNULL(SUM(c.file_count), 0) FROM folder p, folder c "
+		"WHERE p.path = ?1 AND c.path >= p.path AND c.path < p.path "
+		"|| '%c' AND (c.path = p.path OR "
+		"substr(c.path, length(p.path) + 1, 1) = '%c');",
+		PATH_SEP + 1, PATH_SEP);
+	DBSQLBuffer_Append(buf, str);
+	return 0;
+}
+
+/**
+ * 添加匹配词的参数
+ * 英文单词和数字按前缀匹配，例如 abc 的范围是 [abc, abd)，以便在输入的过程中
+ * 就能搜索到文件，其它字符需要完全匹配。
+ * @returns 第一个参数的位置
+ */
+static size_t DBQuery_AddTermParams(DB_Query query, const char *term)
+{
+	size_t len;
+	char upper[DB_TERM_MAX];
+	DB_QueryParam params;
+
+	len = IsTermChar(term[0]) ? 2 : 1;
+	params = realloc(query->params,
+			 (query->n_params + len) * sizeof(DB_QueryParamRec));
+	if (!params) {
+		return 0;
+	}
+	query->params = params;
+	memset(params + query->n_params, 0, len * sizeof(DB_QueryParamRec));
+	params[query->n_params].text = strdup(term);
+	if (len > 1) {
+		strcpy(upper, term);
+		upper[strlen(upper) - 1] += 1;
+		params[query->n_params + 1].text = strdup(upper);
+	}
+	query->n_params += len;
+	return query->n_params - len + 1;
+}
+
+/** 生成匹配词的条件 */
+static void DBQuery_AppendTermCondition(DB_SQLBuffer buf, const char *column,
+				    const char *term, size_t index)
+{
+	char str[128];
+
+	if (IsTermChar(term[0])) {
+		sprintf(str, "(%s >= ?%u AND %s < ?%u)", column,
+			(unsigned)index, column, (unsigned)index + 1);
+	} else {
+		sprintf(str, "%s = ?%u", column, (unsigned)index);
+	}
+	DBSQLBuffer_Append(buf, str);
+}
+
+/**
+ * 添加关键词条件
+ * 关键词中的每个词都需要匹配。最长的词通常匹配到的文件最少，所以先用它找出
+ * 文件，再逐个检查这些文件是否也匹配其它词。
+ * @param[out] relevance 计算相关度的表达式，匹配的词的权重之和即为相关度
+ * @returns 关键词中的词的数量
+ */
+static size_t DBQuery_AddKeywords(DB_Query query, const char *keywords,
+				  DB_SQLBuffer from, DB_SQLBuffer where,
+				  DB_SQLBuffer relevance, const char **and_str)
+{
+	size_t i, n = 0, index;
+	char terms[DB_MAX_KEYWORDS][DB_TERM_MAX], term[DB_TERM_MAX];
+	const char *p = keywords, *end = keywords + strlen(keywords);
+
+	while (n < DB_MAX_KEYWORDS &&
+	       (p = DB_NextTerm(p, end, term)) != NULL) {
+		for (i = n; i > 0 && strlen(terms[i - 1]) < strlen(term); --i) {
+			strcpy(terms[i], terms[i - 1]);
+		}
+		strcpy(terms[i], term);
+		++n;
+	}
+	for (i = 0; i < n; ++i) {
+		index = DBQuery_AddTermParams(query, terms[i]);
+		DBSQLBuffer_Append(where, *and_str);
+		*and_str = "AND ";
+		if (i > 0) {
+			DBSQLBuffer_Append(where, "EXISTS (SELECT 1 FROM "
+					   "file_term ft WHERE ft.fid = f.id "
+					   "AND ");
+			DBQuery_AppendTermCondition(where, "ft.term", terms[i],
+						index);
+			DBSQLBuffer_Append(where, ") ");
+			if (query->by_relevance) {
+				DBSQLBuffer_Append(relevance,
+						   i > 1 ? " OR " : "");
+				DBQuery_AppendTermCondition(relevance, "ft.term",
+							terms[i], index);
+			}
+			continue;
+		}
+		/* 按相关度排序时需要得到第一个词的权重，所以改用连接查询 */
+		if (query->by_relevance) {
+			DBSQLBuffer_Append(from, ", (SELECT fid, SUM(weight) AS "
+					   "weight FROM file_term WHERE ");
+			DBQuery_AppendTermCondition(from, "term", terms[i], index);
+			DBSQLBuffer_Append(from, " GROUP BY fid) k ");
+			DBSQLBuffer_Append(where, "f.id = k.fid ");
+		} else {
+			DBSQLBuffer_Append(where, "f.id IN (SELECT fid FROM "
+					   "file_term WHERE ");
+			DBQuery_AppendTermCondition(where, "term", terms[i], index);
+			DBSQLBuffer_Append(where, ") ");
+		}
+	}
+	return n;
 }
 
-size_t DB_GetTags(DB_Tag **outlist)
+/** 添加标签集合参数 */
+static void DBQuery_AddTagSetParam(DB_Query query, DB_SQLBuffer buf)
 {
-	return DB_GetTagsBySQL(outlist, sql_get_tag_list);
+	DBQuery_AddParam(query, buf, 0, NULL);
+	query->params[query->n_params - 1].tagset = query->tagset;
 }
 
-size_t DB_GetTagsOrderById(DB_Tag **outlist)
+/** 复制目录路径，文件夹记录中的路径不以路径分隔符结尾，所以需要去掉它 */
+static char *DB_DupFolderPath(const char *dirpath)
 {
-	return DB_GetTagsBySQL(outlist, sql_get_tag_list_order_by_id);
-}
+	size_t i;
+	char *path = strdup(dirpath);
 
-int DBFile_RemoveTag(DB_File file, DB_Tag tag)
-{
-	int ret;
-	sqlite3_stmt *stmt = self.stmts[SQL_DEL_FILE_TAG];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, file->id);
-	sqlite3_bind_int(stmt, 2, tag->id);
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_DONE) {
-		return 0;
+	for (i = strlen(path); i > 0; --i) {
+		if (path[i - 1] != '\\' && path[i - 1] != '/') {
+			break;
+		}
+		path[i - 1] = 0;
 	}
-	printf("[database] error: %s\n", sqlite3_errmsg(self.db));
-	return -1;
+	return path;
 }
 
-int DBFile_AddTag(DB_File file, DB_Tag tag)
+/**
+ * 获取目录对应的文件夹集合
+ * @param[in] for_tree 是否包括整个子级目录树中的文件夹
+ */
+static Bitmap DB_GetFolderSet(DB_Connection conn, const char *dirpath,
+			      int for_tree)
 {
-	int ret;
-	sqlite3_stmt *stmt = self.stmts[SQL_ADD_FILE_TAG];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, file->id);
-	sqlite3_bind_int(stmt, 2, tag->id);
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_DONE) {
-		return 0;
+	char sql[384];
+	char *path;
+	Bitmap set;
+	sqlite3_stmt *stmt;
+
+	set = Bitmap_Create();
+	if (!set) {
+		return NULL;
 	}
-	printf("[database] error: %s\n", sqlite3_errmsg(self.db));
-	return -1;
+	if (for_tree) {
+		sprintf(sql,
+			"SELECT c.id FROM folder p, folder c WHERE p.path = ?1 "
+			"AND c.path >= p.path AND c.path < p.path || '%c' AND "
+			"(c.path = p.path OR substr(c.path, length(p.path) + 1, "
+			"1) = '%c');",
+			PATH_SEP + 1, PATH_SEP);
+	} else {
+		strcpy(sql, "SELECT id FROM folder WHERE path = ?1;");
+	}
+	stmt = DB_PrepareCached(conn, sql);
+	if (!stmt) {
+		return set;
+	}
+	path = DB_DupFolderPath(dirpath);
+	sqlite3_bind_text(stmt, 1, path, -1, NULL);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		Bitmap_Add(set, (uint32_t)sqlite3_column_int(stmt, 0));
+	}
+	DB_ReleaseCached(conn, stmt);
+	free(path);
+	return set;
 }
 
-size_t DBFile_GetTags(DB_File file, DB_Tag **outtags)
+void DB_SetFileColumnsEnabled(int enabled)
 {
-	const char *name;
-	size_t len, total = 0;
-	sqlite3_stmt *stmt;
-	DB_Tag tag, *tags = NULL, *newtags;
-	stmt = self.stmts[SQL_GET_FILE_TAGS];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, file->id);
-	while (sqlite3_step(stmt) == SQLITE_ROW) {
-		++total;
-		newtags = realloc(tags, (total + 1) * sizeof(DB_Tag));
-		if (!newtags) {
-			free(tags);
-			return -ENOMEM;
+	size_t i;
+
+	LCUIMutex_Lock(&self.columns.mutex);
+	self.columns.enabled = enabled;
+	if (enabled) {
+		if (!self.columns.changed) {
+			self.columns.changed = Bitmap_Create();
 		}
-		tags = newtags;
-		tag = malloc(sizeof(DB_TagRec));
-		tag->id = sqlite3_column_int(stmt, 0);
-		name = (const char *)sqlite3_column_text(stmt, 1);
-		len = strlen(name) + 1;
-		tag->name = malloc(len * sizeof(char));
-		strncpy(tag->name, name, len);
-		tag->count = sqlite3_column_int(stmt, 2);
-		tags[total - 1] = tag;
+		LCUIMutex_Unlock(&self.columns.mutex);
+		return;
 	}
-	if (total > 0) {
-		tags[total] = NULL;
+	if (self.columns.data) {
+		FileColumns_Destroy(self.columns.data);
+		self.columns.data = NULL;
 	}
-	*outtags = tags;
-	return total;
+	if (self.columns.changed) {
+		Bitmap_Destroy(self.columns.changed);
+		self.columns.changed = NULL;
+	}
+	for (i = 0; i < DB_COLUMNS_CACHE_SIZE; ++i) {
+		free(self.columns.cache[i].key);
+		free(self.columns.cache[i].rows);
+		self.columns.cache[i].key = NULL;
+		self.columns.cache[i].rows = NULL;
+		self.columns.cache[i].length = 0;
+	}
+	LCUIMutex_Unlock(&self.columns.mutex);
 }
 
-int DBFile_SetScore(DB_File file, int score)
+/** 查找缓存的查询结果，调用前需要锁定镜像 */
+static int DB_FindColumnsCache(const char *key)
 {
-	int ret;
-	sqlite3_stmt *stmt = self.stmts[SQL_SET_FILE_SCORE];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, score);
-	sqlite3_bind_int(stmt, 2, file->id);
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_DONE) {
-		return 0;
+	int i;
+
+	for (i = 0; key && i < DB_COLUMNS_CACHE_SIZE; ++i) {
+		if (self.columns.cache[i].key &&
+		    self.columns.cache[i].version == self.columns.version &&
+		    strcmp(self.columns.cache[i].key, key) == 0) {
+			self.columns.cache[i].last_used = ++self.columns.clock;
+			return i;
+		}
 	}
-	printf("[database] error: %s\n", sqlite3_errmsg(self.db));
 	return -1;
 }
 
-int DBFile_SetTime(DB_File file, int ctime, int mtime)
+/**
+ * 缓存查询结果，调用前需要锁定镜像
+ * 优先替换已失效的结果，其次是最久未使用的结果。
+ */
+static int DB_AddColumnsCache(char *key, uint32_t *rows, size_t n)
 {
-	int ret;
-	sqlite3_stmt *stmt = self.stmts[SQL_SET_FILE_TIME];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, ctime);
-	sqlite3_bind_int(stmt, 2, mtime);
-	sqlite3_bind_int(stmt, 3, file->id);
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_DONE) {
-		file->create_time = ctime;
-		file->modify_time = mtime;
-		return 0;
+	int i, target = 0;
+
+	for (i = 0; i < DB_COLUMNS_CACHE_SIZE; ++i) {
+		if (!self.columns.cache[i].key ||
+		    self.columns.cache[i].version != self.columns.version) {
+			target = i;
+			break;
+		}
+		if (self.columns.cache[i].last_used <
+		    self.columns.cache[target].last_used) {
+			target = i;
+		}
 	}
-	printf("[database] error: %s\n", sqlite3_errmsg(self.db));
-	return -1;
+	free(self.columns.cache[target].key);
+	free(self.columns.cache[target].rows);
+	self.columns.cache[target].key = key;
+	self.columns.cache[target].rows = rows;
+	self.columns.cache[target].length = n;
+	self.columns.cache[target].version = self.columns.version;
+	self.columns.cache[target].last_used = ++self.columns.clock;
+	return target;
 }
 
-int DBFile_SetSize(DB_File file, int width, int height)
+/** 将标签列表中的标识号添加到缓存键中 */
+static void DBQuery_AppendTagIds(DB_SQLBuffer key, const char *name,
+				 DB_Tag *tags, size_t n_tags)
 {
-	int ret;
-	sqlite3_stmt *stmt = self.stmts[SQL_SET_FILE_SIZE];
-	sqlite3_reset(stmt);
-	sqlite3_bind_int(stmt, 1, width);
-	sqlite3_bind_int(stmt, 2, height);
-	sqlite3_bind_int(stmt, 3, file->id);
-	ret = sqlite3_step(stmt);
-	if (ret == SQLITE_DONE) {
-		file->width = width;
-		file->height = height;
-		return 0;
+	size_t i;
+	char str[32];
+
+	for (i = 0; tags && i < n_tags; ++i) {
+		sprintf(str, "%s%d,", name, tags[i]->id);
+		DBSQLBuffer_Append(key, str);
 	}
-	printf("[database] error: %s\n", sqlite3_errmsg(self.db));
-	return -1;
 }
 
-DB_Tag DBTag_Dup(DB_Tag tag)
+/** 生成镜像查询结果的缓存键，它包含了影响过滤和排序的全部条件 */
+static void DBQuery_GetColumnsKey(const DB_QueryTerms terms,
+				  DB_SQLBuffer key)
 {
-	size_t len;
-	DB_Tag newtag = malloc(sizeof(DB_TagRec));
+	size_t i;
+	char str[128];
+	const DB_QueryRangeRec *ranges[] = {
+		&terms->range.score, &terms->range.create_time,
+		&terms->range.modify_time, &terms->range.width,
+		&terms->range.height
+	};
 
-	newtag->id = tag->id;
-	len = strlen(tag->name);
-	newtag->name = strdup(tag->name);
-	newtag->count = 0;
-	return newtag;
+	sprintf(str, "%d,%d,%d,%d;", terms->score, terms->create_time,
+		terms->modify_time, terms->for_tree);
+	DBSQLBuffer_Append(key, str);
+	for (i = 0; terms->dirs && i < terms->n_dirs; ++i) {
+		sprintf(str, "d%d,", terms->dirs[i]->id);
+		DBSQLBuffer_Append(key, str);
+	}
+	DBQuery_AppendTagIds(key, "t", terms->tags, terms->n_tags);
+	DBQuery_AppendTagIds(key, "a", terms->any_tags, terms->n_any_tags);
+	DBQuery_AppendTagIds(key, "x", terms->excluded_tags,
+			     terms->n_excluded_tags);
+	for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i) {
+		sprintf(str, "r%d,%d,%lld,%lld;", ranges[i]->has_min,
+			ranges[i]->has_max, ranges[i]->min, ranges[i]->max);
+		DBSQLBuffer_Append(key, str);
+	}
+	if (terms->dirpath) {
+		DBSQLBuffer_Append(key, "p");
+		DBSQLBuffer_Append(key, terms->dirpath);
+	}
 }
 
-void DBTag_Release(DB_Tag tag)
+static int DBQuery_IsCancelled(DB_Query query)
 {
-	free(tag->name);
-	tag->name = NULL;
-	free(tag);
+	return query->cancelled && *query->cancelled;
 }
 
-int DBQuery_GetTotalFiles(DB_Query query)
+/**
+ * 在文件表的镜像中查询
+ * 过滤和排序都在内存中完成，不需要执行 SQL 语句。本页的记录会被复制到查询
+ * 结果中，之后取记录时不再需要访问镜像。
+ * @returns 镜像可用时返回 0，否则返回 -1
+ */
+static int DBQuery_SelectColumns(DB_Query query, const DB_QueryTerms terms)
 {
-	int total = 0;
-	sqlite3_stmt *stmt;
-	char sql[SQL_BUF_SIZE];
+	int index;
+	size_t i, n, start, end;
+	uint32_t *rows;
+	char *path;
+	unsigned long version;
+	DB_File file;
+	DB_ArenaBlock arena = NULL;
+	DB_SQLBufferRec key = { 0 };
+	FileColumnsSort sort;
+	FileColumnsFilterRec filter = { 0 };
 
-	if (!query) {
-		return 0;
+	DBQuery_GetColumnsKey(terms, &key);
+	LCUIMutex_Lock(&self.columns.mutex);
+	if (DB_PrepareFileColumns(query->conn) != 0) {
+		LCUIMutex_Unlock(&self.columns.mutex);
+		free(key.data);
+		return -1;
 	}
-	sprintf(sql, "%s (SELECT * FROM file f %s %s%s%s)", sql_count_files,
-		query->sql_tables, query->sql_terms, query->sql_groupby,
-		query->sql_having);
-	sqlite3_prepare_v2(self.db, sql, -1, &stmt, NULL);
-	if (sqlite3_step(stmt) == SQLITE_ROW) {
-		total = sqlite3_column_int(stmt, 0);
+	index = DB_FindColumnsCache(key.data);
+	if (index < 0) {
+		/* 集合条件需要查询数据库，在锁外准备 */
+		LCUIMutex_Unlock(&self.columns.mutex);
+		filter.terms = terms;
+		query->tagset =
+		    DB_GetTagSet(query->conn, terms, &filter.excluded);
+		if (query->tagset) {
+			filter.files = query->tagset;
+		} else {
+			query->tagset = filter.excluded;
+		}
+		if (terms->dirpath) {
+			filter.folders = DB_GetFolderSet(
+			    query->conn, terms->dirpath, terms->for_tree);
+		}
+		LCUIMutex_Lock(&self.columns.mutex);
+		n = 0;
+		rows = NULL;
+		sort = NULL;
+		version = self.columns.version;
+		if (self.columns.data && !self.columns.dirty &&
+		    !DBQuery_IsCancelled(query)) {
+			n = FileColumns_Select(self.columns.data, &filter,
+					       &rows);
+			sort = FileColumns_PrepareSort(self.columns.data, rows,
+						       n, terms);
+		}
+		LCUIMutex_Unlock(&self.columns.mutex);
+		if (filter.folders) {
+			Bitmap_Destroy(filter.folders);
+		}
+		/* 排序只用到复制出来的键，写连接可以同时同步镜像 */
+		if (FileColumns_SortRows(sort, rows, n, query->cancelled) == 0) {
+			LCUIMutex_Lock(&self.columns.mutex);
+			/* 排序期间镜像被修改过，行号已经不可靠 */
+			if (version == self.columns.version) {
+				index = DB_AddColumnsCache(key.data, rows, n);
+				key.data = NULL;
+				rows = NULL;
+			} else {
+				LCUIMutex_Unlock(&self.columns.mutex);
+			}
+		}
+		if (index < 0) {
+			free(key.data);
+			free(rows);
+			if (query->tagset) {
+				Bitmap_Destroy(query->tagset);
+				query->tagset = NULL;
+			}
+			return -1;
+		}
+	} else {
+		free(key.data);
 	}
-	sqlite3_finalize(stmt);
-	return total;
-}
-
-static size_t escape(char *buf, const char *str)
-{
-	char *outptr = buf;
-	const char *inptr = str;
-	while (*inptr) {
-		switch (*inptr) {
-		case '_':
-		case '%':
-		case '\\':
-			*outptr = '\\';
-			++outptr;
-		default:
+	rows = self.columns.cache[index].rows;
+	n = self.columns.cache[index].length;
+	if (terms->cursor.id > 0) {
+		start = FileColumns_Seek(self.columns.data, rows, n, terms);
+	} else {
+		start = terms->offset < n ? terms->offset : n;
+	}
+	end = n - start > terms->limit ? start + terms->limit : n;
+	query->total = (int)n;
+	query->result.files = malloc(sizeof(DB_FileRec) * (end - start + 1));
+	for (i = start; query->result.files && i < end; ++i) {
+		file = &query->result.files[query->result.length];
+		FileColumns_GetFile(self.columns.data, rows[i], file);
+		path = DBArena_Alloc(&arena, strlen(file->path) + 1);
+		if (!path) {
 			break;
 		}
-		*outptr = *inptr;
-		++outptr;
-		++inptr;
+		file->path = strcpy(path, file->path);
+		query->result.length += 1;
 	}
-	*outptr = 0;
-	return outptr - buf;
+	query->result.arena = arena;
+	LCUIMutex_Unlock(&self.columns.mutex);
+	return 0;
 }
 
-DB_File DBQuery_FetchFile(DB_Query query)
+/**
+ * 新建查询
+ * 查询条件会被编译成参数化的语句，语句内容只与条件的结构有关，例如有哪些
+ * 过滤条件、排序方式等，条件中的值都作为参数绑定到语句上。标签条件先在标签
+ * 索引中算出文件集合，再将集合作为参数绑定到语句上。
+ */
+DB_Query DB_NewQuery(const DB_QueryTerms terms)
 {
-	return DB_LoadFile(query->stmt);
+	return DB_NewCancellableQuery(terms, NULL);
 }
 
-DB_Query DB_NewQuery(const DB_QueryTerms terms)
+/** 在执行语句期间定期检查取消标志，返回非零值时语句被中断 */
+static int DB_OnQueryProgress(void *arg)
 {
-	size_t i;
-	char sql[SQL_BUF_SIZE];
-	char buf_terms[256] = " WHERE ";
-	char buf_having[256] = "HAVING ";
-	char buf_orderby[256] = "ORDER BY ";
-	char buf_groupby[256] = "GROUP BY ";
+	const volatile int *cancelled = arg;
+
+	return *cancelled != 0;
+}
+
+DB_Query DB_NewCancellableQuery(const DB_QueryTerms terms,
+				const volatile int *cancelled)
+{
+	size_t i, n_keys, n_files;
+	char str[256];
+	Bitmap excluded;
+	DB_SortKeyRec keys[4];
+	DB_SQLBufferRec where = { 0 }, seek = { 0 }, tail = { 0 };
+	DB_SQLBufferRec sql = { 0 }, from = { 0 }, relevance = { 0 };
 	DB_Query q = calloc(1, sizeof(DB_QueryRec));
+	const char *and_str = "WHERE ";
+
+	if (!q) {
+		return NULL;
+	}
+	q->total = -1;
+	q->conn = DB_AcquireReader();
+	if (!q->conn) {
+		free(q);
+		return NULL;
+	}
+	/* 加载镜像和标签索引、统计文件数量等语句都可以被取消标志中断 */
+	if (cancelled) {
+		q->cancelled = cancelled;
+		sqlite3_progress_handler(q->conn->db, DB_PROGRESS_STEPS,
+					 DB_OnQueryProgress, (void *)cancelled);
+	}
+	/* 没有关键词时可以直接在文件表的镜像中查询 */
+	if (!terms->keywords && DBQuery_SelectColumns(q, terms) == 0) {
+		return q;
+	}
+	if (DBQuery_IsCancelled(q)) {
+		DB_DeleteQuery(q);
+		return NULL;
+	}
 
 	if (terms->n_dirs > 0 && terms->dirs) {
-		strcpy(q->sql_terms, buf_terms);
-		strcat(q->sql_tables, ", dir d");
-		strcat(q->sql_terms, "f.did = d.id ");
-		strcat(q->sql_terms, "AND f.did IN (");
+		DBSQLBuffer_Append(&where, and_str);
+		DBSQLBuffer_Append(&where, "f.did IN (");
 		for (i = 0; i < terms->n_dirs; ++i) {
-			sprintf(buf_terms, "%d", terms->dirs[i]->id);
 			if (i > 0) {
-				strcat(q->sql_terms, ", ");
+				DBSQLBuffer_Append(&where, ", ");
 			}
-			strcat(q->sql_terms, buf_terms);
+			DBQuery_AddParam(q, &where, terms->dirs[i]->id, NULL);
+		}
+		DBSQLBuffer_Append(&where, ") ");
+		and_str = "AND ";
+	}
+	q->tagset = DB_GetTagSet(q->conn, terms, &excluded);
+	if (DBQuery_IsCancelled(q)) {
+		if (excluded) {
+			Bitmap_Destroy(excluded);
 		}
-		strcat(q->sql_terms, ") ");
-		strcpy(buf_terms, " AND");
+		free(where.data);
+		DB_DeleteQuery(q);
+		return NULL;
 	}
-	if (terms->n_tags > 0 && terms->tags) {
-		strcat(q->sql_terms, buf_terms);
-		if (terms->n_tags == 1) {
-			sprintf(buf_terms, "ftr.tid = %d ", terms->tags[0]->id);
-			strcat(q->sql_terms, buf_terms);
+	if (q->tagset) {
+		n_files = Bitmap_GetCardinality(q->tagset);
+		DBSQLBuffer_Append(&where, and_str);
+		/* 集合较小时直接按标识号查找文件，否则在遍历文件时逐个检查 */
+		if (n_files * DB_TAGSET_LOOKUP_RATIO <
+		    (size_t)DB_CountFiles(NULL)) {
+			DBSQLBuffer_Append(&where, "f.id IN (SELECT value "
+					   "FROM tagset(");
+			DBQuery_AddTagSetParam(q, &where);
+			DBSQLBuffer_Append(&where, ")) ");
 		} else {
-			strcat(q->sql_terms, "ftr.tid IN (");
-			for (i = 0; i < terms->n_tags; ++i) {
-				sprintf(buf_terms, "%d", terms->tags[i]->id);
-				if (i > 0) {
-					strcat(q->sql_terms, ", ");
-				}
-				strcat(q->sql_terms, buf_terms);
-			}
-			strcat(q->sql_terms, ") ");
-			strcpy(q->sql_having, buf_having);
-			sprintf(buf_having, "COUNT(ftr.tid) = %zu ",
-				terms->n_tags);
-			strcat(q->sql_having, buf_having);
-		}
-		strcat(q->sql_tables, ", file_tag_relation ftr ");
-		strcat(q->sql_terms, "AND ftr.fid = f.id ");
-		strcpy(buf_terms, "AND ");
-		strcpy(q->sql_groupby, buf_groupby);
-		strcat(q->sql_groupby, "ftr.fid ");
-		strcpy(buf_having, "AND ");
-		strcpy(buf_groupby, ", ");
+			DBSQLBuffer_Append(&where, "tagset_has(");
+			DBQuery_AddTagSetParam(q, &where);
+			DBSQLBuffer_Append(&where, ", f.id) ");
+		}
+		if (!(terms->n_dirs > 0 && terms->dirs) && !terms->dirpath &&
+		    !terms->keywords && !DBQuery_HasRangeTerms(terms)) {
+			q->total = (int)n_files;
+		}
+		and_str = "AND ";
+	} else if (excluded) {
+		q->tagset = excluded;
+		DBSQLBuffer_Append(&where, and_str);
+		DBSQLBuffer_Append(&where, "NOT tagset_has(");
+		DBQuery_AddTagSetParam(q, &where);
+		DBSQLBuffer_Append(&where, ", f.id) ");
+		and_str = "AND ";
+	}
+	if (terms->keywords) {
+		q->by_relevance = terms->create_time == NONE &&
+				  terms->modify_time == NONE &&
+				  terms->score == NONE;
+		if (DBQuery_AddKeywords(q, terms->keywords, &from, &where,
+					&relevance, &and_str) < 1) {
+			q->by_relevance = 0;
+		}
 	}
 	if (terms->dirpath) {
-		strcat(q->sql_terms, buf_terms);
+		char *path = DB_DupFolderPath(terms->dirpath);
+
+		DBSQLBuffer_Append(&where, and_str);
 		/* 如果是要在当前目录下的整个子级目录树中搜索文件 */
 		if (terms->for_tree) {
-			char *path;
-			i = 2 * strlen(terms->dirpath);
-			path = malloc(i * sizeof(char));
-			escape(path, terms->dirpath);
-			strcat(q->sql_terms, " f.path LIKE '");
-			strcat(q->sql_terms, path);
-			strcat(q->sql_terms, "%' ESCAPE '\\'");
-			free(path);
+			DBSQLBuffer_Append(&where, "f.folder_id IN (SELECT c.id "
+					   "FROM folder p, folder c "
+					   "WHERE p.path = ");
+			DBQuery_AddParam(q, &where, 0, path);
+			sprintf(str,
+				" AND c.path >= p.path AND c.path < p.path "
+				"|| '%c' AND (c.path = p.path OR "
+				"substr(c.path, length(p.path) + 1, 1) = "
+				"'%c')) ",
+				PATH_SEP + 1, PATH_SEP);
+			DBSQLBuffer_Append(&where, str);
 		} else {
-			strcat(q->sql_terms, "HASFILE('");
-			strcat(q->sql_terms, terms->dirpath);
-			strcat(q->sql_terms, "', f.path) ");
-		}
-	}
-	if (terms->create_time == DESC) {
-		strcat(q->sql_orderby, buf_orderby);
-		strcat(q->sql_orderby, "f.create_time DESC ");
-		strcpy(buf_orderby, ", ");
-	} else if (terms->create_time == ASC) {
-		strcat(q->sql_orderby, buf_orderby);
-		strcat(q->sql_orderby, "f.create_time ASC ");
-		strcpy(buf_orderby, ", ");
-	}
-	if (terms->modify_time == DESC) {
-		strcat(q->sql_orderby, buf_orderby);
-		strcat(q->sql_orderby, "f.modify_time DESC ");
-		strcpy(buf_orderby, ", ");
-	} else if (terms->modify_time == ASC) {
-		strcat(q->sql_orderby, buf_orderby);
-		strcat(q->sql_orderby, "f.modify_time ASC ");
-		strcpy(buf_orderby, ", ");
+			DBSQLBuffer_Append(&where, "f.folder_id = (SELECT id "
+					   "FROM folder WHERE path = ");
+			DBQuery_AddParam(q, &where, 0, path);
+			DBSQLBuffer_Append(&where, ") ");
+		}
+		and_str = "AND ";
+		free(path);
 	}
-	if (terms->score != NONE) {
-		strcat(q->sql_orderby, buf_orderby);
-		if (terms->score == DESC) {
-			strcat(q->sql_orderby, "f.score DESC ");
-		} else {
-			strcat(q->sql_orderby, "f.score ASC ");
-		}
-		strcpy(buf_orderby, ", ");
-	}
-	sprintf(q->sql_limit, " LIMIT %zu OFFSET %zu", terms->limit,
-		terms->offset);
-	strcpy(sql, sql_search_files);
-	strcat(sql, q->sql_tables);
-	strcat(sql, q->sql_terms);
-	strcat(sql, q->sql_groupby);
-	strcat(sql, q->sql_having);
-	strcat(sql, q->sql_orderby);
-	strcat(sql, q->sql_limit);
-	i = sqlite3_prepare_v2(self.db, sql, -1, &q->stmt, NULL);
-	if (i == SQLITE_OK) {
+	DBQuery_AddRange(q, &where, "f.score", &terms->range.score, &and_str);
+	DBQuery_AddRange(q, &where, "f.create_time", &terms->range.create_time,
+			 &and_str);
+	DBQuery_AddRange(q, &where, "f.modify_time", &terms->range.modify_time,
+			 &and_str);
+	DBQuery_AddRange(q, &where, "f.width", &terms->range.width, &and_str);
+	DBQuery_AddRange(q, &where, "f.height", &terms->range.height, &and_str);
+	/* 到这里为止的参数都是统计文件总数时需要的 */
+	q->n_count_params = q->n_params;
+	if (DBQuery_BuildCounterSQL(terms, &sql) != 0) {
+		DBSQLBuffer_Append(&sql, sql_count_files);
+		DBSQLBuffer_Append(&sql, from.data ? from.data : "");
+		DBSQLBuffer_Append(&sql, where.data ? where.data : "");
+		DBSQLBuffer_Append(&sql, ";");
+	}
+	q->sql_count = sql.data;
+
+	n_keys = DB_GetSortKeys(terms, q->by_relevance, keys);
+	/* 有游标时从游标之后开始取记录，不再使用 OFFSET 跳过前面的记录 */
+	if (terms->cursor.id > 0) {
+		DBSQLBuffer_Append(&seek, and_str);
+		DBQuery_BuildSeekTerms(q, &seek, keys, n_keys);
+	}
+	for (i = 0; i < n_keys; ++i) {
+		DBSQLBuffer_Append(&tail, i > 0 ? ", " : "ORDER BY ");
+		DBSQLBuffer_Append(&tail, keys[i].column);
+		DBSQLBuffer_Append(&tail, keys[i].order == DESC ? " DESC" : " ASC");
+	}
+	DBSQLBuffer_Append(&tail, " LIMIT ");
+	DBQuery_AddParam(q, &tail, (long long)terms->limit, NULL);
+	if (terms->cursor.id < 1) {
+		DBSQLBuffer_Append(&tail, " OFFSET ");
+		DBQuery_AddParam(q, &tail, (long long)terms->offset, NULL);
+	}
+	sql.data = NULL;
+	sql.length = sql.size = 0;
+	DBSQLBuffer_Append(&sql, sql_search_files);
+	if (q->by_relevance) {
+		DBSQLBuffer_Append(&sql, ", k.weight");
+		if (relevance.data) {
+			DBSQLBuffer_Append(&sql, " + (SELECT IFNULL(SUM("
+					   "ft.weight), 0) FROM file_term ft "
+					   "WHERE ft.fid = f.id AND (");
+			DBSQLBuffer_Append(&sql, relevance.data);
+			DBSQLBuffer_Append(&sql, "))");
+		}
+		DBSQLBuffer_Append(&sql, " AS relevance");
+	}
+	DBSQLBuffer_Append(&sql, " FROM file f ");
+	DBSQLBuffer_Append(&sql, from.data ? from.data : "");
+	DBSQLBuffer_Append(&sql, where.data ? where.data : "");
+	DBSQLBuffer_Append(&sql, seek.data ? seek.data : "");
+	DBSQLBuffer_Append(&sql, tail.data);
+	DBSQLBuffer_Append(&sql, ";");
+	q->sql = sql.data;
+	free(from.data);
+	free(where.data);
+	free(relevance.data);
+	free(seek.data);
+	free(tail.data);
+
+	q->stmt = DB_PrepareCached(q->conn, q->sql);
+	if (q->stmt && !DBQuery_IsCancelled(q)) {
+		DBQuery_BindParams(q, q->stmt, q->n_params);
 		return q;
 	}
+	DB_DeleteQuery(q);
 	return NULL;
 }
 
 void DB_DeleteQuery(DB_Query query)
 {
-	sqlite3_finalize(query->stmt);
+	size_t i;
+
+	if (!query) {
+		return;
+	}
+	if (query->cancelled) {
+		sqlite3_progress_handler(query->conn->db, 0, NULL, NULL);
+	}
+	if (query->stmt) {
+		DB_ReleaseCached(query->conn, query->stmt);
+	}
+	DB_ReleaseConnection(query->conn);
+	for (i = 0; i < query->n_params; ++i) {
+		free(query->params[i].text);
+	}
+	free(query->params);
+	if (query->tagset) {
+		Bitmap_Destroy(query->tagset);
+	}
+	DBFilePage_Destroy(&query->result);
+	free(query->sql);
+	free(query->sql_count);
 	query->stmt = NULL;
+	query->conn = NULL;
 	free(query);
 }
 
+/** 计算某个月份的第一秒的时间，月份可以超出 1 到 12 的范围 */
+static time_t DB_GetMonthStartTime(int year, int month)
+{
+	struct tm t = { 0 };
+
+	t.tm_year = year - 1900;
+	t.tm_mon = month - 1;
+	t.tm_mday = 1;
+	t.tm_isdst = -1;
+	return mktime(&t);
+}
+
+size_t DB_GetTimeline(const DB_QueryTerms terms, DB_TimelineEntry *entries)
+{
+	size_t i, n = 0, offset = 0;
+	int desc = terms->modify_time != ASC;
+	time_t start;
+	sqlite3_stmt *stmt;
+	DB_TimelineEntry list, entry;
+	DB_SQLBufferRec sql = { 0 };
+	DB_Connection conn = DB_AcquireReader();
+
+	*entries = NULL;
+	if (!conn) {
+		return 0;
+	}
+	DBSQLBuffer_Append(&sql, "SELECT month, SUM(file_count) AS n "
+			   "FROM timeline ");
+	if (terms->n_dirs > 0 && terms->dirs) {
+		DBSQLBuffer_Append(&sql, "WHERE did IN (");
+		for (i = 0; i < terms->n_dirs; ++i) {
+			DBSQLBuffer_Append(&sql, i > 0 ? ", ?" : "?");
+		}
+		DBSQLBuffer_Append(&sql, ") ");
+	}
+	DBSQLBuffer_Append(&sql, desc ? "GROUP BY month HAVING n > 0 "
+				      "ORDER BY month DESC;"
+				    : "GROUP BY month HAVING n > 0 "
+				      "ORDER BY month ASC;");
+	stmt = DB_PrepareCached(conn, sql.data);
+	free(sql.data);
+	if (!stmt) {
+		DB_ReleaseConnection(conn);
+		return 0;
+	}
+	for (i = 0; terms->dirs && i < terms->n_dirs; ++i) {
+		sqlite3_bind_int(stmt, (int)i + 1, terms->dirs[i]->id);
+	}
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		list = realloc(*entries, (n + 1) * sizeof(DB_TimelineEntryRec));
+		if (!list) {
+			break;
+		}
+		*entries = list;
+		entry = &list[n++];
+		memset(entry, 0, sizeof(DB_TimelineEntryRec));
+		entry->year = sqlite3_column_int(stmt, 0) / 100;
+		entry->month = sqlite3_column_int(stmt, 0) % 100;
+		entry->count = sqlite3_column_int(stmt, 1);
+		entry->offset = offset;
+		offset += entry->count;
+		/*
+		 * 游标指向该月份前面的那一秒中排在最后的位置，按时间降序排列时，
+		 * 前面的是下个月份，否则是上个月份
+		 */
+		start = DB_GetMonthStartTime(entry->year,
+					     desc ? entry->month + 1
+						  : entry->month);
+		entry->cursor.id = INT_MAX;
+		entry->cursor.modify_time = (unsigned int)(start - 1);
+	}
+	DB_ReleaseCached(conn, stmt);
+	DB_ReleaseConnection(conn);
+	return n;
+}
+
 int DB_Begin(void)
 {
-	return sqlite3_exec(self.db, "begin;", NULL, NULL, NULL);
+	int ret = SQLITE_OK;
+	DB_Connection conn = DB_LockWriter();
+
+	/* 写连接会一直被占用到事务提交为止 */
+	if (self.transaction_depth++ == 0) {
+		ret = sqlite3_exec(conn->db, "begin;", NULL, NULL, NULL);
+	}
+	return ret;
+}
+
+int DB_BeginImport(void)
+{
+	int ret;
+	size_t i, n = 0;
+	char sql[256], **names = NULL, **list;
+	sqlite3_stmt *stmt;
+	DB_Connection conn = DB_LockWriter();
+
+	printf("[database] begin import\n");
+	if (sqlite3_prepare_v2(conn->db, "PRAGMA synchronous;", -1, &stmt,
+			       NULL) == SQLITE_OK) {
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			self.import.synchronous = sqlite3_column_int(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+	}
+	/* 导入期间的数据可在下次同步时重建，不必每次写入都等待落盘 */
+	sqlite3_exec(conn->db, "PRAGMA synchronous=OFF;", NULL, NULL, NULL);
+	ret = DB_Begin();
+	if (ret != SQLITE_OK) {
+		DB_Commit();
+		DB_ReleaseConnection(conn);
+		return ret;
+	}
+	ret = sqlite3_prepare_v2(conn->db, sql_get_file_indexes, -1, &stmt,
+				 NULL);
+	if (ret != SQLITE_OK) {
+		DB_Commit();
+		DB_ReleaseConnection(conn);
+		return ret;
+	}
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		list = realloc(names, (n + 1) * sizeof(char *));
+		if (!list) {
+			break;
+		}
+		names = list;
+		list = realloc(self.import.indexes, (n + 1) * sizeof(char *));
+		if (!list) {
+			break;
+		}
+		self.import.indexes = list;
+		names[n] = strdup((const char *)sqlite3_column_text(stmt, 0));
+		list[n] = strdup((const char *)sqlite3_column_text(stmt, 1));
+		++n;
+	}
+	sqlite3_finalize(stmt);
+	self.import.n_indexes = n;
+	/* 未执行完的语句会锁住数据表，删除索引前需要先重置它们 */
+	for (i = 0; i < SQL_TOTAL; ++i) {
+		sqlite3_reset(conn->stmts[i]);
+	}
+	/* 在同一事务中删除索引，导入失败时回滚即可恢复索引 */
+	for (i = 0; i < n; ++i) {
+		snprintf(sql, sizeof(sql), "DROP INDEX \"%s\";", names[i]);
+		if (sqlite3_exec(conn->db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+			printf("[database] error: %s\n",
+			       sqlite3_errmsg(conn->db));
+		}
+		free(names[i]);
+	}
+	free(names);
+	return SQLITE_OK;
+}
+
+int DB_EndImport(void)
+{
+	int ret;
+	size_t i;
+	char *errmsg, sql[64];
+	DB_Connection conn = &self.writer;
+
+	printf("[database] rebuild %zu indexes\n", self.import.n_indexes);
+	for (i = 0; i < self.import.n_indexes; ++i) {
+		ret = sqlite3_exec(conn->db, self.import.indexes[i], NULL, NULL,
+				   &errmsg);
+		if (ret != SQLITE_OK) {
+			printf("[database] error: %s\n", errmsg);
+			sqlite3_free(errmsg);
+		}
+		free(self.import.indexes[i]);
+	}
+	free(self.import.indexes);
+	self.import.indexes = NULL;
+	self.import.n_indexes = 0;
+	ret = DB_Commit();
+	sprintf(sql, "PRAGMA synchronous=%d;", self.import.synchronous);
+	sqlite3_exec(conn->db, sql, NULL, NULL, NULL);
+	DB_ReleaseConnection(conn);
+	printf("[database] end import\n");
+	return ret;
 }
 
 int DB_Commit(void)
 {
-	return sqlite3_exec(self.db, "commit;", NULL, NULL, NULL);
+	int ret = SQLITE_OK;
+
+	if (--self.transaction_depth == 0) {
+		ret = sqlite3_exec(self.writer.db, "commit;", NULL, NULL, NULL);
+	}
+	DB_ReleaseConnection(&self.writer);
+	return ret;
 }
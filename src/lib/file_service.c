@@ -50,6 +50,12 @@
 #include "common.h"
 #include "file_service.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
 #ifdef _WIN32
 #define _S_ISTYPE(mode, mask) (((mode)&_S_IFMT) == (mask))
 #define S_ISDIR(mode) _S_ISTYPE((mode), _S_IFDIR)
@@ -59,6 +65,16 @@
 #undef LOG
 #define LOG DEBUG_MSG
 
+/** 目录列表缓冲区的大小，每写满一次作为一个数据块发出 */
+#define DIR_RECORD_BUFFER_SIZE (64 * 1024)
+
+/** 工作线程数量的下限和上限，在此范围内与处理器核心数相同 */
+#define FILE_SERVICE_MIN_WORKERS 2
+#define FILE_SERVICE_MAX_WORKERS 16
+
+/** 一个客户端最多能同时等待响应的请求数量 */
+#define FILE_CLIENT_MAX_REQUESTS 8
+
 typedef struct FileStreamRec_ {
 	LCUI_BOOL active;
 	LCUI_BOOL closed;
@@ -66,6 +82,10 @@ typedef struct FileStreamRec_ {
 	LCUI_Mutex mutex;
 	LinkedList data;        /**< 数据块列表 */
 	FileStreamChunk *chunk; /**< 当前操作的数据块 */
+	size_t refs;		/**< 引用计数，由 service.mutex 保护 */
+
+	/** 写入请求时的回调，设置后请求不进入数据块列表，而是直接交给它处理 */
+	void (*on_request)(FileRequest *);
 } FileStreamRec;
 
 typedef struct ConnectionHubRec_ {
@@ -79,7 +99,6 @@ typedef struct ConnectionRec_ {
 	LCUI_BOOL closed;
 	LCUI_Cond cond;
 	LCUI_Mutex mutex;
-	LCUI_Thread thread;
 	FileStream input;
 	FileStream output;
 } ConnectionRec;
@@ -89,15 +108,50 @@ typedef struct FileClientTask_ {
 	FileRequestHandler handler;
 } FileClientTask;
 
+/** 客户端中发送请求的线程，每个线程同时只有一个请求在等待响应 */
+typedef struct FileClientLaneRec_ {
+	FileClient client;
+	LCUI_Thread thread;
+	FileStream stream;	/**< 正在等待响应的请求的响应流 */
+} FileClientLaneRec, *FileClientLane;
+
+/**
+ * 文件服务客户端
+ * 请求由多个线程发送，每个请求有各自的响应流，因此能同时有多个请求在等待
+ * 响应，并由文件服务的多个工作线程同时处理。第一个线程在 FileClient_Run()
+ * 中运行，其余线程由它按需创建。
+ */
 typedef struct FileClientRec_ {
 	LCUI_BOOL active;
+	int priority;		/**< 发出的请求的优先级 */
 	LCUI_Cond cond;
 	LCUI_Mutex mutex;
 	LCUI_Thread thread;
 	Connection connection;
+	size_t n_lanes;		/**< 能同时等待响应的请求数量 */
+	size_t n_started;	/**< 已启动的线程数量 */
+	FileClientLaneRec lanes[FILE_CLIENT_MAX_REQUESTS];
 	LinkedList tasks;
-} FileClientRec, *FileClient;
+} FileClientRec;
+
+typedef struct DirRecordWriterRec_ {
+	FileStream output;
+	size_t len;	/**< 缓冲区中已写入的字节数 */
+	char *buf;
+} DirRecordWriterRec, *DirRecordWriter;
 
+/** 文件服务中待处理的请求 */
+typedef struct FileServiceTaskRec_ {
+	FileRequest request;
+	LinkedListNode node;
+} FileServiceTaskRec, *FileServiceTask;
+
+/**
+ * 文件服务
+ * 请求按优先级放入不同的队列，由固定数量的工作线程处理，工作线程总是先处理
+ * 优先级最高的队列中的请求。每个请求的响应写入客户端随请求附带的响应流中，
+ * 因此不同连接的请求可以被任意一个工作线程处理。
+ */
 static struct FileService {
 	LCUI_BOOL active;
 	LCUI_Thread thread;
@@ -106,6 +160,10 @@ static struct FileService {
 	size_t backlog;
 	LinkedList requests;
 	LinkedList connections;
+	LCUI_Cond tasks_cond;
+	LinkedList tasks[FILE_PRIORITY_TOTAL];
+	size_t n_workers;
+	LCUI_Thread workers[FILE_SERVICE_MAX_WORKERS];
 } service;
 
 void FileStreamChunk_Destroy(FileStreamChunk *chunk)
@@ -156,6 +214,7 @@ FileStream FileStream_Create(void)
 	stream = NEW(FileStreamRec, 1);
 	stream->closed = FALSE;
 	stream->active = TRUE;
+	stream->refs = 1;
 	LinkedList_Init(&stream->data);
 	LCUICond_Init(&stream->cond);
 	LCUIMutex_Init(&stream->mutex);
@@ -172,15 +231,13 @@ void FileStream_Close(FileStream stream)
 
 static LCUI_BOOL FileStream_Useable(FileStream stream)
 {
-	if (stream->active) {
-		if (stream->chunk || stream->data.length > 0) {
-			return TRUE;
-		}
-		if (stream->closed) {
-			return FALSE;
-		}
+	if (!stream->active) {
+		return FALSE;
+	}
+	if (stream->chunk || stream->data.length > 0) {
+		return TRUE;
 	}
-	return TRUE;
+	return !stream->closed;
 }
 
 void FileStream_Destroy(FileStream stream)
@@ -195,6 +252,21 @@ void FileStream_Destroy(FileStream stream)
 	LCUICond_Destroy(&stream->cond);
 }
 
+/** 释放一个引用，客户端和处理请求的工作线程都释放后才销毁响应流 */
+static void FileStream_Release(FileStream stream)
+{
+	size_t refs;
+
+	LCUIMutex_Lock(&service.mutex);
+	refs = --stream->refs;
+	LCUIMutex_Unlock(&service.mutex);
+	if (refs > 0) {
+		return;
+	}
+	FileStream_Destroy(stream);
+	free(stream);
+}
+
 int FileStream_ReadChunk(FileStream stream, FileStreamChunk *chunk)
 {
 	LinkedListNode *node;
@@ -227,6 +299,10 @@ int FileStream_WriteChunk(FileStream stream, FileStreamChunk *chunk)
 		FileStream_Destroy(stream);
 		return -1;
 	}
+	if (chunk->type == DATA_CHUNK_REQUEST && stream->on_request) {
+		stream->on_request(&chunk->request);
+		return 1;
+	}
 	LCUIMutex_Lock(&stream->mutex);
 	buf = NEW(FileStreamChunk, 1);
 	*buf = *chunk;
@@ -314,6 +390,7 @@ size_t FileStream_Write(FileStream stream, char *buf, size_t size, size_t count)
 	}
 	LCUIMutex_Lock(&stream->mutex);
 	if (stream->closed) {
+		LCUIMutex_Unlock(&stream->mutex);
 		return 0;
 	}
 	chunk = NEW(FileStreamChunk, 1);
@@ -534,7 +611,7 @@ static int FileService_RemoveFile(const wchar_t *path, FileResponse *response)
 	return ret;
 }
 
-static int FileService_GetFiles(Connection conn, FileRequest *request,
+static int FileService_GetFiles(FileStream output, FileRequest *request,
 				FileStreamChunk *chunk)
 {
 	int ret;
@@ -547,7 +624,7 @@ static int FileService_GetFiles(Connection conn, FileRequest *request,
 	if (ret != 0) {
 		return ret;
 	}
-	while (!conn->closed && (entry = LCUI_ReadDirW(&dir))) {
+	while (!output->closed && (entry = LCUI_ReadDirW(&dir))) {
 		size_t size;
 		wchar_t *name = LCUI_GetFileNameW(entry);
 		/* 忽略 . 和 .. 文件夹 */
@@ -591,12 +668,198 @@ static int FileService_GetFiles(Connection conn, FileRequest *request,
 		size = LCUI_EncodeUTF8String(buf + 1, name, PATH_LEN) + 1;
 		buf[size++] = '\n';
 		buf[size] = 0;
-		Connection_Write(conn, buf, sizeof(char), size);
+		FileStream_Write(output, buf, sizeof(char), size);
 	}
 	return 0;
 }
 
-static int FileService_GetFile(Connection conn, FileRequest *request,
+/** 按请求的过滤条件判断是否列出该项，文件只列出图片文件 */
+static LCUI_BOOL FileService_FilterEntry(int filter, const wchar_t *name,
+					 LCUI_BOOL is_dir, LCUI_BOOL is_regular)
+{
+	switch (filter) {
+	case FILE_FILTER_FILE:
+		return is_regular && IsImageFile(name);
+	case FILE_FILTER_FOLDER:
+		return is_dir;
+	default:
+		break;
+	}
+	if (is_regular) {
+		return IsImageFile(name);
+	}
+	return is_dir;
+}
+
+static void DirRecordWriter_Flush(DirRecordWriter writer)
+{
+	if (writer->len > 0) {
+		FileStream_Write(writer->output, writer->buf, sizeof(char),
+				 writer->len);
+		writer->len = 0;
+	}
+}
+
+static void DirRecordWriter_Write(DirRecordWriter writer,
+				  const FileDirRecord *record, const char *name)
+{
+	size_t size = sizeof(FileDirRecord) + record->name_len + 1;
+
+	if (writer->len + size > DIR_RECORD_BUFFER_SIZE) {
+		DirRecordWriter_Flush(writer);
+	}
+	memcpy(writer->buf + writer->len, record, sizeof(FileDirRecord));
+	writer->len += sizeof(FileDirRecord);
+	memcpy(writer->buf + writer->len, name, record->name_len + 1);
+	writer->len += record->name_len + 1;
+}
+
+#ifdef _WIN32
+
+static time_t FileTimeToUnixTime(const FILETIME *ft)
+{
+	uint64_t t = ((uint64_t)ft->dwHighDateTime << 32) | ft->dwLowDateTime;
+	/* FILETIME 以 100 纳秒为单位，从 1601 年开始计时 */
+	return (time_t)(t / 10000000 - 11644473600LL);
+}
+
+/** 列出目录，文件状态直接取自 FindNextFileW() 的结果 */
+static int FileService_GetDirEntries(FileStream output, FileRequest *request,
+				     FileStreamChunk *chunk)
+{
+	size_t len;
+	HANDLE handle;
+	LCUI_BOOL is_dir;
+	LCUI_BOOL is_regular;
+	FileDirRecord record = { 0 };
+	DirRecordWriterRec writer;
+	WIN32_FIND_DATAW data;
+	wchar_t pattern[PATH_LEN + 2];
+	char name[PATH_LEN];
+
+	len = wcslen(request->path);
+	wcsncpy(pattern, request->path, PATH_LEN);
+	if (len > 0 && pattern[len - 1] != L'\\' && pattern[len - 1] != L'/') {
+		pattern[len++] = L'\\';
+	}
+	pattern[len++] = L'*';
+	pattern[len] = 0;
+	handle = FindFirstFileW(pattern, &data);
+	if (handle == INVALID_HANDLE_VALUE) {
+		chunk->response.status = RESPONSE_STATUS_NOT_FOUND;
+		return -ENOENT;
+	}
+	FileStream_WriteChunk(output, chunk);
+	writer.output = output;
+	writer.len = 0;
+	writer.buf = malloc(DIR_RECORD_BUFFER_SIZE);
+	do {
+		if (data.cFileName[0] == '.' &&
+		    (data.cFileName[1] == 0 ||
+		     (data.cFileName[1] == '.' && data.cFileName[2] == 0))) {
+			continue;
+		}
+		is_dir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		is_regular = !is_dir &&
+			     !(data.dwFileAttributes & FILE_ATTRIBUTE_DEVICE);
+		if (!FileService_FilterEntry(request->params.filter,
+					     data.cFileName, is_dir,
+					     is_regular)) {
+			continue;
+		}
+		record.type = is_dir ? FILE_TYPE_DIRECTORY : FILE_TYPE_ARCHIVE;
+		record.size = (size_t)(((uint64_t)data.nFileSizeHigh << 32) |
+				       data.nFileSizeLow);
+		record.ctime = FileTimeToUnixTime(&data.ftCreationTime);
+		record.mtime = FileTimeToUnixTime(&data.ftLastWriteTime);
+		record.name_len = (unsigned int)LCUI_EncodeUTF8String(
+		    name, data.cFileName, PATH_LEN - 1);
+		name[record.name_len] = 0;
+		DirRecordWriter_Write(&writer, &record, name);
+	} while (!output->closed && FindNextFileW(handle, &data));
+	DirRecordWriter_Flush(&writer);
+	free(writer.buf);
+	FindClose(handle);
+	return 0;
+}
+
+#else
+
+/** 列出目录，用 fstatat() 相对于已打开的目录获取文件状态，省去路径解析 */
+static int FileService_GetDirEntries(FileStream output, FileRequest *request,
+				     FileStreamChunk *chunk)
+{
+	int fd, ret;
+	DIR *dir;
+	char *path;
+	struct stat buf;
+	struct dirent *d;
+	FileDirRecord record = { 0 };
+	DirRecordWriterRec writer;
+	wchar_t name[PATH_LEN];
+
+	path = EncodeUTF8(request->path);
+	dir = opendir(path);
+	free(path);
+	if (!dir) {
+		ret = -errno;
+		chunk->response.status = GetStatusByErrorCode(ret);
+		return ret;
+	}
+	FileStream_WriteChunk(output, chunk);
+	fd = dirfd(dir);
+	writer.output = output;
+	writer.len = 0;
+	writer.buf = malloc(DIR_RECORD_BUFFER_SIZE);
+	while (!output->closed && (d = readdir(dir))) {
+		if (d->d_name[0] == '.' &&
+		    (d->d_name[1] == 0 ||
+		     (d->d_name[1] == '.' && d->d_name[2] == 0))) {
+			continue;
+		}
+		LCUI_DecodeUTF8String(name, d->d_name, PATH_LEN - 1);
+		name[PATH_LEN - 1] = 0;
+		/* 文件类型已知时，先排除非图片文件，不必获取它们的状态 */
+		if (d->d_type == DT_REG && !IsImageFile(name)) {
+			continue;
+		}
+		if (fstatat(fd, d->d_name, &buf, AT_SYMLINK_NOFOLLOW) != 0) {
+			continue;
+		}
+		/* 跟随指向文件的符号链接，但不进入指向目录的符号链接，以免循环
+		 * 遍历，与扫描器使用的 DirWalker 一致 */
+		if (S_ISLNK(buf.st_mode)) {
+			if (fstatat(fd, d->d_name, &buf, 0) != 0 ||
+			    S_ISDIR(buf.st_mode)) {
+				continue;
+			}
+		}
+		if (!FileService_FilterEntry(request->params.filter, name,
+					     S_ISDIR(buf.st_mode),
+					     S_ISREG(buf.st_mode))) {
+			continue;
+		}
+		if (S_ISDIR(buf.st_mode)) {
+			record.type = FILE_TYPE_DIRECTORY;
+		} else {
+			record.type = FILE_TYPE_ARCHIVE;
+		}
+		record.size = buf.st_size;
+		record.ctime = buf.st_ctime;
+		record.mtime = buf.st_mtime;
+		record.inode = buf.st_ino;
+		record.name_len = (unsigned int)strlen(d->d_name);
+		DirRecordWriter_Write(&writer, &record, d->d_name);
+	}
+	DirRecordWriter_Flush(&writer);
+	free(writer.buf);
+	closedir(dir);
+	return 0;
+}
+
+#endif
+
+static int FileService_GetFile(FileStream output, FileRequest *request,
 			       FileStreamChunk *chunk)
 {
 	int ret;
@@ -612,8 +875,11 @@ static int FileService_GetFile(Connection conn, FileRequest *request,
 		return ret;
 	}
 	if (response->file.type == FILE_TYPE_DIRECTORY) {
-		Connection_WriteChunk(conn, chunk);
-		return FileService_GetFiles(conn, request, chunk);
+		if (params->with_file_status) {
+			return FileService_GetDirEntries(output, request, chunk);
+		}
+		FileStream_WriteChunk(output, chunk);
+		return FileService_GetFiles(output, request, chunk);
 	}
 	Graph_Init(&img);
 	path = EncodeANSI(request->path);
@@ -650,7 +916,7 @@ static int FileService_GetFile(Connection conn, FileRequest *request,
 	fclose(fp);
 		LOG("[file service] load image success, size: (%d, %d)\n",
 		    img.width, img.height);
-	Connection_WriteChunk(conn, chunk);
+	FileStream_WriteChunk(output, chunk);
 	if (!params->get_thumbnail) {
 		chunk->type = DATA_CHUNK_IMAGE;
 		chunk->image = img;
@@ -676,7 +942,7 @@ static int FileService_GetFile(Connection conn, FileRequest *request,
 	return -1;
 }
 
-static void FileService_HandleRequest(Connection conn, FileRequest *request)
+static void FileService_HandleRequest(FileStream output, FileRequest *request)
 {
 	FileStreamChunk chunk = { 0 };
 	const wchar_t *path = request->path;
@@ -688,7 +954,7 @@ static void FileService_HandleRequest(Connection conn, FileRequest *request)
 		break;
 	case REQUEST_METHOD_POST:
 	case REQUEST_METHOD_GET:
-		FileService_GetFile(conn, request, &chunk);
+		FileService_GetFile(output, request, &chunk);
 		break;
 	case REQUEST_METHOD_DELETE:
 		FileService_RemoveFile(path, &chunk.response);
@@ -700,37 +966,122 @@ static void FileService_HandleRequest(Connection conn, FileRequest *request)
 		chunk.response.status = RESPONSE_STATUS_BAD_REQUEST;
 		break;
 	}
-	Connection_WriteChunk(conn, &chunk);
+	FileStream_WriteChunk(output, &chunk);
 	chunk.type = DATA_CHUNK_END;
 	chunk.size = chunk.cur = 0;
 	chunk.data = NULL;
-	Connection_WriteChunk(conn, &chunk);
+	FileStream_WriteChunk(output, &chunk);
 }
 
-void FileService_Handler(void *arg)
+static void FileService_OnRequest(FileRequest *request)
 {
-	int n;
-	FileStreamChunk chunk;
-	Connection conn = arg;
+	int priority = request->params.priority;
+	FileServiceTask task;
 
-	LOG("[file service][thread %d] started, connection: %d\n",
-	    LCUIThread_SelfID(), conn->id);
-	while (1) {
-		n = Connection_ReadChunk(conn, &chunk);
-		if (n == -1) {
+	if (!request->stream) {
+		LOG("[file service] drop request without response stream\n");
+		return;
+	}
+	if (priority < 0 || priority >= FILE_PRIORITY_TOTAL) {
+		priority = FILE_PRIORITY_BACKGROUND;
+	}
+	task = NEW(FileServiceTaskRec, 1);
+	task->request = *request;
+	task->node.data = task;
+	LCUIMutex_Lock(&service.mutex);
+	if (!service.active) {
+		LCUIMutex_Unlock(&service.mutex);
+		FileStream_Close(request->stream);
+		free(task);
+		return;
+	}
+	request->stream->refs += 1;
+	LinkedList_AppendNode(&service.tasks[priority], &task->node);
+	LCUICond_Signal(&service.tasks_cond);
+	LCUIMutex_Unlock(&service.mutex);
+}
+
+/** 取出优先级最高的请求，服务停止时返回 NULL */
+static FileServiceTask FileService_TakeTask(void)
+{
+	int i;
+	FileServiceTask task = NULL;
+
+	LCUIMutex_Lock(&service.mutex);
+	while (service.active) {
+		for (i = 0; i < FILE_PRIORITY_TOTAL; ++i) {
+			if (service.tasks[i].length > 0) {
+				break;
+			}
+		}
+		if (i < FILE_PRIORITY_TOTAL) {
+			task = LinkedList_Get(&service.tasks[i], 0);
+			LinkedList_Unlink(&service.tasks[i], &task->node);
 			break;
-		} else if (n == 0) {
-			continue;
 		}
-		chunk.request.stream = conn->input;
-		FileService_HandleRequest(conn, &chunk.request);
+		LCUICond_Wait(&service.tasks_cond, &service.mutex);
+	}
+	LCUIMutex_Unlock(&service.mutex);
+	return task;
+}
+
+static void FileService_Worker(void *arg)
+{
+	FileStream stream;
+	FileServiceTask task;
+
+	LOG("[file service][thread %d] worker started\n", LCUIThread_SelfID());
+	while ((task = FileService_TakeTask())) {
+		stream = task->request.stream;
+		FileService_HandleRequest(stream, &task->request);
+		FileStream_Release(stream);
+		free(task);
 	}
-	LOG("[file service][thread %d] stopped, connection: %d\n",
-	    LCUIThread_SelfID(), conn->id);
-	Connection_Destroy(conn);
+	LOG("[file service][thread %d] worker stopped\n", LCUIThread_SelfID());
 	LCUIThread_Exit(NULL);
 }
 
+static size_t FileService_GetWorkerCount(void)
+{
+	size_t n;
+#ifdef _WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	n = info.dwNumberOfProcessors;
+#else
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	n = n_cpus > 0 ? (size_t)n_cpus : 1;
+#endif
+	if (n < FILE_SERVICE_MIN_WORKERS) {
+		n = FILE_SERVICE_MIN_WORKERS;
+	}
+	if (n > FILE_SERVICE_MAX_WORKERS) {
+		n = FILE_SERVICE_MAX_WORKERS;
+	}
+	return n;
+}
+
+/** 关闭未处理的请求的响应流，让等待响应的客户端结束等待 */
+static void FileService_ClearTasks(void)
+{
+	int i;
+	FileStream stream;
+	FileServiceTask task;
+
+	for (i = 0; i < FILE_PRIORITY_TOTAL; ++i) {
+		while (service.tasks[i].length > 0) {
+			task = LinkedList_Get(&service.tasks[i], 0);
+			LinkedList_Unlink(&service.tasks[i], &task->node);
+			stream = task->request.stream;
+			FileStream_Close(stream);
+			FileStream_Release(stream);
+			free(task);
+		}
+	}
+}
+
 size_t FileService_Listen(int backlog)
 {
 	LCUIMutex_Lock(&service.mutex);
@@ -790,6 +1141,7 @@ Connection FileService_Accept(void)
 	conn_client->output = conn->streams[1];
 	conn_service->input = conn->streams[1];
 	conn_service->output = conn->streams[0];
+	conn_service->input->on_request = FileService_OnRequest;
 	LinkedList_AppendNode(&service.connections, &conn->node);
 	LCUICond_Signal(&conn_client->cond);
 	LCUIMutex_Unlock(&conn_client->mutex);
@@ -798,24 +1150,40 @@ Connection FileService_Accept(void)
 
 void FileService_Run(void)
 {
+	size_t i;
 	Connection conn;
+
 	LCUIMutex_Lock(&service.mutex);
 	service.active = TRUE;
+	service.n_workers = FileService_GetWorkerCount();
 	LCUICond_Signal(&service.cond);
 	LCUIMutex_Unlock(&service.mutex);
-	LOG("[file service] file service started\n");
+	for (i = 0; i < service.n_workers; ++i) {
+		LCUIThread_Create(&service.workers[i], FileService_Worker, NULL);
+	}
+	LOG("[file service] file service started with %lu workers\n",
+	    service.n_workers);
 	while (service.active) {
 		LOG("[file service] listen...\n");
 		if (FileService_Listen(5) == 0) {
 			continue;
 		}
 		conn = FileService_Accept();
-		LOG("[file service] accept connection %d\n", conn->id);
 		if (!conn) {
 			continue;
 		}
-		LCUIThread_Create(&conn->thread, FileService_Handler, conn);
+		/* 请求由连接的输入流直接交给工作线程，服务端的连接对象不再需要 */
+		LOG("[file service] accept connection %d\n", conn->id);
+		Connection_Destroy(conn);
 	}
+	LCUIMutex_Lock(&service.mutex);
+	LCUICond_Broadcast(&service.tasks_cond);
+	LCUIMutex_Unlock(&service.mutex);
+	for (i = 0; i < service.n_workers; ++i) {
+		LCUIThread_Join(service.workers[i], NULL);
+	}
+	service.n_workers = 0;
+	FileService_ClearTasks();
 	LOG("[file service] file service stopped\n");
 }
 
@@ -835,6 +1203,7 @@ void FileService_Close(void)
 	LCUIMutex_Lock(&service.mutex);
 	service.active = FALSE;
 	LCUICond_Signal(&service.cond);
+	LCUICond_Broadcast(&service.tasks_cond);
 	LCUIMutex_Unlock(&service.mutex);
 	if (service.thread) {
 		LCUIThread_Join(service.thread, NULL);
@@ -845,11 +1214,18 @@ void FileService_Close(void)
 
 void FileService_Init(void)
 {
+	int i;
+
 	service.backlog = 1;
 	service.active = FALSE;
+	service.n_workers = 0;
 	LinkedList_Init(&service.connections);
 	LinkedList_Init(&service.requests);
+	for (i = 0; i < FILE_PRIORITY_TOTAL; ++i) {
+		LinkedList_Init(&service.tasks[i]);
+	}
 	LCUICond_Init(&service.cond);
+	LCUICond_Init(&service.tasks_cond);
 	LCUIMutex_Init(&service.mutex);
 }
 
@@ -911,7 +1287,11 @@ FileClient FileClient_Create(void)
 	client = NEW(FileClientRec, 1);
 	client->thread = 0;
 	client->active = FALSE;
+	client->priority = FILE_PRIORITY_BACKGROUND;
 	client->connection = NULL;
+	client->n_lanes = 1;
+	client->n_started = 0;
+	memset(client->lanes, 0, sizeof(client->lanes));
 	LCUICond_Init(&client->cond);
 	LCUIMutex_Init(&client->mutex);
 	LinkedList_Init(&client->tasks);
@@ -985,51 +1365,120 @@ void FileClient_Destroy(FileClient client)
 	free(client);
 }
 
-void FileClient_Run(FileClient client)
+static void FileClient_ReleaseStream(FileClientLane lane)
+{
+	FileStream stream;
+
+	LCUIMutex_Lock(&lane->client->mutex);
+	stream = lane->stream;
+	lane->stream = NULL;
+	LCUIMutex_Unlock(&lane->client->mutex);
+	FileStream_Release(stream);
+}
+
+static void FileClient_Work(FileClientLane lane)
 {
 	int n;
 	LinkedListNode *node;
 	FileClientTask *task;
+	FileStream stream;
+	FileStreamChunk chunk;
 	FileResponse response;
+	FileClient client = lane->client;
 	Connection conn = client->connection;
 
-	LOG("[file client][%u] work started\n", client->thread);
-	client->active = TRUE;
 	while (client->active) {
 		LCUIMutex_Lock(&client->mutex);
 		while (client->tasks.length < 1 && client->active) {
 			LCUICond_Wait(&client->cond, &client->mutex);
 		}
-		node = LinkedList_GetNode(&client->tasks, 0);
-		LCUIMutex_Unlock(&client->mutex);
 		if (!client->active) {
+			LCUIMutex_Unlock(&client->mutex);
 			break;
 		}
+		node = LinkedList_GetNode(&client->tasks, 0);
 		if (!node) {
+			LCUIMutex_Unlock(&client->mutex);
 			continue;
 		}
 		LinkedList_Unlink(&client->tasks, node);
 		task = node->data;
+		/* 每个请求的响应写入单独的响应流，不会与其它请求的数据混在一起 */
+		stream = FileStream_Create();
+		task->request.stream = stream;
+		task->request.params.priority = client->priority;
+		lane->stream = stream;
+		LCUIMutex_Unlock(&client->mutex);
 		LOG("[file client] send request, "
 		    "method: %s, path len: %lu\n",
 		    GetRequestMethodString(task->request.method),
 		    wcslen(task->request.path));
 		n = Connection_SendRequest(conn, &task->request);
 		if (n == 0) {
-			continue;
-		}
-		while (client->active) {
-			n = Connection_ReceiveResponse(conn, &response);
-			if (n != 0) {
-				break;
-			}
+			FileStream_Close(stream);
 		}
+		n = FileStream_ReadChunk(stream, &chunk);
 		if (!client->active) {
+			if (n > 0) {
+				FileStreamChunk_Destroy(&chunk);
+			}
+			FileClientTask_Destroy(task);
+			FileClient_ReleaseStream(lane);
 			break;
 		}
-		response.stream = conn->input;
+		if (n > 0 && chunk.type == DATA_CHUNK_RESPONSE) {
+			response = chunk.response;
+		} else {
+			if (n > 0) {
+				FileStreamChunk_Destroy(&chunk);
+			}
+			memset(&response, 0, sizeof(response));
+			response.status = RESPONSE_STATUS_ERROR;
+		}
+		response.stream = stream;
 		task->handler.callback(&response, task->handler.data);
 		FileClientTask_Destroy(task);
+		FileClient_ReleaseStream(lane);
+	}
+}
+
+static void FileClient_LaneThread(void *arg)
+{
+	FileClient_Work(arg);
+	LCUIThread_Exit(NULL);
+}
+
+/** 启动尚未启动的线程，调用前需锁定 client->mutex */
+static void FileClient_StartLanes(FileClient client)
+{
+	FileClientLane lane;
+
+	if (!client->active || client->n_started < 1) {
+		return;
+	}
+	for (; client->n_started < client->n_lanes; ++client->n_started) {
+		lane = &client->lanes[client->n_started];
+		lane->client = client;
+		lane->stream = NULL;
+		LCUIThread_Create(&lane->thread, FileClient_LaneThread, lane);
+	}
+}
+
+void FileClient_Run(FileClient client)
+{
+	size_t i;
+
+	LOG("[file client][%u] work started\n", client->thread);
+	LCUIMutex_Lock(&client->mutex);
+	client->active = TRUE;
+	client->lanes[0].client = client;
+	client->lanes[0].stream = NULL;
+	client->n_started = 1;
+	FileClient_StartLanes(client);
+	LCUIMutex_Unlock(&client->mutex);
+	FileClient_Work(&client->lanes[0]);
+	for (i = 1; i < client->n_started; ++i) {
+		LCUIThread_Join(client->lanes[i].thread, NULL);
 	}
 	LOG("[file client][%u] work stopped\n", client->thread);
 	LCUIThread_Exit(NULL);
@@ -1044,11 +1493,18 @@ static void FileClient_Thread(void *arg)
 
 void FileClient_Close(FileClient client)
 {
+	size_t i;
+
 	LOG("[file client][%u] close...\n", client->thread);
 	LCUIMutex_Lock(&client->mutex);
 	client->active = FALSE;
 	Connection_Close(client->connection);
-	LCUICond_Signal(&client->cond);
+	for (i = 0; i < client->n_started; ++i) {
+		if (client->lanes[i].stream) {
+			FileStream_Close(client->lanes[i].stream);
+		}
+	}
+	LCUICond_Broadcast(&client->cond);
 	LCUIMutex_Unlock(&client->mutex);
 	LOG("[file client][%u] waiting...\n", client->thread);
 	LCUIThread_Join(client->thread, NULL);
@@ -1060,6 +1516,27 @@ void FileClient_RunAsync(FileClient client)
 	LCUIThread_Create(&client->thread, FileClient_Thread, client);
 }
 
+void FileClient_SetPriority(FileClient client, int priority)
+{
+	LCUIMutex_Lock(&client->mutex);
+	client->priority = priority;
+	LCUIMutex_Unlock(&client->mutex);
+}
+
+void FileClient_SetMaxRequests(FileClient client, size_t n)
+{
+	if (n > FILE_CLIENT_MAX_REQUESTS) {
+		n = FILE_CLIENT_MAX_REQUESTS;
+	}
+	LCUIMutex_Lock(&client->mutex);
+	/* 已启动的线程不会退出，所以只能增加数量 */
+	if (n > client->n_lanes) {
+		client->n_lanes = n;
+		FileClient_StartLanes(client);
+	}
+	LCUIMutex_Unlock(&client->mutex);
+}
+
 void FileClient_SendRequest(FileClient client, const FileRequest *request,
 			    const FileRequestHandler *handler)
 {
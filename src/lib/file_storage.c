@@ -49,7 +49,8 @@ enum HandlerDataType {
 	HANDLER_ON_GET_FILE,
 	HANDLER_ON_GET_IMAGE,
 	HANDLER_ON_GET_THUMB,
-	HANDLER_ON_GET_PROPS
+	HANDLER_ON_GET_PROPS,
+	HANDLER_ON_GET_ENTRIES
 };
 
 typedef struct HandlerDataPackRec_ {
@@ -59,6 +60,7 @@ typedef struct HandlerDataPackRec_ {
 		HandlerOnGetThumbnail on_get_thumb;
 		HandlerOnGetStatus on_get_status;
 		HandlerOnGetImage on_get_image;
+		HandlerOnGetDirEntries on_get_entries;
 	};
 	HandlerOnGetProgress on_get_prog;
 	void *data;
@@ -118,6 +120,22 @@ int FileStorage_Connect(void)
 	return conn->id;
 }
 
+void FileStorage_SetPriority(int id, int priority)
+{
+	FileStorageConnection conn = FileStorage_GetConnection(id);
+	if (conn && conn->active) {
+		FileClient_SetPriority(conn->client, priority);
+	}
+}
+
+void FileStorage_SetMaxRequests(int id, size_t n)
+{
+	FileStorageConnection conn = FileStorage_GetConnection(id);
+	if (conn && conn->active) {
+		FileClient_SetMaxRequests(conn->client, n);
+	}
+}
+
 void FileStorage_Close(int id)
 {
 	FileStorageConnection conn = FileStorage_GetConnection(id);
@@ -134,6 +152,58 @@ void FileStorage_Free(void)
 	FileService_Close();
 }
 
+/** 读取响应中的目录记录，记录数据块之后的数据块标志着列表结束 */
+static void OnGetDirEntries(FileResponse *response, HandlerDataPack pack)
+{
+	char *buf = NULL, *p, *end;
+	size_t i, n = 0, len = 0;
+	FileDirRecord record;
+	FileDirEntry *entries = NULL;
+	FileStreamChunk chunk = { 0 };
+
+	while (FileStream_ReadChunk(response->stream, &chunk) > 0) {
+		if (chunk.type != DATA_CHUNK_BUFFER) {
+			FileStreamChunk_Destroy(&chunk);
+			break;
+		}
+		if (!buf) {
+			buf = chunk.data;
+			len = chunk.size;
+			continue;
+		}
+		p = realloc(buf, len + chunk.size);
+		if (p) {
+			memcpy(p + len, chunk.data, chunk.size);
+			buf = p;
+			len += chunk.size;
+		}
+		FileStreamChunk_Destroy(&chunk);
+	}
+	/* 记录在缓冲区中紧密排列，不一定对齐，所以先复制出来再读取 */
+	end = buf + len;
+	for (p = buf; p && p + sizeof(FileDirRecord) <= end; ++n) {
+		memcpy(&record, p, sizeof(FileDirRecord));
+		/* 丢弃被截断的记录，以免名称读到缓冲区之外 */
+		if ((size_t)(end - p) - sizeof(FileDirRecord) <
+			record.name_len + (size_t)1 ||
+		    p[sizeof(FileDirRecord) + record.name_len] != 0) {
+			break;
+		}
+		p += sizeof(FileDirRecord) + record.name_len + 1;
+	}
+	if (n > 0) {
+		entries = NEW(FileDirEntry, n);
+	}
+	for (i = 0, p = buf; i < n; ++i) {
+		memcpy(&entries[i].status, p, sizeof(FileDirRecord));
+		entries[i].name = p + sizeof(FileDirRecord);
+		p += sizeof(FileDirRecord) + entries[i].status.name_len + 1;
+	}
+	pack->on_get_entries(&response->file, entries, n, pack->data);
+	free(entries);
+	free(buf);
+}
+
 static void OnResponse(FileResponse *response, void *data)
 {
 	int n;
@@ -180,6 +250,13 @@ static void OnResponse(FileResponse *response, void *data)
 		}
 		pack->on_get_status(&response->file, pack->data);
 		break;
+	case HANDLER_ON_GET_ENTRIES:
+		if (response->status != RESPONSE_STATUS_OK) {
+			pack->on_get_entries(NULL, NULL, 0, pack->data);
+			break;
+		}
+		OnGetDirEntries(response, pack);
+		break;
 	default:
 		break;
 	}
@@ -261,6 +338,31 @@ int FileStorage_GetFolders(int conn_id, const wchar_t *filename,
 	return 0;
 }
 
+int FileStorage_GetDirEntries(int conn_id, const wchar_t *dirname,
+			      HandlerOnGetDirEntries callback, void *data)
+{
+	HandlerDataPack pack;
+	FileRequestHandler handler;
+	FileStorageConnection conn;
+	FileRequest request = { 0 };
+
+	conn = FileStorage_GetConnection(conn_id);
+	if (!conn || !conn->active) {
+		return -1;
+	}
+	pack = NEW(HandlerDataPackRec, 1);
+	pack->type = HANDLER_ON_GET_ENTRIES;
+	pack->on_get_entries = callback;
+	pack->data = data;
+	request.method = REQUEST_METHOD_GET;
+	request.params.with_file_status = TRUE;
+	wcsncpy(request.path, dirname, 255);
+	handler.callback = OnResponse;
+	handler.data = pack;
+	FileClient_SendRequest(conn->client, &request, &handler);
+	return 0;
+}
+
 static void FileStorgage_OnGetProgress(void *data, float progress)
 {
 	HandlerDataPack pack = data;
@@ -0,0 +1,966 @@
+﻿/* ***************************************************************************
+ * file_watcher.c -- file system change watcher
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * file_watcher.c -- 文件系统变更监视器
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+
+/**
+ * 文件系统变更监视器
+ * 监视线程读取 inotify 或 fanotify 的事件，按路径合并到变更表中，等到一段时间
+ * 内没有新事件或积累的时间过长时，再对变更的文件取一次状态，作为一批交给处理
+ * 函数。inotify 需要为每个目录单独添加监视，目录表只在监视线程中访问，其它线程
+ * 添加或移除根目录时只是提交请求。
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <LCUI_Build.h>
+#include <LCUI/LCUI.h>
+#include <LCUI/thread.h>
+#include <LCUI/timer.h>
+#include "build.h"
+#include "common.h"
+#include "file_watcher.h"
+
+#ifdef PLATFORM_LINUX
+
+#include <poll.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/statfs.h>
+#include <sys/inotify.h>
+#ifdef LCFINDER_USE_FANOTIFY
+#include <sys/fanotify.h>
+#endif
+
+/** 最后一个事件之后多久（毫秒）没有新事件，才处理积累的变更 */
+#define WATCHER_SETTLE_TIME 500
+
+/** 变更最多积累多久（毫秒），避免在持续写入文件时一直得不到处理 */
+#define WATCHER_MAX_DELAY 3000
+
+/** 每次读取事件的缓冲区大小 */
+#define WATCHER_BUFFER_SIZE (64 * 1024)
+
+#define WATCHER_INOTIFY_MASK                                               \
+	(IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | \
+	 IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+#ifdef LCFINDER_USE_FANOTIFY
+#define WATCHER_FANOTIFY_MASK                                       \
+	(FAN_CREATE | FAN_CLOSE_WRITE | FAN_ATTRIB | FAN_DELETE |   \
+	 FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+#endif
+
+enum WatchBackend { BACKEND_INOTIFY, BACKEND_FANOTIFY };
+
+/** 目录中一项的变更 */
+enum WatchAction { ENTRY_CREATED, ENTRY_MODIFIED, ENTRY_REMOVED };
+
+/** 添加或移除根目录的请求 */
+typedef struct WatchRequestRec_ {
+	LCUI_BOOL remove;
+	char *path;
+	LinkedListNode node;
+} WatchRequestRec, *WatchRequest;
+
+/** inotify 中被监视的目录 */
+typedef struct WatchRec_ {
+	int wd;
+	char *path;
+} WatchRec, *Watch;
+
+/** 被监视的根目录 */
+typedef struct WatchRootRec_ {
+	char *path;
+	size_t len;
+	int fd;		/**< fanotify 解析文件句柄时所用的目录描述符 */
+	fsid_t fsid;	/**< 所在文件系统的标识 */
+	LinkedListNode node;
+} WatchRootRec, *WatchRoot;
+
+static struct FileWatcherRec_ {
+	int backend;
+	int fd;			/**< inotify 或 fanotify 实例 */
+	int pipe[2];		/**< 用于唤醒监视线程 */
+	char *buffer;
+	LCUI_BOOL active;
+	LCUI_Thread thread;
+	LCUI_Mutex mutex;	/**< 保护 active、paused 和 requests */
+	LCUI_Mutex handler_mutex;	/**< 处理函数执行期间一直被占用 */
+	int paused;
+	LinkedList requests;
+
+	/* 以下成员只在监视线程中访问 */
+	LinkedList roots;
+	Dict *watches;		/**< 以监视描述符作为索引的目录表 */
+	Dict *paths;		/**< 以路径作为索引的目录表 */
+	Dict *changes;		/**< 积累的变更，以路径作为索引 */
+	int64_t first_time;	/**< 第一个未处理的变更的时间 */
+	int64_t last_time;	/**< 最后一个变更的时间 */
+
+	FileWatcherHandler handler;
+	void *data;
+} watcher;
+
+static unsigned int WatchDict_KeyHash(const void *key)
+{
+	return (unsigned int)*(const int *)key;
+}
+
+static int WatchDict_KeyCompare(void *privdata, const void *key1,
+				const void *key2)
+{
+	return *(const int *)key1 == *(const int *)key2;
+}
+
+static void WatchDict_ValDestructor(void *privdata, void *val)
+{
+	Watch w = val;
+
+	free(w->path);
+	free(w);
+}
+
+/** 监视描述符表直接引用 Watch 里的 wd 字段，不复制键 */
+static DictType WatchDict = {
+	WatchDict_KeyHash, NULL, NULL, WatchDict_KeyCompare, NULL,
+	WatchDict_ValDestructor
+};
+
+static void ChangesDict_ValDestructor(void *privdata, void *val)
+{
+	FileWatcherEvent e = val;
+
+	free(e->path);
+	free(e);
+}
+
+static void FileWatcher_Wakeup(void)
+{
+	char c = 0;
+
+	if (write(watcher.pipe[1], &c, 1) < 0 && errno != EAGAIN) {
+		Logger_Debug("[watcher] cannot wake up thread, errno: %d\n",
+			     errno);
+	}
+}
+
+static LCUI_BOOL FileWatcher_IsImageFile(const char *path)
+{
+	int ret;
+	wchar_t *wpath = DecodeUTF8(path);
+
+	if (!wpath) {
+		return FALSE;
+	}
+	ret = IsImageFile(wpath);
+	free(wpath);
+	return ret;
+}
+
+/** 获取路径所处的根目录 */
+static WatchRoot FileWatcher_GetRoot(const char *path)
+{
+	WatchRoot root;
+	LinkedListNode *node;
+
+	for (LinkedList_Each(node, &watcher.roots)) {
+		root = node->data;
+		if (strncmp(root->path, path, root->len) == 0 &&
+		    (path[root->len] == 0 || path[root->len] == PATH_SEP)) {
+			return root;
+		}
+	}
+	return NULL;
+}
+
+/** 记录一个变更，同一路径只保留最后一次变更 */
+static void FileWatcher_AddChange(FileWatcherEventType type, const char *path)
+{
+	FileWatcherEvent e;
+	int64_t now = LCUI_GetTime();
+
+	e = Dict_FetchValue(watcher.changes, path);
+	if (e) {
+		/* 需要重新扫描的根目录不会因为之后的事件而改变 */
+		if (e->type != FILE_WATCHER_OVERFLOW) {
+			e->type = type;
+		}
+	} else {
+		e = NEW(FileWatcherEventRec, 1);
+		e->type = type;
+		e->path = strdup2(path);
+		Dict_Add(watcher.changes, e->path, e);
+		if (Dict_Size(watcher.changes) == 1) {
+			watcher.first_time = now;
+		}
+	}
+	watcher.last_time = now;
+}
+
+static void FileWatcher_Forget(Watch w)
+{
+	Dict_Delete(watcher.paths, w->path);
+	Dict_Delete(watcher.watches, &w->wd);
+}
+
+static int FileWatcher_Watch(const char *path)
+{
+	int wd, ret;
+	Watch w;
+
+	if (watcher.backend != BACKEND_INOTIFY) {
+		return 0;
+	}
+	wd = inotify_add_watch(watcher.fd, path, WATCHER_INOTIFY_MASK);
+	if (wd < 0) {
+		ret = -errno;
+		Logger_Debug("[watcher] cannot watch %s, errno: %d\n", path,
+			     -ret);
+		return ret;
+	}
+	w = Dict_FetchValue(watcher.watches, &wd);
+	if (w) {
+		if (strcmp(w->path, path) == 0) {
+			return 0;
+		}
+		/* 目录被移动后，同一个监视描述符会对应新的路径 */
+		FileWatcher_Forget(w);
+	}
+	w = Dict_FetchValue(watcher.paths, path);
+	if (w) {
+		FileWatcher_Forget(w);
+	}
+	w = NEW(WatchRec, 1);
+	w->wd = wd;
+	w->path = strdup2(path);
+	Dict_Add(watcher.watches, &w->wd, w);
+	Dict_Add(watcher.paths, w->path, w);
+	return 0;
+}
+
+/**
+ * 监视目录树
+ * 新出现的目录中可能已有文件，在添加监视之后才列出目录内容，这样不会漏掉在
+ * 两者之间新建的文件。
+ * @param[in] report 是否将目录树中已有的图片文件记为变更
+ */
+static void FileWatcher_WatchTree(const char *dirpath, LCUI_BOOL report)
+{
+	DIR *dir;
+	struct stat buf;
+	struct dirent *entry;
+	LCUI_BOOL is_dir;
+	char path[PATH_MAX];
+	size_t len = strlen(dirpath);
+
+	if (FileWatcher_Watch(dirpath) != 0) {
+		return;
+	}
+	if (watcher.backend != BACKEND_INOTIFY && !report) {
+		return;
+	}
+	dir = opendir(dirpath);
+	if (!dir) {
+		return;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0 ||
+		    len + strlen(entry->d_name) + 2 > PATH_MAX) {
+			continue;
+		}
+		pathjoin(path, dirpath, entry->d_name);
+		if (entry->d_type == DT_UNKNOWN) {
+			if (lstat(path, &buf) != 0) {
+				continue;
+			}
+			is_dir = S_ISDIR(buf.st_mode);
+		} else {
+			is_dir = entry->d_type == DT_DIR;
+		}
+		if (is_dir) {
+			FileWatcher_WatchTree(path, report);
+		} else if (report && FileWatcher_IsImageFile(path)) {
+			FileWatcher_AddChange(FILE_WATCHER_CHANGED, path);
+		}
+	}
+	closedir(dir);
+}
+
+/** 移除目录树中所有目录的监视，用于目录被删除或移出之后 */
+static void FileWatcher_UnwatchTree(const char *dirpath)
+{
+	Watch w, *list;
+	size_t i, n = 0;
+	DictEntry *entry;
+	DictIterator *iter;
+	size_t len = strlen(dirpath);
+
+	if (watcher.backend != BACKEND_INOTIFY) {
+		return;
+	}
+	list = malloc(sizeof(Watch) * (Dict_Size(watcher.watches) + 1));
+	if (!list) {
+		return;
+	}
+	iter = Dict_GetIterator(watcher.watches);
+	while ((entry = Dict_Next(iter))) {
+		w = DictEntry_GetVal(entry);
+		if (strncmp(w->path, dirpath, len) == 0 &&
+		    (w->path[len] == 0 || w->path[len] == PATH_SEP)) {
+			list[n++] = w;
+		}
+	}
+	Dict_ReleaseIterator(iter);
+	for (i = 0; i < n; ++i) {
+		inotify_rm_watch(watcher.fd, list[i]->wd);
+		FileWatcher_Forget(list[i]);
+	}
+	free(list);
+}
+
+/** 处理目录中一项的变更 */
+static void FileWatcher_OnEntry(const char *path, LCUI_BOOL is_dir,
+				int action)
+{
+	if (is_dir) {
+		if (action == ENTRY_CREATED) {
+			FileWatcher_WatchTree(path, TRUE);
+		} else if (action == ENTRY_REMOVED) {
+			FileWatcher_UnwatchTree(path);
+			FileWatcher_AddChange(FILE_WATCHER_DIR_DELETED, path);
+		}
+		return;
+	}
+	if (!FileWatcher_IsImageFile(path)) {
+		return;
+	}
+	if (action == ENTRY_REMOVED) {
+		FileWatcher_AddChange(FILE_WATCHER_DELETED, path);
+	} else {
+		FileWatcher_AddChange(FILE_WATCHER_CHANGED, path);
+	}
+}
+
+/** 事件队列溢出后已无法知道哪些文件有变更，只能让所有根目录重新扫描 */
+static void FileWatcher_OnOverflow(void)
+{
+	WatchRoot root;
+	LinkedListNode *node;
+
+	Logger_Debug("[watcher] event queue overflow\n");
+	for (LinkedList_Each(node, &watcher.roots)) {
+		root = node->data;
+		/* 丢失的事件中可能有新建的目录，需要补上监视 */
+		FileWatcher_WatchTree(root->path, FALSE);
+		FileWatcher_AddChange(FILE_WATCHER_OVERFLOW, root->path);
+	}
+}
+
+static void FileWatcher_OnInotifyEvent(const struct inotify_event *ev)
+{
+	Watch w;
+	int action;
+	char path[PATH_MAX];
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		FileWatcher_OnOverflow();
+		return;
+	}
+	w = Dict_FetchValue(watcher.watches, &ev->wd);
+	if (!w) {
+		return;
+	}
+	if (ev->mask & IN_IGNORED) {
+		FileWatcher_Forget(w);
+		return;
+	}
+	if (ev->len < 1 || strlen(w->path) + strlen(ev->name) + 2 > PATH_MAX) {
+		return;
+	}
+	if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		action = ENTRY_REMOVED;
+	} else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+		action = ENTRY_CREATED;
+	} else {
+		action = ENTRY_MODIFIED;
+	}
+	pathjoin(path, w->path, ev->name);
+	FileWatcher_OnEntry(path, (ev->mask & IN_ISDIR) != 0, action);
+}
+
+static void FileWatcher_ReadInotify(void)
+{
+	char *p;
+	ssize_t len;
+	const struct inotify_event *ev;
+
+	while ((len = read(watcher.fd, watcher.buffer,
+			   WATCHER_BUFFER_SIZE)) > 0) {
+		for (p = watcher.buffer; p < watcher.buffer + len;
+		     p += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			FileWatcher_OnInotifyEvent(ev);
+		}
+	}
+}
+
+#ifdef LCFINDER_USE_FANOTIFY
+static WatchRoot FileWatcher_GetRootByFsid(const void *fsid)
+{
+	WatchRoot root;
+	LinkedListNode *node;
+
+	for (LinkedList_Each(node, &watcher.roots)) {
+		root = node->data;
+		if (root->fd >= 0 &&
+		    memcmp(&root->fsid, fsid, sizeof(root->fsid)) == 0) {
+			return root;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * 处理 fanotify 事件
+ * 事件中只有所在目录的文件句柄和文件名，需要打开句柄才能得到目录路径。
+ * 整个文件系统的事件都会被收到，不在根目录中的会被忽略。
+ */
+static void FileWatcher_OnFanotifyEvent(
+    const struct fanotify_event_metadata *meta)
+{
+	int fd, action;
+	ssize_t len;
+	WatchRoot root;
+	const char *name;
+	struct file_handle *handle;
+	struct fanotify_event_info_fid *fid;
+	char link[32], dirpath[PATH_MAX], path[PATH_MAX];
+
+	fid = (struct fanotify_event_info_fid *)(meta + 1);
+	if (meta->event_len < sizeof(*meta) + sizeof(*fid) ||
+	    fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+		return;
+	}
+	root = FileWatcher_GetRootByFsid(&fid->fsid);
+	if (!root) {
+		return;
+	}
+	handle = (struct file_handle *)fid->handle;
+	name = (const char *)(handle->f_handle + handle->handle_bytes);
+	if (strcmp(name, ".") == 0) {
+		return;
+	}
+	/* 所在目录已被删除时无法打开，删除该目录的事件会一并处理其中的文件 */
+	fd = open_by_handle_at(root->fd, handle, O_PATH);
+	if (fd < 0) {
+		return;
+	}
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	len = readlink(link, dirpath, PATH_MAX - 1);
+	close(fd);
+	if (len < 1) {
+		return;
+	}
+	dirpath[len] = 0;
+	if (!FileWatcher_GetRoot(dirpath) ||
+	    (size_t)len + strlen(name) + 2 > PATH_MAX) {
+		return;
+	}
+	if (meta->mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+		action = ENTRY_REMOVED;
+	} else if (meta->mask & (FAN_CREATE | FAN_MOVED_TO)) {
+		action = ENTRY_CREATED;
+	} else {
+		action = ENTRY_MODIFIED;
+	}
+	pathjoin(path, dirpath, name);
+	FileWatcher_OnEntry(path, (meta->mask & FAN_ONDIR) != 0, action);
+}
+
+static void FileWatcher_ReadFanotify(void)
+{
+	ssize_t len;
+	struct fanotify_event_metadata *meta;
+
+	while ((len = read(watcher.fd, watcher.buffer,
+			   WATCHER_BUFFER_SIZE)) > 0) {
+		meta = (struct fanotify_event_metadata *)watcher.buffer;
+		for (; FAN_EVENT_OK(meta, len);
+		     meta = FAN_EVENT_NEXT(meta, len)) {
+			if (meta->vers != FANOTIFY_METADATA_VERSION) {
+				return;
+			}
+			if (meta->mask & FAN_Q_OVERFLOW) {
+				FileWatcher_OnOverflow();
+			} else {
+				FileWatcher_OnFanotifyEvent(meta);
+			}
+			if (meta->fd >= 0) {
+				close(meta->fd);
+			}
+		}
+	}
+}
+
+/** 标记根目录所在的整个文件系统，不受 inotify 监视数量的限制 */
+static int FileWatcher_MarkRoot(WatchRoot root)
+{
+	int ret;
+	struct statfs buf;
+
+	root->fd = open(root->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root->fd < 0) {
+		return -errno;
+	}
+	if (fstatfs(root->fd, &buf) != 0 ||
+	    fanotify_mark(watcher.fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+			  WATCHER_FANOTIFY_MASK, AT_FDCWD, root->path) != 0) {
+		ret = -errno;
+		close(root->fd);
+		root->fd = -1;
+		return ret;
+	}
+	memcpy(&root->fsid, &buf.f_fsid, sizeof(root->fsid));
+	return 0;
+}
+
+static void FileWatcher_UnmarkRoot(WatchRoot root)
+{
+	int fd = root->fd;
+
+	if (fd < 0) {
+		return;
+	}
+	root->fd = -1;
+	/* 同一文件系统中还有其它根目录时保留标记 */
+	if (!FileWatcher_GetRootByFsid(&root->fsid)) {
+		fanotify_mark(watcher.fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM,
+			      WATCHER_FANOTIFY_MASK, AT_FDCWD, root->path);
+	}
+	close(fd);
+}
+#endif
+
+static void FileWatcher_AddRoot(const char *path)
+{
+	WatchRoot root;
+#ifdef LCFINDER_USE_FANOTIFY
+	int ret;
+#endif
+
+	if (FileWatcher_GetRoot(path)) {
+		return;
+	}
+	root = NEW(WatchRootRec, 1);
+	root->fd = -1;
+	root->path = strdup2(path);
+	root->len = strlen(path);
+	root->node.data = root;
+	LinkedList_AppendNode(&watcher.roots, &root->node);
+#ifdef LCFINDER_USE_FANOTIFY
+	if (watcher.backend == BACKEND_FANOTIFY) {
+		ret = FileWatcher_MarkRoot(root);
+		if (ret != 0) {
+			Logger_Debug("[watcher] cannot watch %s, errno: %d\n",
+				     path, -ret);
+		}
+		return;
+	}
+#endif
+	FileWatcher_WatchTree(path, FALSE);
+}
+
+static void FileWatcher_RemoveRoot(const char *path)
+{
+	WatchRoot root;
+	LinkedListNode *node;
+
+	for (LinkedList_Each(node, &watcher.roots)) {
+		root = node->data;
+		if (strcmp(root->path, path) != 0) {
+			continue;
+		}
+		LinkedList_Unlink(&watcher.roots, node);
+#ifdef LCFINDER_USE_FANOTIFY
+		FileWatcher_UnmarkRoot(root);
+#endif
+		FileWatcher_UnwatchTree(root->path);
+		free(root->path);
+		free(root);
+		return;
+	}
+}
+
+static void FileWatcher_HandleRequests(void)
+{
+	WatchRequest req;
+	LinkedListNode *node;
+
+	while (1) {
+		LCUIMutex_Lock(&watcher.mutex);
+		node = LinkedList_GetNode(&watcher.requests, 0);
+		if (node) {
+			LinkedList_Unlink(&watcher.requests, node);
+		}
+		LCUIMutex_Unlock(&watcher.mutex);
+		if (!node) {
+			break;
+		}
+		req = node->data;
+		if (req->remove) {
+			FileWatcher_RemoveRoot(req->path);
+		} else {
+			FileWatcher_AddRoot(req->path);
+		}
+		free(req->path);
+		free(req);
+	}
+}
+
+/** 计算距离处理积累的变更还有多久，没有变更或已暂停时返回 -1 */
+static int FileWatcher_GetTimeout(void)
+{
+	int paused;
+	int64_t now, due;
+
+	LCUIMutex_Lock(&watcher.mutex);
+	paused = watcher.paused;
+	LCUIMutex_Unlock(&watcher.mutex);
+	if (paused > 0 || Dict_Size(watcher.changes) < 1) {
+		return -1;
+	}
+	now = LCUI_GetTime();
+	due = watcher.last_time + WATCHER_SETTLE_TIME;
+	if (due > watcher.first_time + WATCHER_MAX_DELAY) {
+		due = watcher.first_time + WATCHER_MAX_DELAY;
+	}
+	return due > now ? (int)(due - now) : 0;
+}
+
+/** 将积累的变更交给处理函数，删除的目录排在文件之前 */
+static void FileWatcher_Flush(void)
+{
+	int paused;
+	size_t n = 0;
+	Dict *changes;
+	struct stat buf;
+	DictEntry *entry;
+	DictIterator *iter;
+	FileWatcherEvent e, events;
+
+	LCUIMutex_Lock(&watcher.handler_mutex);
+	LCUIMutex_Lock(&watcher.mutex);
+	paused = watcher.paused;
+	LCUIMutex_Unlock(&watcher.mutex);
+	if (paused > 0) {
+		LCUIMutex_Unlock(&watcher.handler_mutex);
+		return;
+	}
+	changes = watcher.changes;
+	watcher.changes = StrDict_Create(NULL, ChangesDict_ValDestructor);
+	events = malloc(sizeof(FileWatcherEventRec) * Dict_Size(changes));
+	if (!events) {
+		StrDict_Release(changes);
+		LCUIMutex_Unlock(&watcher.handler_mutex);
+		return;
+	}
+	iter = Dict_GetIterator(changes);
+	while ((entry = Dict_Next(iter))) {
+		e = DictEntry_GetVal(entry);
+		if (e->type == FILE_WATCHER_DIR_DELETED ||
+		    e->type == FILE_WATCHER_OVERFLOW) {
+			events[n++] = *e;
+		}
+	}
+	Dict_ReleaseIterator(iter);
+	iter = Dict_GetIterator(changes);
+	while ((entry = Dict_Next(iter))) {
+		e = DictEntry_GetVal(entry);
+		if (e->type == FILE_WATCHER_CHANGED) {
+			/* 文件可能在事件之后又被删除 */
+			if (stat(e->path, &buf) != 0 || !S_ISREG(buf.st_mode)) {
+				e->type = FILE_WATCHER_DELETED;
+			} else {
+				e->ctime = (unsigned int)buf.st_ctime;
+				e->mtime = (unsigned int)buf.st_mtime;
+			}
+		} else if (e->type != FILE_WATCHER_DELETED) {
+			continue;
+		}
+		events[n++] = *e;
+	}
+	Dict_ReleaseIterator(iter);
+	Logger_Debug("[watcher] %lu changes\n", (unsigned long)n);
+	watcher.handler(events, n, watcher.data);
+	free(events);
+	StrDict_Release(changes);
+	LCUIMutex_Unlock(&watcher.handler_mutex);
+}
+
+static void FileWatcher_Thread(void *arg)
+{
+	char buf[64];
+	struct pollfd fds[2];
+
+	fds[0].fd = watcher.fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = watcher.pipe[0];
+	fds[1].events = POLLIN;
+	while (1) {
+		LCUIMutex_Lock(&watcher.mutex);
+		if (!watcher.active) {
+			LCUIMutex_Unlock(&watcher.mutex);
+			break;
+		}
+		LCUIMutex_Unlock(&watcher.mutex);
+		FileWatcher_HandleRequests();
+		if (poll(fds, 2, FileWatcher_GetTimeout()) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			Logger_Debug("[watcher] poll failed, errno: %d\n",
+				     errno);
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			while (read(watcher.pipe[0], buf, sizeof(buf)) > 0);
+		}
+		if (fds[0].revents & POLLIN) {
+#ifdef LCFINDER_USE_FANOTIFY
+			if (watcher.backend == BACKEND_FANOTIFY) {
+				FileWatcher_ReadFanotify();
+			} else
+#endif
+				FileWatcher_ReadInotify();
+		}
+		if (FileWatcher_GetTimeout() == 0) {
+			FileWatcher_Flush();
+		}
+	}
+	LCUIThread_Exit(NULL);
+}
+
+static int FileWatcher_Open(void)
+{
+	watcher.fd = -1;
+#ifdef LCFINDER_USE_FANOTIFY
+	watcher.backend = BACKEND_FANOTIFY;
+	watcher.fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME |
+				   FAN_CLOEXEC | FAN_NONBLOCK,
+				   O_RDONLY | O_LARGEFILE);
+	if (watcher.fd >= 0) {
+		return 0;
+	}
+	/* fanotify 需要 CAP_SYS_ADMIN 权限 */
+	Logger_Debug("[watcher] fanotify is unavailable, errno: %d\n", errno);
+#endif
+	watcher.backend = BACKEND_INOTIFY;
+	watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watcher.fd < 0) {
+		return -errno;
+	}
+	return 0;
+}
+
+int FileWatcher_Init(FileWatcherHandler handler, void *data)
+{
+	int ret;
+
+	ret = FileWatcher_Open();
+	if (ret != 0) {
+		return ret;
+	}
+	if (pipe2(watcher.pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+		ret = -errno;
+		close(watcher.fd);
+		return ret;
+	}
+	watcher.buffer = malloc(WATCHER_BUFFER_SIZE);
+	if (!watcher.buffer) {
+		close(watcher.pipe[0]);
+		close(watcher.pipe[1]);
+		close(watcher.fd);
+		return -ENOMEM;
+	}
+	watcher.handler = handler;
+	watcher.data = data;
+	watcher.paused = 0;
+	watcher.active = TRUE;
+	LCUIMutex_Init(&watcher.mutex);
+	LCUIMutex_Init(&watcher.handler_mutex);
+	LinkedList_Init(&watcher.requests);
+	LinkedList_Init(&watcher.roots);
+	watcher.watches = Dict_Create(&WatchDict, NULL);
+	watcher.paths = StrDict_Create(NULL, NULL);
+	watcher.changes = StrDict_Create(NULL, ChangesDict_ValDestructor);
+	LCUIThread_Create(&watcher.thread, FileWatcher_Thread, NULL);
+	Logger_Debug("[watcher] started, backend: %s\n",
+		     watcher.backend == BACKEND_INOTIFY ? "inotify"
+							: "fanotify");
+	return 0;
+}
+
+void FileWatcher_Exit(void)
+{
+	WatchRoot root;
+	WatchRequest req;
+	LinkedListNode *node;
+
+	if (!watcher.active) {
+		return;
+	}
+	LCUIMutex_Lock(&watcher.mutex);
+	watcher.active = FALSE;
+	LCUIMutex_Unlock(&watcher.mutex);
+	FileWatcher_Wakeup();
+	LCUIThread_Join(watcher.thread, NULL);
+	while ((node = LinkedList_GetNode(&watcher.requests, 0)) != NULL) {
+		req = node->data;
+		LinkedList_Unlink(&watcher.requests, node);
+		free(req->path);
+		free(req);
+	}
+	while ((node = LinkedList_GetNode(&watcher.roots, 0)) != NULL) {
+		root = node->data;
+		LinkedList_Unlink(&watcher.roots, node);
+		if (root->fd >= 0) {
+			close(root->fd);
+		}
+		free(root->path);
+		free(root);
+	}
+	StrDict_Release(watcher.changes);
+	StrDict_Release(watcher.paths);
+	Dict_Release(watcher.watches);
+	close(watcher.fd);
+	close(watcher.pipe[0]);
+	close(watcher.pipe[1]);
+	free(watcher.buffer);
+	watcher.buffer = NULL;
+	LCUIMutex_Destroy(&watcher.handler_mutex);
+	LCUIMutex_Destroy(&watcher.mutex);
+}
+
+static int FileWatcher_Request(const char *dirpath, LCUI_BOOL remove)
+{
+	WatchRequest req;
+
+	if (!watcher.active) {
+		return -1;
+	}
+	req = NEW(WatchRequestRec, 1);
+	req->remove = remove;
+	req->path = strdup2(dirpath);
+	req->node.data = req;
+	LCUIMutex_Lock(&watcher.mutex);
+	LinkedList_AppendNode(&watcher.requests, &req->node);
+	LCUIMutex_Unlock(&watcher.mutex);
+	FileWatcher_Wakeup();
+	return 0;
+}
+
+int FileWatcher_AddDir(const char *dirpath)
+{
+	return FileWatcher_Request(dirpath, FALSE);
+}
+
+int FileWatcher_RemoveDir(const char *dirpath)
+{
+	return FileWatcher_Request(dirpath, TRUE);
+}
+
+void FileWatcher_Pause(void)
+{
+	if (!watcher.active) {
+		return;
+	}
+	LCUIMutex_Lock(&watcher.handler_mutex);
+	LCUIMutex_Lock(&watcher.mutex);
+	watcher.paused += 1;
+	LCUIMutex_Unlock(&watcher.mutex);
+	LCUIMutex_Unlock(&watcher.handler_mutex);
+}
+
+void FileWatcher_Resume(void)
+{
+	if (!watcher.active) {
+		return;
+	}
+	LCUIMutex_Lock(&watcher.mutex);
+	if (watcher.paused > 0) {
+		watcher.paused -= 1;
+	}
+	LCUIMutex_Unlock(&watcher.mutex);
+	FileWatcher_Wakeup();
+}
+
+#else
+
+int FileWatcher_Init(FileWatcherHandler handler, void *data)
+{
+	return -ENOSYS;
+}
+
+void FileWatcher_Exit(void)
+{
+}
+
+int FileWatcher_AddDir(const char *dirpath)
+{
+	return -ENOSYS;
+}
+
+int FileWatcher_RemoveDir(const char *dirpath)
+{
+	return -ENOSYS;
+}
+
+void FileWatcher_Pause(void)
+{
+}
+
+void FileWatcher_Resume(void)
+{
+}
+
+#endif
@@ -0,0 +1,640 @@
+﻿/* ***************************************************************************
+ * image_header.c -- image file header parser
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * image_header.c -- 图片文件头解析
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+
+/**
+ * 图片文件头解析
+ * 只读取文件开头的少量数据，从中取出 JPEG 的 SOF 段和 EXIF 信息、PNG 的 IHDR
+ * 块以及 BMP 的信息头。JPEG 的 EXIF 段中可能带有较大的缩略图，SOF 段不在已读
+ * 取的数据中时，根据各段的长度跳到下一个段的位置继续读取。
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <LCUI_Build.h>
+#include <LCUI/LCUI.h>
+#include <LCUI/thread.h>
+#include "build.h"
+#include "common.h"
+#include "io_engine.h"
+#include "image_header.h"
+
+#ifdef PLATFORM_LINUX
+#include <fcntl.h>
+#endif
+
+/** 批量解析时使用的线程数量 */
+#define IMAGE_HEADER_THREADS 4
+
+/** 每个线程至少处理的文件数量，文件较少时不必启用全部线程 */
+#define IMAGE_HEADER_MIN_FILES 32
+
+/** 继续解析 JPEG 时每次读取的字节数 */
+#define JPEG_SEGMENT_READ_SIZE 512
+
+/** JPEG 最多跳过的段数量，避免在损坏的文件中无休止地读取 */
+#define JPEG_MAX_SEGMENTS 64
+
+#define EXIF_TAG_ORIENTATION 0x0112
+#define EXIF_TAG_EXIF_IFD 0x8769
+#define EXIF_TAG_DATETIME_ORIGINAL 0x9003
+
+/** 一批文件中分给一个线程处理的部分 */
+typedef struct ImageHeaderJobRec_ {
+	ImageHeader headers;
+	const char **paths;
+	size_t n;
+} ImageHeaderJobRec, *ImageHeaderJob;
+
+typedef struct ImageHeaderWorkerRec_ {
+	LCUI_Thread tid;
+	ImageHeaderReader reader;
+#ifdef PLATFORM_LINUX
+	IOEngine io;
+	char **bufs;
+	long *results;
+	size_t capacity;
+#endif
+} ImageHeaderWorkerRec, *ImageHeaderWorker;
+
+struct ImageHeaderReaderRec_ {
+	LCUI_BOOL active;
+	LCUI_Mutex mutex;
+
+	/** 有新的任务或者需要退出时通知工作线程 */
+	LCUI_Cond cond;
+
+	/** 一批任务处理完时通知调用者 */
+	LCUI_Cond done;
+
+	/** 当前这批任务，n_jobs 为 0 时表示空闲 */
+	ImageHeaderJobRec jobs[IMAGE_HEADER_THREADS];
+	size_t n_jobs;
+	size_t next_job;
+	size_t done_jobs;
+
+	ImageHeaderWorkerRec workers[IMAGE_HEADER_THREADS];
+};
+
+typedef struct ExifReaderRec_ {
+	const unsigned char *data;
+	size_t len;
+	LCUI_BOOL big_endian;
+} ExifReaderRec, *ExifReader;
+
+static unsigned int ReadBE16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static unsigned int ReadBE32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static unsigned int ReadLE16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int ReadLE32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned int ExifReader_Read16(ExifReader reader, size_t offset)
+{
+	if (reader->big_endian) {
+		return ReadBE16(reader->data + offset);
+	}
+	return ReadLE16(reader->data + offset);
+}
+
+static unsigned int ExifReader_Read32(ExifReader reader, size_t offset)
+{
+	if (reader->big_endian) {
+		return ReadBE32(reader->data + offset);
+	}
+	return ReadLE32(reader->data + offset);
+}
+
+/** 将 EXIF 中 "YYYY:MM:DD HH:MM:SS" 格式的本地时间转换为时间戳 */
+static time_t ParseExifTime(const unsigned char *str, size_t len)
+{
+	char buf[20];
+	struct tm t = { 0 };
+
+	if (len < 19) {
+		return 0;
+	}
+	memcpy(buf, str, 19);
+	buf[19] = 0;
+	if (sscanf(buf, "%d:%d:%d %d:%d:%d", &t.tm_year, &t.tm_mon,
+		   &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6 ||
+	    t.tm_year < 1900 || t.tm_mon < 1) {
+		return 0;
+	}
+	t.tm_year -= 1900;
+	t.tm_mon -= 1;
+	t.tm_isdst = -1;
+	return mktime(&t);
+}
+
+/** 解析 IFD 中的方向和拍摄时间，返回 EXIF 子目录的位置 */
+static size_t ParseExifIFD(ImageHeader header, ExifReader reader,
+			   size_t offset)
+{
+	size_t i, n, entry, value, count, sub_ifd = 0;
+
+	if (offset + 2 > reader->len) {
+		return 0;
+	}
+	n = ExifReader_Read16(reader, offset);
+	for (i = 0; i < n; ++i) {
+		entry = offset + 2 + i * 12;
+		if (entry + 12 > reader->len) {
+			break;
+		}
+		switch (ExifReader_Read16(reader, entry)) {
+		case EXIF_TAG_ORIENTATION:
+			value = ExifReader_Read16(reader, entry + 8);
+			if (value >= 1 && value <= 8) {
+				header->orientation = (int)value;
+			}
+			break;
+		case EXIF_TAG_EXIF_IFD:
+			sub_ifd = ExifReader_Read32(reader, entry + 8);
+			break;
+		case EXIF_TAG_DATETIME_ORIGINAL:
+			count = ExifReader_Read32(reader, entry + 4);
+			value = ExifReader_Read32(reader, entry + 8);
+			if (count <= reader->len && value <= reader->len - count) {
+				header->capture_time = ParseExifTime(
+				    reader->data + value, count);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return sub_ifd;
+}
+
+/** 解析 APP1 段中的 EXIF 数据，data 指向 "Exif\0\0" 之后的 TIFF 头 */
+static void ParseExif(ImageHeader header, const unsigned char *data,
+		      size_t len)
+{
+	size_t offset;
+	ExifReaderRec reader;
+
+	if (len < 8) {
+		return;
+	}
+	if (memcmp(data, "II*\0", 4) == 0) {
+		reader.big_endian = FALSE;
+	} else if (memcmp(data, "MM\0*", 4) == 0) {
+		reader.big_endian = TRUE;
+	} else {
+		return;
+	}
+	reader.data = data;
+	reader.len = len;
+	offset = ExifReader_Read32(&reader, 4);
+	offset = ParseExifIFD(header, &reader, offset);
+	if (offset > 0) {
+		ParseExifIFD(header, &reader, offset);
+	}
+}
+
+static LCUI_BOOL IsJPEGSOFMarker(unsigned int marker)
+{
+	return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+	       marker != 0xC8 && marker != 0xCC;
+}
+
+/** 从 header->offset 处开始逐段解析 JPEG，data 是文件中从 offset 开始的数据 */
+static int ParseJPEG(ImageHeader header, const unsigned char *data,
+		     size_t len, size_t offset)
+{
+	int i;
+	size_t pos, seg_len;
+	unsigned int marker;
+
+	if (header->offset < offset) {
+		return -1;
+	}
+	pos = header->offset - offset;
+	for (i = 0; i < JPEG_MAX_SEGMENTS; ++i) {
+		/* 段之间可能有多个 0xFF 填充字节 */
+		while (pos + 1 < len && data[pos] == 0xFF &&
+		       data[pos + 1] == 0xFF) {
+			pos += 1;
+		}
+		if (pos + 4 > len) {
+			break;
+		}
+		if (data[pos] != 0xFF) {
+			return -1;
+		}
+		marker = data[pos + 1];
+		if (marker == 0xD8 || marker == 0x01 ||
+		    (marker >= 0xD0 && marker <= 0xD7)) {
+			pos += 2;
+			continue;
+		}
+		/* 到了图像数据或结尾仍没有 SOF 段 */
+		if (marker == 0xDA || marker == 0xD9) {
+			return -1;
+		}
+		seg_len = ReadBE16(data + pos + 2);
+		if (seg_len < 2) {
+			return -1;
+		}
+		if (IsJPEGSOFMarker(marker)) {
+			if (pos + 9 > len) {
+				break;
+			}
+			header->height = ReadBE16(data + pos + 5);
+			header->width = ReadBE16(data + pos + 7);
+			return header->width > 0 && header->height > 0 ? 0
+								       : -1;
+		}
+		/* APP1 段可能因为带有缩略图而超出已读取的数据，IFD0 通常在段的
+		 * 开头，所以只解析已读取的部分，越界的项会被跳过 */
+		if (marker == 0xE1 && seg_len > 8 && pos + 10 <= len &&
+		    memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+			ParseExif(header, data + pos + 10,
+				  min(seg_len - 8, len - pos - 10));
+		}
+		pos += 2 + seg_len;
+	}
+	if (i >= JPEG_MAX_SEGMENTS) {
+		return -1;
+	}
+	/* 没有前进说明数据不足一个段的开头或 SOF 段被截断了，再次从同一位置读取
+	 * 也只会得到同样的结果 */
+	if (offset + pos <= header->offset) {
+		return -1;
+	}
+	header->offset = offset + pos;
+	return 1;
+}
+
+static int ParsePNG(ImageHeader header, const unsigned char *data,
+		    size_t len)
+{
+	if (len < 24 || memcmp(data + 12, "IHDR", 4) != 0) {
+		return -1;
+	}
+	header->width = ReadBE32(data + 16);
+	header->height = ReadBE32(data + 20);
+	return header->width > 0 && header->height > 0 ? 0 : -1;
+}
+
+static int ParseBMP(ImageHeader header, const unsigned char *data,
+		    size_t len)
+{
+	int height;
+
+	if (len < 26) {
+		return -1;
+	}
+	/* OS/2 的 BITMAPCOREHEADER 使用 16 位的尺寸 */
+	if (ReadLE32(data + 14) == 12) {
+		header->width = ReadLE16(data + 18);
+		header->height = ReadLE16(data + 20);
+	} else {
+		header->width = ReadLE32(data + 18);
+		/* 高度为负数时表示图像是从上到下存储的 */
+		height = (int)ReadLE32(data + 22);
+		header->height = height < 0 ? -height : height;
+	}
+	return header->width > 0 && header->height > 0 ? 0 : -1;
+}
+
+int ImageHeader_Parse(ImageHeader header, const void *data, size_t len,
+		      size_t offset)
+{
+	const unsigned char *p = data;
+
+	if (header->type == IMAGE_HEADER_UNKNOWN) {
+		if (offset != 0) {
+			return -1;
+		}
+		if (len >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF) {
+			header->type = IMAGE_HEADER_JPEG;
+			header->offset = 2;
+		} else if (len >= 8 &&
+			   memcmp(p, "\x89PNG\r\n\x1a\n", 8) == 0) {
+			header->type = IMAGE_HEADER_PNG;
+		} else if (len >= 2 && p[0] == 'B' && p[1] == 'M') {
+			header->type = IMAGE_HEADER_BMP;
+		} else {
+			return -1;
+		}
+	}
+	switch (header->type) {
+	case IMAGE_HEADER_JPEG:
+		return ParseJPEG(header, p, len, offset);
+	case IMAGE_HEADER_PNG:
+		return ParsePNG(header, p, len);
+	case IMAGE_HEADER_BMP:
+		return ParseBMP(header, p, len);
+	default:
+		break;
+	}
+	return -1;
+}
+
+static FILE *ImageHeader_OpenFile(const char *path)
+{
+#ifdef _WIN32
+	FILE *fp;
+	wchar_t *wpath = DecodeUTF8(path);
+
+	if (!wpath) {
+		return NULL;
+	}
+	fp = _wfopen(wpath, L"rb");
+	free(wpath);
+	return fp;
+#else
+	return fopen(path, "rb");
+#endif
+}
+
+/** 从文件中继续读取并解析 JPEG 的后续段 */
+static int ImageHeader_ContinueFile(ImageHeader header, FILE *fp)
+{
+	int ret = 1;
+	size_t len, offset;
+	unsigned char buf[JPEG_SEGMENT_READ_SIZE];
+
+	while (ret == 1) {
+		offset = header->offset;
+		if (fseek(fp, (long)offset, SEEK_SET) != 0) {
+			return -1;
+		}
+		len = fread(buf, 1, sizeof(buf), fp);
+		if (len < 4) {
+			return -1;
+		}
+		ret = ImageHeader_Parse(header, buf, len, offset);
+		/* 已读到文件末尾却仍需继续读取，说明文件被截断了 */
+		if (ret == 1 && (header->offset <= offset || len < sizeof(buf))) {
+			return -1;
+		}
+	}
+	return ret;
+}
+
+int ImageHeader_ReadFile(ImageHeader header, const char *path)
+{
+	int ret;
+	size_t len;
+	char *buf;
+	FILE *fp;
+
+	memset(header, 0, sizeof(ImageHeaderRec));
+	fp = ImageHeader_OpenFile(path);
+	if (!fp) {
+		return -1;
+	}
+	buf = malloc(IMAGE_HEADER_READ_SIZE);
+	len = fread(buf, 1, IMAGE_HEADER_READ_SIZE, fp);
+	ret = ImageHeader_Parse(header, buf, len, 0);
+	free(buf);
+	if (ret == 1) {
+		if (len < IMAGE_HEADER_READ_SIZE) {
+			ret = -1;
+		} else {
+			ret = ImageHeader_ContinueFile(header, fp);
+		}
+	}
+	fclose(fp);
+	return ret;
+}
+
+/** 解析已读取的文件头，尺寸信息不在其中时再打开文件继续读取 */
+static void ImageHeader_ParseRead(ImageHeader header, const char *path,
+				  const char *buf, long len)
+{
+	FILE *fp;
+
+	memset(header, 0, sizeof(ImageHeaderRec));
+	if (len <= 0 || ImageHeader_Parse(header, buf, len, 0) != 1) {
+		return;
+	}
+	/* 整个文件都已读取，没有更多的数据可供解析 */
+	if (len < IMAGE_HEADER_READ_SIZE) {
+		return;
+	}
+	fp = ImageHeader_OpenFile(path);
+	if (fp) {
+		ImageHeader_ContinueFile(header, fp);
+		fclose(fp);
+	}
+}
+
+#ifdef PLATFORM_LINUX
+/** 确保工作线程的缓冲区足够存放 n 个文件头，缓冲区会在多批任务之间复用 */
+static int ImageHeaderWorker_Reserve(ImageHeaderWorker worker, size_t n)
+{
+	size_t i;
+	char **bufs;
+	long *results;
+
+	if (n <= worker->capacity) {
+		return 0;
+	}
+	bufs = realloc(worker->bufs, sizeof(char *) * n);
+	if (!bufs) {
+		return -1;
+	}
+	worker->bufs = bufs;
+	results = realloc(worker->results, sizeof(long) * n);
+	if (!results) {
+		return -1;
+	}
+	worker->results = results;
+	for (i = worker->capacity; i < n; ++i) {
+		bufs[i] = malloc(IMAGE_HEADER_READ_SIZE);
+		if (!bufs[i]) {
+			return -1;
+		}
+		worker->capacity = i + 1;
+	}
+	return 0;
+}
+#endif
+
+static void ImageHeaderWorker_Run(ImageHeaderWorker worker, ImageHeaderJob job)
+{
+	size_t i;
+
+#ifdef PLATFORM_LINUX
+	if (ImageHeaderWorker_Reserve(worker, job->n) == 0) {
+		IOEngine_ReadHeadersAt(worker->io, AT_FDCWD, job->paths,
+				       job->n, worker->bufs,
+				       IMAGE_HEADER_READ_SIZE, worker->results);
+		for (i = 0; i < job->n; ++i) {
+			ImageHeader_ParseRead(&job->headers[i], job->paths[i],
+					      worker->bufs[i],
+					      worker->results[i]);
+		}
+		return;
+	}
+#endif
+	for (i = 0; i < job->n; ++i) {
+		ImageHeader_ReadFile(&job->headers[i], job->paths[i]);
+	}
+}
+
+static void ImageHeader_Worker(void *arg)
+{
+	ImageHeaderJob job;
+	ImageHeaderWorker worker = arg;
+	ImageHeaderReader reader = worker->reader;
+
+#ifdef PLATFORM_LINUX
+	worker->io = IOEngine_Create();
+#endif
+	LCUIMutex_Lock(&reader->mutex);
+	while (reader->active) {
+		if (reader->next_job >= reader->n_jobs) {
+			LCUICond_Wait(&reader->cond, &reader->mutex);
+			continue;
+		}
+		job = &reader->jobs[reader->next_job++];
+		LCUIMutex_Unlock(&reader->mutex);
+		ImageHeaderWorker_Run(worker, job);
+		LCUIMutex_Lock(&reader->mutex);
+		reader->done_jobs += 1;
+		if (reader->done_jobs >= reader->n_jobs) {
+			LCUICond_Broadcast(&reader->done);
+		}
+	}
+	LCUIMutex_Unlock(&reader->mutex);
+#ifdef PLATFORM_LINUX
+	while (worker->capacity > 0) {
+		free(worker->bufs[--worker->capacity]);
+	}
+	free(worker->bufs);
+	free(worker->results);
+	IOEngine_Destroy(worker->io);
+#endif
+	LCUIThread_Exit(NULL);
+}
+
+ImageHeaderReader ImageHeaderReader_Create(void)
+{
+	size_t i;
+	ImageHeaderReader reader;
+
+	reader = calloc(1, sizeof(struct ImageHeaderReaderRec_));
+	if (!reader) {
+		return NULL;
+	}
+	reader->active = TRUE;
+	LCUIMutex_Init(&reader->mutex);
+	LCUICond_Init(&reader->cond);
+	LCUICond_Init(&reader->done);
+	for (i = 0; i < IMAGE_HEADER_THREADS; ++i) {
+		reader->workers[i].reader = reader;
+		LCUIThread_Create(&reader->workers[i].tid, ImageHeader_Worker,
+				  &reader->workers[i]);
+	}
+	return reader;
+}
+
+void ImageHeaderReader_Destroy(ImageHeaderReader reader)
+{
+	size_t i;
+
+	LCUIMutex_Lock(&reader->mutex);
+	reader->active = FALSE;
+	LCUICond_Broadcast(&reader->cond);
+	LCUIMutex_Unlock(&reader->mutex);
+	for (i = 0; i < IMAGE_HEADER_THREADS; ++i) {
+		LCUIThread_Join(reader->workers[i].tid, NULL);
+	}
+	LCUICond_Destroy(&reader->cond);
+	LCUICond_Destroy(&reader->done);
+	LCUIMutex_Destroy(&reader->mutex);
+	free(reader);
+}
+
+void ImageHeaderReader_ReadFiles(ImageHeaderReader reader,
+				 ImageHeader headers, const char **paths,
+				 size_t n)
+{
+	size_t i, n_jobs, count, start = 0;
+
+	if (n == 0) {
+		return;
+	}
+	n_jobs = n / IMAGE_HEADER_MIN_FILES + 1;
+	if (n_jobs > IMAGE_HEADER_THREADS) {
+		n_jobs = IMAGE_HEADER_THREADS;
+	}
+	LCUIMutex_Lock(&reader->mutex);
+	/* 等待其它调用者的任务处理完 */
+	while (reader->n_jobs > 0) {
+		LCUICond_Wait(&reader->done, &reader->mutex);
+	}
+	for (i = 0; i < n_jobs; ++i) {
+		count = (n - start) / (n_jobs - i);
+		reader->jobs[i].headers = headers + start;
+		reader->jobs[i].paths = paths + start;
+		reader->jobs[i].n = count;
+		start += count;
+	}
+	reader->n_jobs = n_jobs;
+	reader->next_job = 0;
+	reader->done_jobs = 0;
+	LCUICond_Broadcast(&reader->cond);
+	while (reader->done_jobs < reader->n_jobs) {
+		LCUICond_Wait(&reader->done, &reader->mutex);
+	}
+	reader->n_jobs = 0;
+	LCUICond_Broadcast(&reader->done);
+	LCUIMutex_Unlock(&reader->mutex);
+}
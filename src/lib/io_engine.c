@@ -0,0 +1,613 @@
+﻿/* ***************************************************************************
+ * io_engine.c -- batched file I/O engine
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * io_engine.c -- 批量文件 I/O 引擎
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+
+/**
+ * 批量文件 I/O 引擎
+ * io_uring 的提交队列和完成队列通过 mmap 与内核共享，这里直接使用系统调用，
+ * 不依赖 liburing。一批操作分多次提交时，每次最多提交队列长度个请求。
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <LCUI_Build.h>
+#include <LCUI/LCUI.h>
+#include "build.h"
+#include "io_engine.h"
+
+#ifdef PLATFORM_LINUX
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef LCFINDER_USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/** 队列长度，即一次最多提交的请求数量 */
+#define IO_RING_ENTRIES 256
+
+typedef struct IORingRec_ {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+} IORingRec, *IORing;
+
+/** 准备第 i 个请求 */
+typedef void (*IORingPrepFunc)(struct io_uring_sqe *, size_t, void *);
+
+#endif
+
+typedef struct IOEngineRec_ {
+#ifdef LCFINDER_USE_IO_URING
+	LCUI_BOOL async;
+	IORingRec ring;
+	struct statx *statxs;	/**< 批量获取状态时使用的缓冲区 */
+	size_t max_statxs;
+	int *fds;		/**< 批量读取时打开的文件 */
+	size_t max_fds;
+#endif
+	int unused;
+} IOEngineRec;
+
+#ifdef LCFINDER_USE_IO_URING
+
+static int IORing_Setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int IORing_Enter(IORing ring, unsigned int to_submit,
+			unsigned int min_complete)
+{
+	return (int)syscall(__NR_io_uring_enter, ring->fd, to_submit,
+			    min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/** 检查内核是否支持引擎用到的所有操作 */
+static LCUI_BOOL IORing_Probe(IORing ring)
+{
+	size_t i;
+	LCUI_BOOL ok = TRUE;
+	struct io_uring_probe *probe;
+	int ops[] = { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ,
+		      IORING_OP_CLOSE };
+
+	probe = calloc(1, sizeof(struct io_uring_probe) +
+			      256 * sizeof(struct io_uring_probe_op));
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+		    probe, 256) < 0) {
+		free(probe);
+		return FALSE;
+	}
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+		if (ops[i] > probe->last_op ||
+		    !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			ok = FALSE;
+		}
+	}
+	free(probe);
+	return ok;
+}
+
+static void IORing_Exit(IORing ring)
+{
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_size);
+	}
+	if (ring->sq_ptr) {
+		munmap(ring->sq_ptr, ring->sq_size);
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(IORingRec));
+	ring->fd = -1;
+}
+
+static int IORing_Init(IORing ring)
+{
+	char *sq, *cq;
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(IORingRec));
+	memset(&p, 0, sizeof(p));
+	ring->fd = IORing_Setup(IO_RING_ENTRIES, &p);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		return -errno;
+	}
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_size =
+	    p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_size > ring->sq_size) {
+			ring->sq_size = ring->cq_size;
+		}
+		ring->cq_size = ring->sq_size;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd,
+			    IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		IORing_Exit(ring);
+		return -ENOMEM;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_size,
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd,
+				    IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ring->cq_ptr = NULL;
+			IORing_Exit(ring);
+			return -ENOMEM;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		IORing_Exit(ring);
+		return -ENOMEM;
+	}
+	sq = ring->sq_ptr;
+	cq = ring->cq_ptr;
+	ring->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	if (!IORing_Probe(ring)) {
+		IORing_Exit(ring);
+		return -EOPNOTSUPP;
+	}
+	return 0;
+}
+
+/**
+ * 执行一批请求，results[i] 为第 i 个请求的结果
+ * @returns 队列出错时返回负的错误码，未完成的请求需由调用者另行处理
+ */
+static int IORing_Run(IORing ring, size_t n, IORingPrepFunc prep, void *arg,
+		      long *results)
+{
+	int ret;
+	size_t next = 0, done = 0;
+	unsigned int inflight = 0, pending = 0, tail, head, mask;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+
+	while (done < n) {
+		tail = *ring->sq_tail;
+		mask = *ring->sq_mask;
+		while (next < n && inflight + pending < IO_RING_ENTRIES) {
+			sqe = &ring->sqes[tail & mask];
+			memset(sqe, 0, sizeof(*sqe));
+			prep(sqe, next, arg);
+			sqe->user_data = next;
+			ring->sq_array[tail & mask] = tail & mask;
+			tail += 1;
+			pending += 1;
+			next += 1;
+		}
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+		/* 内核可能只接受了一部分请求，剩下的留在队列中下次再提交 */
+		ret = IORing_Enter(ring, pending, 1);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno != EAGAIN && errno != EBUSY) ||
+			    inflight < 1) {
+				return -errno;
+			}
+			/* 资源暂时不足，先等待已提交的请求完成 */
+			if (IORing_Enter(ring, 0, 1) < 0 && errno != EINTR) {
+				return -errno;
+			}
+			ret = 0;
+		} else if (ret == 0 && inflight < 1) {
+			return -EAGAIN;
+		}
+		pending -= (unsigned int)ret;
+		inflight += (unsigned int)ret;
+		head = *ring->cq_head;
+		mask = *ring->cq_mask;
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring->cqes[head & mask];
+			results[cqe->user_data] = cqe->res;
+			head += 1;
+			inflight -= 1;
+			done += 1;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+typedef struct IOStatArgsRec_ {
+	int dirfd;
+	const char **names;
+	struct statx *statxs;
+} IOStatArgsRec;
+
+typedef struct IOReadArgsRec_ {
+	int dirfd;
+	const char **names;
+	int *fds;
+	char **bufs;
+	size_t size;
+} IOReadArgsRec;
+
+static void IORing_PrepStatx(struct io_uring_sqe *sqe, size_t i, void *arg)
+{
+	IOStatArgsRec *args = arg;
+
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = args->dirfd;
+	sqe->addr = (uintptr_t)args->names[i];
+	sqe->len = STATX_BASIC_STATS;
+	sqe->off = (uintptr_t)&args->statxs[i];
+	sqe->statx_flags = 0;
+}
+
+static void IORing_PrepOpen(struct io_uring_sqe *sqe, size_t i, void *arg)
+{
+	IOReadArgsRec *args = arg;
+
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = args->dirfd;
+	sqe->addr = (uintptr_t)args->names[i];
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+static void IORing_PrepRead(struct io_uring_sqe *sqe, size_t i, void *arg)
+{
+	IOReadArgsRec *args = arg;
+
+	/* 打开失败的文件改为提交空操作，以保持结果的序号不变 */
+	if (args->fds[i] < 0) {
+		sqe->opcode = IORING_OP_NOP;
+		return;
+	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = args->fds[i];
+	sqe->addr = (uintptr_t)args->bufs[i];
+	sqe->len = (unsigned int)args->size;
+	sqe->off = 0;
+}
+
+static void IORing_PrepClose(struct io_uring_sqe *sqe, size_t i, void *arg)
+{
+	IOReadArgsRec *args = arg;
+
+	if (args->fds[i] < 0) {
+		sqe->opcode = IORING_OP_NOP;
+		return;
+	}
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = args->fds[i];
+}
+
+/** 确保引擎的缓冲区能容纳 n 项 */
+static LCUI_BOOL IOEngine_Reserve(void **buf, size_t *max, size_t n,
+				  size_t item_size)
+{
+	void *p;
+
+	if (*max >= n) {
+		return TRUE;
+	}
+	p = realloc(*buf, n * item_size);
+	if (!p) {
+		return FALSE;
+	}
+	*buf = p;
+	*max = n;
+	return TRUE;
+}
+
+#endif
+
+IOEngine IOEngine_Create(void)
+{
+	IOEngine engine = NEW(IOEngineRec, 1);
+#ifdef LCFINDER_USE_IO_URING
+	int ret = IORing_Init(&engine->ring);
+
+	engine->async = ret == 0;
+	if (ret != 0) {
+		Logger_Debug("[io engine] io_uring is unavailable, code: %d\n",
+			     ret);
+	}
+#endif
+	return engine;
+}
+
+void IOEngine_Destroy(IOEngine engine)
+{
+#ifdef LCFINDER_USE_IO_URING
+	if (engine->async) {
+		IORing_Exit(&engine->ring);
+	}
+	free(engine->statxs);
+	free(engine->fds);
+#endif
+	free(engine);
+}
+
+int IOEngine_IsAsync(IOEngine engine)
+{
+#ifdef LCFINDER_USE_IO_URING
+	return engine->async;
+#else
+	return FALSE;
+#endif
+}
+
+static void IOEngine_StatAtSync(int dirfd, const char *name, IOFileStat result)
+{
+	struct stat buf;
+
+	if (fstatat(dirfd, name, &buf, 0) != 0) {
+		result->error = -errno;
+		return;
+	}
+	result->error = 0;
+	result->mode = buf.st_mode;
+	result->size = buf.st_size;
+	result->inode = buf.st_ino;
+	result->ctime = buf.st_ctime;
+	result->mtime = buf.st_mtime;
+}
+
+static long IOEngine_ReadHeaderAtSync(int dirfd, const char *name, char *buf,
+				      size_t size)
+{
+	int fd;
+	long ret;
+
+	fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -errno;
+	}
+	ret = (long)pread(fd, buf, size, 0);
+	if (ret < 0) {
+		ret = -errno;
+	}
+	close(fd);
+	return ret;
+}
+
+void IOEngine_StatAt(IOEngine engine, int dirfd, const char **names,
+		     size_t n, IOFileStat results)
+{
+	size_t i;
+#ifdef LCFINDER_USE_IO_URING
+	long *codes;
+	struct statx *stx;
+	IOStatArgsRec args;
+
+	if (engine->async &&
+	    IOEngine_Reserve((void **)&engine->statxs, &engine->max_statxs,
+			     n, sizeof(struct statx))) {
+		codes = malloc(sizeof(long) * n);
+		args.dirfd = dirfd;
+		args.names = names;
+		args.statxs = engine->statxs;
+		if (codes &&
+		    IORing_Run(&engine->ring, n, IORing_PrepStatx, &args,
+			       codes) == 0) {
+			for (i = 0; i < n; ++i) {
+				stx = &engine->statxs[i];
+				results[i].error = (int)codes[i];
+				if (codes[i] < 0) {
+					continue;
+				}
+				results[i].mode = stx->stx_mode;
+				results[i].size = stx->stx_size;
+				results[i].inode = stx->stx_ino;
+				results[i].ctime = stx->stx_ctime.tv_sec;
+				results[i].mtime = stx->stx_mtime.tv_sec;
+			}
+			free(codes);
+			return;
+		}
+		free(codes);
+		/* 队列出错后不再使用 io_uring */
+		IORing_Exit(&engine->ring);
+		engine->async = FALSE;
+	}
+#endif
+	for (i = 0; i < n; ++i) {
+		IOEngine_StatAtSync(dirfd, names[i], &results[i]);
+	}
+}
+
+#ifdef LCFINDER_USE_IO_URING
+
+/**
+ * 通过 io_uring 读取一批文件，文件数量不能超过队列长度
+ * 打开、读取和关闭分三批提交，每批之间等待上一批全部完成。
+ */
+static int IOEngine_ReadHeadersAsync(IOEngine engine, IOReadArgsRec *args,
+				     size_t n, long *codes, long *results)
+{
+	size_t i;
+
+	if (IORing_Run(&engine->ring, n, IORing_PrepOpen, args, codes) != 0) {
+		return -1;
+	}
+	for (i = 0; i < n; ++i) {
+		args->fds[i] = (int)codes[i];
+	}
+	if (IORing_Run(&engine->ring, n, IORing_PrepRead, args, results) ==
+		0 &&
+	    IORing_Run(&engine->ring, n, IORing_PrepClose, args, codes) == 0) {
+		for (i = 0; i < n; ++i) {
+			if (args->fds[i] < 0) {
+				results[i] = args->fds[i];
+			}
+		}
+		return 0;
+	}
+	for (i = 0; i < n; ++i) {
+		if (args->fds[i] >= 0) {
+			close(args->fds[i]);
+		}
+	}
+	return -1;
+}
+
+#endif
+
+void IOEngine_ReadHeadersAt(IOEngine engine, int dirfd, const char **names,
+			    size_t n, char **bufs, size_t size, long *results)
+{
+	size_t i = 0;
+#ifdef LCFINDER_USE_IO_URING
+	size_t j, count;
+	long *codes;
+	IOReadArgsRec args;
+
+	/* 每次最多打开队列长度个文件，以免占用过多的文件描述符 */
+	if (engine->async &&
+	    IOEngine_Reserve((void **)&engine->fds, &engine->max_fds,
+			     IO_RING_ENTRIES, sizeof(int))) {
+		codes = malloc(sizeof(long) * IO_RING_ENTRIES);
+		args.dirfd = dirfd;
+		args.fds = engine->fds;
+		args.size = size;
+		for (; codes && i < n; i += count) {
+			count = n - i < IO_RING_ENTRIES ? n - i : IO_RING_ENTRIES;
+			args.names = names + i;
+			args.bufs = bufs + i;
+			if (IOEngine_ReadHeadersAsync(engine, &args, count,
+						      codes,
+						      results + i) != 0) {
+				break;
+			}
+			/* 文件描述符用完时，等这批文件关闭后再逐个读取 */
+			for (j = i; j < i + count; ++j) {
+				if (results[j] == -EMFILE ||
+				    results[j] == -ENFILE) {
+					results[j] = IOEngine_ReadHeaderAtSync(
+					    dirfd, names[j], bufs[j], size);
+				}
+			}
+		}
+		free(codes);
+		if (i < n) {
+			IORing_Exit(&engine->ring);
+			engine->async = FALSE;
+		}
+	}
+#endif
+	for (; i < n; ++i) {
+		results[i] =
+		    IOEngine_ReadHeaderAtSync(dirfd, names[i], bufs[i], size);
+	}
+}
+
+#else
+
+IOEngine IOEngine_Create(void)
+{
+	return NULL;
+}
+
+void IOEngine_Destroy(IOEngine engine)
+{
+}
+
+int IOEngine_IsAsync(IOEngine engine)
+{
+	return FALSE;
+}
+
+void IOEngine_StatAt(IOEngine engine, int dirfd, const char **names,
+		     size_t n, IOFileStat results)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		results[i].error = -ENOSYS;
+	}
+}
+
+void IOEngine_ReadHeadersAt(IOEngine engine, int dirfd, const char **names,
+			    size_t n, char **bufs, size_t size, long *results)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		results[i] = -ENOSYS;
+	}
+}
+
+#endif
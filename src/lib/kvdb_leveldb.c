@@ -43,8 +43,18 @@ typedef struct kvdb_t {
 	leveldb_options_t *options;
 	leveldb_readoptions_t *roptions;
 	leveldb_writeoptions_t *woptions;
+	leveldb_writeoptions_t *async_woptions;
 } kvdb_t;
 
+typedef struct kvdb_batch_t {
+	leveldb_writebatch_t *batch;
+	size_t count;
+} kvdb_batch_t;
+
+typedef struct kvdb_iterator_t {
+	leveldb_iterator_t *iter;
+} kvdb_iterator_t;
+
 static leveldb_options_t *kvdb_options_create(void)
 {
 	leveldb_options_t *options = leveldb_options_create();
@@ -64,11 +74,13 @@ kvdb_t *kvdb_open(const char *name)
 
 	db->options = kvdb_options_create();
 	db->woptions = leveldb_writeoptions_create();
+	db->async_woptions = leveldb_writeoptions_create();
 	db->roptions = leveldb_readoptions_create();
 	leveldb_options_set_create_if_missing(db->options, 1);
 	leveldb_readoptions_set_fill_cache(db->roptions, 0);
 	leveldb_readoptions_set_verify_checksums(db->roptions, 1);
 	leveldb_writeoptions_set_sync(db->woptions, 1);
+	leveldb_writeoptions_set_sync(db->async_woptions, 0);
 	db->db = leveldb_open(db->options, name, &err);
 	if (err) {
 		Logger_Debug("[kvdb] error: %s\n", err);
@@ -82,6 +94,7 @@ void kvdb_close(kvdb_t *db)
 	assert(db && db->db);
 	leveldb_readoptions_destroy(db->roptions);
 	leveldb_writeoptions_destroy(db->woptions);
+	leveldb_writeoptions_destroy(db->async_woptions);
 	leveldb_options_destroy(db->options);
 	leveldb_close(db->db);
 	free(db);
@@ -191,4 +204,101 @@ size_t kvdb_each(kvdb_t *db, kvdb_each_callback_t callback, void *privdata)
 	leveldb_iter_destroy(iter);
 	return count;
 }
+
+kvdb_batch_t *kvdb_batch_create(void)
+{
+	kvdb_batch_t *batch = malloc(sizeof(kvdb_batch_t));
+
+	batch->batch = leveldb_writebatch_create();
+	batch->count = 0;
+	return batch;
+}
+
+void kvdb_batch_destroy(kvdb_batch_t *batch)
+{
+	leveldb_writebatch_destroy(batch->batch);
+	free(batch);
+}
+
+void kvdb_batch_put(kvdb_batch_t *batch, const char *key, size_t keylen,
+		    const void *val, size_t vallen)
+{
+	leveldb_writebatch_put(batch->batch, key, keylen, val, vallen);
+	batch->count += 1;
+}
+
+void kvdb_batch_delete(kvdb_batch_t *batch, const char *key, size_t keylen)
+{
+	leveldb_writebatch_delete(batch->batch, key, keylen);
+	batch->count += 1;
+}
+
+size_t kvdb_batch_count(kvdb_batch_t *batch)
+{
+	return batch->count;
+}
+
+int kvdb_write(kvdb_t *db, kvdb_batch_t *batch, int durable)
+{
+	char *err = NULL;
+
+	leveldb_write(db->db, durable ? db->woptions : db->async_woptions,
+		      batch->batch, &err);
+	leveldb_writebatch_clear(batch->batch);
+	batch->count = 0;
+	if (err) {
+		Logger_Debug("[kvdb] error: %s\n", err);
+		return -1;
+	}
+	return 0;
+}
+
+int kvdb_is_ordered(void)
+{
+	return 1;
+}
+
+kvdb_iterator_t *kvdb_iter_create(kvdb_t *db)
+{
+	kvdb_iterator_t *iter = malloc(sizeof(kvdb_iterator_t));
+
+	iter->iter = leveldb_create_iterator(db->db, db->roptions);
+	leveldb_iter_seek_to_first(iter->iter);
+	return iter;
+}
+
+void kvdb_iter_destroy(kvdb_iterator_t *iter)
+{
+	leveldb_iter_destroy(iter->iter);
+	free(iter);
+}
+
+void kvdb_iter_seek(kvdb_iterator_t *iter, const char *key, size_t keylen)
+{
+	if (key) {
+		leveldb_iter_seek(iter->iter, key, keylen);
+	} else {
+		leveldb_iter_seek_to_first(iter->iter);
+	}
+}
+
+int kvdb_iter_valid(kvdb_iterator_t *iter)
+{
+	return leveldb_iter_valid(iter->iter);
+}
+
+void kvdb_iter_next(kvdb_iterator_t *iter)
+{
+	leveldb_iter_next(iter->iter);
+}
+
+const char *kvdb_iter_key(kvdb_iterator_t *iter, size_t *keylen)
+{
+	return leveldb_iter_key(iter->iter, keylen);
+}
+
+const void *kvdb_iter_value(kvdb_iterator_t *iter, size_t *vallen)
+{
+	return leveldb_iter_value(iter->iter, vallen);
+}
 #endif
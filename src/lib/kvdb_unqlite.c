@@ -39,6 +39,29 @@ typedef struct kvdb_t {
 	unqlite *db;
 } kvdb_t;
 
+typedef struct kvdb_batch_op_t {
+	char *key;
+	size_t keylen;
+	void *val;	/**< 为 NULL 时表示删除 */
+	size_t vallen;
+} kvdb_batch_op_t;
+
+typedef struct kvdb_batch_t {
+	kvdb_batch_op_t *ops;
+	size_t count;
+	size_t capacity;
+} kvdb_batch_t;
+
+/** unqlite 的键按哈希值存放，迭代器只能按存放顺序遍历 */
+typedef struct kvdb_iterator_t {
+	kvdb_t *db;
+	unqlite_kv_cursor *cur;
+	int keylen;
+	char key[MAX_KEY_LEN];
+	char *val;
+	size_t vallen;
+} kvdb_iterator_t;
+
 kvdb_t *kvdb_open(const char *name)
 {
 	kvdb_t *db = malloc(sizeof(kvdb_t));
@@ -144,4 +167,186 @@ size_t kvdb_each(kvdb_t *db, kvdb_each_callback_t callback, void *privdata)
 	unqlite_kv_cursor_release(db->db, cur);
 	return count;
 }
+
+kvdb_batch_t *kvdb_batch_create(void)
+{
+	kvdb_batch_t *batch = malloc(sizeof(kvdb_batch_t));
+
+	batch->ops = NULL;
+	batch->count = 0;
+	batch->capacity = 0;
+	return batch;
+}
+
+static void kvdb_batch_clear(kvdb_batch_t *batch)
+{
+	size_t i;
+
+	for (i = 0; i < batch->count; ++i) {
+		free(batch->ops[i].key);
+		free(batch->ops[i].val);
+	}
+	batch->count = 0;
+}
+
+void kvdb_batch_destroy(kvdb_batch_t *batch)
+{
+	kvdb_batch_clear(batch);
+	free(batch->ops);
+	free(batch);
+}
+
+static kvdb_batch_op_t *kvdb_batch_add(kvdb_batch_t *batch, const char *key,
+				       size_t keylen)
+{
+	kvdb_batch_op_t *ops, *op;
+
+	if (batch->count >= batch->capacity) {
+		batch->capacity = batch->capacity * 2 + 64;
+		ops = realloc(batch->ops,
+			      sizeof(kvdb_batch_op_t) * batch->capacity);
+		if (!ops) {
+			return NULL;
+		}
+		batch->ops = ops;
+	}
+	op = &batch->ops[batch->count++];
+	op->key = malloc(keylen);
+	op->keylen = keylen;
+	op->val = NULL;
+	op->vallen = 0;
+	memcpy(op->key, key, keylen);
+	return op;
+}
+
+void kvdb_batch_put(kvdb_batch_t *batch, const char *key, size_t keylen,
+		    const void *val, size_t vallen)
+{
+	kvdb_batch_op_t *op = kvdb_batch_add(batch, key, keylen);
+
+	if (op) {
+		op->val = malloc(vallen);
+		op->vallen = vallen;
+		memcpy(op->val, val, vallen);
+	}
+}
+
+void kvdb_batch_delete(kvdb_batch_t *batch, const char *key, size_t keylen)
+{
+	kvdb_batch_add(batch, key, keylen);
+}
+
+size_t kvdb_batch_count(kvdb_batch_t *batch)
+{
+	return batch->count;
+}
+
+int kvdb_write(kvdb_t *db, kvdb_batch_t *batch, int durable)
+{
+	int rc = UNQLITE_OK;
+	size_t i;
+	kvdb_batch_op_t *op;
+
+	/* unqlite 在提交事务时落盘，所有操作放在同一个事务中 */
+	unqlite_begin(db->db);
+	for (i = 0; i < batch->count && rc == UNQLITE_OK; ++i) {
+		op = &batch->ops[i];
+		if (op->val) {
+			rc = unqlite_kv_store(db->db, op->key, (int)op->keylen,
+					      op->val, op->vallen);
+		} else {
+			unqlite_kv_delete(db->db, op->key, (int)op->keylen);
+		}
+	}
+	kvdb_batch_clear(batch);
+	if (rc != UNQLITE_OK) {
+		unqlite_rollback(db->db);
+		return -1;
+	}
+	unqlite_commit(db->db);
+	return 0;
+}
+
+int kvdb_is_ordered(void)
+{
+	return 0;
+}
+
+static void kvdb_iter_fetch(kvdb_iterator_t *iter)
+{
+	unqlite_int64 vallen = 0;
+
+	free(iter->val);
+	iter->val = NULL;
+	iter->vallen = 0;
+	iter->keylen = 0;
+	if (!iter->cur || !unqlite_kv_cursor_valid_entry(iter->cur)) {
+		return;
+	}
+	iter->keylen = MAX_KEY_LEN;
+	unqlite_kv_cursor_key(iter->cur, iter->key, &iter->keylen);
+	unqlite_kv_cursor_data(iter->cur, NULL, &vallen);
+	iter->val = malloc((size_t)vallen);
+	unqlite_kv_cursor_data(iter->cur, iter->val, &vallen);
+	iter->vallen = (size_t)vallen;
+}
+
+kvdb_iterator_t *kvdb_iter_create(kvdb_t *db)
+{
+	kvdb_iterator_t *iter = malloc(sizeof(kvdb_iterator_t));
+
+	iter->db = db;
+	iter->val = NULL;
+	if (unqlite_kv_cursor_init(db->db, &iter->cur) != UNQLITE_OK) {
+		iter->cur = NULL;
+	}
+	kvdb_iter_seek(iter, NULL, 0);
+	return iter;
+}
+
+void kvdb_iter_destroy(kvdb_iterator_t *iter)
+{
+	if (iter->cur) {
+		unqlite_kv_cursor_release(iter->db->db, iter->cur);
+	}
+	free(iter->val);
+	free(iter);
+}
+
+void kvdb_iter_seek(kvdb_iterator_t *iter, const char *key, size_t keylen)
+{
+	if (!iter->cur) {
+		return;
+	}
+	if (key) {
+		unqlite_kv_cursor_seek(iter->cur, key, (int)keylen,
+				       UNQLITE_CURSOR_MATCH_GE);
+	} else {
+		unqlite_kv_cursor_first_entry(iter->cur);
+	}
+	kvdb_iter_fetch(iter);
+}
+
+int kvdb_iter_valid(kvdb_iterator_t *iter)
+{
+	return iter->cur && unqlite_kv_cursor_valid_entry(iter->cur);
+}
+
+void kvdb_iter_next(kvdb_iterator_t *iter)
+{
+	unqlite_kv_cursor_next_entry(iter->cur);
+	kvdb_iter_fetch(iter);
+}
+
+const char *kvdb_iter_key(kvdb_iterator_t *iter, size_t *keylen)
+{
+	*keylen = (size_t)iter->keylen;
+	return iter->key;
+}
+
+const void *kvdb_iter_value(kvdb_iterator_t *iter, size_t *vallen)
+{
+	*vallen = iter->vallen;
+	return iter->val;
+}
 #endif
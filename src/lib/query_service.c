@@ -0,0 +1,469 @@
+﻿/* ***************************************************************************
+ * query_service.c -- asynchronous file query service
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * query_service.c -- 异步文件查询服务
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/**
+ * 异步文件查询服务
+ * 查询在工作线程中执行，结果按页投递到 UI 线程。每个视图拥有一个查询通道，
+ * 同一通道中的新查询会取代旧的查询：排队中的旧查询直接移除，执行中的旧查询
+ * 通过取消标志中断，包括加载镜像、排序等构建查询的过程，已投递但还未处理的
+ * 结果按查询的序号丢弃，提交新查询时不用等待旧查询结束。
+ */
+
+#define LCFINDER_QUERY_SERVICE_C
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <LCUI_Build.h>
+#include <LCUI/LCUI.h>
+#include <LCUI/thread.h>
+#include "query_service.h"
+
+/** 工作线程的数量 */
+#define QUERY_WORKERS 2
+
+/** 每个通道中已投递但 UI 线程还未处理的页的最大数量 */
+#define QUERY_MAX_PENDING_PAGES 2
+
+typedef struct QueryRequestRec_ {
+	QueryChannel channel;
+	unsigned generation;    /**< 查询的序号，用于识别过时的结果 */
+	LCUI_BOOL running;      /**< 是否正在执行 */
+	volatile int cancelled; /**< 是否已被取消，构建查询时也会检查它 */
+	DB_Query query;         /**< 正在执行的查询，用于中断查询 */
+	DB_QueryTermsRec terms; /**< 查询条件的副本 */
+	LinkedListNode node;
+} QueryRequestRec, *QueryRequest;
+
+typedef struct QueryChannelRec_ {
+	QueryPageHandler on_page;
+	QueryDoneHandler on_done;
+	void *data;
+
+	unsigned generation;   /**< 最新的查询的序号，只在 UI 线程中访问 */
+	QueryRequest request;  /**< 未完成的查询 */
+	size_t pending_pages;  /**< 已投递但还未处理的页的数量 */
+	size_t refs;           /**< 引用计数，每个已投递的结果持有一个引用 */
+	LCUI_BOOL destroyed;
+} QueryChannelRec;
+
+/** 投递到 UI 线程的查询结果 */
+typedef struct QueryResultRec_ {
+	QueryChannel channel;
+	unsigned generation;
+	DB_FilePage page; /**< 一页文件，为 NULL 时表示查询已完成 */
+	size_t count;
+} QueryResultRec, *QueryResult;
+
+static struct QueryService {
+	LCUI_BOOL active;
+	LCUI_Mutex mutex;
+	LCUI_Cond cond;
+	LinkedList requests;
+	LCUI_Thread threads[QUERY_WORKERS];
+	QueryRequest running[QUERY_WORKERS];	/**< 各工作线程正在执行的查询 */
+} service;
+
+static DB_Tag *QueryTerms_CopyTags(DB_Tag *tags, size_t n)
+{
+	size_t i;
+	DB_Tag *list;
+	DB_TagRec *recs;
+
+	if (!tags || n < 1) {
+		return NULL;
+	}
+	/* 查询只用到标签的标识号，所以只复制标识号，记录与指针数组一起分配 */
+	list = malloc((n + 1) * sizeof(DB_Tag) + n * sizeof(DB_TagRec));
+	if (!list) {
+		return NULL;
+	}
+	recs = (DB_TagRec *)(list + n + 1);
+	for (i = 0; i < n; ++i) {
+		recs[i].id = tags[i]->id;
+		recs[i].name = NULL;
+		recs[i].count = tags[i]->count;
+		list[i] = &recs[i];
+	}
+	list[n] = NULL;
+	return list;
+}
+
+static DB_Dir *QueryTerms_CopyDirs(DB_Dir *dirs, size_t n)
+{
+	size_t i;
+	DB_Dir *list;
+	DB_DirRec *recs;
+
+	if (!dirs || n < 1) {
+		return NULL;
+	}
+	list = malloc((n + 1) * sizeof(DB_Dir) + n * sizeof(DB_DirRec));
+	if (!list) {
+		return NULL;
+	}
+	recs = (DB_DirRec *)(list + n + 1);
+	for (i = 0; i < n; ++i) {
+		memset(&recs[i], 0, sizeof(DB_DirRec));
+		recs[i].id = dirs[i]->id;
+		recs[i].visible = dirs[i]->visible;
+		list[i] = &recs[i];
+	}
+	list[n] = NULL;
+	return list;
+}
+
+static void QueryTerms_Copy(DB_QueryTerms dst, const DB_QueryTerms src)
+{
+	*dst = *src;
+	dst->dirs = QueryTerms_CopyDirs(src->dirs, src->n_dirs);
+	dst->tags = QueryTerms_CopyTags(src->tags, src->n_tags);
+	dst->any_tags = QueryTerms_CopyTags(src->any_tags, src->n_any_tags);
+	dst->excluded_tags =
+	    QueryTerms_CopyTags(src->excluded_tags, src->n_excluded_tags);
+	dst->n_dirs = dst->dirs ? src->n_dirs : 0;
+	dst->n_tags = dst->tags ? src->n_tags : 0;
+	dst->n_any_tags = dst->any_tags ? src->n_any_tags : 0;
+	dst->n_excluded_tags = dst->excluded_tags ? src->n_excluded_tags : 0;
+	dst->dirpath = src->dirpath ? strdup(src->dirpath) : NULL;
+	dst->keywords = src->keywords ? strdup(src->keywords) : NULL;
+}
+
+static void QueryTerms_Destroy(DB_QueryTerms terms)
+{
+	free(terms->dirs);
+	free(terms->tags);
+	free(terms->any_tags);
+	free(terms->excluded_tags);
+	free(terms->dirpath);
+	free(terms->keywords);
+	memset(terms, 0, sizeof(DB_QueryTermsRec));
+}
+
+static void QueryRequest_Destroy(QueryRequest req)
+{
+	QueryTerms_Destroy(&req->terms);
+	free(req);
+}
+
+static void QueryPage_Destroy(DB_FilePage page)
+{
+	DBFilePage_Destroy(page);
+	free(page);
+}
+
+/** 释放通道的引用，需要在锁定服务后调用 */
+static void QueryChannel_Release(QueryChannel channel)
+{
+	if (--channel->refs == 0) {
+		free(channel);
+	}
+}
+
+/** 取消通道中的查询，需要在锁定服务后调用 */
+static void QueryChannel_CancelRequest(QueryChannel channel)
+{
+	QueryRequest req = channel->request;
+
+	if (!req) {
+		return;
+	}
+	channel->request = NULL;
+	req->cancelled = TRUE;
+	if (req->running) {
+		/* 执行中的查询由工作线程负责释放 */
+		if (req->query) {
+			DBQuery_Interrupt(req->query);
+		}
+		LCUICond_Broadcast(&service.cond);
+		return;
+	}
+	LinkedList_Unlink(&service.requests, &req->node);
+	QueryRequest_Destroy(req);
+	QueryChannel_Release(channel);
+}
+
+/** 在 UI 线程中处理查询结果 */
+static void QueryService_OnResult(void *arg1, void *arg2)
+{
+	QueryResult result = arg1;
+	QueryChannel channel = result->channel;
+
+	if (!channel->destroyed && result->generation == channel->generation) {
+		if (result->page) {
+			channel->on_page(result->page, channel->data);
+			result->page = NULL;
+		} else if (channel->on_done) {
+			channel->on_done(result->count, channel->data);
+		}
+	}
+	if (result->page) {
+		QueryPage_Destroy(result->page);
+	}
+	LCUIMutex_Lock(&service.mutex);
+	if (arg2) {
+		channel->pending_pages -= 1;
+		LCUICond_Broadcast(&service.cond);
+	}
+	QueryChannel_Release(channel);
+	LCUIMutex_Unlock(&service.mutex);
+	free(result);
+}
+
+/** 投递查询结果，需要在锁定服务后调用 */
+static void QueryService_PostResult(QueryRequest req, DB_FilePage page,
+				    size_t count)
+{
+	QueryResult result;
+
+	result = malloc(sizeof(QueryResultRec));
+	if (!result) {
+		if (page) {
+			QueryPage_Destroy(page);
+		}
+		return;
+	}
+	result->channel = req->channel;
+	result->generation = req->generation;
+	result->page = page;
+	result->count = count;
+	req->channel->refs += 1;
+	if (page) {
+		req->channel->pending_pages += 1;
+	}
+	/* 第二个参数用于标记这个结果是否占用了待处理的页数 */
+	LCUI_PostSimpleTask(QueryService_OnResult, result, page ? result : NULL);
+}
+
+/** 执行查询，按页取出文件并投递到 UI 线程 */
+static void QueryService_Run(QueryRequest req)
+{
+	size_t n, count = 0;
+	DB_Query query;
+	DB_FilePage page;
+	DB_QueryTerms terms = &req->terms;
+
+	while (1) {
+		query = DB_NewCancellableQuery(terms, &req->cancelled);
+		if (!query) {
+			break;
+		}
+		page = calloc(1, sizeof(DB_FilePageRec));
+		LCUIMutex_Lock(&service.mutex);
+		if (req->cancelled || !service.active || !page) {
+			LCUIMutex_Unlock(&service.mutex);
+			DB_DeleteQuery(query);
+			free(page);
+			break;
+		}
+		req->query = query;
+		LCUIMutex_Unlock(&service.mutex);
+
+		n = DBQuery_FetchFiles(query, page, terms->limit);
+		DBQuery_GetCursor(query, &terms->cursor);
+
+		LCUIMutex_Lock(&service.mutex);
+		req->query = NULL;
+		LCUIMutex_Unlock(&service.mutex);
+		DB_DeleteQuery(query);
+
+		LCUIMutex_Lock(&service.mutex);
+		if (req->cancelled || !service.active || n < 1) {
+			LCUIMutex_Unlock(&service.mutex);
+			QueryPage_Destroy(page);
+			break;
+		}
+		count += n;
+		QueryService_PostResult(req, page, n);
+		/* UI 线程来不及处理时先暂停，避免结果堆积在任务队列中 */
+		while (!req->cancelled && service.active &&
+		       req->channel->pending_pages >= QUERY_MAX_PENDING_PAGES) {
+			LCUICond_Wait(&service.cond, &service.mutex);
+		}
+		LCUIMutex_Unlock(&service.mutex);
+		if (n < terms->limit) {
+			break;
+		}
+	}
+	LCUIMutex_Lock(&service.mutex);
+	if (!req->cancelled && service.active) {
+		QueryService_PostResult(req, NULL, count);
+	}
+	LCUIMutex_Unlock(&service.mutex);
+}
+
+static void QueryService_Thread(void *arg)
+{
+	QueryRequest req;
+	QueryRequest *running = arg;
+	LinkedListNode *node;
+
+	LCUIMutex_Lock(&service.mutex);
+	while (service.active) {
+		node = LinkedList_GetNode(&service.requests, 0);
+		if (!node) {
+			LCUICond_Wait(&service.cond, &service.mutex);
+			continue;
+		}
+		req = node->data;
+		LinkedList_Unlink(&service.requests, node);
+		req->running = TRUE;
+		*running = req;
+		LCUIMutex_Unlock(&service.mutex);
+
+		QueryService_Run(req);
+
+		LCUIMutex_Lock(&service.mutex);
+		*running = NULL;
+		if (req->channel->request == req) {
+			req->channel->request = NULL;
+		}
+		QueryChannel_Release(req->channel);
+		QueryRequest_Destroy(req);
+	}
+	LCUIMutex_Unlock(&service.mutex);
+	LCUIThread_Exit(NULL);
+}
+
+int QueryService_Init(void)
+{
+	int i;
+
+	service.active = TRUE;
+	LCUIMutex_Init(&service.mutex);
+	LCUICond_Init(&service.cond);
+	LinkedList_Init(&service.requests);
+	for (i = 0; i < QUERY_WORKERS; ++i) {
+		service.running[i] = NULL;
+		LCUIThread_Create(&service.threads[i], QueryService_Thread,
+				  &service.running[i]);
+	}
+	return 0;
+}
+
+void QueryService_Exit(void)
+{
+	int i;
+	QueryRequest req;
+	LinkedListNode *node;
+
+	LCUIMutex_Lock(&service.mutex);
+	service.active = FALSE;
+	while ((node = LinkedList_GetNode(&service.requests, 0)) != NULL) {
+		req = node->data;
+		LinkedList_Unlink(&service.requests, node);
+		req->channel->request = NULL;
+		QueryChannel_Release(req->channel);
+		QueryRequest_Destroy(req);
+	}
+	/* 中断执行中的查询，工作线程会在查询返回后释放它们 */
+	for (i = 0; i < QUERY_WORKERS; ++i) {
+		req = service.running[i];
+		if (!req) {
+			continue;
+		}
+		req->cancelled = TRUE;
+		if (req->query) {
+			DBQuery_Interrupt(req->query);
+		}
+	}
+	LCUICond_Broadcast(&service.cond);
+	LCUIMutex_Unlock(&service.mutex);
+	for (i = 0; i < QUERY_WORKERS; ++i) {
+		LCUIThread_Join(service.threads[i], NULL);
+	}
+	LCUICond_Destroy(&service.cond);
+	LCUIMutex_Destroy(&service.mutex);
+}
+
+QueryChannel QueryChannel_Create(QueryPageHandler on_page,
+				 QueryDoneHandler on_done, void *data)
+{
+	QueryChannel channel;
+
+	channel = calloc(1, sizeof(QueryChannelRec));
+	if (!channel) {
+		return NULL;
+	}
+	channel->on_page = on_page;
+	channel->on_done = on_done;
+	channel->data = data;
+	channel->refs = 1;
+	return channel;
+}
+
+void QueryChannel_Destroy(QueryChannel channel)
+{
+	LCUIMutex_Lock(&service.mutex);
+	QueryChannel_CancelRequest(channel);
+	channel->destroyed = TRUE;
+	QueryChannel_Release(channel);
+	LCUIMutex_Unlock(&service.mutex);
+}
+
+int QueryChannel_Submit(QueryChannel channel, const DB_QueryTerms terms)
+{
+	QueryRequest req;
+
+	req = calloc(1, sizeof(QueryRequestRec));
+	if (!req) {
+		return -ENOMEM;
+	}
+	QueryTerms_Copy(&req->terms, terms);
+	req->channel = channel;
+	req->node.data = req;
+	LCUIMutex_Lock(&service.mutex);
+	if (!service.active) {
+		LCUIMutex_Unlock(&service.mutex);
+		QueryRequest_Destroy(req);
+		return -1;
+	}
+	QueryChannel_CancelRequest(channel);
+	req->generation = ++channel->generation;
+	channel->request = req;
+	channel->refs += 1;
+	LinkedList_AppendNode(&service.requests, &req->node);
+	LCUICond_Signal(&service.cond);
+	LCUIMutex_Unlock(&service.mutex);
+	return 0;
+}
+
+void QueryChannel_Cancel(QueryChannel channel)
+{
+	LCUIMutex_Lock(&service.mutex);
+	QueryChannel_CancelRequest(channel);
+	LCUIMutex_Unlock(&service.mutex);
+	channel->generation += 1;
+}
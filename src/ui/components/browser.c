@@ -302,11 +302,7 @@ static int OnFileDeleted(void *privdata, size_t i, size_t n)
 /** 当其它地方删除了一个文件 */
 static void OnFileDeletionEvent(void *privdata, void *arg)
 {
-	FileBrowser browser = privdata;
-	FileIndex fidx = Dict_FetchValue(browser->file_indexes, arg);
-	if (fidx) {
-		FileBrowser_UnlinkFile(browser, fidx);
-	}
+	FileBrowser_RemovePicture(privdata, arg);
 }
 
 static void FileDeletionThread(void *arg)
@@ -579,6 +575,104 @@ LCUI_Widget FileBrowser_AppendPicture(FileBrowser browser, const DB_File file)
 	return item;
 }
 
+/** 从 w 开始往后找到第一张图片在文件列表中的位置 */
+static size_t FileBrowser_GetFileIndex(FileBrowser browser, LCUI_Widget w)
+{
+	size_t i;
+	DB_File file;
+	FileIndex fidx;
+	LinkedListNode *node;
+
+	for (; w; w = Widget_GetNext(w)) {
+		if (!Widget_CheckType(w, "thumbviewitem")) {
+			continue;
+		}
+		file = ThumbViewItem_GetFile(w);
+		if (!file) {
+			continue;
+		}
+		fidx = Dict_FetchValue(browser->file_indexes, file->path);
+		if (!fidx || fidx->item != w) {
+			continue;
+		}
+		i = 0;
+		for (LinkedList_Each(node, &browser->files)) {
+			if (node == &fidx->node) {
+				return i;
+			}
+			++i;
+		}
+	}
+	return browser->files.length;
+}
+
+void FileBrowser_Insert(FileBrowser browser, LCUI_Widget widget,
+			LCUI_Widget before)
+{
+	ThumbView_Insert(browser->items, widget, before);
+}
+
+LCUI_Widget FileBrowser_InsertPicture(FileBrowser browser, const DB_File file,
+				      LCUI_Widget before)
+{
+	size_t pos;
+	DataPack data;
+	LCUI_Widget item;
+
+	pos = FileBrowser_GetFileIndex(browser, before);
+	data = NEW(DataPackRec, 1);
+	data->fidx = NEW(FileIndexRec, 1);
+	item = ThumbView_InsertPicture(browser->items, file, before);
+	data->fidx->is_file = TRUE;
+	data->browser = browser;
+	data->fidx->item = item;
+	/* 插入的文件记录通常是临时的，改用列表项持有的副本 */
+	data->fidx->file = ThumbViewItem_GetFile(item);
+	data->fidx->node.data = data->fidx;
+	data->fidx->checkbox = LCUIWidget_New("textview");
+	Widget_AddClass(data->fidx->checkbox, "checkbox icon");
+	ThumbViewItem_AppendToCover(item, data->fidx->checkbox);
+	Dict_Add(browser->file_indexes, data->fidx->file->path, data->fidx);
+	if (pos < browser->files.length) {
+		LinkedList_InsertNode(&browser->files, pos, &data->fidx->node);
+	} else {
+		LinkedList_AppendNode(&browser->files, &data->fidx->node);
+	}
+	Widget_BindEvent(item, "click", OnItemClick, data, NULL);
+	Widget_Show(browser->btn_select);
+	return item;
+}
+
+LCUI_BOOL FileBrowser_RemovePicture(FileBrowser browser, const char *path)
+{
+	FileIndex fidx = Dict_FetchValue(browser->file_indexes, path);
+
+	if (!fidx || !fidx->is_file) {
+		return FALSE;
+	}
+	if (browser->is_selection_mode) {
+		FileBrowser_UnselectItem(browser, fidx);
+	}
+	FileBrowser_UnlinkFile(browser, fidx);
+	return TRUE;
+}
+
+LCUI_Widget FileBrowser_FindPosition(FileBrowser browser, const DB_File file,
+				     int (*compare)(const DB_File,
+						    const DB_File))
+{
+	FileIndex fidx;
+	LinkedListNode *node;
+
+	for (LinkedList_Each(node, &browser->files)) {
+		fidx = node->data;
+		if (compare(file, fidx->file) < 0) {
+			return fidx->item;
+		}
+	}
+	return NULL;
+}
+
 LCUI_Widget FileBrowser_AppendFolder(FileBrowser browser, const char *path,
 				     LCUI_BOOL show_path)
 {
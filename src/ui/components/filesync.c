@@ -68,11 +68,6 @@ static void RenderStatusText(wchar_t *buf, const wchar_t *text, void *data)
 		total = self.status.added_files;
 		total += self.status.changed_files;
 		total += self.status.deleted_files;
-		if (self.status.task) {
-			total += self.status.task->added_files;
-			total += self.status.task->changed_files;
-			total += self.status.task->deleted_files;
-		}
 		swprintf(buf, TXTFMT_BUF_MAX_LEN, text, count, total);
 		break;
 	case STATE_FINISHED:
@@ -89,6 +84,7 @@ static void RenderStatusText(wchar_t *buf, const wchar_t *text, void *data)
 
 static void OnUpdateStats(void *arg)
 {
+	LCFinder_UpdateSyncStatus(&self.status);
 	self.cached_state = self.status.state;
 	switch (self.cached_state) {
 	case STATE_SAVING:
@@ -54,6 +54,11 @@
 
 #define REFRESH_INTERVAL	500
 #define THUMB_TASK_MAX		32
+/** 同时加载的缩略图数量上限，其中预加载的不超过一半，以便可见的缩略图优先加载 */
+#define THUMB_MAX_LOADERS	4
+#define THUMB_MAX_PREFETCH	(THUMB_MAX_LOADERS / 2)
+/** 每次滚动加载时预加载的可见区域下方的缩略图数量 */
+#define THUMB_PREFETCH_COUNT	16
 #define SCROLLLOADING_DELAY	500
 #define LAYOUT_DELAY		1000
 #define ANIMATION_DELAY		750
@@ -74,6 +79,7 @@
 typedef struct AutoLoaderRec_ {
 	float top;			/**< 当前可见区域上边界的 Y 轴坐标 */
 	int event_id;			/**< 滚动加载功能的事件ID */
+	int prefetch_event_id;		/**< 预加载功能的事件ID */
 	int timer;			/**< 定时器，用于实现延迟加载 */
 	LCUI_BOOL is_delaying;		/**< 是否处于延迟状态 */
 	LCUI_BOOL need_update;		/**< 是否需要更新 */
@@ -112,6 +118,8 @@ typedef void (*ThumbLoaderCallback)(ThumbLoader);
 /** 缩略图加载器的数据结构 */
 typedef struct ThumbLoaderRec_ {
 	LCUI_BOOL active;		/**< 是否处于活动状态 */
+	LCUI_BOOL is_prefetch;		/**< 是否为预加载 */
+	int storage;			/**< 文件存储服务的连接标识符 */
 	ThumbDB db;			/**< 缩略图缓存数据库 */
 	ThumbView view;			/**< 所属缩略图视图 */
 	LCUI_Widget target;		/**< 需要缩略图的部件 */
@@ -125,15 +133,18 @@ typedef struct ThumbLoaderRec_ {
 } ThumbLoaderRec;
 
 typedef struct ThumbWorkerRec_ {
-	LCUI_BOOL active;
-	ThumbLoader loader;
+	size_t n_loaders;			/**< 正在运行的加载器数量 */
+	size_t n_prefetching;			/**< 其中用于预加载的加载器数量 */
+	ThumbLoader loaders[THUMB_MAX_LOADERS];	/**< 正在运行的加载器 */
 	LinkedList tasks;			/**< 缩略图加载任务队列 */
+	LinkedList prefetch_tasks;		/**< 预加载任务队列 */
 	int timer;
 } ThumbWorkerRec, *ThumbWorker;
 
 typedef struct ThumbViewRec_ {
 	int timer;
 	int storage;				/**< 文件存储服务的连接标识符 */
+	int prefetch_storage;			/**< 用于预加载的文件存储服务的连接标识符 */
 	Dict **dbs;				/**< 缩略图数据库字典，以目录路径进行索引 */
 	ThumbCache cache;			/**< 缩略图缓存 */
 	ThumbLinker linker;			/**< 缩略图链接器 */
@@ -168,6 +179,7 @@ static struct ThumbViewModule {
 	LCUI_WidgetPrototype main; /**< 缩略图视图的原型 */
 	LCUI_WidgetPrototype item; /**< 缩略图视图列表项的原型 */
 	int event_scrollload;      /**< 滚动加载事件的标识号 */
+	int event_prefetch;        /**< 预加载事件的标识号 */
 } self = { 0 };
 
 /* clang-format on */
@@ -330,6 +342,17 @@ static void OnScrollLoad(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
 	ThumbWorker_AddTask(&data->view->worker, w);
 }
 
+static void OnPrefetch(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
+{
+	ThumbViewItem data = Widget_GetData(w, self.item);
+	LCUI_Style s = Widget_GetStyle(w, key_background_image);
+	if (s->is_valid || !data || !data->view || !data->view->cache ||
+	    data->view->prefetch_storage <= 0 || data->loader) {
+		return;
+	}
+	ThumbWorker_AddPrefetchTask(&data->view->worker, w);
+}
+
 void ThumbView_EnableAutoLoader(LCUI_Widget w)
 {
 	ThumbView view = Widget_GetData(w, self.main);
@@ -442,6 +465,49 @@ void ThumbView_Append(LCUI_Widget w, LCUI_Widget child)
 	}
 }
 
+/** 将追加在末尾的子部件移到 before 前面 */
+static void ThumbView_MoveBefore(LCUI_Widget w, LCUI_Widget child,
+				 LCUI_Widget before)
+{
+	LCUI_Widget cur, next;
+
+	/* 只能追加或前置子部件，所以选 before 前后部件较少的一侧，把这些部件
+	 * 依次重新前置或追加 */
+	if (before->index < w->children.length - before->index) {
+		Widget_Prepend(w, child);
+		for (cur = Widget_GetPrev(before); cur && cur != child;
+		     cur = Widget_GetPrev(before)) {
+			Widget_Prepend(w, cur);
+		}
+		return;
+	}
+	for (cur = before; cur && cur != child; cur = next) {
+		next = Widget_GetNext(cur);
+		Widget_Append(w, cur);
+	}
+}
+
+void ThumbView_Insert(LCUI_Widget w, LCUI_Widget child, LCUI_Widget before)
+{
+	ThumbView_Append(w, child);
+	if (before) {
+		ThumbView_MoveBefore(w, child, before);
+		ThumbView_DelayUpdateLayout(w, child);
+	}
+}
+
+LCUI_Widget ThumbView_InsertPicture(LCUI_Widget w, const DB_File file,
+				    LCUI_Widget before)
+{
+	LCUI_Widget item = ThumbView_AppendPicture(w, file);
+
+	if (before) {
+		ThumbView_MoveBefore(w, item, before);
+		ThumbView_DelayUpdateLayout(w, item);
+	}
+	return item;
+}
+
 void ThumbView_SetCache(LCUI_Widget w, ThumbCache cache)
 {
 	ThumbView view = Widget_GetData(w, self.main);
@@ -456,6 +522,14 @@ void ThumbView_SetStorage(LCUI_Widget w, int storage)
 {
 	ThumbView view = Widget_GetData(w, self.main);
 	view->storage = storage;
+	FileStorage_SetMaxRequests(storage, THUMB_MAX_LOADERS);
+}
+
+void ThumbView_SetPrefetchStorage(LCUI_Widget w, int storage)
+{
+	ThumbView view = Widget_GetData(w, self.main);
+	view->prefetch_storage = storage;
+	FileStorage_SetMaxRequests(storage, THUMB_MAX_PREFETCH);
 }
 
 static void ThumbView_AutoLoadThumb(void *arg)
@@ -496,6 +570,7 @@ static void ThumbViewItem_OnInit(LCUI_Widget w)
 	item->updatesize = NULL;
 	item->loader = NULL;
 	Widget_BindEvent(w, "loader", OnScrollLoad, NULL, NULL);
+	Widget_BindEvent(w, "prefetch", OnPrefetch, NULL, NULL);
 }
 
 static void ThumbView_OnRemove(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
@@ -665,6 +740,8 @@ static void ThumbView_OnInit(LCUI_Widget w)
 
 	view = Widget_AddData(w, self.main, sizeof(ThumbViewRec));
 	view->dbs = &finder.thumb_dbs;
+	view->storage = 0;
+	view->prefetch_storage = 0;
 	view->is_loading = FALSE;
 	view->is_running = TRUE;
 	view->hashes_len = 0;
@@ -707,4 +784,6 @@ void LCUIWidget_AddThumbView(void)
 	self.item->destroy = ThumbViewItem_OnDestroy;
 	self.event_scrollload = LCUIWidget_AllocEventId();
 	LCUIWidget_SetEventName(self.event_scrollload, "loader");
+	self.event_prefetch = LCUIWidget_AllocEventId();
+	LCUIWidget_SetEventName(self.event_prefetch, "prefetch");
 }
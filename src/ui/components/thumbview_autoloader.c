@@ -1,10 +1,36 @@
 ﻿#ifdef LCFINDER_THUMBVIEW_C
 
+/** 预加载可见区域下方的部件的内容，node 是可见区域下方的第一个部件的节点 */
+static void AutoLoader_Prefetch(AutoLoader ctx, LinkedListNode *node)
+{
+	int count = 0;
+	LCUI_Widget w;
+	LinkedList list;
+	LCUI_WidgetEventRec e = { 0 };
+
+	e.type = ctx->prefetch_event_id;
+	e.cancel_bubble = TRUE;
+	LinkedList_Init(&list);
+	for (; node && count < THUMB_PREFETCH_COUNT; node = node->next) {
+		w = node->data;
+		if (w && w->state == LCUI_WSTATE_NORMAL) {
+			/* 倒序排列，让离可见区域最近的部件最后加入任务队列的头部 */
+			LinkedList_Insert(&list, 0, w);
+			++count;
+		}
+	}
+	for (LinkedList_Each(node, &list)) {
+		w = node->data;
+		Widget_TriggerEvent(w, &e, &count);
+	}
+	LinkedList_Clear(&list, NULL);
+}
+
 static int AutoLoader_OnUpdate(AutoLoader ctx)
 {
 	LCUI_Widget w;
 	LinkedList list;
-	LinkedListNode *node;
+	LinkedListNode *node, *below;
 	LCUI_WidgetEventRec e = { 0 };
 	int count = 0;
 	float top, bottom;
@@ -56,11 +82,13 @@ static int AutoLoader_OnUpdate(AutoLoader ctx)
 		}
 		node = node->next;
 	}
+	below = node;
 	for (LinkedList_Each(node, &list)) {
 		w = node->data;
 		Widget_TriggerEvent(w, &e, &count);
 	}
 	LinkedList_Clear(&list, NULL);
+	AutoLoader_Prefetch(ctx, below);
 	return count;
 }
 
@@ -112,6 +140,7 @@ static AutoLoader AutoLoader_New(LCUI_Widget scrolllayer)
 	ctx->is_delaying = FALSE;
 	ctx->scrolllayer = scrolllayer;
 	ctx->event_id = self.event_scrollload;
+	ctx->prefetch_event_id = self.event_prefetch;
 	Widget_BindEvent(scrolllayer, "scroll", AutoLoader_OnScroll, ctx,
 			 NULL);
 	return ctx;
@@ -16,8 +16,14 @@ static int GetDirThumbFilePath(char *filepath, char *dirpath)
 	total = DBQuery_GetTotalFiles(query);
 	if (total > 0) {
 		file = DBQuery_FetchFile(query);
-		strcpy(filepath, file->path);
+		if (file) {
+			strcpy(filepath, file->path);
+			DBFile_Release(file);
+		} else {
+			total = 0;
+		}
 	}
+	DB_DeleteQuery(query);
 	return total;
 }
 
@@ -153,12 +159,12 @@ static void ThumbLoader_Load(ThumbLoader loader, FileStatus *status)
 		}
 	}
 	if (item->is_dir) {
-		FileStorage_GetThumbnail(loader->view->storage,
+		FileStorage_GetThumbnail(loader->storage,
 					 loader->wfullpath, FOLDER_MAX_WIDTH, 0,
 					 OnGetThumbnail, loader);
 		return;
 	}
-	FileStorage_GetThumbnail(loader->view->storage, loader->wfullpath, 0,
+	FileStorage_GetThumbnail(loader->storage, loader->wfullpath, 0,
 				 THUMB_MAX_WIDTH, OnGetThumbnail, loader);
 }
 
@@ -184,6 +190,8 @@ static ThumbLoader ThumbLoader_Create(ThumbView view, LCUI_Widget target)
 	loader->view = view;
 	loader->data = NULL;
 	loader->active = TRUE;
+	loader->is_prefetch = FALSE;
+	loader->storage = view->storage;
 	loader->target = target;
 	loader->callback = NULL;
 	LCUICond_Init(&loader->cond);
@@ -237,7 +245,7 @@ static void ThumbLoader_Start(ThumbLoader loader)
 		pathjoin(loader->path, item->path + len, "");
 	}
 	loader->wfullpath = DecodeUTF8(loader->fullpath);
-	FileStorage_GetStatus(loader->view->storage, loader->wfullpath, FALSE,
+	FileStorage_GetStatus(loader->storage, loader->wfullpath, FALSE,
 			      OnGetFileStatus, loader);
 }
 
@@ -2,34 +2,66 @@
 
 static void ThumbWorker_Run(void *arg);
 
-static LCUI_BOOL ThumbWorker_RemoveTask(ThumbWorker worker, LCUI_Widget target)
+static LCUI_BOOL ThumbWorker_RemoveTaskFrom(LinkedList *tasks,
+					    LCUI_Widget target)
 {
 	LinkedListNode *node;
 
-	if (worker->tasks.length < 1) {
+	if (tasks->length < 1) {
 		return FALSE;
 	}
-	for (LinkedList_Each(node, &worker->tasks)) {
+	for (LinkedList_Each(node, tasks)) {
 		if (node->data != target) {
 			continue;
 		}
-		LinkedList_DeleteNode(&worker->tasks, node);
+		LinkedList_DeleteNode(tasks, node);
 		return TRUE;
 	}
 	return FALSE;
 }
 
-static void ThumbWorker_OnThumbLoadDone(ThumbLoader loader)
+static LCUI_BOOL ThumbWorker_RemoveTask(ThumbWorker worker, LCUI_Widget target)
 {
-	ThumbWorker worker = loader->data;
+	LCUI_BOOL removed;
 
+	removed = ThumbWorker_RemoveTaskFrom(&worker->tasks, target);
+	if (ThumbWorker_RemoveTaskFrom(&worker->prefetch_tasks, target)) {
+		removed = TRUE;
+	}
+	return removed;
+}
+
+/** 在加载器结束后释放它并继续处理任务，由主线程调用 */
+static void ThumbWorker_OnLoaderFinished(void *arg1, void *arg2)
+{
+	size_t i;
+	ThumbWorker worker = arg1;
+	ThumbLoader loader = arg2;
+
+	/* 如果工作者已经重置过，则加载器已不在列表中 */
+	for (i = 0; i < worker->n_loaders; ++i) {
+		if (worker->loaders[i] != loader) {
+			continue;
+		}
+		if (loader->is_prefetch) {
+			worker->n_prefetching -= 1;
+		}
+		worker->n_loaders -= 1;
+		worker->loaders[i] = worker->loaders[worker->n_loaders];
+		worker->loaders[worker->n_loaders] = NULL;
+		break;
+	}
 	ThumbLoader_Destroy(loader);
-	worker->active = FALSE;
-	worker->loader = NULL;
 	ThumbWorker_Run(worker);
 }
 
-static LCUI_BOOL ThumbWorker_ProcessTask(ThumbWorker worker)
+static void ThumbWorker_OnThumbLoadDone(ThumbLoader loader)
+{
+	/* 回调函数可能在多个文件服务客户端线程中同时被调用，所以交给主线程处理 */
+	LCUI_PostSimpleTask(ThumbWorker_OnLoaderFinished, loader->data, loader);
+}
+
+static void ThumbWorker_ProcessTask(ThumbWorker worker, LCUI_BOOL prefetch)
 {
 	LCUI_Graph *thumb;
 	LCUI_Widget target;
@@ -37,13 +69,14 @@ static LCUI_BOOL ThumbWorker_ProcessTask(ThumbWorker worker)
 	ThumbLoader loader;
 	ThumbViewItem item;
 	LinkedListNode *node;
+	LinkedList *tasks;
 
-	worker->active = FALSE;
-	node = LinkedList_GetNode(&worker->tasks, 0);
+	tasks = prefetch ? &worker->prefetch_tasks : &worker->tasks;
+	node = LinkedList_GetNode(tasks, 0);
 	assert(node && node->data);
 	target = node->data;
 	item = Widget_GetData(target, self.item);
-	LinkedList_Delete(&worker->tasks, 0);
+	LinkedList_Delete(tasks, 0);
 	thumb = ThumbLinker_Link(item->view->linker, item->path, target);
 	DEBUG_MSG("cache[%p]: load thumb: %s, cached: %d\n", view->cache,
 		  item->path, thumb ? 1 : 0);
@@ -51,27 +84,37 @@ static LCUI_BOOL ThumbWorker_ProcessTask(ThumbWorker worker)
 		if (item->setthumb) {
 			item->setthumb(target, thumb);
 		}
-		return FALSE;
+		return;
 	}
 	loader = ThumbLoader_Create(item->view, target);
 	if (!loader) {
-		return FALSE;
+		return;
+	}
+	if (prefetch) {
+		loader->is_prefetch = TRUE;
+		loader->storage = item->view->prefetch_storage;
+		worker->n_prefetching += 1;
 	}
-	worker->loader = loader;
-	worker->active = TRUE;
+	worker->loaders[worker->n_loaders++] = loader;
 	ThumbLoader_SetCallback(loader, ThumbWorker_OnThumbLoadDone, worker);
 	ThumbLoader_Start(loader);
-	return TRUE;
 }
 
 static void ThumbWorker_Run(void *arg)
 {
 	ThumbWorker worker = arg;
-	if (worker->active) {
-		return;
+
+	/* 可见的缩略图优先加载，剩余的加载器再用于预加载 */
+	while (worker->n_loaders < THUMB_MAX_LOADERS) {
+		if (worker->tasks.length > 0) {
+			ThumbWorker_ProcessTask(worker, FALSE);
+		} else if (worker->prefetch_tasks.length > 0 &&
+			   worker->n_prefetching < THUMB_MAX_PREFETCH) {
+			ThumbWorker_ProcessTask(worker, TRUE);
+		} else {
+			break;
+		}
 	}
-	while (worker->tasks.length > 0 && !ThumbWorker_ProcessTask(worker))
-		;
 }
 
 static void ThumbWorker_Activate(ThumbWorker worker)
@@ -84,31 +127,37 @@ static void ThumbWorker_Activate(ThumbWorker worker)
 
 static void ThumbWorker_Reset(ThumbWorker worker)
 {
-	if (worker->loader) {
-		ThumbLoader_Stop(worker->loader);
-		worker->loader = FALSE;
+	size_t i;
+
+	for (i = 0; i < worker->n_loaders; ++i) {
+		ThumbLoader_Stop(worker->loaders[i]);
+		worker->loaders[i] = NULL;
 	}
-	worker->active = FALSE;
+	worker->n_loaders = 0;
+	worker->n_prefetching = 0;
 	if (worker->timer) {
 		LCUITimer_Free(worker->timer);
 	}
 	worker->timer = 0;
 	LinkedList_Clear(&worker->tasks, NULL);
+	LinkedList_Clear(&worker->prefetch_tasks, NULL);
 }
 
 static void ThumbWorker_Init(ThumbWorker worker)
 {
 	worker->timer = 0;
-	worker->loader = NULL;
-	worker->active = FALSE;
+	worker->n_loaders = 0;
+	worker->n_prefetching = 0;
+	memset(worker->loaders, 0, sizeof(worker->loaders));
 	LinkedList_Init(&worker->tasks);
+	LinkedList_Init(&worker->prefetch_tasks);
 }
 
-static void ThumbWorker_AddTask(ThumbWorker worker, LCUI_Widget target)
+static void ThumbWorker_AddTaskTo(ThumbWorker worker, LinkedList *tasks,
+				  LCUI_Widget target, size_t max_tasks)
 {
-	LinkedList *tasks = &worker->tasks;
 	/* 如果待处理的任务数量超过最大限制，则移除最后一个任务 */
-	if (tasks->length >= THUMB_TASK_MAX) {
+	if (tasks->length >= max_tasks) {
 		LinkedListNode *node = LinkedList_GetNodeAtTail(tasks, 0);
 		DEBUG_MSG("remove old task\n");
 		LinkedList_Unlink(tasks, node);
@@ -117,4 +166,16 @@ static void ThumbWorker_AddTask(ThumbWorker worker, LCUI_Widget target)
 	ThumbWorker_Activate(worker);
 }
 
+static void ThumbWorker_AddTask(ThumbWorker worker, LCUI_Widget target)
+{
+	ThumbWorker_AddTaskTo(worker, &worker->tasks, target, THUMB_TASK_MAX);
+}
+
+/** 添加预加载任务，预加载任务只在没有其它任务时处理 */
+static void ThumbWorker_AddPrefetchTask(ThumbWorker worker, LCUI_Widget target)
+{
+	ThumbWorker_AddTaskTo(worker, &worker->prefetch_tasks, target,
+			      THUMB_PREFETCH_COUNT);
+}
+
 #endif
@@ -222,6 +222,7 @@ static size_t FileScanner_ScanFiles(FileScanner scanner)
 
 	view.terms.limit = 512;
 	view.terms.offset = 0;
+	view.terms.cursor.id = 0;
 	view.terms.dirpath = EncodeUTF8(scanner->dirpath);
 
 	query = DB_NewQuery(&view.terms);
@@ -241,7 +242,7 @@ static size_t FileScanner_ScanFiles(FileScanner scanner)
 			DEBUG_MSG("file: %s\n", file->path);
 			FileStage_AddFile(scanner->stage, entry);
 		}
-		view.terms.offset += view.terms.limit;
+		DBQuery_GetCursor(query, &view.terms.cursor);
 		FileStage_Commit(scanner->stage);
 		DB_DeleteQuery(query);
 		if (i < view.terms.limit) {
@@ -447,6 +448,100 @@ static void OnSyncDone(void *privdata, void *arg)
 	LCUI_PostSimpleTask(OpenFolder, NULL, NULL);
 }
 
+/** 按当前的排序方式比较两个文件的先后顺序 */
+static int FoldersView_CompareFiles(const DB_File a, const DB_File b)
+{
+	long long diff;
+	LCUI_BOOL asc;
+
+	switch (finder.config.files_sort) {
+	case CREATE_TIME_DESC:
+	case CREATE_TIME_ASC:
+		diff = (long long)a->create_time - b->create_time;
+		break;
+	case SCORE_DESC:
+	case SCORE_ASC:
+		diff = (long long)a->score - b->score;
+		break;
+	default:
+		diff = (long long)a->modify_time - b->modify_time;
+		break;
+	}
+	asc = finder.config.files_sort == CREATE_TIME_ASC ||
+	      finder.config.files_sort == SCORE_ASC ||
+	      finder.config.files_sort == MODIFY_TIME_ASC;
+	if (diff == 0) {
+		return 0;
+	}
+	return (diff < 0) == asc ? -1 : 1;
+}
+
+/** 文件是否直接位于当前打开的文件夹中 */
+static LCUI_BOOL FoldersView_HasFile(DB_File file)
+{
+	size_t len;
+
+	if (!view.dirpath) {
+		return FALSE;
+	}
+	len = strlen(view.dirpath);
+	if (strncmp(file->path, view.dirpath, len) != 0) {
+		return FALSE;
+	}
+	if (len > 0 && view.dirpath[len - 1] != PATH_SEP) {
+		if (file->path[len] != PATH_SEP) {
+			return FALSE;
+		}
+		len += 1;
+	}
+	return strchr(file->path + len, PATH_SEP) == NULL;
+}
+
+/** 按顺序插入文件，排在已载入的文件之后的文件会随扫描结果载入 */
+static void FoldersView_InsertFile(DB_File file)
+{
+	LCUI_Widget before, divider;
+	FileScanner scanner = &view.scanner;
+
+	before = FileBrowser_FindPosition(&view.browser, file,
+					  FoldersView_CompareFiles);
+	if (!before) {
+		if (scanner->is_running || scanner->timer) {
+			return;
+		}
+		if (view.browser.files.length == 0 &&
+		    view.browser.dirs.length > 0) {
+			divider = LCUIWidget_New(NULL);
+			Widget_AddClass(divider, "divider");
+			FileBrowser_Append(&view.browser, divider);
+		}
+	}
+	FileBrowser_InsertPicture(&view.browser, file, before);
+	Widget_Hide(view.tip_empty);
+}
+
+/**
+ * 就地应用文件监视器报告的变更
+ * 删除的文件已经由文件浏览器在 EVENT_FILE_DEL 事件中移除，改变的文件可能
+ * 需要换个位置，所以先移除再插入。
+ */
+static void OnFilesChanged(void *privdata, void *arg)
+{
+	size_t i;
+	FileChanges changes = arg;
+
+	if (!view.is_activated) {
+		return;
+	}
+	for (i = 0; i < changes->n_files; ++i) {
+		FileBrowser_RemovePicture(&view.browser,
+					  changes->files[i]->path);
+		if (FoldersView_HasFile(changes->files[i])) {
+			FoldersView_InsertFile(changes->files[i]);
+		}
+	}
+}
+
 static void UpdateQueryTerms(void)
 {
 	view.terms.modify_time = NONE;
@@ -539,6 +634,7 @@ static void FoldersView_InitBase(void)
 	SelectWidget(view.info_path, ID_VIEW_FOLDER_INFO_PATH);
 	SelectWidget(view.tip_empty, ID_TIP_FOLDERS_EMPTY);
 	LCFinder_BindEvent(EVENT_SYNC_DONE, OnSyncDone, NULL);
+	LCFinder_BindEvent(EVENT_FILES_CHG, OnFilesChanged, NULL);
 	LCFinder_BindEvent(EVENT_DIR_ADD, OnAddDir, NULL);
 	LCFinder_BindEvent(EVENT_DIR_DEL, OnFolderChange, NULL);
 }
@@ -567,6 +663,7 @@ static void FoldersView_InitBrowser(void)
 	view.browser.items = view.items;
 	ThumbView_SetCache(view.items, finder.thumb_cache);
 	ThumbView_SetStorage(view.items, finder.storage_for_thumb);
+	ThumbView_SetPrefetchStorage(view.items, finder.storage_for_prefetch);
 }
 
 void UI_InitFoldersView(void)
@@ -40,13 +40,12 @@
 #include <string.h>
 #include "ui.h"
 #include "finder.h"
-#include <LCUI/timer.h>
 #include <LCUI/display.h>
 #include <LCUI/gui/widget.h>
 #include <LCUI/gui/widget/textview.h>
 #include <LCUI/gui/widget/button.h>
 #include "file_storage.h"
-#include "file_stage.h"
+#include "query_service.h"
 #include "thumbview.h"
 #include "progressbar.h"
 #include "timeseparator.h"
@@ -56,6 +55,14 @@
 
 #define KEY_TITLE "home.title"
 
+/** 时间线中的月份对应的链接 */
+typedef struct HomeTimeRangeRec_ {
+	LCUI_BOOL has_entry;       /**< 是否有时间线中的月份记录 */
+	DB_TimelineEntryRec entry; /**< 时间线中的月份记录 */
+	LCUI_Widget link;          /**< 时间范围列表中的链接 */
+	LCUI_Widget separator;     /**< 时间分割器，文件还未载入时为 NULL */
+} HomeTimeRangeRec, *HomeTimeRange;
+
 /** 主页集锦视图的相关数据 */
 static struct HomeCollectionView {
 	LCUI_BOOL is_activated;
@@ -69,26 +76,27 @@ static struct HomeCollectionView {
 	LCUI_Widget tip_empty;
 	LCUI_Widget progressbar;
 
-	/** 文件列表，供视图渲染 */
-	LinkedList files;
-	/** 文件暂存区域，用于存放已扫描到的文件 */
-	FileStage stage;
-	/** 文件扫描器线程 */
-	LCUI_Thread scanner_thread;
-	/**< 文件扫描器是否在运行 */
-	LCUI_BOOL scanner_running;
-	/**< 定时器，用于定时处理暂存区域内的文件，将他们渲染到视图中 */
-	int scanner_timer;
+	/** 文件记录页列表，视图中的文件记录都存放在这些页中 */
+	LinkedList pages;
+	/** 文件扫描器开始扫描的位置 */
+	DB_QueryCursorRec cursor;
+	/** 文件查询通道，查询结果会按页投递到视图中 */
+	QueryChannel channel;
+	/** 查询结果是否已经全部载入 */
+	LCUI_BOOL files_loaded;
 
 	/**< 时间分割器列表 */
 	LinkedList separators;
+	/**< 时间范围列表，包含时间线中的所有月份 */
+	LinkedList ranges;
 	/**< 文件浏览器数据 */
 	FileBrowserRec browser;
 } view;
 
-static void OnDeleteDBFile(void *arg)
+static void OnDeleteFilePage(void *arg)
 {
-	DBFile_Release(arg);
+	DBFilePage_Destroy(arg);
+	free(arg);
 }
 
 static void OnBtnSyncClick(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
@@ -98,7 +106,14 @@ static void OnBtnSyncClick(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
 
 static void DeleteTimeSeparator(LCUI_Widget sep)
 {
+	HomeTimeRange range;
 	LinkedListNode *node;
+	for (LinkedList_Each(node, &view.ranges)) {
+		range = node->data;
+		if (range->separator == sep) {
+			range->separator = NULL;
+		}
+	}
 	for (LinkedList_Each(node, &view.separators)) {
 		if (node->data == sep) {
 			LinkedList_Unlink(&view.separators, node);
@@ -163,10 +178,18 @@ static void OnAfterDeleted(LCUI_Widget first)
 	}
 }
 
+static void HomeView_JumpToTimeRange(HomeTimeRange range);
+
 static void OnTimeRangeClick(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
 {
-	LCUI_Widget title = e->data;
-	FileBrowser_SetScroll(&view.browser, (int)title->box.canvas.y);
+	HomeTimeRange range = e->data;
+	if (range->separator) {
+		FileBrowser_SetScroll(&view.browser,
+				      (int)range->separator->box.canvas.y);
+	} else if (range->has_entry) {
+		/* 该月份的文件还未载入，直接从该月份开始载入文件 */
+		HomeView_JumpToTimeRange(range);
+	}
 	FileBrowser_SetButtonsDisabled(&view.browser, FALSE);
 	Widget_Hide(view.time_ranges->parent->parent);
 }
@@ -206,135 +229,245 @@ static LCUI_Widget LCUIWidget_NewTimeRange(const struct tm *t)
 	return range;
 }
 
-/** 向视图追加文件 */
-static void HomeView_AppendFile(DB_File file)
+/** 添加时间范围链接，entry 为 NULL 时表示该月份不在时间线中 */
+static HomeTimeRange HomeView_AddTimeRange(const struct tm *t,
+					   const DB_TimelineEntry entry)
 {
-	time_t time;
-	struct tm *t;
-	LCUI_Widget sep, range;
+	HomeTimeRange range;
+
+	range = malloc(sizeof(HomeTimeRangeRec));
+	if (!range) {
+		return NULL;
+	}
+	range->has_entry = entry != NULL;
+	if (entry) {
+		range->entry = *entry;
+	}
+	range->separator = NULL;
+	range->link = LCUIWidget_NewTimeRange(t);
+	Widget_AddClass(range->link, "time-range link");
+	Widget_Append(view.time_ranges, range->link);
+	Widget_BindEvent(range->link, "click", OnTimeRangeClick, range, NULL);
+	LinkedList_Append(&view.ranges, range);
+	return range;
+}
+
+static HomeTimeRange HomeView_GetTimeRange(const struct tm *t)
+{
+	HomeTimeRange range;
+	LinkedListNode *node;
+
+	for (LinkedList_Each(node, &view.ranges)) {
+		range = node->data;
+		if (range->has_entry &&
+		    range->entry.year == t->tm_year + 1900 &&
+		    range->entry.month == t->tm_mon + 1) {
+			return range;
+		}
+	}
+	return NULL;
+}
+
+/** 新建时间分割器，并与时间范围链接关联 */
+static LCUI_Widget HomeView_NewTimeSeparator(const struct tm *t)
+{
+	LCUI_Widget sep;
+	HomeTimeRange range;
+
+	sep = LCUIWidget_New("time-separator");
+	TimeSeparator_SetTime(sep, t);
+	range = HomeView_GetTimeRange(t);
+	if (!range) {
+		range = HomeView_AddTimeRange(t, NULL);
+	}
+	if (range) {
+		range->separator = sep;
+		Widget_BindEvent(TimeSeparator_GetTitle(sep), "click",
+				 OnTimeTitleClick, range->link, NULL);
+	}
+	return sep;
+}
+
+/** 获取末尾的时间分割器，它与 t 不在同一个月份时追加一个新的 */
+static LCUI_Widget HomeView_GetLastTimeSeparator(struct tm *t)
+{
+	LCUI_Widget sep;
 
-	time = file->modify_time;
-	t = localtime(&time);
 	sep = LinkedList_Get(&view.separators, view.separators.length - 1);
 	/* 如果当前文件的创建时间超出当前时间段，则新建分割线 */
 	if (!sep || !TimeSeparator_CheckTime(sep, t)) {
-		sep = LCUIWidget_New("time-separator");
-		range = LCUIWidget_NewTimeRange(t);
-		TimeSeparator_SetTime(sep, t);
+		sep = HomeView_NewTimeSeparator(t);
 		FileBrowser_Append(&view.browser, sep);
 		LinkedList_Append(&view.separators, sep);
-		Widget_AddClass(range, "time-range link");
-		Widget_Append(view.time_ranges, range);
-		Widget_BindEvent(TimeSeparator_GetTitle(sep), "click",
-				 OnTimeTitleClick, range, NULL);
-		Widget_BindEvent(range, "click", OnTimeRangeClick, sep, NULL);
 	}
-	TimeSeparator_AddTime(sep, t);
+	return sep;
+}
+
+/** 向视图追加文件 */
+static void HomeView_AppendFile(DB_File file)
+{
+	time_t time;
+	struct tm *t;
+
+	time = file->modify_time;
+	t = localtime(&time);
+	TimeSeparator_AddTime(HomeView_GetLastTimeSeparator(t), t);
 	FileBrowser_AppendPicture(&view.browser, file);
 }
 
-static void HomeView_AppendFiles(void *unused)
+/** 集锦中的文件按修改时间从新到旧排列 */
+static int HomeView_CompareFiles(const DB_File a, const DB_File b)
 {
-	LinkedList files;
-	LinkedListNode *node;
+	if (a->modify_time == b->modify_time) {
+		return 0;
+	}
+	return a->modify_time > b->modify_time ? -1 : 1;
+}
 
-	LinkedList_Init(&files);
-	FileStage_GetFiles(view.stage, &files, 512);
-	for (LinkedList_Each(node, &files)) {
-		HomeView_AppendFile(node->data);
+/** 文件是否在可见的源文件夹中 */
+static LCUI_BOOL HomeView_IsVisibleFile(DB_File file)
+{
+	size_t i, n;
+	DB_Dir *dirs;
+	LCUI_BOOL visible = FALSE;
+
+	n = LCFinder_GetSourceDirList(&dirs);
+	for (i = 0; i < n; ++i) {
+		if (dirs[i]->id == file->did) {
+			visible = TRUE;
+			break;
+		}
 	}
-	LinkedList_Concat(&view.files, &files);
-	view.scanner_timer = LCUI_SetTimeout(200, HomeView_AppendFiles, NULL);
+	free(dirs);
+	return visible;
 }
 
-static size_t HomeView_ScanFiles(void)
+/**
+ * 在时间分割器 sep 前面插入文件
+ * 文件与上一个分割器的月份相同时放在上一段的末尾，否则新建一个分割器。
+ */
+static void HomeView_InsertFileBefore(DB_File file, struct tm *t,
+				      LCUI_Widget sep)
 {
-	DB_File file;
-	DB_Query query;
-	size_t i, total, count;
-	DB_QueryTermsRec terms = { 0 };
+	size_t i;
+	LCUI_Widget prev = NULL;
+	LinkedListNode *node;
 
-	terms.limit = 512;
-	terms.modify_time = DESC;
-	terms.n_dirs = LCFinder_GetSourceDirList(&terms.dirs);
-	if (terms.n_dirs == finder.n_dirs) {
-		free(terms.dirs);
-		terms.dirs = NULL;
-		terms.n_dirs = 0;
-	}
-	query = DB_NewQuery(&terms);
-	total = DBQuery_GetTotalFiles(query);
-	DB_DeleteQuery(query);
-
-	for (count = 0; view.scanner_running && count < total;) {
-		query = DB_NewQuery(&terms);
-		for (i = 0; view.scanner_running; ++count, ++i) {
-			file = DBQuery_FetchFile(query);
-			if (!file) {
-				break;
-			}
-			FileStage_AddFile(view.stage, file);
-		}
-		terms.offset += terms.limit;
-		FileStage_Commit(view.stage);
-		DB_DeleteQuery(query);
-		if (i < terms.limit) {
+	i = 0;
+	for (LinkedList_Each(node, &view.separators)) {
+		if (node->data == sep) {
 			break;
 		}
+		prev = node->data;
+		++i;
 	}
-	if (terms.dirs) {
-		free(terms.dirs);
-		terms.dirs = NULL;
+	if (!prev || !TimeSeparator_CheckTime(prev, t)) {
+		prev = HomeView_NewTimeSeparator(t);
+		FileBrowser_Insert(&view.browser, prev, sep);
+		LinkedList_Insert(&view.separators, i, prev);
 	}
-	FileStage_Commit(view.stage);
-	return total;
+	FileBrowser_InsertPicture(&view.browser, file, sep);
 }
 
-static void HomeView_ScannerThread(void *unused)
+/**
+ * 按顺序插入文件，只处理已载入的范围内的文件，其余的会随查询结果载入
+ * 时间分割器中的文件统计由调用者在插入完后重新计算。
+ */
+static void HomeView_InsertFile(DB_File file)
 {
-	size_t count = HomeView_ScanFiles();
+	time_t time;
+	struct tm *t;
+	LCUI_Widget before, prev;
 
-	if (view.is_activated) {
-		if (count > 0) {
+	if (!HomeView_IsVisibleFile(file)) {
+		return;
+	}
+	before = FileBrowser_FindPosition(&view.browser, file,
+					  HomeView_CompareFiles);
+	time = file->modify_time;
+	t = localtime(&time);
+	if (!before) {
+		if (view.files_loaded) {
+			HomeView_GetLastTimeSeparator(t);
+			FileBrowser_InsertPicture(&view.browser, file, NULL);
+		}
+		return;
+	}
+	prev = Widget_GetPrev(before);
+	if (!prev || !Widget_CheckType(prev, "time-separator") ||
+	    TimeSeparator_CheckTime(prev, t)) {
+		FileBrowser_InsertPicture(&view.browser, file, before);
+		return;
+	}
+	/* 从某个月份开始载入时，比已载入的文件更新的文件不在视图中 */
+	if (view.cursor.id != 0 && prev == LinkedList_Get(&view.separators, 0)) {
+		return;
+	}
+	HomeView_InsertFileBefore(file, t, prev);
+}
+
+static void HomeView_OnPage(DB_FilePage page, void *data)
+{
+	size_t i;
+
+	for (i = 0; i < page->length; ++i) {
+		HomeView_AppendFile(&page->files[i]);
+	}
+	LinkedList_Append(&view.pages, page);
+}
+
+static void HomeView_OnDone(size_t count, void *data)
+{
+	if (!view.is_activated) {
+		return;
+	}
+	view.files_loaded = TRUE;
+	if (count > 0) {
 		Widget_AddClass(view.tip_empty, "hide");
 		Widget_Hide(view.tip_empty);
 	} else {
 		Widget_RemoveClass(view.tip_empty, "hide");
 		Widget_Show(view.tip_empty);
 	}
+}
+
+/** 初始化查询条件，只查询可见的源文件夹中的文件 */
+static void HomeView_InitQueryTerms(DB_QueryTerms terms)
+{
+	terms->modify_time = DESC;
+	terms->n_dirs = LCFinder_GetSourceDirList(&terms->dirs);
+	if (terms->n_dirs == finder.n_dirs) {
+		free(terms->dirs);
+		terms->dirs = NULL;
+		terms->n_dirs = 0;
 	}
-	view.scanner_running = FALSE;
-	LCUIThread_Exit(NULL);
 }
 
 static void HomeView_InitScanner(void)
 {
-	view.stage = FileStage_Create();
-	view.scanner_running = FALSE;
-	view.scanner_timer = 0;
-	LinkedList_Init(&view.files);
+	view.channel =
+	    QueryChannel_Create(HomeView_OnPage, HomeView_OnDone, NULL);
+	LinkedList_Init(&view.pages);
 }
 
+/** 停止扫描文件，正在进行的查询会被取消，不必等待它结束 */
 static void HomeView_StopScanner(void)
 {
-	if (view.scanner_running) {
-		view.scanner_running = FALSE;
-		LCUIThread_Join(view.scanner_thread, NULL);
-	}
-	if (view.scanner_timer) {
-		LCUITimer_Free(view.scanner_timer);
-		view.scanner_timer = 0;
-	}
-	FileStage_GetFiles(view.stage, &view.files, 0);
-	LinkedList_Clear(&view.files, OnDeleteDBFile);
+	QueryChannel_Cancel(view.channel);
+	LinkedList_Clear(&view.pages, OnDeleteFilePage);
 }
 
 static void HomeView_StartScanner(void)
 {
+	DB_QueryTermsRec terms = { 0 };
+
 	HomeView_StopScanner();
-	view.scanner_running = TRUE;
-	view.scanner_timer = LCUI_SetTimeout(200, HomeView_AppendFiles, NULL);
-	LCUIThread_Create(&view.scanner_thread, HomeView_ScannerThread, NULL);
+	HomeView_InitQueryTerms(&terms);
+	view.files_loaded = FALSE;
+	terms.limit = 512;
+	terms.cursor = view.cursor;
+	QueryChannel_Submit(view.channel, &terms);
+	free(terms.dirs);
 	ProgressBar_SetValue(view.progressbar, 0);
 	ProgressBar_SetMaxValue(view.progressbar, 100);
 	Widget_Show(view.progressbar);
@@ -343,15 +476,52 @@ static void HomeView_StartScanner(void)
 static void HomeView_FreeScanner(void)
 {
 	HomeView_StopScanner();
-	FileStage_Destroy(view.stage);
+	QueryChannel_Destroy(view.channel);
+}
+
+/** 载入时间线，时间范围列表中会列出所有月份，不必等到文件都载入之后 */
+static void HomeView_LoadTimeline(void)
+{
+	size_t i, n;
+	struct tm t = { 0 };
+	DB_TimelineEntry entries;
+	DB_QueryTermsRec terms = { 0 };
+
+	HomeView_InitQueryTerms(&terms);
+	n = DB_GetTimeline(&terms, &entries);
+	for (i = 0; i < n; ++i) {
+		t.tm_year = entries[i].year - 1900;
+		t.tm_mon = entries[i].month - 1;
+		t.tm_mday = 1;
+		HomeView_AddTimeRange(&t, &entries[i]);
+	}
+	free(entries);
+	free(terms.dirs);
+}
+
+/** 从时间范围对应的月份开始载入文件，跳过排在它前面的文件 */
+static void HomeView_JumpToTimeRange(HomeTimeRange range)
+{
+	LinkedListNode *node;
+
+	for (LinkedList_Each(node, &view.ranges)) {
+		((HomeTimeRange)node->data)->separator = NULL;
+	}
+	LinkedList_Clear(&view.separators, NULL);
+	FileBrowser_Empty(&view.browser);
+	view.cursor = range->entry.cursor;
+	HomeView_StartScanner();
 }
 
 /** 载入集锦中的文件列表 */
 static void HomeView_LoadFiles(void)
 {
 	LinkedList_Clear(&view.separators, NULL);
+	LinkedList_Clear(&view.ranges, free);
 	Widget_Empty(view.time_ranges);
 	FileBrowser_Empty(&view.browser);
+	HomeView_LoadTimeline();
+	view.cursor.id = 0;
 	HomeView_StartScanner();
 }
 
@@ -369,6 +539,31 @@ static void OnSyncDone(void *privdata, void *arg)
 	LCUI_PostSimpleTask(HomeView_LoadFiles, NULL, NULL);
 }
 
+/**
+ * 就地应用文件监视器报告的变更
+ * 删除的文件已经由文件浏览器在 EVENT_FILE_DEL 事件中移除，这里把增加和改变
+ * 的文件插入到对应的位置，然后重新统计各个时间分割器中的文件。
+ */
+static void OnFilesChanged(void *privdata, void *arg)
+{
+	size_t i;
+	FileChanges changes = arg;
+
+	if (!view.is_activated) {
+		return;
+	}
+	for (i = 0; i < changes->n_files; ++i) {
+		FileBrowser_RemovePicture(&view.browser,
+					  changes->files[i]->path);
+		HomeView_InsertFile(changes->files[i]);
+	}
+	OnAfterDeleted(NULL);
+	if (view.separators.length > 0) {
+		Widget_AddClass(view.tip_empty, "hide");
+		Widget_Hide(view.tip_empty);
+	}
+}
+
 static void HomeView_InitBase(void)
 {
 	SelectWidget(view.view, ID_VIEW_HOME);
@@ -380,6 +575,7 @@ static void HomeView_InitBase(void)
 	Widget_Hide(view.time_ranges->parent->parent);
 	Widget_AddClass(view.time_ranges, "time-range-list");
 	LCFinder_BindEvent(EVENT_SYNC_DONE, OnSyncDone, NULL);
+	LCFinder_BindEvent(EVENT_FILES_CHG, OnFilesChanged, NULL);
 }
 
 static void HomeView_OnProgress(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
@@ -417,6 +613,7 @@ static void HomeView_InitBrowser(void)
 	view.browser.after_deleted = OnAfterDeleted;
 	ThumbView_SetCache(view.items, finder.thumb_cache);
 	ThumbView_SetStorage(view.items, finder.storage_for_thumb);
+	ThumbView_SetPrefetchStorage(view.items, finder.storage_for_prefetch);
 	Widget_BindEvent(view.items, "progress", HomeView_OnProgress, NULL, NULL);
 	FileBrowser_Init(&view.browser);
 }
@@ -39,14 +39,13 @@
 #include <string.h>
 #include "finder.h"
 #include "ui.h"
-#include <LCUI/timer.h>
 #include <LCUI/display.h>
 #include <LCUI/gui/widget.h>
 #include <LCUI/gui/widget/textview.h>
 #include <LCUI/gui/widget/textedit.h>
 #include <LCUI/util/charset.h>
 #include "file_storage.h"
-#include "file_stage.h"
+#include "query_service.h"
 #include "thumbview.h"
 #include "textview_i18n.h"
 #include "tagthumb.h"
@@ -69,16 +68,12 @@ typedef enum ViewState {
 
 /** 文件扫描功能的相关数据 */
 typedef struct FileScannerRec_ {
-	LCUI_Thread tid;
-	LCUI_BOOL is_running;
-
-	int timer;
-
-	FileStage stage;
-	LinkedList files;
+	QueryChannel channel;
+	LinkedList pages;
 
 	DB_Tag *tags;
 	size_t n_tags;
+	char *keywords;
 } FileScannerRec, *FileScanner;
 
 static struct SearchView {
@@ -125,42 +120,64 @@ typedef struct TagItemRec_ {
 
 /* clang-format on */
 
-static void OnDeleteDBFile(void *arg)
+static void OnDeleteFilePage(void *arg)
 {
-	DBFile_Release(arg);
+	DBFilePage_Destroy(arg);
+	free(arg);
 }
 
-static void SearchView_AppendFiles(void *arg)
+static void FileScanner_OnPage(DB_FilePage page, void *data)
 {
-	LinkedList files;
-	LinkedListNode *node;
-	FileScanner scanner = &search_view.scanner;
+	size_t i;
+	FileScanner scanner = data;
 
-	LinkedList_Init(&files);
-	FileStage_GetFiles(scanner->stage, &files, 512);
-	for (LinkedList_Each(node, &files)) {
-		FileBrowser_AppendPicture(&search_view.browser, node->data);
+	for (i = 0; i < page->length; ++i) {
+		FileBrowser_AppendPicture(&search_view.browser,
+					  &page->files[i]);
 	}
-	LinkedList_Concat(&scanner->files, &files);
-	if (!scanner->is_running) {
-		scanner->timer = 0;
-		return;
+	LinkedList_Append(&scanner->pages, page);
+}
+
+static void FileScanner_OnDone(size_t count, void *data)
+{
+	if (count > 0) {
+		Widget_AddClass(search_view.tip_empty_files, "hide");
+		Widget_Hide(search_view.tip_empty_files);
+	} else {
+		Widget_RemoveClass(search_view.tip_empty_files, "hide");
+		Widget_Show(search_view.tip_empty_files);
 	}
-	scanner->timer = LCUI_SetTimeout(200, SearchView_AppendFiles, NULL);
 }
 
-static size_t FileScanner_ScanAll(FileScanner scanner)
+static void FileScanner_Init(FileScanner scanner)
+{
+	scanner->tags = NULL;
+	scanner->n_tags = 0;
+	scanner->keywords = NULL;
+	scanner->channel = QueryChannel_Create(
+	    FileScanner_OnPage, FileScanner_OnDone, scanner);
+	LinkedList_Init(&scanner->pages);
+}
+
+/** 取消正在进行的查询，不必等待它结束 */
+static void FileScanner_Reset(FileScanner scanner)
+{
+	QueryChannel_Cancel(scanner->channel);
+	LinkedList_Clear(&scanner->pages, OnDeleteFilePage);
+}
+
+static void FileScanner_Start(FileScanner scanner)
 {
-	DB_File file;
-	DB_Query query;
 	DB_QueryTerms terms;
-	size_t i, total, count;
 
+	FileScanner_Reset(scanner);
 	terms = &search_view.terms;
 	terms->offset = 0;
+	terms->cursor.id = 0;
 	terms->limit = 512;
 	terms->tags = scanner->tags;
 	terms->n_tags = scanner->n_tags;
+	terms->keywords = scanner->keywords;
 	if (terms->dirs) {
 		size_t n_dirs;
 		free(terms->dirs);
@@ -171,86 +188,17 @@ static size_t FileScanner_ScanAll(FileScanner scanner)
 			terms->dirs = NULL;
 		}
 	}
-
-	query = DB_NewQuery(&search_view.terms);
-	total = DBQuery_GetTotalFiles(query);
-	DB_DeleteQuery(query);
-
-	for (count = 0; scanner->is_running && count < total;) {
-		query = DB_NewQuery(&search_view.terms);
-		for (i = 0; scanner->is_running; ++count, ++i) {
-			file = DBQuery_FetchFile(query);
-			if (!file) {
-				break;
-			}
-			FileStage_AddFile(scanner->stage, file);
-			++count;
-		}
-		terms->offset += terms->limit;
-		FileStage_Commit(scanner->stage);
-		DB_DeleteQuery(query);
-		if (i < terms->limit) {
-			break;
-		}
-	}
+	QueryChannel_Submit(scanner->channel, terms);
 	if (terms->dirs) {
 		free(terms->dirs);
 		terms->dirs = NULL;
 	}
-	FileStage_Commit(scanner->stage);
-	return total;
-}
-
-static void FileScanner_Init(FileScanner scanner)
-{
-	scanner->tags = NULL;
-	scanner->n_tags = 0;
-	scanner->stage = FileStage_Create();
-	LinkedList_Init(&scanner->files);
-}
-
-static void FileScanner_Reset(FileScanner scanner)
-{
-	if (scanner->is_running) {
-		scanner->is_running = FALSE;
-		LCUIThread_Join(scanner->tid, NULL);
-	}
-	if (scanner->timer) {
-		LCUITimer_Free(scanner->timer);
-		scanner->timer = 0;
-	}
-	FileStage_GetFiles(scanner->stage, &scanner->files, 0);
-	LinkedList_Clear(&scanner->files, OnDeleteDBFile);
-}
-
-static void FileScanner_Thread(void *arg)
-{
-	size_t count;
-
-	search_view.scanner.is_running = TRUE;
-	count = FileScanner_ScanAll(&search_view.scanner);
-	if (count > 0) {
-		Widget_AddClass(search_view.tip_empty_files, "hide");
-		Widget_Hide(search_view.tip_empty_files);
-	} else {
-		Widget_RemoveClass(search_view.tip_empty_files, "hide");
-		Widget_Show(search_view.tip_empty_files);
-	}
-	search_view.scanner.is_running = FALSE;
-	LCUIThread_Exit(NULL);
-}
-
-static void FileScanner_Start(FileScanner scanner)
-{
-	FileScanner_Reset(scanner);
-	scanner->timer = LCUI_SetTimeout(200, SearchView_AppendFiles, NULL);
-	LCUIThread_Create(&scanner->tid, FileScanner_Thread, NULL);
 }
 
 static void FileScanner_Destroy(FileScanner scanner)
 {
 	FileScanner_Reset(scanner);
-	FileStage_Destroy(scanner->stage);
+	QueryChannel_Destroy(scanner->channel);
 }
 
 static void UpdateLayoutContext(void)
@@ -437,6 +385,7 @@ static DB_File GetFileByTag(DB_Tag tag)
 	terms.modify_time = DESC;
 	query = DB_NewQuery(&terms);
 	file = DBQuery_FetchFile(query);
+	DB_DeleteQuery(query);
 	free(terms.tags);
 	return file;
 }
@@ -474,32 +423,58 @@ static void OnSidebarBtnClick(LCUI_Widget w, LCUI_WidgetEvent e, void *arg)
 
 static void StartSearchFiles(LinkedList *tags)
 {
-	size_t i;
+	size_t i, len = 0;
 	size_t n_tags = 0;
+	LCUI_BOOL found;
 
 	DB_Tag tag;
 	DB_Tag *newtags;
+	char *keywords;
 	LinkedListNode *node;
 
+	for (LinkedList_Each(node, tags)) {
+		len += strlen(node->data) + 1;
+	}
 	newtags = malloc(sizeof(DB_Tag) * (tags->length + 1));
-	if (!newtags) {
+	keywords = malloc(sizeof(char) * (len + 1));
+	if (!newtags || !keywords) {
+		free(newtags);
+		free(keywords);
 		return;
 	}
+	keywords[0] = 0;
 	for (LinkedList_Each(node, tags)) {
+		found = FALSE;
 		for (i = 0; i < finder.n_tags; ++i) {
 			tag = finder.tags[i];
 			if (strcmp(tag->name, node->data) == 0) {
 				newtags[n_tags++] = tag;
+				found = TRUE;
 			}
 		}
+		/* 不是标签名的词作为关键词匹配文件名和文件夹名 */
+		if (!found) {
+			if (keywords[0]) {
+				strcat(keywords, " ");
+			}
+			strcat(keywords, node->data);
+		}
 	}
 	newtags[n_tags] = NULL;
 	FileScanner_Reset(&search_view.scanner);
 	if (search_view.scanner.tags) {
 		free(search_view.scanner.tags);
 	}
+	if (search_view.scanner.keywords) {
+		free(search_view.scanner.keywords);
+	}
+	if (!keywords[0]) {
+		free(keywords);
+		keywords = NULL;
+	}
 	search_view.scanner.tags = newtags;
 	search_view.scanner.n_tags = n_tags;
+	search_view.scanner.keywords = keywords;
 	FileBrowser_Empty(&search_view.browser);
 	FileScanner_Start(&search_view.scanner);
 }
@@ -754,6 +729,8 @@ static void InitBrowser(void)
 	ThumbView_SetCache(search_view.view_files, finder.thumb_cache);
 	ThumbView_SetStorage(search_view.view_tags, finder.storage_for_thumb);
 	ThumbView_SetStorage(search_view.view_files, finder.storage_for_thumb);
+	ThumbView_SetPrefetchStorage(search_view.view_files,
+				     finder.storage_for_prefetch);
 	ThumbView_OnLayout(search_view.view_tags, OnTagViewStartLayout);
 	BindEvent(btns[0], "click", OnSidebarBtnClick);
 	FileBrowser_Init(&search_view.browser);
@@ -0,0 +1,154 @@
+﻿/* ***************************************************************************
+ * test_image_header.c -- test image file header parser with truncated files
+ *
+ * Copyright (C) 2019 by Liu Chao <lc-soft@live.cn>
+ *
+ * This file is part of the LC-Finder project, and may only be used, modified,
+ * and distributed under the terms of the GPLv2.
+ *
+ * By continuing to use, modify, or distribute this file you indicate that you
+ * have read the license and understand and accept it fully.
+ *
+ * The LC-Finder project is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GPL v2 for more details.
+ *
+ * You should have received a copy of the GPLv2 along with this file. It is
+ * usually in the LICENSE.TXT file, If not, see <http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+/* ****************************************************************************
+ * test_image_header.c -- 用被截断的文件测试图片文件头解析
+ *
+ * 版权所有 (C) 2019 归属于 刘超 <lc-soft@live.cn>
+ *
+ * 这个文件是 LC-Finder 项目的一部分，并且只可以根据GPLv2许可协议来使用、更改和
+ * 发布。
+ *
+ * 继续使用、修改或发布本文件，表明您已经阅读并完全理解和接受这个许可协议。
+ *
+ * LC-Finder 项目是基于使用目的而加以散布的，但不负任何担保责任，甚至没有适销
+ * 性或特定用途的隐含担保，详情请参照GPLv2许可协议。
+ *
+ * 您应已收到附随于本文件的GPLv2许可协议的副本，它通常在 LICENSE 文件中，如果
+ * 没有，请查看：<http://www.gnu.org/licenses/>.
+ * ****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "image_header.h"
+
+typedef struct TestFileRec_ {
+	const char *name;
+	const unsigned char *data;
+	size_t len;
+	int ret;		/**< ImageHeader_ReadFile() 应返回的值 */
+	unsigned int width;
+	unsigned int height;
+} TestFileRec;
+
+/** SOF 段在 8 字节处被截断 */
+static const unsigned char jpeg_cut_sof[] = { 0xFF, 0xD8, 0xFF, 0xE0, 0x00,
+					      0x04, 0x00, 0x00, 0xFF, 0xC0,
+					      0x00, 0x11, 0x08 };
+
+/** 只有 SOI 标记 */
+static const unsigned char jpeg_cut_soi[] = { 0xFF, 0xD8, 0xFF };
+
+/** APP1 段的长度超出了文件末尾 */
+static const unsigned char jpeg_cut_app1[] = { 0xFF, 0xD8, 0xFF, 0xE1, 0x40,
+					       0x00, 'E',  'x',  'i',  'f',
+					       0x00, 0x00 };
+
+static const unsigned char jpeg_ok[] = { 0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x04,
+					 0x00, 0x00, 0xFF, 0xC0, 0x00, 0x11,
+					 0x08, 0x00, 0x10, 0x00, 0x20, 0x03 };
+
+/** IHDR 块在宽度之后被截断 */
+static const unsigned char png_cut_ihdr[] = {
+	0x89, 'P',  'N',  'G',  '\r', '\n', 0x1A, '\n', 0x00, 0x00,
+	0x00, 0x0D, 'I',  'H',  'D',  'R',  0x00, 0x00, 0x00, 0x20
+};
+
+/** 信息头在宽度之前被截断 */
+static const unsigned char bmp_cut_info[] = { 'B',  'M',  0x00, 0x00, 0x00,
+					      0x00, 0x00, 0x00, 0x00, 0x00,
+					      0x36, 0x00, 0x00, 0x00, 0x28,
+					      0x00, 0x00, 0x00 };
+
+static const TestFileRec test_files[] = {
+	{ "jpeg_cut_sof", jpeg_cut_sof, sizeof(jpeg_cut_sof), -1, 0, 0 },
+	{ "jpeg_cut_soi", jpeg_cut_soi, sizeof(jpeg_cut_soi), -1, 0, 0 },
+	{ "jpeg_cut_app1", jpeg_cut_app1, sizeof(jpeg_cut_app1), -1, 0, 0 },
+	{ "jpeg_ok", jpeg_ok, sizeof(jpeg_ok), 0, 32, 16 },
+	{ "png_cut_ihdr", png_cut_ihdr, sizeof(png_cut_ihdr), -1, 0, 0 },
+	{ "bmp_cut_info", bmp_cut_info, sizeof(bmp_cut_info), -1, 0, 0 }
+};
+
+#define N_TEST_FILES (sizeof(test_files) / sizeof(test_files[0]))
+
+static int WriteTestFile(const char *path, const TestFileRec *file)
+{
+	FILE *fp;
+	size_t n;
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		return -1;
+	}
+	n = fwrite(file->data, 1, file->len, fp);
+	fclose(fp);
+	return n == file->len ? 0 : -1;
+}
+
+static int CheckHeader(const char *func, const TestFileRec *file,
+		       ImageHeader header, int ret)
+{
+	if (ret != -2 && ret != file->ret) {
+		printf("[%s] %s: returned %d, expected %d\n", func, file->name,
+		       ret, file->ret);
+		return 1;
+	}
+	if (header->width != file->width || header->height != file->height) {
+		printf("[%s] %s: size is %ux%u, expected %ux%u\n", func,
+		       file->name, header->width, header->height, file->width,
+		       file->height);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	size_t i;
+	int ret, errors = 0;
+	char paths[N_TEST_FILES][64];
+	const char *path_list[N_TEST_FILES];
+	ImageHeaderRec header, headers[N_TEST_FILES];
+	ImageHeaderReader reader;
+
+	for (i = 0; i < N_TEST_FILES; ++i) {
+		snprintf(paths[i], sizeof(paths[i]), "test_image_header_%s.tmp",
+			 test_files[i].name);
+		path_list[i] = paths[i];
+		if (WriteTestFile(paths[i], &test_files[i]) != 0) {
+			printf("cannot write %s\n", paths[i]);
+			return 1;
+		}
+	}
+	for (i = 0; i < N_TEST_FILES; ++i) {
+		ret = ImageHeader_ReadFile(&header, paths[i]);
+		errors += CheckHeader("ReadFile", &test_files[i], &header, ret);
+	}
+	/* 批量读取时不返回结果，只检查尺寸 */
+	reader = ImageHeaderReader_Create();
+	ImageHeaderReader_ReadFiles(reader, headers, path_list, N_TEST_FILES);
+	ImageHeaderReader_Destroy(reader);
+	for (i = 0; i < N_TEST_FILES; ++i) {
+		errors += CheckHeader("ReadFiles", &test_files[i], &headers[i],
+				      -2);
+		remove(paths[i]);
+	}
+	printf("%d error(s)\n", errors);
+	return errors > 0 ? 1 : 0;
+}
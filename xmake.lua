@@ -13,3 +13,9 @@ target("lc-finder")
     set_targetdir("app/")
     set_kind("binary")
     add_files("src/**.c")
+
+target("test_image_header")
+    set_kind("binary")
+    set_default(false)
+    add_files("test/test_image_header.c")
+    add_files("src/lib/image_header.c", "src/lib/io_engine.c")